@@ -0,0 +1,179 @@
+/*
+ * This is a header file of kinect::record::BatchConverter.
+ * Author : @ChenRP07
+ * Date : 2022-11-20
+ * */
+#ifndef KINECT_BATCH_H
+#define KINECT_BATCH_H
+
+#include "kinect_record.h"
+#include "kinect_pool.h"
+
+namespace kinect {
+    namespace record {
+        /*
+        * Parameters of BatchConverter.
+        * */
+        struct BatchConfig {
+            // worker threads shared by all recordings, 0 is one per hardware thread
+            size_t threads = 0;
+            // recordings open at the same time, 0 is the number of workers
+            size_t open_recordings = 0;
+            // bytes of frames between demux and emit, summed over all recordings
+            uint64_t memory_budget = 2048ull << 20;
+        };
+
+        /*
+        * Result of one recording of a batch.
+        * */
+        struct BatchReport {
+            // sequence name
+            std::string name;
+            // converted frames
+            uint64_t frames = 0;
+            // generated points
+            uint64_t points = 0;
+            // time from opening the recording to its last written frame
+            double seconds = 0.0;
+        };
+
+        /*
+        * Convert many mkv recordings with one WorkStealingPool. Frames of all
+        * open recordings are jobs of the same pool: a job demuxes one frame of
+        * a recording, queues the job of the next frame, which idle workers
+        * steal, and then decodes, transforms and emits its frame. So a long
+        * recording is converted by all workers once the short ones are done.
+        *
+        * A frame reserves memory_budget from demux until the writer of its
+        * recording has written and freed it, each recording streams its frames
+        * to OUTPUT_DIR/NAME/.
+        *
+        * BatchConverter batch(OUTPUT_DIR, FORMAT, convert_config, batch_config);
+        * batch.add_source(MKV_FILE or MANIFEST or DIR);
+        * batch.convert();
+        * */
+        class BatchConverter {
+        private:
+            // state of one recording
+            struct Recording;
+
+            // output dir path
+            std::string output_path_;
+            // output format of all recordings
+            kinect::type::OutputFormat format_;
+            // conversion parameters of all recordings
+            ConvertConfig config_;
+            // scheduling parameters
+            BatchConfig batch_config_;
+            // recordings in the order they are added
+            std::vector<std::unique_ptr<Recording>> recordings_;
+            // shared workers
+            std::unique_ptr<kinect::type::WorkStealingPool> pool_;
+            // guards next_recording_ and open_recordings_
+            std::mutex mutex_;
+            // index of the next recording to be opened
+            size_t next_recording_ = 0;
+            // recordings open now
+            size_t open_recordings_ = 0;
+            // guards budget_used_
+            std::mutex budget_mutex_;
+            // signaled when budget is released
+            std::condition_variable budget_released_;
+            // bytes reserved by frames in flight
+            uint64_t budget_used_ = 0;
+
+            /*
+             * Reserve __bytes of memory_budget, wait until they are available.
+             * A frame is always admitted if nothing is reserved.
+             * @param  : uint64_t __bytes -- bytes
+             * @return : void
+             * */
+            void acquire_budget(uint64_t __bytes);
+
+            /*
+             * Release __bytes reserved by acquire_budget().
+             * @param  : uint64_t __bytes -- bytes
+             * @return : void
+             * */
+            void release_budget(uint64_t __bytes);
+
+            /*
+             * Queue the opening of recordings until open_recordings are open, must hold mutex_.
+             * @param  : ----
+             * @return : void
+             * */
+            void open_next();
+
+            /*
+             * Open a recording and queue its first frame.
+             * @param  : Recording* __recording -- recording
+             * @return : void
+             * */
+            void start(Recording *__recording);
+
+            /*
+             * Demux the next frame of a recording, queue the following one, then convert and emit it.
+             * @param  : Recording* __recording -- recording
+             * @return : void
+             * */
+            void step(Recording *__recording);
+
+            /*
+             * If all frames of a recording are demuxed and emitted, mark it finished.
+             * @param  : Recording* __recording -- recording
+             * @return : bool -- if the caller has to finish the recording
+             * */
+            bool try_finish(Recording *__recording);
+
+            /*
+             * Wait for the stream of a recording, close it and open the next recording.
+             * @param  : Recording* __recording -- recording
+             * @return : void
+             * */
+            void finish(Recording *__recording);
+
+            /*
+             * Log the per recording and aggregate throughput, and write them to
+             * OUTPUT_DIR/batch_report.csv.
+             * @param  : double __wall_sec -- time of the whole batch
+             * @return : void
+             * */
+            void report(double __wall_sec);
+
+        public:
+            /*
+             * Constructor.
+             * @param  : const std::string& __output_path -- output dir path
+             * @param  : OutputFormat __format -- output format
+             * @param  : const ConvertConfig& __config -- conversion parameters of each recording
+             * @param  : const BatchConfig& __batch_config -- scheduling parameters
+             * */
+            BatchConverter(const std::string &__output_path, kinect::type::OutputFormat __format,
+                           const ConvertConfig &__config, const BatchConfig &__batch_config);
+
+            /*
+             * Deconstructor.
+             * */
+            ~BatchConverter();
+
+            /*
+             * Add recordings, __source is a .mkv file, a directory whose .mkv
+             * files are added in name order, or a manifest with one .mkv path per
+             * line, empty lines and lines starting with # are skipped. A
+             * recording is written as a sequence named after its file.
+             * @param  : const std::string& __source -- mkv, directory or manifest path
+             * @return : void
+             * */
+            void add_source(const std::string &__source);
+
+            /*
+             * Convert all added recordings.
+             * @param  : ----
+             * @return : void
+             * */
+            void convert();
+        };
+    };  // namespace record
+};  // namespace kinect
+
+#endif  // KINECT_BATCH_H
@@ -0,0 +1,377 @@
+/*
+ * This is a header file of kinect::camera.
+ * Author : @ChenRP07
+ * Date : 2022-11-26
+ * */
+#ifndef KINECT_CAMERA_H
+#define KINECT_CAMERA_H
+
+#include "kinect_type.h"
+#include "kinect_pool.h"
+#include "kinect_kernel.h"
+
+namespace kinect {
+    /*
+    * Namespace of native camera geometry in kinect, same lens model and results
+    * as the k4a transformation functions, computed from the calibration alone,
+    * so it needs neither the k4a runtime nor the depth engine.
+    * */
+    namespace camera {
+        /*
+        * Project a point of the z = 1 plane of a camera to a pixel, Brown Conrady
+        * or Rational 6KT lens distortion as in k4a.
+        * @param  : const k4a_calibration_camera_t& __camera -- calibration of the camera
+        * @param  : const float* __xy -- x, y of the point on the z = 1 plane
+        * @param  : float* __uv -- output pixel coordinates
+        * @param  : float* __jacobian -- output d(uv)/d(xy), row major 2x2, may be nullptr
+        * @return : bool -- if the point is inside the metric radius of the camera
+        * */
+        bool project(const k4a_calibration_camera_t &__camera, const float *__xy, float *__uv, float *__jacobian);
+
+        /*
+        * Unproject a pixel to the z = 1 plane of a camera, a closed form guess of
+        * the undistorted point refined by Newton iterations as in k4a.
+        * @param  : const k4a_calibration_camera_t& __camera -- calibration of the camera
+        * @param  : const float* __uv -- pixel coordinates
+        * @param  : float* __xy -- output x, y on the z = 1 plane
+        * @return : bool -- if the pixel has a ray, the iterations converge inside the metric radius
+        * */
+        bool unproject(const k4a_calibration_camera_t &__camera, const float *__uv, float *__xy);
+
+        /*
+        * Ray of each pixel of a camera at z = 1, computed once per calibration, so
+        * unprojecting a depth image is a multiplication per pixel. Pixels without
+        * a ray have NaN in both tables and give (0, 0, 0). After build() the table
+        * is only read and can be shared by all threads.
+        * */
+        class RayTable {
+        private:
+            // image size
+            int width_, height_;
+            // x and y of the ray of each pixel, row major
+            std::vector<float> x_, y_;
+
+        public:
+            /*
+             * Constructor, an empty table.
+             * */
+            RayTable();
+
+            /*
+             * Deconstructor.
+             * */
+            ~RayTable();
+
+            /*
+             * Compute the rays of all pixels of a camera, rows in parallel.
+             * @param  : const k4a_calibration_camera_t& __camera -- calibration of the camera
+             * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+             * @return : void
+             * */
+            void build(const k4a_calibration_camera_t &__camera, kinect::type::ThreadPool *__pool);
+
+            /*
+             * Image width.
+             * @param  : ----
+             * @return : int -- width, 0 before build()
+             * */
+            int width() const { return this->width_; }
+
+            /*
+             * Image height.
+             * @param  : ----
+             * @return : int -- height, 0 before build()
+             * */
+            int height() const { return this->height_; }
+
+            /*
+             * x of the ray of each pixel.
+             * @param  : ----
+             * @return : const float* -- width * height values
+             * */
+            const float *x() const { return this->x_.data(); }
+
+            /*
+             * y of the ray of each pixel.
+             * @param  : ----
+             * @return : const float* -- width * height values
+             * */
+            const float *y() const { return this->y_.data(); }
+        };
+
+        /*
+        * Scratch of Registration and of fused point extraction, kept for the
+        * next frame, one per thread.
+        * */
+        struct RegistrationBuffer {
+            // color pixel coordinates and color camera depth of each depth pixel, z is 0 without a projection
+            std::vector<float> u, v, z;
+            // least and largest v of each segment of each depth row, see Registration
+            std::vector<float> lower, upper;
+            // points of each tile of a fused extraction, tile i starts at point i * tile_pixels
+            std::vector<size_t> counts;
+            size_t tile_pixels = 0;
+        };
+
+        /*
+        * Depth to color registration, the native version of
+        * k4a_transformation_depth_image_to_color_camera().
+        *
+        * Each depth pixel is unprojected by a RayTable, moved to the color camera
+        * and projected with its lens model. Two neighbour rows of depth pixels
+        * form quads, each one split into two triangles which are rasterized at
+        * color pixel centers with their depth interpolated, and the nearest depth
+        * of a color pixel wins. Triangles across a depth edge are dropped, so
+        * foreground and background are not joined. Projection runs on bands of
+        * depth rows, rasterization on tiles of color rows, each tile reads only
+        * the segments of depth rows whose projections reach it and owns its part
+        * of the z-buffer, so no locks are needed and the result does not depend
+        * on the number of threads. Tables are built once per calibration, after
+        * build() a Registration is only read and can be shared by all threads.
+        * */
+        class Registration {
+        private:
+            // color camera, at the resolution of decoded color images
+            k4a_calibration_camera_t color_;
+            // rays of the depth pixels
+            RayTable depth_rays_;
+            // depth camera to color camera, row major rotation and translation in millimeters
+            float rotation_[9], translation_[3];
+
+            /*
+             * Project all depth pixels of a frame to the color camera.
+             * @param  : const uint16_t* __depth -- DEPTH16 pixels of the depth camera
+             * @param  : RegistrationBuffer& __buffer -- output projections
+             * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+             * @return : void
+             * */
+            void project(const uint16_t *__depth, RegistrationBuffer &__buffer, kinect::type::ThreadPool *__pool) const;
+
+            /*
+             * Rasterize the projected depth pixels to color rows [__row_begin, __row_end).
+             * @param  : const RegistrationBuffer& __buffer -- projections of project()
+             * @param  : int __row_begin -- first color row
+             * @param  : int __row_end -- end of color rows
+             * @param  : uint16_t* __rows -- output DEPTH16 pixels of these rows
+             * @return : void
+             * */
+            void splat(const RegistrationBuffer &__buffer, int __row_begin, int __row_end, uint16_t *__rows) const;
+
+            /*
+             * Rasterize color rows [__row_begin, __row_end) to a z-buffer of this
+             * thread and unproject it to points.
+             * @param  : const RegistrationBuffer& __buffer -- projections of project()
+             * @param  : const RayTable& __color_rays -- rays of the color camera
+             * @param  : int __row_begin -- first color row
+             * @param  : int __row_end -- end of color rows
+             * @param  : int16_t* __points -- output x, y, z of each pixel of these rows
+             * @return : void
+             * */
+            void splat_points(const RegistrationBuffer &__buffer, const RayTable &__color_rays, int __row_begin,
+                              int __row_end, int16_t *__points) const;
+
+            /*
+             * Fused registration, unprojection and extraction, see extract_points().
+             * @param  : const uint16_t* __depth -- DEPTH16 pixels of the depth camera
+             * @param  : const RayTable& __color_rays -- rays of the color camera
+             * @param  : const uint8_t* __bgra -- BGRA32 pixels of the color camera
+             * @param  : const ExtractOptions& __options -- per point work
+             * @param  : Output& __output -- room for one point per color pixel
+             * @param  : RegistrationBuffer& __buffer -- scratch of this thread
+             * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+             * @return : size_t -- number of points
+             * */
+            template<class Output>
+            size_t extract(const uint16_t *__depth, const RayTable &__color_rays, const uint8_t *__bgra,
+                           const kinect::kernel::ExtractOptions &__options, Output &__output,
+                           RegistrationBuffer &__buffer, kinect::type::ThreadPool *__pool) const;
+
+        public:
+            /*
+             * Constructor, an empty registration.
+             * */
+            Registration();
+
+            /*
+             * Deconstructor.
+             * */
+            ~Registration();
+
+            /*
+             * Compute the tables of a calibration.
+             * @param  : const k4a_calibration_t& __calibration -- color camera at decoded resolution
+             * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+             * @return : void
+             * */
+            void build(const k4a_calibration_t &__calibration, kinect::type::ThreadPool *__pool);
+
+            /*
+             * Register a depth image to a DEPTH16 image of the color camera.
+             * @param  : const uint16_t* __depth -- DEPTH16 pixels of the depth camera
+             * @param  : uint16_t* __output -- output DEPTH16 pixels of the color camera
+             * @param  : RegistrationBuffer& __buffer -- scratch of this thread
+             * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+             * @return : void
+             * */
+            void depth_to_color(const uint16_t *__depth, uint16_t *__output, RegistrationBuffer &__buffer,
+                                kinect::type::ThreadPool *__pool) const;
+
+            /*
+             * Register a depth image and unproject it to an int16 x, y, z point image
+             * of the color camera, each tile is unprojected while it is in cache, so
+             * the registered depth image is never written.
+             * @param  : const uint16_t* __depth -- DEPTH16 pixels of the depth camera
+             * @param  : const RayTable& __color_rays -- rays of the color camera
+             * @param  : int16_t* __points -- output x, y, z of each color pixel
+             * @param  : RegistrationBuffer& __buffer -- scratch of this thread
+             * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+             * @return : void
+             * */
+            void depth_to_color_points(const uint16_t *__depth, const RayTable &__color_rays, int16_t *__points,
+                                       RegistrationBuffer &__buffer, kinect::type::ThreadPool *__pool) const;
+
+            /*
+             * Register, unproject and extract the points of a frame in one pass, no
+             * image at color resolution is written. Each tile of color rows is
+             * rasterized, unprojected and given to kinect::kernel::extract_points()
+             * with its colors while in cache, points of a tile are written at its
+             * first pixel and put together by compact_points() or gather_points(),
+             * they are the same as kinect::kernel::extract_points() on the image of
+             * depth_to_color_points().
+             * @param  : const uint16_t* __depth -- DEPTH16 pixels of the depth camera
+             * @param  : const RayTable& __color_rays -- rays of the color camera
+             * @param  : const uint8_t* __bgra -- BGRA32 pixels of the color camera
+             * @param  : const ExtractOptions& __options -- per point work
+             * @param  : PointXYZRGB* __output -- room for one point per color pixel
+             * @param  : RegistrationBuffer& __buffer -- scratch of this thread
+             * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+             * @return : size_t -- number of points of all tiles
+             * */
+            size_t extract_points(const uint16_t *__depth, const RayTable &__color_rays, const uint8_t *__bgra,
+                                  const kinect::kernel::ExtractOptions &__options, kinect::type::PointXYZRGB *__output,
+                                  RegistrationBuffer &__buffer, kinect::type::ThreadPool *__pool) const;
+
+            /*
+             * Same as extract_points, structure of arrays.
+             * @param  : const uint16_t* __depth -- DEPTH16 pixels of the depth camera
+             * @param  : const RayTable& __color_rays -- rays of the color camera
+             * @param  : const uint8_t* __bgra -- BGRA32 pixels of the color camera
+             * @param  : const ExtractOptions& __options -- per point work
+             * @param  : PointCloudSoA& __output -- room for one point per color pixel
+             * @param  : RegistrationBuffer& __buffer -- scratch of this thread
+             * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+             * @return : size_t -- number of points
+             * */
+            size_t extract_points(const uint16_t *__depth, const RayTable &__color_rays, const uint8_t *__bgra,
+                                  const kinect::kernel::ExtractOptions &__options, kinect::type::PointCloudSoA &__output,
+                                  RegistrationBuffer &__buffer, kinect::type::ThreadPool *__pool) const;
+        };
+
+        /*
+        * Fraction of the pixels with depth in two registered DEPTH16 images whose
+        * depths differ by more than 2 millimeters and 2% of the depth. Pixels with
+        * depth in one image only are edges, which registrations fill differently,
+        * and are not counted.
+        * @param  : const uint16_t* __depth -- first image
+        * @param  : const uint16_t* __reference -- second image
+        * @param  : size_t __pixels -- number of pixels
+        * @return : double -- 0 to 1
+        * */
+        double registration_mismatch(const uint16_t *__depth, const uint16_t *__reference, size_t __pixels);
+
+        /*
+        * Unproject a DEPTH16 image to an int16 x, y, z point image in millimeters,
+        * the same image as k4a_transformation_depth_image_to_point_cloud() gives.
+        * Bands of rows are unprojected in parallel by kinect::kernel::unproject_depth().
+        * @param  : const RayTable& __rays -- rays of the camera of the depth image
+        * @param  : const uint16_t* __depth -- DEPTH16 pixels, width * height of __rays
+        * @param  : int16_t* __points -- output x, y, z of each pixel
+        * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+        * @return : void
+        * */
+        void unproject_depth(const RayTable &__rays, const uint16_t *__depth, int16_t *__points,
+                             kinect::type::ThreadPool *__pool);
+
+        /*
+        * Unproject and extract the points of a depth image in one pass, the fused
+        * version of unproject_depth() and kinect::kernel::extract_points(), the
+        * point image is never written. Bands of rows are unprojected to a buffer
+        * of their thread and extracted with their colors, points of a band are
+        * written at its first pixel like Registration::extract_points().
+        * @param  : const RayTable& __rays -- rays of the depth camera
+        * @param  : const uint16_t* __depth -- DEPTH16 pixels, width * height of __rays
+        * @param  : const uint8_t* __bgra -- BGRA32 pixels registered to the depth camera
+        * @param  : const ExtractOptions& __options -- per point work
+        * @param  : PointXYZRGB* __output -- room for one point per pixel
+        * @param  : RegistrationBuffer& __buffer -- scratch of this thread
+        * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+        * @return : size_t -- number of points
+        * */
+        size_t extract_points(const RayTable &__rays, const uint16_t *__depth, const uint8_t *__bgra,
+                              const kinect::kernel::ExtractOptions &__options, kinect::type::PointXYZRGB *__output,
+                              RegistrationBuffer &__buffer, kinect::type::ThreadPool *__pool);
+
+        /*
+        * Same as extract_points, structure of arrays.
+        * @param  : const RayTable& __rays -- rays of the depth camera
+        * @param  : const uint16_t* __depth -- DEPTH16 pixels, width * height of __rays
+        * @param  : const uint8_t* __bgra -- BGRA32 pixels registered to the depth camera
+        * @param  : const ExtractOptions& __options -- per point work
+        * @param  : PointCloudSoA& __output -- room for one point per pixel
+        * @param  : RegistrationBuffer& __buffer -- scratch of this thread
+        * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+        * @return : size_t -- number of points
+        * */
+        size_t extract_points(const RayTable &__rays, const uint16_t *__depth, const uint8_t *__bgra,
+                              const kinect::kernel::ExtractOptions &__options, kinect::type::PointCloudSoA &__output,
+                              RegistrationBuffer &__buffer, kinect::type::ThreadPool *__pool);
+
+        /*
+        * Move the points of the tiles of a fused extraction together in place, in order.
+        * @param  : const RegistrationBuffer& __buffer -- tiles of the extraction
+        * @param  : PointXYZRGB* __points -- output of the extraction
+        * @return : size_t -- number of points
+        * */
+        size_t compact_points(const RegistrationBuffer &__buffer, kinect::type::PointXYZRGB *__points);
+
+        /*
+        * Same as compact_points, structure of arrays.
+        * @param  : const RegistrationBuffer& __buffer -- tiles of the extraction
+        * @param  : PointCloudSoA& __points -- output of the extraction
+        * @return : size_t -- number of points
+        * */
+        size_t compact_points(const RegistrationBuffer &__buffer, kinect::type::PointCloudSoA &__points);
+
+        /*
+        * Copy the points of the tiles of a fused extraction to an exactly sized
+        * frame in order, one copy instead of compact_points() and a copy.
+        * @param  : const RegistrationBuffer& __buffer -- tiles of the extraction
+        * @param  : const PointXYZRGB* __points -- output of the extraction
+        * @param  : std::vector<PointXYZRGB>& __output -- frame, replaced
+        * @return : void
+        * */
+        void gather_points(const RegistrationBuffer &__buffer, const kinect::type::PointXYZRGB *__points,
+                           std::vector<kinect::type::PointXYZRGB> &__output);
+
+        /*
+        * Same as gather_points, structure of arrays.
+        * @param  : const RegistrationBuffer& __buffer -- tiles of the extraction
+        * @param  : const PointCloudSoA& __points -- output of the extraction
+        * @param  : PointCloudSoA& __output -- frame, replaced
+        * @return : void
+        * */
+        void gather_points(const RegistrationBuffer &__buffer, const kinect::type::PointCloudSoA &__points,
+                           kinect::type::PointCloudSoA &__output);
+
+        /*
+        * Largest difference of two int16 x, y, z point images, in millimeters.
+        * @param  : const int16_t* __points -- first image
+        * @param  : const int16_t* __reference -- second image
+        * @param  : size_t __pixels -- number of pixels
+        * @return : int -- max absolute difference of a coordinate
+        * */
+        int max_difference(const int16_t *__points, const int16_t *__reference, size_t __pixels);
+    };  // namespace camera
+};  // namespace kinect
+
+#endif  // KINECT_CAMERA_H
@@ -0,0 +1,221 @@
+/*
+ * This is a header file of kinect::type::ContainerFrameSink and ContainerReader.
+ * Author : @ChenRP07
+ * Date : 2022-11-16
+ * */
+#ifndef KINECT_CONTAINER_H
+#define KINECT_CONTAINER_H
+
+#include "kinect_quantized.h"
+
+namespace kinect {
+    namespace type {
+        /*
+        * Volumetric video container, one file for a whole sequence, all values
+        * are little endian.
+        *
+        * ContainerHeader at offset 0, raw k4a calibration at calibration_offset,
+        * frame payloads of point_count QuantizedPoint each starting on a 64 byte
+        * boundary, then frame_count ContainerFrameEntry at index_offset sorted by
+        * time stamp. The index is written last, so frames can be streamed in
+        * before the number of frames is known.
+        * */
+        struct ContainerHeader {
+            // "KVVC"
+            char magic[4];
+            // format version, 1
+            uint32_t version;
+            // bytes of one point, 9
+            uint32_t point_size;
+            // camera whose coordinate system the points are in, k4a_calibration_type_t, or world_camera
+            uint32_t camera;
+            // color images are decoded at 1/color_scale resolution
+            uint32_t color_scale;
+            // number of ContainerFrameEntry at index_offset
+            uint32_t frame_count;
+            // position and bytes of raw calibration
+            uint64_t calibration_offset;
+            uint64_t calibration_size;
+            // position of the frame index
+            uint64_t index_offset;
+            // zero
+            uint64_t reserved[2];
+        };
+
+        struct ContainerFrameEntry {
+            // usec timestamp
+            uint64_t time_stamp;
+            // position of the first point
+            uint64_t offset;
+            // number of points
+            uint64_t point_count;
+        };
+
+        static_assert(sizeof(ContainerHeader) == 64 && sizeof(ContainerFrameEntry) == 24,
+                      "container headers have no padding");
+
+        // magic of ContainerHeader
+        static const char container_magic[4] = {'K', 'V', 'V', 'C'};
+        // alignment of frame payloads
+        static const uint64_t container_alignment = 64;
+
+        /*
+        * Points of one frame, pointing into the mapped file of a ContainerReader.
+        * */
+        struct ContainerFrame {
+            // usec timestamp
+            uint64_t time_stamp;
+            // number of points
+            size_t size;
+            // first point
+            const QuantizedPoint *points;
+        };
+
+        /*
+        * Write all frames of a sequence to (SEQUENCE_PATH).kvv. write() may be
+        * called by several threads at the same time, frames are quantized in
+        * parallel and appended one at a time.
+        * */
+        class ContainerFrameSink : public FrameSink {
+        private:
+            // output file
+            std::ofstream outfile_;
+            // header, frame_count and index_offset are set on close()
+            ContainerHeader header_;
+            // end of the written data
+            uint64_t file_size_;
+            // written frames
+            std::vector<ContainerFrameEntry> frames_;
+            // guards outfile_, file_size_ and frames_
+            std::mutex mutex_;
+
+            /*
+             * Write __size bytes at file_size_, after zero padding up to __alignment.
+             * @param  : const char* __data -- bytes to write
+             * @param  : size_t __size -- number of bytes
+             * @param  : uint64_t __alignment -- alignment of the start position
+             * @return : uint64_t -- start position
+             * */
+            uint64_t append(const char *__data, size_t __size, uint64_t __alignment);
+
+        public:
+            /*
+             * Constructor, create the file and write calibration.
+             * @param  : const std::string& __output_path -- output dir path
+             * @param  : const std::string& __sequence_name -- name
+             * @param  : const std::vector<uint8_t>& __calibration -- raw k4a calibration
+             * @param  : k4a_calibration_type_t __camera -- camera of the point coordinates, UNKNOWN for world
+             * @param  : int __color_scale -- color images are decoded at 1/__color_scale resolution
+             * */
+            ContainerFrameSink(const std::string &__output_path, const std::string &__sequence_name,
+                               const std::vector<uint8_t> &__calibration, k4a_calibration_type_t __camera,
+                               int __color_scale);
+
+            /*
+             * Append __frame to the file.
+             * @param  : PointCloudFrame& __frame -- frame to be written
+             * @return : void
+             * */
+            void write(PointCloudFrame &__frame) override;
+
+            /*
+             * Write frame index and final header.
+             * @param  : ----
+             * @return : void
+             * */
+            void close() override;
+        };
+
+        /*
+        * Read only view of a container file. The file is memory mapped, opening
+        * it only checks the header, frames are returned as pointers into the
+        * mapping and read from disk when they are touched.
+        *
+        * ContainerReader reader;
+        * reader.open(CONTAINER_PATH);
+        * ContainerFrame frame = reader.frame(reader.find(TIME_STAMP));
+        * */
+        class ContainerReader {
+        private:
+            // mapped file
+            const uint8_t *data_;
+            // bytes of data_
+            size_t length_;
+#ifdef _WIN32
+            // file and mapping handles
+            void *file_;
+            void *mapping_;
+#endif
+            // header at data_
+            const ContainerHeader *header_;
+            // frame index in data_
+            const ContainerFrameEntry *index_;
+
+        public:
+            /*
+             * Default constructor.
+             * */
+            ContainerReader();
+
+            /*
+             * Deconstructor, unmap the file.
+             * */
+            ~ContainerReader();
+
+            ContainerReader(const ContainerReader &) = delete;
+
+            ContainerReader &operator=(const ContainerReader &) = delete;
+
+            /*
+             * Map a container file and check its header.
+             * @param  : const std::string& __container_path -- file path
+             * @return : void
+             * */
+            void open(const std::string &__container_path);
+
+            /*
+             * Unmap the file, views returned before are invalid.
+             * @param  : ----
+             * @return : void
+             * */
+            void close();
+
+            /*
+             * Header of the container.
+             * @param  : ----
+             * @return : const ContainerHeader& -- header
+             * */
+            const ContainerHeader &header() const { return *this->header_; }
+
+            /*
+             * Raw k4a calibration, header().calibration_size bytes.
+             * @param  : ----
+             * @return : const uint8_t* -- calibration
+             * */
+            const uint8_t *calibration() const { return this->data_ + this->header_->calibration_offset; }
+
+            /*
+             * Number of frames.
+             * @param  : ----
+             * @return : size_t -- size
+             * */
+            size_t size() const { return this->header_ == nullptr ? 0 : this->header_->frame_count; }
+
+            /*
+             * Frame at __index in time order.
+             * @param  : size_t __index -- frame index, less than size()
+             * @return : ContainerFrame -- points of the frame
+             * */
+            ContainerFrame frame(size_t __index) const;
+
+            /*
+             * Index of the frame with time stamp __time_stamp.
+             * @param  : uint64_t __time_stamp -- usec timestamp
+             * @return : size_t -- frame index, size() if there is no such frame
+             * */
+            size_t find(uint64_t __time_stamp) const;
+        };
+    };  // namespace type
+};  // namespace kinect
+
+#endif  // KINECT_CONTAINER_H
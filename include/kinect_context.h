@@ -0,0 +1,214 @@
+/*
+ * This is a header file of kinect::record::FrameContext and ImagePool.
+ * Author : @ChenRP07
+ * Date : 2022-11-05
+ * */
+#ifndef KINECT_CONTEXT_H
+#define KINECT_CONTEXT_H
+
+#include <turbojpeg.h>
+#include "kinect_type.h"
+#include "kinect_filter.h"
+#include "kinect_camera.h"
+
+namespace kinect {
+    namespace record {
+        /*
+        * Fixed number of images of the same format and size, created once on
+        * memory owned by the pool and reused for the whole run. acquire() blocks
+        * while all images are in use.
+        * */
+        class ImagePool {
+        private:
+            // image memory
+            std::vector<std::vector<uint8_t>> buffers_;
+            // k4a images wrapping buffers_
+            std::vector<k4a_image_t> images_;
+            // images not in use
+            kinect::type::BoundedQueue<k4a_image_t> free_;
+
+        public:
+            /*
+             * Constructor, allocate all images.
+             * @param  : size_t __count -- number of images
+             * @param  : k4a_image_format_t __format -- image format
+             * @param  : int __width -- width in pixels
+             * @param  : int __height -- height in pixels
+             * @param  : int __stride -- bytes per row
+             * */
+            ImagePool(size_t __count, k4a_image_format_t __format, int __width, int __height, int __stride);
+
+            /*
+             * Deconstructor, release all images, they must be returned already.
+             * */
+            ~ImagePool();
+
+            ImagePool(const ImagePool &) = delete;
+
+            ImagePool &operator=(const ImagePool &) = delete;
+
+            /*
+             * Take an image out of the pool, wait if there is none.
+             * @param  : ----
+             * @return : k4a_image_t -- image
+             * */
+            k4a_image_t acquire();
+
+            /*
+             * Return an image taken by acquire().
+             * @param  : k4a_image_t __image -- image
+             * @return : void
+             * */
+            void release(k4a_image_t __image);
+        };
+
+        /*
+        * Intermediate images cached in a FrameContext.
+        * */
+        enum ContextImage {
+            FILTERED_DEPTH_IMAGE,
+            TRANSFORMED_DEPTH_IMAGE,
+            TRANSFORMED_COLOR_IMAGE,
+            POINT_CLOUD_IMAGE,
+            VERIFY_POINT_CLOUD_IMAGE,
+            VERIFY_DEPTH_IMAGE,
+            CONTEXT_IMAGE_COUNT
+        };
+
+        /*
+        * Per thread state of frame processing. The TurboJPEG decompressor, the k4a
+        * transformation handle and the intermediate images are created on first
+        * use and kept until the context is destroyed, so processing a frame does
+        * not allocate after the first one. Must be used by one thread at a time.
+        * */
+        class FrameContext {
+        private:
+            // calibration used to create transformation_
+            const k4a_calibration_t *calibration_;
+            // TurboJPEG decompressor
+            tjhandle decompressor_;
+            // k4a transformation handle
+            k4a_transformation_t transformation_;
+            // memory of images_
+            std::vector<uint8_t> buffers_[CONTEXT_IMAGE_COUNT];
+            // cached intermediate images
+            k4a_image_t images_[CONTEXT_IMAGE_COUNT];
+            // room for the points of one frame before compaction
+            std::vector<kinect::type::PointXYZRGB> point_buffer_;
+            // same as point_buffer_, SOA_LAYOUT
+            kinect::type::PointCloudSoA point_buffer_soa_;
+            // points left by the outlier filter when the voxel grid filter follows it
+            std::vector<kinect::type::PointXYZRGB> filtered_points_;
+            // same as filtered_points_, SOA_LAYOUT
+            kinect::type::PointCloudSoA filtered_points_soa_;
+            // outlier filter scratch
+            kinect::filter::OutlierFilter outlier_filter_;
+            // voxel grid filter scratch
+            kinect::filter::VoxelGrid voxel_grid_;
+            // native registration scratch
+            kinect::camera::RegistrationBuffer registration_buffer_;
+
+        public:
+            /*
+             * Constructor.
+             * @param  : const k4a_calibration_t& __calibration -- must outlive this context
+             * */
+            explicit FrameContext(const k4a_calibration_t &__calibration);
+
+            /*
+             * Deconstructor, destroy handles and release images.
+             * */
+            ~FrameContext();
+
+            FrameContext(const FrameContext &) = delete;
+
+            FrameContext &operator=(const FrameContext &) = delete;
+
+            /*
+             * TurboJPEG decompressor of this context.
+             * @param  : ----
+             * @return : tjhandle -- decompressor
+             * */
+            tjhandle decompressor();
+
+            /*
+             * Transformation handle of this context.
+             * @param  : ----
+             * @return : k4a_transformation_t -- transformation handle
+             * */
+            k4a_transformation_t transformation();
+
+            /*
+             * Cached intermediate image, created again only if format or size changes.
+             * @param  : ContextImage __slot -- which image
+             * @param  : k4a_image_format_t __format -- image format
+             * @param  : int __width -- width in pixels
+             * @param  : int __height -- height in pixels
+             * @param  : int __stride -- bytes per row
+             * @return : k4a_image_t -- image owned by this context
+             * */
+            k4a_image_t image(ContextImage __slot, k4a_image_format_t __format, int __width, int __height,
+                              int __stride);
+
+            /*
+             * Cached point buffer, grows only if it is smaller than __size.
+             * @param  : size_t __size -- min number of points
+             * @return : PointXYZRGB* -- buffer owned by this context
+             * */
+            kinect::type::PointXYZRGB *point_buffer(size_t __size);
+
+            /*
+             * Cached structure of arrays point buffer, grows only if it is smaller than __size.
+             * @param  : size_t __size -- min number of points
+             * @return : PointCloudSoA& -- buffer owned by this context
+             * */
+            kinect::type::PointCloudSoA &point_buffer_soa(size_t __size);
+
+            /*
+             * Points between the outlier filter and the voxel grid filter, resized by the outlier filter.
+             * @param  : ----
+             * @return : std::vector<PointXYZRGB>& -- buffer owned by this context
+             * */
+            std::vector<kinect::type::PointXYZRGB> &filtered_points() { return this->filtered_points_; }
+
+            /*
+             * Same as filtered_points, structure of arrays.
+             * @param  : ----
+             * @return : PointCloudSoA& -- buffer owned by this context
+             * */
+            kinect::type::PointCloudSoA &filtered_points_soa() { return this->filtered_points_soa_; }
+
+            /*
+             * Outlier filter of this context.
+             * @param  : ----
+             * @return : OutlierFilter& -- filter owned by this context
+             * */
+            kinect::filter::OutlierFilter &outlier_filter() { return this->outlier_filter_; }
+
+            /*
+             * Voxel grid filter of this context.
+             * @param  : ----
+             * @return : VoxelGrid& -- filter owned by this context
+             * */
+            kinect::filter::VoxelGrid &voxel_grid() { return this->voxel_grid_; }
+
+            /*
+             * Native registration scratch of this context.
+             * @param  : ----
+             * @return : RegistrationBuffer& -- buffer owned by this context
+             * */
+            kinect::camera::RegistrationBuffer &registration_buffer() { return this->registration_buffer_; }
+        };
+
+        /*
+        * Count the image buffers k4a allocates itself, e.g. by k4a_image_create()
+        * or while decoding and transforming, in kinect::stats::allocation_count().
+        * Call it before any k4a image exists.
+        * @param  : ----
+        * @return : void
+        * */
+        void count_image_allocations();
+    };  // namespace record
+};  // namespace kinect
+
+#endif  // KINECT_CONTEXT_H
@@ -0,0 +1,360 @@
+/*
+ * This is a header file of kinect::filter.
+ * Author : @ChenRP07
+ * Date : 2022-11-24
+ * */
+#ifndef KINECT_FILTER_H
+#define KINECT_FILTER_H
+
+#include "kinect_type.h"
+#include "kinect_pool.h"
+#include "kinect_kernel.h"
+
+namespace kinect {
+    /*
+    * Namespace of filters in kinect, depth image filters run before registration,
+    * point cloud filters between point generation and VolumetricVideo::add_point_cloud().
+    * */
+    namespace filter {
+        /*
+        * Strided access to the coordinates and colors of AOS_LAYOUT and SOA_LAYOUT points.
+        * */
+        struct PointView {
+            // coordinates of point 0, points are stride floats apart
+            float *x, *y, *z;
+            size_t stride;
+            // r g b of point 0, points are rgb_stride bytes apart
+            uint8_t *rgb;
+            size_t rgb_stride;
+        };
+
+        /*
+        * Voxel grid downsampling, all points in a cube of voxel size are replaced
+        * by one point at their centroid with their average color.
+        *
+        * Points are read once in fixed size chunks, consecutive points of the same
+        * voxel, mostly neighbor pixels, are summed, and the sums of a chunk are
+        * grouped by a hash of their voxel to a fixed number of partitions, so no
+        * voxel spans two partitions. Chunks, then partitions, each one merged with
+        * an open addressing table, run in parallel on a ThreadPool, and the result
+        * does not depend on the number of threads.
+        * Scratch memory is kept for the next frame, so one VoxelGrid must be used
+        * by one thread at a time.
+        * */
+        class VoxelGrid {
+        private:
+            // sums of the points of one voxel
+            struct Voxel;
+            // sums of consecutive points of one voxel
+            struct Run;
+            // voxels of one partition
+            struct Partition;
+
+            // runs of consecutive points of one job
+            struct Chunk;
+
+            // chunks of the frame, each one summed by one thread
+            std::vector<Chunk> chunks_;
+            // partitions, each one reduced by one thread
+            std::vector<Partition> partitions_;
+
+            /*
+             * Group points by voxel.
+             * @param  : const PointView& __points -- input points
+             * @param  : size_t __count -- number of input points
+             * @param  : float __voxel_size -- voxel edge, millimeters
+             * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+             * @return : size_t -- number of voxels
+             * */
+            size_t reduce(const PointView &__points, size_t __count, float __voxel_size,
+                          kinect::type::ThreadPool *__pool);
+
+            /*
+             * Write one point per voxel found by reduce().
+             * @param  : const PointView& __output -- room for all voxels
+             * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+             * @return : void
+             * */
+            void write(const PointView &__output, kinect::type::ThreadPool *__pool);
+
+        public:
+            /*
+             * Constructor.
+             * */
+            VoxelGrid();
+
+            /*
+             * Deconstructor.
+             * */
+            ~VoxelGrid();
+
+            VoxelGrid(const VoxelGrid &) = delete;
+
+            VoxelGrid &operator=(const VoxelGrid &) = delete;
+
+            /*
+             * Downsample __count points to __output, which is resized to the number of voxels.
+             * @param  : const PointXYZRGB* __points -- input points
+             * @param  : size_t __count -- number of input points
+             * @param  : float __voxel_size -- voxel edge, millimeters
+             * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+             * @param  : std::vector<PointXYZRGB>& __output -- output points
+             * @return : void
+             * */
+            void downsample(const kinect::type::PointXYZRGB *__points, size_t __count, float __voxel_size,
+                            kinect::type::ThreadPool *__pool, std::vector<kinect::type::PointXYZRGB> &__output);
+
+            /*
+             * Same as downsample, structure of arrays.
+             * @param  : const PointCloudSoA& __points -- input points
+             * @param  : size_t __count -- number of input points
+             * @param  : float __voxel_size -- voxel edge, millimeters
+             * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+             * @param  : PointCloudSoA& __output -- output points
+             * @return : void
+             * */
+            void downsample(const kinect::type::PointCloudSoA &__points, size_t __count, float __voxel_size,
+                            kinect::type::ThreadPool *__pool, kinect::type::PointCloudSoA &__output);
+        };
+
+        /*
+        * Radius outlier removal, a point is kept if at least a number of other
+        * points lie within a radius of it, isolated noise points are dropped.
+        *
+        * The spatial index is a hash grid of cells of radius size. Chunks of points
+        * are hashed and grouped by partition like in VoxelGrid, then the points of
+        * each partition are counting sorted by the bucket of their cell, so no
+        * atomics are needed and each query reads at most 27 contiguous bucket
+        * ranges. Points are queried in sorted order, so the points of a cell
+        * follow each other and find the buckets around it in cache. A query stops
+        * as soon as enough neighbours are found, so dense surfaces cost a few
+        * distance tests per point and only isolated points search all neighbour
+        * cells. Hashing, sorting, queries and output run in parallel chunks or
+        * partitions on a ThreadPool, kept points stay in input order, and the
+        * result does not depend on the number of threads.
+        * Scratch memory is kept for the next frame, so one OutlierFilter must be
+        * used by one thread at a time.
+        * */
+        class OutlierFilter {
+        private:
+            // a point and its bucket
+            struct Entry;
+            // points of one job, grouped by partition
+            struct Chunk;
+
+            // chunks of the frame, each one hashed by one thread
+            std::vector<Chunk> chunks_;
+            // points of bucket b are entries_[starts_[b], starts_[b + 1])
+            std::vector<uint32_t> starts_;
+            // next free entry of each bucket while sorting
+            std::vector<uint32_t> cursors_;
+            // points sorted by bucket
+            std::vector<Entry> entries_;
+            // 1 if an input point is kept
+            std::vector<uint8_t> keep_;
+            // kept points of each chunk, then first output point of each chunk
+            std::vector<size_t> chunk_kept_;
+
+            /*
+             * Find the points to keep.
+             * @param  : const PointView& __points -- input points
+             * @param  : size_t __count -- number of input points
+             * @param  : float __radius -- neighbourhood radius, millimeters
+             * @param  : size_t __neighbours -- least number of neighbours of a kept point
+             * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+             * @return : size_t -- number of kept points
+             * */
+            size_t select(const PointView &__points, size_t __count, float __radius, size_t __neighbours,
+                          kinect::type::ThreadPool *__pool);
+
+            /*
+             * Copy the points found by select() to __output, in input order.
+             * @param  : const PointView& __points -- input points
+             * @param  : size_t __count -- number of input points
+             * @param  : const PointView& __output -- room for all kept points
+             * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+             * @return : void
+             * */
+            void write(const PointView &__points, size_t __count, const PointView &__output,
+                       kinect::type::ThreadPool *__pool);
+
+        public:
+            /*
+             * Constructor.
+             * */
+            OutlierFilter();
+
+            /*
+             * Deconstructor.
+             * */
+            ~OutlierFilter();
+
+            OutlierFilter(const OutlierFilter &) = delete;
+
+            OutlierFilter &operator=(const OutlierFilter &) = delete;
+
+            /*
+             * Remove outliers of __count points to __output, which is resized to the number of kept points.
+             * @param  : const PointXYZRGB* __points -- input points
+             * @param  : size_t __count -- number of input points
+             * @param  : float __radius -- neighbourhood radius, millimeters
+             * @param  : size_t __neighbours -- least number of neighbours of a kept point
+             * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+             * @param  : std::vector<PointXYZRGB>& __output -- output points
+             * @return : void
+             * */
+            void filter(const kinect::type::PointXYZRGB *__points, size_t __count, float __radius,
+                        size_t __neighbours, kinect::type::ThreadPool *__pool,
+                        std::vector<kinect::type::PointXYZRGB> &__output);
+
+            /*
+             * Same as filter, structure of arrays.
+             * @param  : const PointCloudSoA& __points -- input points
+             * @param  : size_t __count -- number of input points
+             * @param  : float __radius -- neighbourhood radius, millimeters
+             * @param  : size_t __neighbours -- least number of neighbours of a kept point
+             * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+             * @param  : PointCloudSoA& __output -- output points
+             * @return : void
+             * */
+            void filter(const kinect::type::PointCloudSoA &__points, size_t __count, float __radius,
+                        size_t __neighbours, kinect::type::ThreadPool *__pool, kinect::type::PointCloudSoA &__output);
+        };
+
+        /*
+        * Remove flying pixels, which lie between a foreground and a background
+        * surface, from a DEPTH16 image, see kinect::kernel::remove_flying_pixels().
+        * Bands of rows are filtered in parallel.
+        * @param  : const uint16_t* __input -- DEPTH16 pixels, __width * __height
+        * @param  : uint16_t* __output -- DEPTH16 pixels, __width * __height
+        * @param  : int __width -- width in pixels
+        * @param  : int __height -- height in pixels
+        * @param  : float __ratio -- largest depth jump per depth, in (0, 1)
+        * @param  : ThreadPool* __pool -- helpers, nullptr runs on this thread
+        * @return : void
+        * */
+        void remove_flying_pixels(const uint16_t *__input, uint16_t *__output, int __width, int __height,
+                                  float __ratio, kinect::type::ThreadPool *__pool);
+
+        /*
+        * Temporal depth filter of one sequence of frames, keeps the per pixel state
+        * of kinect::kernel::temporal_filter() from frame to frame. Frames must be
+        * given in time order by one thread at a time.
+        * */
+        class TemporalFilter {
+        private:
+            // running average of each pixel
+            std::vector<float> average_;
+            // last output of each pixel
+            std::vector<uint16_t> output_;
+
+        public:
+            /*
+             * Constructor, no history.
+             * */
+            TemporalFilter();
+
+            /*
+             * Deconstructor.
+             * */
+            ~TemporalFilter();
+
+            /*
+             * Stabilize the next frame in place, the history is dropped if the frame size changes.
+             * @param  : uint16_t* __depth -- DEPTH16 pixels
+             * @param  : size_t __pixels -- number of pixels
+             * @param  : const TemporalOptions& __options -- parameters
+             * @return : void
+             * */
+            void filter(uint16_t *__depth, size_t __pixels, const kinect::kernel::TemporalOptions &__options);
+        };
+
+        /*
+        * Static background of a fixed camera in depth pixel space. Valid depth
+        * samples of empty scene frames are accumulated per pixel, build() turns
+        * them into a band mean +- max(tolerance, 3 standard deviations) of each
+        * pixel, and subtract() sets the pixels of a frame inside their band to 0,
+        * so background pixels are neither registered nor turned into points.
+        * Pixels without a valid sample have no band and are always kept.
+        * After build() the model is only read and can be shared by all threads.
+        * */
+        class BackgroundModel {
+        private:
+            // depth image size
+            int width_, height_;
+            // frames added
+            uint64_t frames_;
+            // valid samples, their sum and sum of squares of each pixel, freed by build()
+            std::vector<uint32_t> count_;
+            std::vector<uint64_t> sum_, square_sum_;
+            // background band of each pixel, [lower, upper], empty if lower > upper
+            std::vector<uint16_t> lower_, upper_;
+            // pixels with a band
+            size_t background_pixels_;
+
+        public:
+            /*
+             * Constructor, an empty model of a depth image size.
+             * @param  : int __width -- depth image width
+             * @param  : int __height -- depth image height
+             * */
+            BackgroundModel(int __width, int __height);
+
+            /*
+             * Deconstructor.
+             * */
+            ~BackgroundModel();
+
+            /*
+             * Accumulate the valid samples of an empty scene frame.
+             * @param  : const uint16_t* __depth -- DEPTH16 pixels, width * height
+             * @return : void
+             * */
+            void add_frame(const uint16_t *__depth);
+
+            /*
+             * Compute the band of each pixel from the accumulated samples.
+             * @param  : int __tolerance -- least half width of a band, millimeters
+             * @return : void
+             * */
+            void build(int __tolerance);
+
+            /*
+             * Set the background pixels of a frame to 0 in place.
+             * @param  : uint16_t* __depth -- DEPTH16 pixels, width * height
+             * @return : void
+             * */
+            void subtract(uint16_t *__depth) const;
+
+            /*
+             * Depth image width.
+             * @param  : ----
+             * @return : int -- width
+             * */
+            int width() const;
+
+            /*
+             * Depth image height.
+             * @param  : ----
+             * @return : int -- height
+             * */
+            int height() const;
+
+            /*
+             * Number of frames added.
+             * @param  : ----
+             * @return : uint64_t -- frames
+             * */
+            uint64_t frames() const;
+
+            /*
+             * Fraction of pixels with a background band, after build().
+             * @param  : ----
+             * @return : double -- 0 to 1
+             * */
+            double coverage() const;
+        };
+    };  // namespace filter
+};  // namespace kinect
+
+#endif  // KINECT_FILTER_H
@@ -0,0 +1,157 @@
+/*
+ * This is a header file of kinect::record::MultiCameraFusion.
+ * Author : @ChenRP07
+ * Date : 2022-11-22
+ * */
+#ifndef KINECT_FUSION_H
+#define KINECT_FUSION_H
+
+#include "kinect_record.h"
+#include "kinect_filter.h"
+
+namespace kinect {
+    namespace record {
+        /*
+        * Fuse the recordings of several cameras connected by sync cables, one
+        * master and its subordinates, into one point cloud per tick. How to use :
+        * ......
+        *
+        * MultiCameraFusion rig;
+        * rig.load_rig(RIG_FILE);
+        * rig.set_name(SEQUENCE_NAME);
+        * rig.set_config(convert_config);
+        * rig.convert();
+        * rig.output_point_cloud_sequence(OUTPUT_SEQUENCE_DIR, FORMAT);
+        *
+        * ......
+        *
+        * A rig file has one camera per line, the mkv path and optionally its
+        * camera to world transform, 9 row major rotation values and 3 translation
+        * values in millimeters, separated by spaces. Empty lines and lines
+        * starting with # are skipped. The camera recorded in master mode, or the
+        * first camera if there is none, is the master.
+        *
+        * Captures are paired by device timestamp minus the start offset of their
+        * recording and the delay of their camera off the master, a subordinate
+        * capture belongs to the master capture within half a frame period. Ticks
+        * missing a camera are dropped. A sync thread pairs captures, one worker
+        * per camera generates points in world coordinates, and the calling
+        * thread merges the points of each tick to a frame of the master video.
+        * */
+        class MultiCameraFusion {
+        private:
+            // state of one camera
+            struct Camera;
+
+            // cameras, the master is the first one
+            std::vector<std::unique_ptr<Camera>> cameras_;
+            // conversion parameters of the master
+            ConvertConfig config_;
+            // ticks with a capture of every camera
+            uint64_t fused_ticks_ = 0;
+            // master captures without a capture of some subordinate
+            uint64_t dropped_ticks_ = 0;
+            // subordinate captures without a master capture
+            uint64_t dropped_captures_ = 0;
+            // downsamples fused frames, so overlapping cameras share voxels
+            kinect::filter::VoxelGrid voxel_grid_;
+            // helpers of voxel_grid_
+            std::unique_ptr<kinect::type::ThreadPool> filter_pool_;
+
+            /*
+             * Usec of a capture on the common clock of the rig.
+             * @param  : const Camera& __camera -- camera of the capture
+             * @param  : const FrameTask& __task -- fetched capture
+             * @return : int64_t -- tick time
+             * */
+            static int64_t tick_time(const Camera &__camera, const FrameTask &__task);
+
+            /*
+             * Fetch the next master capture and the matching capture of each
+             * subordinate, drop the master captures missing a subordinate.
+             * @param  : std::vector<std::unique_ptr<FrameTask>>& __tasks -- output, one per camera
+             * @return : bool -- if no tick 1, else 0
+             * */
+            bool fetch_tick(std::vector<std::unique_ptr<FrameTask>> &__tasks);
+
+            /*
+             * Release held captures and close the playback handles of the
+             * subordinates, the master is closed by its output_point_cloud_sequence().
+             * @param  : ----
+             * @return : void
+             * */
+            void close();
+
+        public:
+            /*
+             * Default constructor.
+             * */
+            MultiCameraFusion();
+
+            /*
+             * Deconstructor, close subordinate recordings.
+             * */
+            ~MultiCameraFusion();
+
+            /*
+             * Open the recordings of a rig file.
+             * @param  : const std::string& __rig_path -- rig file path
+             * @return : void
+             * */
+            void load_rig(const std::string &__rig_path);
+
+            /*
+             * Log the synchronization settings of each camera.
+             * @param  : ----
+             * @return : void
+             * */
+            void log_config() const;
+
+            /*
+             * Set sequence name.
+             * @param  : const std::string& __sequence_name -- name
+             * @return : void
+             * */
+            void set_name(const std::string &__sequence_name);
+
+            /*
+             * Set conversion parameters of all cameras, start, end and stride
+             * select master captures, shards is not used, voxel_size applies to
+             * fused frames.
+             * @param  : const ConvertConfig& __config -- parameters
+             * @return : void
+             * */
+            void set_config(const ConvertConfig &__config);
+
+            /*
+             * Stream fused frames to gived path as soon as they are generated,
+             * see KinectMkv2VolumetricVideo::open_stream().
+             * @param  : const std::string& __output_sequence_path -- output dir path
+             * @param  : OutputFormat __format -- output format
+             * @param  : size_t __max_in_flight -- max frames waiting to be written
+             * @return : void
+             * */
+            void open_stream(const std::string &__output_sequence_path, kinect::type::OutputFormat __format,
+                             size_t __max_in_flight);
+
+            /*
+             * Fuse all remaining ticks. Log throughput of each stage at the end.
+             * @param  : ----
+             * @return : void
+             * */
+            void convert();
+
+            /*
+             * Output fused sequence to gived path, see
+             * KinectMkv2VolumetricVideo::output_point_cloud_sequence().
+             * @param  : const std::string& __output_sequence_path -- output dir path
+             * @param  : OutputFormat __format -- output format
+             * @return : void
+             * */
+            void output_point_cloud_sequence(const std::string &__output_sequence_path,
+                                             kinect::type::OutputFormat __format);
+        };
+    };  // namespace record
+};  // namespace kinect
+
+#endif  // KINECT_FUSION_H
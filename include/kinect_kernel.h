@@ -0,0 +1,153 @@
+/*
+ * This is a header file of kinect::kernel.
+ * Author : @ChenRP07
+ * Date : 2022-11-10
+ * */
+#ifndef KINECT_KERNEL_H
+#define KINECT_KERNEL_H
+
+#include "kinect_type.h"
+
+#include <string>
+
+namespace kinect {
+    /*
+    * Namespace of per pixel kernels in kinect. Each kernel has a scalar version
+    * and SIMD versions, the fastest one supported by this CPU is picked at run
+    * time on first call.
+    * */
+    namespace kernel {
+        /*
+        * Per point work done by extract_points while a point is in registers.
+        * */
+        struct ExtractOptions {
+            // transform points to world coordinates, nullptr keeps camera coordinates
+            const kinect::type::Extrinsics *extrinsics = nullptr;
+            // keep pixels with depth_min <= raw z <= depth_max, camera z in millimeters, z == 0 is never kept
+            int16_t depth_min = 1;
+            int16_t depth_max = INT16_MAX;
+            // keep points inside this box, nullptr keeps all
+            const kinect::type::Box *crop = nullptr;
+            // test crop before the transform, in camera coordinates, else after it
+            bool crop_camera = false;
+        };
+
+        /*
+        * Convert a k4a point cloud image and a pixel aligned BGRA32 image to points.
+        * Pixels with z == 0 or alpha == 0 and pixels culled by __options are dropped,
+        * the others are written to __output without gaps in pixel order.
+        * @param  : const int16_t* __xyz -- 3 * __pixels coordinates
+        * @param  : const uint8_t* __bgra -- 4 * __pixels colors
+        * @param  : size_t __pixels -- number of pixels
+        * @param  : const ExtractOptions& __options -- per point work
+        * @param  : PointXYZRGB* __output -- room for __pixels points
+        * @return : size_t -- number of points written
+        * */
+        size_t extract_points(const int16_t *__xyz, const uint8_t *__bgra, size_t __pixels,
+                              const ExtractOptions &__options, kinect::type::PointXYZRGB *__output);
+
+        /*
+        * Same as extract_points, output to structure of arrays from point __first.
+        * @param  : const int16_t* __xyz -- 3 * __pixels coordinates
+        * @param  : const uint8_t* __bgra -- 4 * __pixels colors
+        * @param  : size_t __pixels -- number of pixels
+        * @param  : const ExtractOptions& __options -- per point work
+        * @param  : PointCloudSoA& __output -- room for __first + __pixels points
+        * @param  : size_t __first -- index of the first written point
+        * @return : size_t -- number of points written
+        * */
+        size_t extract_points(const int16_t *__xyz, const uint8_t *__bgra, size_t __pixels,
+                              const ExtractOptions &__options, kinect::type::PointCloudSoA &__output, size_t __first);
+
+        /*
+        * Set depth pixels inside their background band, __lower[i] <= __depth[i] <= __upper[i],
+        * to 0 in place. Pixels without background have an empty band, lower > upper.
+        * @param  : uint16_t* __depth -- DEPTH16 pixels
+        * @param  : const uint16_t* __lower -- lower bound of each pixel, at least 1
+        * @param  : const uint16_t* __upper -- upper bound of each pixel
+        * @param  : size_t __pixels -- number of pixels
+        * @return : void
+        * */
+        void subtract_background(uint16_t *__depth, const uint16_t *__lower, const uint16_t *__upper,
+                                 size_t __pixels);
+
+        /*
+        * Copy rows [__row_begin, __row_end) of a DEPTH16 image to __output with flying
+        * pixels set to 0. A pixel is flying if it differs from both its horizontal or
+        * both its vertical neighbours by more than (depth * __ratio) >> 16, so it lies
+        * between two surfaces, while a pixel on the edge of a surface matches the
+        * neighbour on its side. Neighbours outside the image count as equal.
+        * @param  : const uint16_t* __input -- DEPTH16 pixels, __width * __height
+        * @param  : uint16_t* __output -- DEPTH16 pixels, __width * __height
+        * @param  : int __width -- width in pixels
+        * @param  : int __height -- height in pixels
+        * @param  : int __row_begin -- first row
+        * @param  : int __row_end -- one past the last row
+        * @param  : uint16_t __ratio -- largest depth jump per depth, 16-bit fraction
+        * @return : void
+        * */
+        void remove_flying_pixels(const uint16_t *__input, uint16_t *__output, int __width, int __height,
+                                  int __row_begin, int __row_end, uint16_t __ratio);
+
+        /*
+        * Parameters of temporal_filter.
+        * */
+        struct TemporalOptions {
+            // weight of a new sample in the running average
+            float alpha = 0.25f;
+            // a sample farther than motion * depth from the average restarts it
+            float motion = 0.02f;
+            // millimeters the average moves before the output follows it
+            float hold = 2.0f;
+        };
+
+        /*
+        * Stabilize a DEPTH16 image in place with per pixel state kept across frames.
+        * Each pixel keeps an exponential average of its depth, restarted at the new
+        * sample on motion, no depth or no history, and outputs the last rounded
+        * average until the average moves by more than hold, so a steady surface
+        * has the same depth in every frame. State starts as zeros.
+        * @param  : uint16_t* __depth -- DEPTH16 pixels, replaced by the output
+        * @param  : float* __average -- running average of each pixel
+        * @param  : uint16_t* __output -- last output of each pixel
+        * @param  : size_t __pixels -- number of pixels
+        * @param  : const TemporalOptions& __options -- parameters
+        * @return : void
+        * */
+        void temporal_filter(uint16_t *__depth, float *__average, uint16_t *__output, size_t __pixels,
+                             const TemporalOptions &__options);
+
+        /*
+        * Unproject DEPTH16 pixels [__begin, __end) to int16 x, y, z points in millimeters,
+        * point i is __depth[i] * (__rays_x[i], __rays_y[i], 1) rounded to nearest even,
+        * pixels whose ray is NaN give (0, 0, 0).
+        * @param  : const uint16_t* __depth -- DEPTH16 pixels
+        * @param  : const float* __rays_x -- x of the ray of each pixel at z = 1
+        * @param  : const float* __rays_y -- y of the ray of each pixel at z = 1
+        * @param  : int16_t* __points -- output x, y, z of each pixel
+        * @param  : size_t __begin -- first pixel
+        * @param  : size_t __end -- end of pixels
+        * @return : void
+        * */
+        void unproject_depth(const uint16_t *__depth, const float *__rays_x, const float *__rays_y, int16_t *__points,
+                             size_t __begin, size_t __end);
+
+        /*
+        * Instruction set used by the kernels on this CPU.
+        * @param  : ----
+        * @return : const char* -- "avx2", "sse4.1" or "scalar"
+        * */
+        const char *instruction_set();
+
+        /*
+        * Run the kernels with another instruction set of this CPU, all of them
+        * give the same output, so the versions can be compared. Call it while no
+        * kernel runs.
+        * @param  : const std::string& __name -- "avx2", "sse4.1" or "scalar"
+        * @return : bool -- false if the name is unknown or this CPU does not support it
+        * */
+        bool set_instruction_set(const std::string &__name);
+    };  // namespace kernel
+};  // namespace kinect
+
+#endif  // KINECT_KERNEL_H
@@ -29,7 +29,17 @@ static std::string error_info[100] = {
         "wrong color image format, must be MJPEG",
         "cannot decompress color image by JPEG",
         "cannot seek beginning timestamp",
-        "wrong application parameters, try kinect.exe -h|--help for help"
+        "wrong application parameters, try kinect.exe -h|--help for help",
+        "image size does not match calibration",
+        "file write fault",
+        "cannot map file to memory",
+        "wrong volumetric video container format",
+        "wrong camera rig file format",
+        "wrong wired synchronization mode of camera rig",
+        "background recording does not match the depth camera",
+        "lens distortion model is not supported",
+        "native transformation engine does not match k4a",
+        "k4a image allocator can not be set"
 };
 
 // error code
@@ -51,7 +61,17 @@ enum kinect_error_code {
     WRONG_COLOR_FORMAT,
     JPEG_DECOMPRESSION_FAULT,
     TIMESTAMP_FAULT,
-    APP_PARAMETER_FAULT
+    APP_PARAMETER_FAULT,
+    WRONG_IMAGE_SIZE,
+    FILE_WRITE_FAULT,
+    FILE_MAP_FAULT,
+    WRONG_CONTAINER_FORMAT,
+    WRONG_RIG_FORMAT,
+    SYNC_MODE_FAULT,
+    BACKGROUND_MODEL_FAULT,
+    LENS_MODEL_FAULT,
+    ENGINE_MISMATCH,
+    SET_ALLOCATOR_FAILED
 };
 
 // color format information
@@ -75,6 +95,9 @@ static int fps_info[3] = {5, 15, 30};
 // external camera sync mode information
 static std::string sync_mode_info[3] = {"Standalone", "Master", "Subordinate"};
 
+// output format information
+static std::string format_info[4] = {"ascii .ply", "binary .ply", "quantized .kpq", "container .kvv"};
+
 #define __error__(src) \
     kinect::log::except(__FILE__, __FUNCTION__, __LINE__, error_info[src])
 
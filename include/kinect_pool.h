@@ -0,0 +1,174 @@
+/*
+ * This is a header file of kinect::type::ThreadPool.
+ * Author : @ChenRP07
+ * Date : 2022-11-12
+ * */
+#ifndef KINECT_POOL_H
+#define KINECT_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kinect {
+    namespace type {
+        /*
+        * Fixed set of worker threads running submitted jobs in FIFO order.
+        * parallel_for() spreads an index range over the workers and the calling
+        * thread, and returns after every index is done.
+        * */
+        class ThreadPool {
+        private:
+            // worker threads
+            std::vector<std::thread> workers_;
+            // jobs waiting for a worker
+            std::deque<std::function<void()>> jobs_;
+            // guards jobs_ and stopped_
+            std::mutex mutex_;
+            // signaled when a job is queued or the pool stops
+            std::condition_variable job_ready_;
+            // workers exit once jobs_ is empty
+            bool stopped_;
+
+            /*
+             * Loop of a worker thread.
+             * @param  : ----
+             * @return : void
+             * */
+            void work();
+
+        public:
+            /*
+             * Constructor, start workers.
+             * @param  : size_t __threads -- number of workers, 0 means one per hardware thread
+             * */
+            explicit ThreadPool(size_t __threads = 0);
+
+            /*
+             * Deconstructor, finish queued jobs and join workers.
+             * */
+            ~ThreadPool();
+
+            ThreadPool(const ThreadPool &) = delete;
+
+            ThreadPool &operator=(const ThreadPool &) = delete;
+
+            /*
+             * Number of workers.
+             * @param  : ----
+             * @return : size_t -- size
+             * */
+            size_t size() const { return this->workers_.size(); }
+
+            /*
+             * Queue a job, it runs on the first free worker.
+             * @param  : std::function<void()> __job -- job
+             * @return : void
+             * */
+            void submit(std::function<void()> __job);
+
+            /*
+             * Call __body(i) for each i in [0, __count), indices are taken one by
+             * one by the workers and the calling thread, so uneven items balance.
+             * @param  : size_t __count -- number of indices
+             * @param  : const std::function<void(size_t)>& __body -- work of one index
+             * @return : void
+             * */
+            void parallel_for(size_t __count, const std::function<void(size_t)> &__body);
+        };
+
+        /*
+        * Worker threads with one job deque each. A job submitted by a worker goes
+        * to the back of its own deque and is run by it LIFO, idle workers steal
+        * from the front of the other deques, so jobs spawned by a busy worker
+        * spread over the idle ones. Jobs submitted by other threads are dealt
+        * round robin.
+        * */
+        class WorkStealingPool {
+        private:
+            // job deque of one worker
+            struct JobQueue {
+                std::deque<std::function<void()>> jobs;
+                std::mutex mutex;
+            };
+
+            // one deque per worker
+            std::vector<std::unique_ptr<JobQueue>> queues_;
+            // worker threads
+            std::vector<std::thread> workers_;
+            // jobs in all deques
+            std::atomic<size_t> queued_;
+            // jobs submitted and not finished
+            std::atomic<size_t> pending_;
+            // next deque of a job submitted by a non worker thread
+            std::atomic<size_t> next_queue_;
+            // guards sleeping and stopped_
+            std::mutex mutex_;
+            // signaled when a job is queued, when pending_ drops to 0, or on stop
+            std::condition_variable changed_;
+            // workers exit
+            bool stopped_;
+
+            /*
+             * Take a job from deque __index, its back if __own, else its front.
+             * @param  : size_t __index -- deque index
+             * @param  : bool __own -- if the caller is the owner of the deque
+             * @param  : std::function<void()>& __job -- output job
+             * @return : bool -- if a job is taken
+             * */
+            bool take(size_t __index, bool __own, std::function<void()> &__job);
+
+            /*
+             * Loop of worker __index.
+             * @param  : size_t __index -- worker index
+             * @return : void
+             * */
+            void work(size_t __index);
+
+        public:
+            /*
+             * Constructor, start workers.
+             * @param  : size_t __threads -- number of workers, 0 means one per hardware thread
+             * */
+            explicit WorkStealingPool(size_t __threads = 0);
+
+            /*
+             * Deconstructor, wait for all jobs and join workers.
+             * */
+            ~WorkStealingPool();
+
+            WorkStealingPool(const WorkStealingPool &) = delete;
+
+            WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+            /*
+             * Number of workers.
+             * @param  : ----
+             * @return : size_t -- size
+             * */
+            size_t size() const { return this->workers_.size(); }
+
+            /*
+             * Queue a job, jobs may submit more jobs.
+             * @param  : std::function<void()> __job -- job
+             * @return : void
+             * */
+            void submit(std::function<void()> __job);
+
+            /*
+             * Wait until all submitted jobs, and the jobs they submitted, are done.
+             * @param  : ----
+             * @return : void
+             * */
+            void wait();
+        };
+    };  // namespace type
+};  // namespace kinect
+
+#endif  // KINECT_POOL_H
@@ -0,0 +1,125 @@
+/*
+ * This is a header file of kinect::type::QuantizedFrameSink.
+ * Author : @ChenRP07
+ * Date : 2022-11-14
+ * */
+#ifndef KINECT_QUANTIZED_H
+#define KINECT_QUANTIZED_H
+
+#include <map>
+#include <mutex>
+#include "kinect_type.h"
+
+namespace kinect {
+    namespace type {
+        /*
+        * Quantized point cloud sequence, all values are little endian.
+        *
+        * (SEQUENCE_PATH).kpc     : QuantizedHeader, calibration_size bytes of raw
+        *                           k4a calibration, frame_count QuantizedFrameEntry
+        *                           sorted by time stamp.
+        * (SEQUENCE_PATH)_(TIME_STAMP).kpq : point_count points of point_size bytes,
+        *                           int16 x, y, z in millimeters then uint8 r, g, b,
+        *                           no header, so a frame can be mapped as is.
+        * */
+        struct QuantizedHeader {
+            // "KPCQ"
+            char magic[4];
+            // format version, 1
+            uint32_t version;
+            // bytes of one point, 9
+            uint32_t point_size;
+            // camera whose coordinate system the points are in, k4a_calibration_type_t, or world_camera
+            uint32_t camera;
+            // color images are decoded at 1/color_scale resolution
+            uint32_t color_scale;
+            // number of QuantizedFrameEntry
+            uint32_t frame_count;
+            // bytes of raw calibration following this header
+            uint64_t calibration_size;
+        };
+
+        struct QuantizedFrameEntry {
+            // usec timestamp, also names the payload file
+            uint64_t time_stamp;
+            // number of points in the payload file
+            uint64_t point_count;
+        };
+
+        static_assert(sizeof(QuantizedHeader) == 32 && sizeof(QuantizedFrameEntry) == 16,
+                      "quantized sequence headers have no padding");
+
+#pragma pack(push, 1)
+        // One point of a quantized frame.
+        struct QuantizedPoint {
+            int16_t x, y, z;
+            uint8_t r, g, b;
+        };
+#pragma pack(pop)
+
+        // magic of QuantizedHeader
+        static const char quantized_magic[4] = {'K', 'P', 'C', 'Q'};
+        // bytes of one quantized point
+        static const size_t quantized_point_size = sizeof(QuantizedPoint);
+        // camera of points in the world coordinates of a rig, K4A_CALIBRATION_TYPE_UNKNOWN as uint32
+        static const uint32_t world_camera = static_cast<uint32_t>(K4A_CALIBRATION_TYPE_UNKNOWN);
+
+        static_assert(sizeof(QuantizedPoint) == 9, "quantized points are packed");
+
+        /*
+        * Quantize all points of __frame to __output.
+        * @param  : const PointCloudFrame& __frame -- points
+        * @param  : char* __output -- room for __frame.size() quantized points
+        * @return : void
+        * */
+        void quantize_frame(const PointCloudFrame &__frame, char *__output);
+
+        /*
+        * Write each frame to a quantized payload file and, on close(), the
+        * sequence header with the frame index. write() may be called by several
+        * threads at the same time.
+        * */
+        class QuantizedFrameSink : public FrameSink {
+        private:
+            // output path prefix, dir path and sequence name
+            std::string file_name_prev_;
+            // header of the sequence, frame_count is set on close()
+            QuantizedHeader header_;
+            // raw k4a calibration
+            std::vector<uint8_t> calibration_;
+            // written frames, point count by time stamp
+            std::map<uint64_t, uint64_t> frames_;
+            // guards frames_
+            std::mutex mutex_;
+
+        public:
+            /*
+             * Constructor.
+             * @param  : const std::string& __output_path -- output dir path
+             * @param  : const std::string& __sequence_name -- name
+             * @param  : const std::vector<uint8_t>& __calibration -- raw k4a calibration
+             * @param  : k4a_calibration_type_t __camera -- camera of the point coordinates, UNKNOWN for world
+             * @param  : int __color_scale -- color images are decoded at 1/__color_scale resolution
+             * */
+            QuantizedFrameSink(const std::string &__output_path, const std::string &__sequence_name,
+                               const std::vector<uint8_t> &__calibration, k4a_calibration_type_t __camera,
+                               int __color_scale);
+
+            /*
+             * Output __frame to (SEQUENCE_PATH)_(TIME_STAMP).kpq.
+             * @param  : PointCloudFrame& __frame -- frame to be written
+             * @return : void
+             * */
+            void write(PointCloudFrame &__frame) override;
+
+            /*
+             * Output header and frame index to (SEQUENCE_PATH).kpc.
+             * @param  : ----
+             * @return : void
+             * */
+            void close() override;
+        };
+    };  // namespace type
+};  // namespace kinect
+
+#endif  // KINECT_QUANTIZED_H
@@ -0,0 +1,95 @@
+/*
+ * This is a header file of kinect::type::BoundedQueue.
+ * Author : @ChenRP07
+ * Date : 2022-11-02
+ * */
+#ifndef KINECT_QUEUE_H
+#define KINECT_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+
+namespace kinect {
+    namespace type {
+        /*
+        * Thread safe FIFO queue with a fixed capacity.
+        * push() blocks while the queue is full and pop() blocks while it is empty,
+        * so a producer can never run more than capacity elements ahead of its
+        * consumer. After close(), push() is rejected and pop() drains the rest.
+        * */
+        template<typename T>
+        class BoundedQueue {
+        private:
+            // queued elements
+            std::deque<T> queue_;
+            // max size of queue_
+            size_t capacity_;
+            // no more push() is accepted
+            bool closed_;
+            std::mutex mutex_;
+            std::condition_variable not_full_;
+            std::condition_variable not_empty_;
+
+        public:
+            /*
+             * Constructor.
+             * @param  : size_t __capacity -- max queued elements, at least 1
+             * */
+            explicit BoundedQueue(size_t __capacity) : capacity_{__capacity == 0 ? 1 : __capacity}, closed_{false} {}
+
+            /*
+             * Default deconstructor.
+             * */
+            ~BoundedQueue() = default;
+
+            /*
+             * Add an element, wait while queue is full.
+             * @param  : T&& __value -- element
+             * @return : bool -- false if queue is closed
+             * */
+            bool push(T &&__value) {
+                std::unique_lock<std::mutex> lock(this->mutex_);
+                this->not_full_.wait(lock, [this] { return this->closed_ || this->queue_.size() < this->capacity_; });
+                if (this->closed_) {
+                    return false;
+                }
+                this->queue_.emplace_back(std::move(__value));
+                this->not_empty_.notify_one();
+                return true;
+            }
+
+            /*
+             * Take the front element, wait while queue is empty.
+             * @param  : T& __value -- output element
+             * @return : bool -- false if queue is closed and empty
+             * */
+            bool pop(T &__value) {
+                std::unique_lock<std::mutex> lock(this->mutex_);
+                this->not_empty_.wait(lock, [this] { return this->closed_ || !this->queue_.empty(); });
+                if (this->queue_.empty()) {
+                    return false;
+                }
+                __value = std::move(this->queue_.front());
+                this->queue_.pop_front();
+                this->not_full_.notify_one();
+                return true;
+            }
+
+            /*
+             * Reject further push(), wake up all waiting threads.
+             * @param  : ----
+             * @return : void
+             * */
+            void close() {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                this->closed_ = true;
+                this->not_full_.notify_all();
+                this->not_empty_.notify_all();
+            }
+        };
+    };  // namespace type
+};  // namespace kinect
+
+#endif  // KINECT_QUEUE_H
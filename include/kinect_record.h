@@ -9,10 +9,177 @@
 
 #include <turbojpeg.h>
 #include "kinect_type.h"
+#include "kinect_context.h"
+#include "kinect_stats.h"
+#include "kinect_container.h"
+#include "kinect_pool.h"
+#include "kinect_camera.h"
 #include <dirent.h>
 
+#include <chrono>
+
 namespace kinect {
     namespace record {
+        class BatchConverter;
+
+        class MultiCameraFusion;
+
+        /*
+        * Camera whose pixel grid the point cloud is generated in.
+        * COLOR_GEOMETRY warps depth into the color camera, one candidate point per
+        * color pixel, coordinates in color camera space.
+        * DEPTH_GEOMETRY warps color into the depth camera, one candidate point per
+        * depth pixel, coordinates in depth camera space.
+        * */
+        enum GeometryMode {
+            COLOR_GEOMETRY,
+            DEPTH_GEOMETRY
+        };
+
+        /*
+        * Implementation of the depth image to point cloud image transformation.
+        * K4A_ENGINE calls k4a_transformation_depth_image_to_point_cloud().
+        * NATIVE_ENGINE multiplies depth by a ray table built once from the
+        * calibration, see kinect::camera::RayTable, and in COLOR_GEOMETRY also
+        * registers depth to the color camera, see kinect::camera::Registration.
+        * */
+        enum TransformEngine {
+            K4A_ENGINE,
+            NATIVE_ENGINE
+        };
+
+        /*
+        * Parameters of KinectMkv2VolumetricVideo::convert().
+        * Frames flow demux -> decode -> transform -> emit, demux and emit run on
+        * one thread each, decode and transform on worker pools. Every queue
+        * between two stages holds at most queue_depth frames, and at most
+        * max_in_flight frames are between demux and emit at the same time.
+        * */
+        struct ConvertConfig {
+            // threads decoding MJPEG color images
+            size_t decode_workers = 2;
+            // threads aligning depth to color and generating points
+            size_t transform_workers = 2;
+            // capacity of the queue in front of each stage
+            size_t queue_depth = 4;
+            // frames demuxed but not yet emitted, bounds out of order results
+            size_t max_in_flight = 8;
+            // pixel grid of generated points
+            GeometryMode geometry = COLOR_GEOMETRY;
+            // decode color images at 1/color_scale resolution, 1, 2, 4 or 8
+            int color_scale = 1;
+            // implementation of depth unprojection and registration
+            TransformEngine engine = K4A_ENGINE;
+            // transform every frame with k4a too and fail if NATIVE_ENGINE differs, see kinect::camera::registration_mismatch()
+            bool verify_engine = false;
+            // NATIVE_ENGINE only, generate points in one pass without point cloud image, see extract_fused()
+            bool fuse_points = false;
+            // memory layout of generated frames
+            kinect::type::PointLayout layout = kinect::type::AOS_LAYOUT;
+            // usec from the beginning of the recording to the first converted capture
+            uint64_t start_usec = 0;
+            // usec from the beginning of the recording to the end of conversion, 0 is the end of the recording
+            uint64_t end_usec = 0;
+            // convert one capture in every stride frame periods
+            size_t stride = 1;
+            // independent playback handles converting consecutive time segments, 1 is the pipeline above
+            size_t shards = 1;
+            // millimeters, drop points with less than outlier_neighbours other points within outlier_radius,
+            // before voxel_size, 0 keeps all points
+            float outlier_radius = 0.0f;
+            size_t outlier_neighbours = 4;
+            // millimeters, replace the points of each voxel by their centroid and average color, 0 keeps all points
+            float voxel_size = 0.0f;
+            // threads helping the thread of a frame to filter it, 0 filters on that thread only
+            size_t filter_workers = 2;
+            // millimeters along the optical axis, keep points with near_z <= z <= far_z, 0 is no limit
+            int near_z = 0;
+            int far_z = 0;
+            // keep only points inside crop_box, culled while points are generated
+            bool crop = false;
+            kinect::type::Box crop_box;
+            // crop_box is in camera coordinates, else in world coordinates of a camera with extrinsics
+            bool crop_camera = false;
+            // empty scene frames the background model is learned from, 0 keeps the background
+            size_t background_frames = 0;
+            // empty scene recording of the same camera, empty learns from the beginning of this recording
+            std::string background_path;
+            // millimeters, least distance of a foreground pixel from the background depth
+            int background_tolerance = 25;
+            // largest depth jump per depth from a pixel to both its neighbours on an axis,
+            // pixels with larger jumps are flying pixels and are dropped, 0 keeps them
+            float flying_pixel_ratio = 0.04f;
+            // weight of a new depth sample in the per pixel temporal average, 0 turns the temporal filter off
+            float temporal_alpha = 0.0f;
+            // a depth sample farther than temporal_motion * depth from the average restarts it
+            float temporal_motion = 0.02f;
+            // millimeters the average moves before the depth of a pixel changes
+            float temporal_hold = 2.0f;
+        };
+
+        /*
+        * A playback handle reading the captures of one time segment.
+        * */
+        struct PlaybackRange {
+            // playback handle
+            k4a_playback_t handle = nullptr;
+            // device timestamps owned by this range, [begin, end)
+            uint64_t begin = 0;
+            uint64_t end = UINT64_MAX;
+            // captures read from the file but not converted
+            uint64_t skipped = 0;
+            // temporal depth filter state of the captures read by this range, created on first use
+            std::unique_ptr<kinect::filter::TemporalFilter> temporal;
+        };
+
+        /*
+        * Steps of the transform stage timed on each frame. Native registration in
+        * COLOR_GEOMETRY without verification writes points at once, its unprojection
+        * is part of REGISTRATION_STEP, fused point generation is EXTRACTION_STEP.
+        * */
+        enum TransformStep {
+            // background subtraction and flying pixel removal of the depth image
+            DEPTH_FILTER_STEP,
+            // depth to color or color to depth registration
+            REGISTRATION_STEP,
+            // depth image to point cloud image
+            UNPROJECTION_STEP,
+            // point cloud image and color image to points
+            EXTRACTION_STEP,
+            // outlier and voxel grid filters, or the copy of points to the frame
+            FILTERING_STEP,
+            TRANSFORM_STEP_COUNT
+        };
+
+        /*
+        * One frame travelling through the convert() pipeline.
+        * */
+        struct FrameTask {
+            // frame order in this video, starting from 0
+            uint64_t index = 0;
+            // usec device timestamp of the depth image
+            uint64_t time_stamp = 0;
+            // frame period this capture falls in, counted from the beginning of the converted range
+            uint64_t frame_number = 0;
+            // capture holding depth_image and color_image
+            k4a_capture_t capture = nullptr;
+            // DEPTH16 image
+            k4a_image_t depth_image = nullptr;
+            // MJPEG image
+            k4a_image_t color_image = nullptr;
+            // decoded BGRA32 color image
+            k4a_image_t uncompressed_color_image = nullptr;
+            // generated points, AOS_LAYOUT
+            std::vector<kinect::type::PointXYZRGB> point_cloud;
+            // generated points, SOA_LAYOUT
+            kinect::type::PointCloudSoA point_cloud_soa;
+            // time this frame is demuxed
+            std::chrono::steady_clock::time_point start;
+            // nsec spent on each TransformStep, and the steps run, bit 1 << step
+            uint64_t step_nsec[TRANSFORM_STEP_COUNT] = {};
+            uint32_t steps = 0;
+        };
+
         /*
         * KinectMkv2VolumetricVideo is used to convert a mkv video to a point cloud
         * sequence. How to use :
@@ -29,36 +196,272 @@ namespace kinect {
         * example.output_point_cloud_sequence(OUTPUT_SEQUENCE_DIR);
         *
         * ......
+        *
+        * To write each frame as soon as it is generated instead of buffering the
+        * whole video, call example.open_stream(OUTPUT_SEQUENCE_DIR, ...) after
+        * set_name(), output_point_cloud_sequence() then waits for the last frame.
+        *
+        * The while loop can be replaced by example.convert(), which processes
+        * several frames at the same time, see ConvertConfig.
         * */
         class KinectMkv2VolumetricVideo {
         private:
+            // drives the frames of many videos on one thread pool
+            friend class BatchConverter;
+            // drives the frames of several synchronized cameras
+            friend class MultiCameraFusion;
+
             // volumetric video
             kinect::type::VolumetricVideo video_;
             // kinect process handle
-            k4a_playback_t k4a_handle_;
+            k4a_playback_t k4a_handle_ = nullptr;
             // configuration of this video
             k4a_record_configuration_t k4a_record_config_;
-            // kinect transformation handle, used to transform depth image
-            k4a_transformation_t k4a_point_cloud_transformation_handle_;
+            // decoder and transformation state of get_point_cloud()
+            std::unique_ptr<FrameContext> context_;
+            // decoded BGRA32 color images shared by all workers
+            std::unique_ptr<ImagePool> color_pool_;
             // kinect capture handle, used to get image from mkv video
-            k4a_capture_t k4a_capture_;
+            k4a_capture_t k4a_capture_ = nullptr;
+            // calibration of this video, read from file
+            k4a_calibration_t calibration_;
+            // calibration_ with color camera matched to decoded color resolution,
+            // used to create transformation handles
+            k4a_calibration_t scaled_calibration_;
+            // calibration blob of this video as stored in the file
+            std::vector<uint8_t> raw_calibration_;
+            // pipeline parameters of convert()
+            ConvertConfig config_;
+            // path of the mkv file, opened again by each shard
+            std::string video_path_;
+            // whole converted range read by k4a_handle_
+            PlaybackRange range_;
+            // captures read from the file but not converted, by all ranges
+            uint64_t skipped_captures_ = 0;
+            // helpers of the filters and of the native engine, shared by all threads
+            std::unique_ptr<kinect::type::ThreadPool> filter_pool_;
+            // rays of the camera of config_.geometry, built for NATIVE_ENGINE only
+            kinect::camera::RayTable rays_;
+            // depth to color registration, built for NATIVE_ENGINE and COLOR_GEOMETRY only
+            kinect::camera::Registration registration_;
+            // camera to world transform applied to generated points
+            kinect::type::Extrinsics extrinsics_;
+            // if extrinsics_ is set, otherwise points stay in camera space
+            bool has_extrinsics_ = false;
+            // written frames are in world coordinates, set with extrinsics_ or by the rig of the reference camera
+            bool world_output_ = false;
+            // static background removed from depth images, shared by all threads
+            std::unique_ptr<kinect::filter::BackgroundModel> background_;
+            // stages and totals of the last convert(), kept until the report is written
+            std::unique_ptr<kinect::stats::RunReport> report_;
+
+            /*
+             * Seek the first capture of config_.start_usec, and compute the
+             * range of device timestamps to be converted.
+             * @param  : ----
+             * @return : void
+             * */
+            void seek_range();
+
+            /*
+             * Learn background_ from the first config_.background_frames depth
+             * images of config_.background_path or of this recording, read by a
+             * playback handle of its own, or reset it if background_frames is 0.
+             * @param  : ----
+             * @return : void
+             * */
+            void learn_background();
+
+            /*
+             * Fetch next capture of __range to be converted and its depth and color
+             * images, captures out of __range or between strides are released here
+             * before anything is decoded. Strides are counted in frame periods from
+             * the beginning of range_, so every range picks the same captures.
+             * Captures of a range are fetched in time order, so the temporal depth
+             * filter runs here, on the state of __range.
+             * @param  : PlaybackRange& __range -- playback handle and time segment
+             * @param  : FrameTask& __task -- output capture and images
+             * @return : bool -- if no frame 1, else 0
+             * */
+            bool fetch_frame(PlaybackRange &__range, FrameTask &__task);
+
+            /*
+             * convert() with config_.shards playback handles, each one decodes and
+             * transforms a time segment sequentially, frames are merged in time order.
+             * @param  : ----
+             * @return : void
+             * */
+            void convert_sharded();
+
+            /*
+             * Compute scaled_calibration_ from calibration_ and config_.color_scale,
+             * and create context_ with it.
+             * @param  : ----
+             * @return : void
+             * */
+            void apply_color_scale();
+
+            /*
+             * Create color_pool_ holding __count images of decoded color resolution.
+             * @param  : size_t __count -- number of images
+             * @return : void
+             * */
+            void create_color_pool(size_t __count);
+
+            /*
+             * Decompress a MJPEG color image to a BGRA32 image taken from color_pool_.
+             * @param  : FrameContext& __context -- decompressor owner
+             * @param  : k4a_image_t& __color_image -- MJPEG image
+             * @return : k4a_image_t -- BGRA32 image, returned by release_frame()
+             * */
+            k4a_image_t decode_color_image(FrameContext &__context, k4a_image_t &__color_image);
+
+            /*
+             * Filter a depth image before it is registered, background_ is removed in
+             * place, flying pixels while the image is copied to an image of __context.
+             * @param  : FrameContext& __context -- image owner
+             * @param  : k4a_image_t& __depth_image -- DEPTH16 image of a frame
+             * @return : k4a_image_t -- filtered image, __depth_image or owned by __context
+             * */
+            k4a_image_t filter_depth_image(FrameContext &__context, k4a_image_t &__depth_image);
+
+            /*
+             * Unproject a depth image to a point cloud image with config_.engine,
+             * and compare with k4a if config_.verify_engine.
+             * @param  : FrameContext& __context -- transformation and image owner
+             * @param  : k4a_image_t& __depth_image -- DEPTH16 image in the pixel grid of __camera
+             * @param  : k4a_calibration_type_t __camera -- camera of __depth_image
+             * @param  : k4a_image_t& __point_cloud_image -- output point cloud image of the same size
+             * @return : void
+             * */
+            void unproject_depth_image(FrameContext &__context, k4a_image_t &__depth_image,
+                                       k4a_calibration_type_t __camera, k4a_image_t &__point_cloud_image);
+
             /*
-             * Get a point cloud image from a color image and a depth image.
+             * Get a point cloud image from a color image and a depth image, in the
+             * pixel grid selected by config_.geometry.
+             * @param  : FrameContext& __context -- transformation and image owner
              * @param  : k4a_image_t& __color_image -- color information
              * @param  : k4a_image_t& __depth_image -- depth information
-             * @return : k4a_image_t -- result point cloud image
+             * @param  : k4a_image_t& __point_color_image -- output BGRA32 image aligned with result
+             * @param  : FrameTask& __task -- time of registration and unprojection
+             * @return : k4a_image_t -- result point cloud image, owned by __context
              * */
-            k4a_image_t get_point_cloud_image(k4a_image_t &__color_image,
-                                              k4a_image_t &__depth_image);
+            k4a_image_t get_point_cloud_image(FrameContext &__context,
+                                              k4a_image_t &__color_image,
+                                              k4a_image_t &__depth_image,
+                                              k4a_image_t &__point_color_image,
+                                              FrameTask &__task);
 
             /*
-             * Generate point cloud and add it to video_.
+             * Generate point cloud from a point cloud image and a color image.
+             * @param  : FrameContext& __context -- point buffer owner
              * @param  : k4a_image_t& __point_cloud_image -- point xyz coordinates
              * @param  : k4a_image_t& __color_image -- point color information
+             * @param  : FrameTask& __task -- output points, in the layout of config_.layout
+             * @return : void
+             * */
+            void generate_point_cloud(FrameContext &__context,
+                                      k4a_image_t &__point_cloud_image,
+                                      k4a_image_t &__color_image,
+                                      FrameTask &__task);
+
+            /*
+             * Per point work of extraction from config_ and the extrinsics.
+             * @param  : ----
+             * @return : ExtractOptions -- options of kinect::kernel::extract_points()
+             * */
+            kinect::kernel::ExtractOptions extract_options() const;
+
+            /*
+             * Generate the points of a frame in one pass, registration, unprojection,
+             * color lookup and culling are fused, see kinect::camera::Registration::extract_points().
+             * Color is still registered to the depth camera by k4a in DEPTH_GEOMETRY.
+             * @param  : FrameContext& __context -- transformation and point buffer owner
+             * @param  : k4a_image_t& __color_image -- decoded color image
+             * @param  : k4a_image_t& __depth_image -- depth image
+             * @param  : FrameTask& __task -- time of registration and extraction
+             * @return : size_t -- number of points, in tiles of the point buffer of __context
+             * */
+            size_t extract_fused(FrameContext &__context, k4a_image_t &__color_image, k4a_image_t &__depth_image,
+                                 FrameTask &__task);
+
+            /*
+             * Copy or filter the points in the point buffer of a context to a frame.
+             * @param  : FrameContext& __context -- point buffer owner
+             * @param  : size_t __count -- number of points in the point buffer
+             * @param  : FrameTask& __task -- output points, in the layout of config_.layout
+             * @return : void
+             * */
+            void filter_points(FrameContext &__context, size_t __count, FrameTask &__task);
+
+            /*
+             * Generate the points of a frame from its decoded color image and filtered
+             * depth image, fused or through the point cloud image.
+             * @param  : FrameContext& __context -- transformation and image owner
+             * @param  : k4a_image_t& __color_image -- decoded color image
+             * @param  : k4a_image_t& __depth_image -- depth image
+             * @param  : FrameTask& __task -- output points, in the layout of config_.layout
              * @return : void
              * */
-            void generate_point_cloud(k4a_image_t &__point_cloud_image,
-                                      k4a_image_t &__color_image);
+            void transform_frame(FrameContext &__context, k4a_image_t &__color_image, k4a_image_t &__depth_image,
+                                 FrameTask &__task);
+
+            /*
+             * Add the time since __begin to a step of a frame.
+             * @param  : FrameTask& __task -- frame
+             * @param  : TransformStep __step -- step
+             * @param  : uint64_t __begin -- kinect::stats::now_nsec() when the step starts
+             * @return : uint64_t -- now_nsec() when the step ends, the start of the next one
+             * */
+            static uint64_t end_step(FrameTask &__task, TransformStep __step, uint64_t __begin);
+
+            /*
+             * Add the transform steps of a frame to their stages of report_.
+             * @param  : kinect::stats::StageStats* const* __stages -- stage of each step
+             * @param  : const FrameTask& __task -- frame
+             * @return : void
+             * */
+            static void add_steps(kinect::stats::StageStats *const *__stages, const FrameTask &__task);
+
+            /*
+             * Move the points of a frame to video_.
+             * @param  : FrameTask& __task -- frame
+             * @return : void
+             * */
+            void add_frame(FrameTask &__task);
+
+            /*
+             * Decode, transform and generate the points of a fetched frame, then
+             * release its images.
+             * @param  : FrameContext& __context -- decoder and transformation of this thread
+             * @param  : FrameTask& __task -- frame
+             * @return : void
+             * */
+            void process_frame(FrameContext &__context, FrameTask &__task);
+
+            /*
+             * Release all k4a handles held by a frame.
+             * @param  : FrameTask& __task -- frame
+             * @return : void
+             * */
+            void release_frame(FrameTask &__task);
+
+            /*
+             * Create output dir if it does not exist.
+             * @param  : const std::string& __output_sequence_path -- output dir path
+             * @return : void
+             * */
+            void create_output_dir(const std::string &__output_sequence_path);
+
+            /*
+             * Create the writer of an output sequence in __format.
+             * @param  : const std::string& __output_sequence_path -- output dir path
+             * @param  : OutputFormat __format -- output format
+             * @return : std::shared_ptr<FrameSink> -- writer
+             * */
+            std::shared_ptr<kinect::type::FrameSink> create_sink(const std::string &__output_sequence_path,
+                                                                 kinect::type::OutputFormat __format);
 
         public:
             /*
@@ -100,12 +503,59 @@ namespace kinect {
             void set_name(const std::string &__sequence_name);
 
             /*
-             * Output point cloud sequence to gived path, named as (SEQUENCE_NAME)_(TIME_STAMP).ply
+             * Set pipeline parameters of convert().
+             * @param  : const ConvertConfig& __config -- parameters
+             * @return : void
+             * */
+            void set_config(const ConvertConfig &__config);
+
+            /*
+             * Transform generated points to a world coordinate system.
+             * @param  : const Extrinsics& __extrinsics -- camera to world transform
+             * @return : void
+             * */
+            void set_extrinsics(const kinect::type::Extrinsics &__extrinsics);
+
+            /*
+             * Convert all remaining frames using a multi-threaded pipeline, frames
+             * are added to the video in order. Log throughput and latency of each
+             * stage and of each transform step at the end.
+             * @param  : ----
+             * @return : void
+             * */
+            void convert();
+
+            /*
+             * Stream point cloud frames to gived path as soon as they are generated,
+             * at most __max_in_flight frames are kept in memory.
+             * @param  : const std::string& __output_sequence_path -- output dir path
+             * @param  : OutputFormat __format -- output format
+             * @param  : size_t __max_in_flight -- max frames waiting to be written
+             * @param  : std::function<void()> __frame_written -- called by the writer after each frame is freed, may be empty
+             * @return : void
+             * */
+            void open_stream(const std::string &__output_sequence_path, kinect::type::OutputFormat __format,
+                             size_t __max_in_flight, std::function<void()> __frame_written = nullptr);
+
+            /*
+             * Output point cloud sequence to gived path, named as (SEQUENCE_NAME)_(TIME_STAMP).ply,
+             * or (SEQUENCE_NAME)_(TIME_STAMP).kpq and (SEQUENCE_NAME).kpc in QUANTIZED_FORMAT,
+             * or (SEQUENCE_NAME).kvv in CONTAINER_FORMAT
              * @param  : const std::string& __output_sequence_path -- output dir path
-             * @param  : bool __binary -- output format, 0 is ascii, 1 is binary
+             * @param  : OutputFormat __format -- output format
+             * @return : void
+             * */
+            void output_point_cloud_sequence(const std::string &__output_sequence_path,
+                                             kinect::type::OutputFormat __format);
+
+            /*
+             * Write the stages, points per frame, output bytes and peak memory of
+             * convert() and of writing its frames as a JSON file, call it after
+             * output_point_cloud_sequence().
+             * @param  : const std::string& __report_path -- report file
              * @return : void
              * */
-            void output_point_cloud_sequence(const std::string &__output_sequence_path, bool __binary);
+            void write_report(const std::string &__report_path);
         };
     };  // namespace record
 };  // namespace kinect
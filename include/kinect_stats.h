@@ -0,0 +1,388 @@
+/*
+ * This is a header file of kinect::stats.
+ * Author : @ChenRP07
+ * Date : 2022-11-02
+ * */
+#ifndef KINECT_STATS_H
+#define KINECT_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace kinect {
+    /*
+    * Namespace of run time statistics in kinect.
+    * */
+    namespace stats {
+        /*
+        * Nanoseconds of the steady clock, from an unspecified origin.
+        * @param  : ----
+        * @return : uint64_t -- nsec
+        * */
+        inline uint64_t now_nsec() {
+            return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+
+        /*
+        * Quote and escape a string for a JSON file.
+        * @param  : const std::string& __text -- text
+        * @return : std::string -- JSON string
+        * */
+        std::string json_string(const std::string &__text);
+
+        /*
+        * Distribution of non-negative values, e.g. nsec or points per frame.
+        * Values below 8 have a bucket each, larger values share 8 buckets per
+        * power of 2, so a percentile is at most 12.5% above the exact value.
+        * Values are added by any number of threads without locks.
+        * */
+        class Histogram {
+        private:
+            // buckets per power of 2, 1 << sub_bits
+            static const int sub_bits = 3;
+            // enough for any uint64_t
+            static const size_t bucket_count = (64 - sub_bits + 1) << sub_bits;
+
+            // values of each bucket
+            std::atomic<uint64_t> buckets_[bucket_count];
+            // number, sum and largest of values
+            std::atomic<uint64_t> count_;
+            std::atomic<uint64_t> sum_;
+            std::atomic<uint64_t> max_;
+
+            /*
+             * Bucket of a value.
+             * @param  : uint64_t __value -- value
+             * @return : size_t -- bucket index
+             * */
+            static size_t bucket(uint64_t __value);
+
+            /*
+             * Largest value of a bucket.
+             * @param  : size_t __bucket -- bucket index
+             * @return : uint64_t -- value
+             * */
+            static uint64_t upper_bound(size_t __bucket);
+
+        public:
+            /*
+             * Constructor, no values.
+             * */
+            Histogram();
+
+            /*
+             * Default deconstructor.
+             * */
+            ~Histogram() = default;
+
+            Histogram(const Histogram &) = delete;
+
+            Histogram &operator=(const Histogram &) = delete;
+
+            /*
+             * Record one value.
+             * @param  : uint64_t __value -- value
+             * @return : void
+             * */
+            void add(uint64_t __value);
+
+            /*
+             * Number of values.
+             * @param  : ----
+             * @return : uint64_t -- count
+             * */
+            uint64_t count() const;
+
+            /*
+             * Sum of values.
+             * @param  : ----
+             * @return : uint64_t -- sum
+             * */
+            uint64_t sum() const;
+
+            /*
+             * Largest value, 0 if there is none.
+             * @param  : ----
+             * @return : uint64_t -- max
+             * */
+            uint64_t maximum() const;
+
+            /*
+             * Value not exceeded by a share of values, the largest value of its
+             * bucket but at most maximum(), 0 if there is no value.
+             * @param  : double __share -- in [0, 1], e.g. 0.99 for p99
+             * @return : uint64_t -- value
+             * */
+            uint64_t percentile(double __share) const;
+        };
+
+        /*
+        * Throughput and latency of one pipeline stage, shared by all workers of this stage.
+        * */
+        class StageStats {
+        private:
+            // stage name in the report
+            std::string name_;
+            // stage name of the spans of the timeline, see kinect::trace
+            const char *trace_name_;
+            // number of workers running this stage
+            size_t workers_;
+            // processed frames
+            std::atomic<uint64_t> frames_;
+            // sum of busy time of all workers, nsec
+            std::atomic<uint64_t> busy_nsec_;
+            // busy time of each frame, nsec
+            Histogram latency_;
+
+        public:
+            /*
+             * Constructor.
+             * @param  : const std::string& __name -- stage name
+             * @param  : size_t __workers -- number of workers
+             * */
+            StageStats(const std::string &__name, size_t __workers);
+
+            /*
+             * Default deconstructor.
+             * */
+            ~StageStats() = default;
+
+            /*
+             * Record one processed frame.
+             * @param  : uint64_t __busy_nsec -- time spent on this frame
+             * @return : void
+             * */
+            void add(uint64_t __busy_nsec);
+
+            /*
+             * Record one processed frame, and its span if tracing is enabled.
+             * @param  : uint64_t __frame -- frame index, or kinect::trace::no_frame
+             * @param  : uint64_t __begin_nsec -- now_nsec() when this frame starts
+             * @param  : uint64_t __end_nsec -- now_nsec() when this frame ends
+             * @return : void
+             * */
+            void add(uint64_t __frame, uint64_t __begin_nsec, uint64_t __end_nsec);
+
+            /*
+             * Log frames, busy time, throughput and latency percentiles of this stage.
+             * @param  : double __wall_sec -- wall time of the whole run
+             * @return : void
+             * */
+            void log(double __wall_sec) const;
+
+            /*
+             * Same as log, as a JSON object of the run report.
+             * @param  : double __wall_sec -- wall time of the whole run
+             * @return : std::string -- JSON object
+             * */
+            std::string json(double __wall_sec) const;
+
+            /*
+             * Stage name.
+             * @param  : ----
+             * @return : const std::string& -- name
+             * */
+            const std::string &name() const { return this->name_; }
+        };
+
+        /*
+        * Record a heap allocation, called by the operator new of kinect.cpp and
+        * by the allocator of k4a images, kinect-core alone does not replace
+        * operator new. Threads count on cache lines of their own.
+        * @param  : size_t __bytes -- allocated bytes
+        * @return : void
+        * */
+        void count_allocation(size_t __bytes);
+
+        /*
+        * Number of heap allocations recorded by count_allocation().
+        * @param  : ----
+        * @return : uint64_t -- count
+        * */
+        uint64_t allocation_count();
+
+        /*
+        * Sum of bytes recorded by count_allocation().
+        * @param  : ----
+        * @return : uint64_t -- bytes
+        * */
+        uint64_t allocation_bytes();
+
+        /*
+        * Record the bytes of frame memory, images, tables, scratch and points,
+        * read and written by one pass of point generation. Counts are computed
+        * from buffer sizes, data kept in cache inside a pass is not counted.
+        * @param  : size_t __read -- bytes read
+        * @param  : size_t __written -- bytes written
+        * @return : void
+        * */
+        void count_traffic(size_t __read, size_t __written);
+
+        /*
+        * Sum of bytes read recorded by count_traffic().
+        * @param  : ----
+        * @return : uint64_t -- bytes
+        * */
+        uint64_t traffic_read();
+
+        /*
+        * Sum of bytes written recorded by count_traffic().
+        * @param  : ----
+        * @return : uint64_t -- bytes
+        * */
+        uint64_t traffic_written();
+
+        /*
+        * Record bytes written to output files.
+        * @param  : size_t __bytes -- written bytes
+        * @return : void
+        * */
+        void count_output(size_t __bytes);
+
+        /*
+        * Sum of bytes recorded by count_output().
+        * @param  : ----
+        * @return : uint64_t -- bytes
+        * */
+        uint64_t output_bytes();
+
+        /*
+        * Peak resident memory of this process, the peak working set on Windows.
+        * @param  : ----
+        * @return : uint64_t -- bytes, 0 if unknown
+        * */
+        uint64_t peak_memory();
+
+        /*
+        * Stages and totals of one conversion run, logged and written as a JSON
+        * report at its end. Stages are added before their workers start, a stage
+        * may be kept by the code writing frames until the run ends.
+        * */
+        class RunReport {
+        private:
+            // sequence name
+            std::string name_;
+            // time the run starts
+            std::chrono::steady_clock::time_point start_;
+            // stages in pipeline order
+            std::vector<std::shared_ptr<StageStats>> stages_;
+            // points of each emitted frame
+            Histogram points_;
+            // counters when the run starts, the report holds their increase
+            uint64_t start_output_bytes_;
+            uint64_t start_traffic_read_;
+            uint64_t start_traffic_written_;
+
+        public:
+            /*
+             * Constructor, the run starts.
+             * @param  : const std::string& __name -- sequence name
+             * */
+            explicit RunReport(const std::string &__name);
+
+            /*
+             * Default deconstructor.
+             * */
+            ~RunReport() = default;
+
+            RunReport(const RunReport &) = delete;
+
+            RunReport &operator=(const RunReport &) = delete;
+
+            /*
+             * Add a stage at the end of the pipeline.
+             * @param  : const std::string& __name -- stage name
+             * @param  : size_t __workers -- number of workers
+             * @return : std::shared_ptr<StageStats> -- the stage
+             * */
+            std::shared_ptr<StageStats> add_stage(const std::string &__name, size_t __workers);
+
+            /*
+             * Stage added by add_stage().
+             * @param  : const std::string& __name -- stage name
+             * @return : std::shared_ptr<StageStats> -- the stage, nullptr if there is none
+             * */
+            std::shared_ptr<StageStats> stage(const std::string &__name) const;
+
+            /*
+             * Record one emitted frame.
+             * @param  : uint64_t __points -- points of this frame
+             * @return : void
+             * */
+            void add_frame(uint64_t __points);
+
+            /*
+             * Seconds since the run starts.
+             * @param  : ----
+             * @return : double -- wall time
+             * */
+            double wall_sec() const;
+
+            /*
+             * Log points per frame, output bytes and peak memory.
+             * @param  : ----
+             * @return : void
+             * */
+            void log() const;
+
+            /*
+             * Write the report, stages, points, output bytes, memory traffic and
+             * peak memory, as JSON to __path.
+             * @param  : const std::string& __path -- report file
+             * @return : void
+             * */
+            void write(const std::string &__path) const;
+        };
+
+        /*
+        * Measure the time from construction to stop() and add it to a StageStats.
+        * */
+        class StageTimer {
+        private:
+            StageStats &stats_;
+            uint64_t frame_;
+            uint64_t start_;
+            bool stopped_;
+
+        public:
+            /*
+             * Constructor, start timing.
+             * @param  : StageStats& __stats -- destination of the measured time
+             * @param  : uint64_t __frame -- frame index of the span, UINT64_MAX is no frame
+             * */
+            explicit StageTimer(StageStats &__stats, uint64_t __frame = UINT64_MAX)
+                    : stats_{__stats}, frame_{__frame}, start_{now_nsec()}, stopped_{false} {}
+
+            /*
+             * Deconstructor, stop timing if stop() is not called.
+             * */
+            ~StageTimer() { this->stop(); }
+
+            /*
+             * Stop timing without recording, e.g. nothing is processed.
+             * @param  : ----
+             * @return : void
+             * */
+            void cancel() { this->stopped_ = true; }
+
+            /*
+             * Stop timing and record one frame.
+             * @param  : ----
+             * @return : void
+             * */
+            void stop() {
+                if (!this->stopped_) {
+                    this->stopped_ = true;
+                    this->stats_.add(this->frame_, this->start_, now_nsec());
+                }
+            }
+        };
+    };  // namespace stats
+};  // namespace kinect
+
+#endif  // KINECT_STATS_H
@@ -0,0 +1,114 @@
+/*
+ * This is a header file of kinect::trace.
+ * Author : @ChenRP07
+ * Date : 2022-11-28
+ * */
+#ifndef KINECT_TRACE_H
+#define KINECT_TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "kinect_stats.h"
+
+namespace kinect {
+    /*
+    * Namespace of the timeline of a run in kinect. When tracing is enabled,
+    * every thread appends the spans of the frames and stages it works on to a
+    * buffer of its own without locks, and write() dumps all of them in Chrome
+    * Trace Event format, which chrome://tracing and Perfetto open. When it is
+    * disabled a span costs one relaxed load.
+    * */
+    namespace trace {
+        // frame of a span which belongs to no frame
+        static const uint64_t no_frame = UINT64_MAX;
+
+        // if spans are recorded, set by enable()
+        extern std::atomic<bool> enabled_;
+
+        /*
+        * If spans are recorded.
+        * @param  : ----
+        * @return : bool
+        * */
+        inline bool enabled() {
+            return enabled_.load(std::memory_order_relaxed);
+        }
+
+        /*
+        * Start recording spans, the timeline starts now.
+        * @param  : ----
+        * @return : void
+        * */
+        void enable();
+
+        /*
+        * A copy of __name which lives until the process exits, for span names
+        * which are not string literals. Takes a lock, call it once per name.
+        * @param  : const std::string& __name -- name
+        * @return : const char* -- interned name
+        * */
+        const char *intern(const std::string &__name);
+
+        /*
+        * Name the calling thread in the timeline, no effect if tracing is disabled.
+        * @param  : const std::string& __name -- thread name
+        * @return : void
+        * */
+        void set_thread_name(const std::string &__name);
+
+        /*
+        * Record a span of the calling thread, no effect if tracing is disabled.
+        * @param  : const char* __name -- stage name, a literal or from intern()
+        * @param  : uint64_t __frame -- frame index, or no_frame
+        * @param  : uint64_t __begin_nsec -- kinect::stats::now_nsec() at the beginning
+        * @param  : uint64_t __end_nsec -- kinect::stats::now_nsec() at the end
+        * @return : void
+        * */
+        void record(const char *__name, uint64_t __frame, uint64_t __begin_nsec, uint64_t __end_nsec);
+
+        /*
+        * Write the spans of all threads as Chrome Trace Event JSON, call it
+        * after the traced threads stop recording.
+        * @param  : const std::string& __path -- trace file
+        * @return : void
+        * */
+        void write(const std::string &__path);
+
+        /*
+        * Record a span from construction to destruction.
+        * */
+        class Span {
+        private:
+            const char *name_;
+            uint64_t frame_;
+            // 0 if tracing is disabled at construction
+            uint64_t begin_;
+
+        public:
+            /*
+             * Constructor, the span begins.
+             * @param  : const char* __name -- stage name, a literal or from intern()
+             * @param  : uint64_t __frame -- frame index, or no_frame
+             * */
+            explicit Span(const char *__name, uint64_t __frame = no_frame)
+                    : name_{__name}, frame_{__frame}, begin_{enabled() ? kinect::stats::now_nsec() : 0} {}
+
+            /*
+             * Deconstructor, the span ends.
+             * */
+            ~Span() {
+                if (this->begin_ != 0) {
+                    record(this->name_, this->frame_, this->begin_, kinect::stats::now_nsec());
+                }
+            }
+
+            Span(const Span &) = delete;
+
+            Span &operator=(const Span &) = delete;
+        };
+    };  // namespace trace
+};  // namespace kinect
+
+#endif  // KINECT_TRACE_H
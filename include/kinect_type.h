@@ -13,8 +13,15 @@
 #include <cstdint>
 #include <vector>
 #include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unistd.h>
 
+#include "kinect_queue.h"
+#include "kinect_stats.h"
+
 namespace kinect {
     namespace type {
         // Point attributes, x/y/z for 3D coordinates, r/g/b for colors
@@ -23,16 +30,83 @@ namespace kinect {
             uint8_t r, g, b;
         };
 
+        /*
+        * Structure of arrays storage of points, point i is (x[i], y[i], z[i]) with
+        * color (rgb[3i], rgb[3i + 1], rgb[3i + 2]). 15 bytes per point instead of
+        * the 16 bytes of a padded PointXYZRGB.
+        * */
+        struct PointCloudSoA {
+            std::vector<float> x, y, z;
+            // packed r/g/b
+            std::vector<uint8_t> rgb;
+
+            /*
+             * Number of points.
+             * @param  : ----
+             * @return : size_t -- size
+             * */
+            size_t size() const { return this->x.size(); }
+
+            /*
+             * Resize all arrays to __size points.
+             * @param  : size_t __size -- number of points
+             * @return : void
+             * */
+            void resize(size_t __size) {
+                this->x.resize(__size);
+                this->y.resize(__size);
+                this->z.resize(__size);
+                this->rgb.resize(__size * 3);
+            }
+        };
+
+        /*
+        * Rigid transform from a camera to a common world coordinate system,
+        * world = rotation * camera + translation, rotation row major, millimeters.
+        * */
+        struct Extrinsics {
+            float rotation[9] = {1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+            float translation[3] = {0.0f, 0.0f, 0.0f};
+        };
+
+        /*
+        * Axis aligned box, a point is inside if min <= p <= max on every axis, millimeters.
+        * */
+        struct Box {
+            float min[3] = {0.0f, 0.0f, 0.0f};
+            float max[3] = {0.0f, 0.0f, 0.0f};
+        };
+
+        // File format of an output sequence.
+        enum OutputFormat {
+            ASCII_PLY_FORMAT,
+            BINARY_PLY_FORMAT,
+            QUANTIZED_FORMAT,
+            CONTAINER_FORMAT
+        };
+
+        // Memory layout of points in a PointCloudFrame.
+        enum PointLayout {
+            AOS_LAYOUT,
+            SOA_LAYOUT
+        };
+
         /*
         * Point cloud frame of a volumetric video.
-        * It contains a set of PointXYZRGB type points and a relative usec timestamp.
+        * It contains a set of points and a relative usec timestamp. Points are
+        * stored as PointXYZRGB (AOS_LAYOUT) or as PointCloudSoA (SOA_LAYOUT),
+        * whichever the frame is constructed from, and are never copied.
         * */
         class PointCloudFrame {
         private:
-            // A static point cloud frame with format coordinates XYZ and colors RGB.
+            // A static point cloud frame with format coordinates XYZ and colors RGB, AOS_LAYOUT.
             std::vector<kinect::type::PointXYZRGB> cloud_;
+            // Same as cloud_, SOA_LAYOUT.
+            kinect::type::PointCloudSoA cloud_soa_;
+            // which one of cloud_ and cloud_soa_ holds the points
+            PointLayout layout_ = AOS_LAYOUT;
             // time stamp for this point cloud frame
-            uint64_t time_stamp_;
+            uint64_t time_stamp_ = 0;
 
             /*
              * Output cloud_ to a binary .ply format file.
@@ -60,12 +134,27 @@ namespace kinect {
              * */
             ~PointCloudFrame() = default;
 
+            PointCloudFrame(PointCloudFrame &&) = default;
+
+            PointCloudFrame &operator=(PointCloudFrame &&) = default;
+
+            PointCloudFrame(const PointCloudFrame &) = delete;
+
+            PointCloudFrame &operator=(const PointCloudFrame &) = delete;
+
             /*
-             * Constructor.
-             * @param  : std::vector<kinect::type::PointXYZRGB>& __point_cloud -- data
+             * Constructor, take the points of __point_cloud.
+             * @param  : std::vector<kinect::type::PointXYZRGB>&& __point_cloud -- data
+             * @param  : uint64_t __time -- usec timestamp
+             * */
+            PointCloudFrame(std::vector<kinect::type::PointXYZRGB> &&__point_cloud, uint64_t __time);
+
+            /*
+             * Constructor, take the points of __point_cloud.
+             * @param  : PointCloudSoA&& __point_cloud -- data
              * @param  : uint64_t __time -- usec timestamp
              * */
-            PointCloudFrame(std::vector<kinect::type::PointXYZRGB> &__point_cloud, uint64_t __time);
+            PointCloudFrame(kinect::type::PointCloudSoA &&__point_cloud, uint64_t __time);
 
             /*
              * Output cloud_ to  .ply format file.
@@ -74,6 +163,112 @@ namespace kinect {
              * @return : void
              * */
             void output(const std::string &__output_path, bool __binary);
+
+            /*
+             * Timestamp of this frame.
+             * @param  : ----
+             * @return : uint64_t -- usec timestamp
+             * */
+            uint64_t time_stamp() const { return this->time_stamp_; }
+
+            /*
+             * Memory layout of points.
+             * @param  : ----
+             * @return : PointLayout -- layout
+             * */
+            PointLayout layout() const { return this->layout_; }
+
+            /*
+             * Number of points.
+             * @param  : ----
+             * @return : size_t -- size
+             * */
+            size_t size() const { return this->layout_ == SOA_LAYOUT ? this->cloud_soa_.size() : this->cloud_.size(); }
+
+            /*
+             * Points of an AOS_LAYOUT frame.
+             * @param  : ----
+             * @return : const std::vector<PointXYZRGB>& -- points
+             * */
+            const std::vector<kinect::type::PointXYZRGB> &points() const { return this->cloud_; }
+
+            /*
+             * Points of a SOA_LAYOUT frame.
+             * @param  : ----
+             * @return : const PointCloudSoA& -- points
+             * */
+            const kinect::type::PointCloudSoA &points_soa() const { return this->cloud_soa_; }
+
+            /*
+             * Move the points out of this frame, so a later frame reuses their storage.
+             * @param  : std::vector<PointXYZRGB>& __points -- AOS_LAYOUT points, replaced
+             * @param  : PointCloudSoA& __points_soa -- SOA_LAYOUT points, replaced
+             * @return : void
+             * */
+            void release_points(std::vector<kinect::type::PointXYZRGB> &__points,
+                                kinect::type::PointCloudSoA &__points_soa);
+        };
+
+        /*
+        * Scratch of the calling thread for the bytes of one output file, it only
+        * grows, so writing frames of similar size does not allocate.
+        * @param  : size_t __bytes -- min size
+        * @return : char* -- buffer, valid until the next call on this thread
+        * */
+        char *write_buffer(size_t __bytes);
+
+        /*
+        * Destination of a streamed volumetric video, receives point cloud frames
+        * one by one in frame order.
+        * */
+        class FrameSink {
+        public:
+            /*
+             * Default deconstructor.
+             * */
+            virtual ~FrameSink() = default;
+
+            /*
+             * Write a point cloud frame, may be called by several threads at the
+             * same time with different frames.
+             * @param  : PointCloudFrame& __frame -- frame to be written
+             * @return : void
+             * */
+            virtual void write(PointCloudFrame &__frame) = 0;
+
+            /*
+             * Called once after the last frame.
+             * @param  : ----
+             * @return : void
+             * */
+            virtual void close() {}
+        };
+
+        /*
+        * Write each frame to (SEQUENCE_PATH)_(TIME_STAMP).ply.
+        * */
+        class PlyFrameSink : public FrameSink {
+        private:
+            // output path prefix, dir path and sequence name
+            std::string file_name_prev_;
+            // output format, 0 is ascii, 1 is binary
+            bool binary_;
+
+        public:
+            /*
+             * Constructor.
+             * @param  : const std::string& __output_path -- output dir path
+             * @param  : const std::string& __sequence_name -- name
+             * @param  : bool __binary -- 0 is ascii, 1 is binary
+             * */
+            PlyFrameSink(const std::string &__output_path, const std::string &__sequence_name, bool __binary);
+
+            /*
+             * Output __frame to .ply format file.
+             * @param  : PointCloudFrame& __frame -- frame to be written
+             * @return : void
+             * */
+            void write(PointCloudFrame &__frame) override;
         };
 
         /*
@@ -82,19 +277,63 @@ namespace kinect {
         * */
         class VolumetricVideo {
         private:
-            // All point cloud frames.
+            // All point cloud frames, empty in streaming mode.
             std::vector<PointCloudFrame> frames_;
             // Name of this video, using this to name the output file.
             std::string volumetric_video_name_;
+            // Number of frames added, including the streamed ones.
+            size_t frame_count_ = 0;
+            // Streaming mode, frames are passed to sink_ instead of frames_.
+            std::shared_ptr<FrameSink> sink_;
+            // Frames waiting for sink_, bounds the frames held in memory.
+            std::unique_ptr<BoundedQueue<PointCloudFrame>> stream_queue_;
+            // Thread draining stream_queue_ into sink_.
+            std::thread stream_writer_;
+            // Called by stream_writer_ after each frame is written and freed, may be empty.
+            std::function<void()> frame_written_;
+            // Guards the spare point storage below.
+            std::mutex spare_mutex_;
+            // Point storage of written frames, taken by reuse_points().
+            std::vector<std::vector<PointXYZRGB>> spare_points_;
+            std::vector<PointCloudSoA> spare_points_soa_;
+            // Most points of a written frame, storage is reused with 1/4 headroom over it.
+            size_t largest_frame_ = 0;
+            // Max spare storages kept, frames in flight need no more.
+            size_t spare_limit_ = 0;
+            // Time of each frame written to a sink, nullptr is not measured.
+            std::shared_ptr<kinect::stats::StageStats> write_stats_;
+
+            /*
+             * Add a frame to frames_, or pass it to the sink in streaming mode.
+             * @param  : PointCloudFrame&& __frame -- frame, moved
+             * @return : void
+             * */
+            void add_frame(PointCloudFrame &&__frame);
+
+            /*
+             * Timestamp of next frame.
+             * @param  : uint64_t __time_offset -- usec time offset of whole video
+             * @param  : int __fps -- fps of this video
+             * @return : uint64_t -- usec timestamp
+             * */
+            uint64_t next_time_stamp(uint64_t __time_offset, int __fps) const;
+
+            /*
+             * Record the time of a frame written to a sink in write_stats_ and the timeline.
+             * @param  : uint64_t __frame -- frame index in this video
+             * @param  : uint64_t __begin -- kinect::stats::now_nsec() when writing starts
+             * @return : void
+             * */
+            void count_write(uint64_t __frame, uint64_t __begin);
         public:
             /*
              * Default constructor.
              * */
             VolumetricVideo() = default;
             /*
-             * Default deconstructor.
+             * Deconstructor, finish streaming if it is opened.
              * */
-            ~VolumetricVideo() = default;
+            ~VolumetricVideo();
 
             /*
              * Set sequence name.
@@ -104,17 +343,50 @@ namespace kinect {
             void set_name(const std::string &__sequence_name);
 
             /*
-             * Add point cloud frame to frames_;
-             * @param  : std::vector<kinect::type::PointXYZRGB> &__point_cloud -- data
+             * Sequence name.
+             * @param  : ----
+             * @return : const std::string& -- name
+             * */
+            const std::string &name() const { return this->volumetric_video_name_; }
+
+            /*
+             * Add point cloud frame to frames_, or pass it to the sink in streaming mode.
+             * @param  : std::vector<kinect::type::PointXYZRGB>&& __point_cloud -- data, moved
              * @param  : uint64_t __time_offset -- usec time offset of whole video
              * @param  : int __fps -- fps of this video
              * @return : void
              * */
-            void add_point_cloud(std::vector<kinect::type::PointXYZRGB> &__point_cloud,
+            void add_point_cloud(std::vector<kinect::type::PointXYZRGB> &&__point_cloud,
                                  uint64_t __time_offset, int __fps);
 
             /*
-             * Output video to  .ply format file.
+             * Add point cloud frame to frames_, or pass it to the sink in streaming mode.
+             * @param  : PointCloudSoA&& __point_cloud -- data, moved
+             * @param  : uint64_t __time_offset -- usec time offset of whole video
+             * @param  : int __fps -- fps of this video
+             * @return : void
+             * */
+            void add_point_cloud(kinect::type::PointCloudSoA &&__point_cloud, uint64_t __time_offset, int __fps);
+
+            /*
+             * Add point cloud frame with a known timestamp.
+             * @param  : std::vector<kinect::type::PointXYZRGB>&& __point_cloud -- data, moved
+             * @param  : uint64_t __time_stamp -- usec timestamp
+             * @return : void
+             * */
+            void add_point_cloud(std::vector<kinect::type::PointXYZRGB> &&__point_cloud, uint64_t __time_stamp);
+
+            /*
+             * Add point cloud frame with a known timestamp.
+             * @param  : PointCloudSoA&& __point_cloud -- data, moved
+             * @param  : uint64_t __time_stamp -- usec timestamp
+             * @return : void
+             * */
+            void add_point_cloud(kinect::type::PointCloudSoA &&__point_cloud, uint64_t __time_stamp);
+
+            /*
+             * Output video to  .ply format file, frames are written in parallel,
+             * one per hardware thread.
              * @param  : const std::string& __output_path -- file path.
              * @param  : bool __binary -- 0 is ascii, 1 is binary
              * @return : void
@@ -122,11 +394,66 @@ namespace kinect {
             void output(const std::string &__output_path, bool __binary);
 
             /*
-             * Size of frames_;
+             * Output video to __sink, frames are written in parallel, then __sink is closed.
+             * @param  : FrameSink& __sink -- frame destination
+             * @return : void
+             * */
+            void output(FrameSink &__sink);
+
+            /*
+             * Measure the time of each frame written by output() or the stream.
+             * @param  : std::shared_ptr<StageStats> __stats -- destination, nullptr stops measuring
+             * @return : void
+             * */
+            void set_write_stats(std::shared_ptr<kinect::stats::StageStats> __stats);
+
+            /*
+             * Switch to streaming mode, every frame added later is written to
+             * __sink by a writer thread and then freed.
+             * @param  : std::shared_ptr<FrameSink> __sink -- frame destination
+             * @param  : size_t __max_in_flight -- max frames waiting for __sink
+             * @param  : std::function<void()> __frame_written -- called by the writer after each frame is freed, may be empty
+             * @return : void
+             * */
+            void open_stream(std::shared_ptr<FrameSink> __sink, size_t __max_in_flight,
+                             std::function<void()> __frame_written = nullptr);
+
+            /*
+             * Wait until all streamed frames are written, then close the sink.
+             * @param  : ----
+             * @return : void
+             * */
+            void close_stream();
+
+            /*
+             * Give __points the storage of a frame already written by the stream,
+             * so the points of a frame do not allocate in streaming mode.
+             * No effect if there is none.
+             * @param  : std::vector<PointXYZRGB>& __points -- empty points of a new frame
+             * @return : void
+             * */
+            void reuse_points(std::vector<PointXYZRGB> &__points);
+
+            /*
+             * Same as reuse_points, structure of arrays.
+             * @param  : PointCloudSoA& __points -- empty points of a new frame
+             * @return : void
+             * */
+            void reuse_points(PointCloudSoA &__points);
+
+            /*
+             * If this video is in streaming mode.
+             * @param  : ----
+             * @return : bool
+             * */
+            bool streaming() const { return this->sink_ != nullptr; }
+
+            /*
+             * Number of frames added.
              * @param  : ----
              * @return : size_t -- size
              * */
-            const size_t size() const { return this->frames_.size(); }
+            const size_t size() const { return this->frame_count_; }
         protected:
         };
     };  // namespace type
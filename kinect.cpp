@@ -1,8 +1,120 @@
 #include "kinect_log.h"
 #include "kinect_record.h"
+#include "kinect_batch.h"
+#include "kinect_fusion.h"
+#include "kinect_trace.h"
+
+#include <cstdlib>
+#include <new>
+
+/*
+ * Replaceable global operator new and delete of kinect.exe, every heap
+ * allocation of the converter made through them is counted in
+ * kinect::stats::allocation_count(), containers and strings included. They
+ * live here and not in kinect-core, so programs linking the library keep
+ * their own allocator. Over-aligned allocations keep the library versions,
+ * kinect makes none.
+ * */
+static void *allocate(std::size_t __size) {
+    kinect::stats::count_allocation(__size);
+    if (__size == 0) {
+        __size = 1;
+    }
+    for (;;) {
+        void *pointer = std::malloc(__size);
+        if (pointer != nullptr) {
+            return pointer;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+static void *allocate(std::size_t __size, const std::nothrow_t &) noexcept {
+    try {
+        return allocate(__size);
+    }
+    catch (...) {
+        return nullptr;
+    }
+}
+
+void *operator new(std::size_t __size) {
+    return allocate(__size);
+}
+
+void *operator new[](std::size_t __size) {
+    return allocate(__size);
+}
+
+void *operator new(std::size_t __size, const std::nothrow_t &__tag) noexcept {
+    return allocate(__size, __tag);
+}
+
+void *operator new[](std::size_t __size, const std::nothrow_t &__tag) noexcept {
+    return allocate(__size, __tag);
+}
+
+void operator delete(void *__pointer) noexcept {
+    std::free(__pointer);
+}
+
+void operator delete[](void *__pointer) noexcept {
+    std::free(__pointer);
+}
+
+void operator delete(void *__pointer, std::size_t) noexcept {
+    std::free(__pointer);
+}
+
+void operator delete[](void *__pointer, std::size_t) noexcept {
+    std::free(__pointer);
+}
+
+void operator delete(void *__pointer, const std::nothrow_t &) noexcept {
+    std::free(__pointer);
+}
+
+void operator delete[](void *__pointer, const std::nothrow_t &) noexcept {
+    std::free(__pointer);
+}
+
+/*
+ * Parse a non-negative number of seconds, such as "12.5", to usec.
+ * */
+static uint64_t seconds_to_usec(const std::string &__value) {
+    double seconds = std::stod(__value);
+    if (!(seconds >= 0.0)) {
+        throw __error__(APP_PARAMETER_FAULT);
+    }
+    return static_cast<uint64_t>(seconds * 1e6 + 0.5);
+}
+
+/*
+ * Parse a crop box "X0,Y0,Z0,X1,Y1,Z1" in millimeters.
+ * */
+static kinect::type::Box parse_box(const std::string &__value) {
+    kinect::type::Box box;
+    float *bounds[6] = {&box.min[0], &box.min[1], &box.min[2], &box.max[0], &box.max[1], &box.max[2]};
+    size_t begin = 0;
+    for (int i = 0; i < 6; ++i) {
+        size_t end = __value.find(',', begin);
+        if ((end == std::string::npos) != (i == 5)) {
+            throw __error__(APP_PARAMETER_FAULT);
+        }
+        *bounds[i] = std::stof(__value.substr(begin, end - begin));
+        begin = end + 1;
+    }
+    return box;
+}
 
 int main(int argc, char *argv[]) {
     try {
+        // before any k4a image exists
+        kinect::record::count_image_allocations();
         if (argc < 2) {
             throw __error__(APP_PARAMETER_FAULT);
         }
@@ -12,31 +124,309 @@ int main(int argc, char *argv[]) {
                 std::cout << "Giving a mkv kinect video, this application will generate point cloud frames."
                           << std::endl;
                 std::cout << "Parameters should be given as followed : " << std::endl;
-                std::cout << "kinect.exe -t|-b MKV_VIDEO_PATH OUTPUT_DIR_PATH SEQUENCE_NAME" << std::endl;
+                std::cout << "kinect.exe -t|-b|-q|-c MKV_VIDEO_PATH OUTPUT_DIR_PATH SEQUENCE_NAME [OPTIONS]" << std::endl;
+                std::cout << "kinect.exe -t|-b|-q|-c --batch MANIFEST|MKV_DIR_PATH OUTPUT_DIR_PATH [OPTIONS]" << std::endl;
+                std::cout << "kinect.exe -t|-b|-q|-c --fuse RIG_FILE OUTPUT_DIR_PATH [OPTIONS]" << std::endl;
+                std::cout << "Options : " << std::endl;
+                std::cout << "    --stream N              write each frame as soon as it is generated, keep at most N"
+                          << " frames in memory" << std::endl;
+                std::cout << "    --decode-threads N      threads decoding MJPEG color images, default 2" << std::endl;
+                std::cout << "    --transform-threads N   threads generating point clouds, default 2" << std::endl;
+                std::cout << "    --queue N               frames queued in front of each pipeline stage, default 4"
+                          << std::endl;
+                std::cout << "    --in-flight N           frames processed at the same time, default 8" << std::endl;
+                std::cout << "    --geometry color|depth  generate one point per color pixel in color camera space,"
+                          << " or one point per depth pixel in depth camera space, default color" << std::endl;
+                std::cout << "    --engine k4a|native|fused|verify  unproject and register depth with k4a or natively,"
+                          << " fused generates points in one pass without intermediate images, verify checks"
+                          << " native against k4a on every frame, default k4a" << std::endl;
+                std::cout << "    --color-scale 1|2|4|8   decode color images at 1/N resolution, default 1" << std::endl;
+                std::cout << "    --start SEC             convert from SEC seconds after the beginning of the recording,"
+                          << " default 0" << std::endl;
+                std::cout << "    --end SEC               stop converting at SEC seconds after the beginning of the"
+                          << " recording, default the end of the recording" << std::endl;
+                std::cout << "    --stride N              convert one capture in every N frame periods, default 1" << std::endl;
+                std::cout << "    --shards N              split the recording into N time segments converted by"
+                          << " independent playback handles, default 1" << std::endl;
+                std::cout << "    --layout aos|soa        keep points as xyzrgb structs or as separate x/y/z/rgb arrays,"
+                          << " default aos" << std::endl;
+                std::cout << "    --outlier-radius MM     drop points with less than --outlier-neighbours other points"
+                          << " within MM, default off" << std::endl;
+                std::cout << "    --outlier-neighbours N  least number of neighbours of a kept point, default 4"
+                          << std::endl;
+                std::cout << "    --voxel MM              replace the points of each MM sized voxel by their centroid and"
+                          << " average color, default off" << std::endl;
+                std::cout << "    --filter-threads N      threads helping to filter each frame, default 2" << std::endl;
+                std::cout << "    --near MM               drop points closer than MM along the optical axis, default 0"
+                          << std::endl;
+                std::cout << "    --far MM                drop points farther than MM along the optical axis, default"
+                          << " no limit" << std::endl;
+                std::cout << "    --crop X0,Y0,Z0,X1,Y1,Z1 keep only points inside this box in millimeters, default off"
+                          << std::endl;
+                std::cout << "    --crop-space world|camera  --crop box in world coordinates of a rig camera, or in"
+                          << " camera coordinates, default world" << std::endl;
+                std::cout << "    --flying-pixels RATIO   drop pixels whose depth jumps by more than RATIO * depth to"
+                          << " both neighbours on an axis, 0 keeps them, default 0.04" << std::endl;
+                std::cout << "    --temporal ALPHA        stabilize depth with a per pixel running average, ALPHA is the"
+                          << " weight of a new frame, default 0, off" << std::endl;
+                std::cout << "    --temporal-motion RATIO restart the average of a pixel whose depth moves by more than"
+                          << " RATIO * depth, default 0.02" << std::endl;
+                std::cout << "    --temporal-hold MM      keep the depth of a pixel until its average moves by more than"
+                          << " MM, default 2" << std::endl;
+                std::cout << "    --background N          learn the static background from the first N frames of the"
+                          << " recording and drop it from every frame, default off" << std::endl;
+                std::cout << "    --background-mkv PATH   learn the background from an empty scene recording of the"
+                          << " same camera instead, with --background N" << std::endl;
+                std::cout << "    --background-tolerance MM  least distance of foreground from the background,"
+                          << " default 25" << std::endl;
+                std::cout << "    --report PATH           write stage latency percentiles, points per frame, output"
+                          << " bytes and peak memory of the run as JSON to PATH, single recordings only" << std::endl;
+                std::cout << "    --trace PATH            record a span per frame and stage on every thread and write"
+                          << " them as Chrome Trace Event JSON to PATH, for Perfetto, default off" << std::endl;
+                std::cout << "Batch options : " << std::endl;
+                std::cout << "    --threads N             worker threads shared by all recordings, default one per"
+                          << " hardware thread" << std::endl;
+                std::cout << "    --open N                recordings converted at the same time, default --threads"
+                          << std::endl;
+                std::cout << "    --memory-budget MB      memory of frames in flight of all recordings, default 2048"
+                          << std::endl;
             }
             else {
                 throw __error__(APP_PARAMETER_FAULT);
             }
         }
-        else if (argc == 5) {
+        else if (argc >= 5) {
             std::string format(argv[1]), mkv_path(argv[2]), output_dir(argv[3]), seq_name(argv[4]);
-            bool binary;
+            kinect::type::OutputFormat output_format;
             if (format == "-t") {
-                binary = false;
+                output_format = kinect::type::ASCII_PLY_FORMAT;
             }
             else if (format == "-b") {
-                binary = true;
+                output_format = kinect::type::BINARY_PLY_FORMAT;
+            }
+            else if (format == "-q") {
+                output_format = kinect::type::QUANTIZED_FORMAT;
             }
+            else if (format == "-c") {
+                output_format = kinect::type::CONTAINER_FORMAT;
+            }
+            else {
+                throw __error__(APP_PARAMETER_FAULT);
+            }
+
+            // optional parameters
+            size_t stream_frames = 0;
+            std::string report_path;
+            std::string trace_path;
+            kinect::record::ConvertConfig config;
+            kinect::record::BatchConfig batch_config;
+            for (int i = 5; i < argc; i += 2) {
+                std::string option(argv[i]);
+                if (i + 1 >= argc) {
+                    throw __error__(APP_PARAMETER_FAULT);
+                }
+                std::string value(argv[i + 1]);
+                if (option == "--stream") {
+                    stream_frames = std::stoul(value);
+                    if (stream_frames == 0) {
+                        throw __error__(APP_PARAMETER_FAULT);
+                    }
+                }
+                else if (option == "--report") {
+                    report_path = value;
+                }
+                else if (option == "--trace") {
+                    trace_path = value;
+                }
+                else if (option == "--decode-threads") {
+                    config.decode_workers = std::stoul(value);
+                }
+                else if (option == "--transform-threads") {
+                    config.transform_workers = std::stoul(value);
+                }
+                else if (option == "--queue") {
+                    config.queue_depth = std::stoul(value);
+                }
+                else if (option == "--in-flight") {
+                    config.max_in_flight = std::stoul(value);
+                }
+                else if (option == "--geometry") {
+                    if (value == "color") {
+                        config.geometry = kinect::record::COLOR_GEOMETRY;
+                    }
+                    else if (value == "depth") {
+                        config.geometry = kinect::record::DEPTH_GEOMETRY;
+                    }
+                    else {
+                        throw __error__(APP_PARAMETER_FAULT);
+                    }
+                }
+                else if (option == "--color-scale") {
+                    config.color_scale = std::stoi(value);
+                }
+                else if (option == "--start") {
+                    config.start_usec = seconds_to_usec(value);
+                }
+                else if (option == "--end") {
+                    config.end_usec = seconds_to_usec(value);
+                }
+                else if (option == "--stride") {
+                    config.stride = std::stoul(value);
+                }
+                else if (option == "--shards") {
+                    config.shards = std::stoul(value);
+                }
+                else if (option == "--threads") {
+                    batch_config.threads = std::stoul(value);
+                }
+                else if (option == "--open") {
+                    batch_config.open_recordings = std::stoul(value);
+                }
+                else if (option == "--memory-budget") {
+                    batch_config.memory_budget = static_cast<uint64_t>(std::stoul(value)) << 20;
+                    if (batch_config.memory_budget == 0) {
+                        throw __error__(APP_PARAMETER_FAULT);
+                    }
+                }
+                else if (option == "--outlier-radius") {
+                    config.outlier_radius = std::stof(value);
+                }
+                else if (option == "--outlier-neighbours") {
+                    config.outlier_neighbours = std::stoul(value);
+                }
+                else if (option == "--voxel") {
+                    config.voxel_size = std::stof(value);
+                }
+                else if (option == "--filter-threads") {
+                    config.filter_workers = std::stoul(value);
+                }
+                else if (option == "--near") {
+                    config.near_z = std::stoi(value);
+                }
+                else if (option == "--far") {
+                    config.far_z = std::stoi(value);
+                }
+                else if (option == "--crop") {
+                    config.crop = true;
+                    config.crop_box = parse_box(value);
+                }
+                else if (option == "--flying-pixels") {
+                    config.flying_pixel_ratio = std::stof(value);
+                }
+                else if (option == "--temporal") {
+                    config.temporal_alpha = std::stof(value);
+                }
+                else if (option == "--temporal-motion") {
+                    config.temporal_motion = std::stof(value);
+                }
+                else if (option == "--temporal-hold") {
+                    config.temporal_hold = std::stof(value);
+                }
+                else if (option == "--background") {
+                    config.background_frames = std::stoul(value);
+                }
+                else if (option == "--background-mkv") {
+                    config.background_path = value;
+                }
+                else if (option == "--background-tolerance") {
+                    config.background_tolerance = std::stoi(value);
+                }
+                else if (option == "--crop-space") {
+                    if (value == "world") {
+                        config.crop_camera = false;
+                    }
+                    else if (value == "camera") {
+                        config.crop_camera = true;
+                    }
+                    else {
+                        throw __error__(APP_PARAMETER_FAULT);
+                    }
+                }
+                else if (option == "--engine") {
+                    if (value == "k4a") {
+                        config.engine = kinect::record::K4A_ENGINE;
+                        config.verify_engine = false;
+                        config.fuse_points = false;
+                    }
+                    else if (value == "native" || value == "fused" || value == "verify") {
+                        config.engine = kinect::record::NATIVE_ENGINE;
+                        config.verify_engine = value == "verify";
+                        config.fuse_points = value == "fused";
+                    }
+                    else {
+                        throw __error__(APP_PARAMETER_FAULT);
+                    }
+                }
+                else if (option == "--layout") {
+                    if (value == "aos") {
+                        config.layout = kinect::type::AOS_LAYOUT;
+                    }
+                    else if (value == "soa") {
+                        config.layout = kinect::type::SOA_LAYOUT;
+                    }
+                    else {
+                        throw __error__(APP_PARAMETER_FAULT);
+                    }
+                }
+                else {
+                    throw __error__(APP_PARAMETER_FAULT);
+                }
+            }
+
+            if (!report_path.empty() && (mkv_path == "--batch" || mkv_path == "--fuse")) {
+                throw __error__(APP_PARAMETER_FAULT);
+            }
+            if (!trace_path.empty()) {
+                kinect::trace::enable();
+            }
+
+            if (mkv_path == "--batch") {
+                // kinect.exe FORMAT --batch SOURCE OUTPUT_DIR
+                kinect::record::BatchConverter batch(seq_name, output_format, config, batch_config);
+                batch.add_source(output_dir);
+                batch.convert();
+                if (!trace_path.empty()) {
+                    kinect::trace::write(trace_path);
+                }
+                return 0;
+            }
+
+            if (mkv_path == "--fuse") {
+                // kinect.exe FORMAT --fuse RIG_FILE OUTPUT_DIR, named after the rig file
+                std::string rig_name = output_dir.substr(output_dir.find_last_of("/\\") + 1);
+                rig_name = rig_name.substr(0, rig_name.find_last_of('.'));
+                kinect::record::MultiCameraFusion rig;
+                rig.load_rig(output_dir);
+                rig.set_name(rig_name);
+                rig.set_config(config);
+                rig.log_config();
+                if (stream_frames != 0) {
+                    rig.open_stream(seq_name, output_format, stream_frames);
+                }
+                rig.convert();
+                rig.output_point_cloud_sequence(seq_name, output_format);
+                if (!trace_path.empty()) {
+                    kinect::trace::write(trace_path);
+                }
+                return 0;
+            }
+
             kinect::record::KinectMkv2VolumetricVideo handle;
             handle.init_video(mkv_path);
             handle.set_name(seq_name);
+            handle.set_config(config);
             handle.log_config();
-            while (true) {
-                if (handle.get_point_cloud()) {
-                    break;
-                }
+            if (stream_frames != 0) {
+                handle.open_stream(output_dir, output_format, stream_frames);
+            }
+            handle.convert();
+            handle.output_point_cloud_sequence(output_dir, output_format);
+            if (!report_path.empty()) {
+                handle.write_report(report_path);
+            }
+            if (!trace_path.empty()) {
+                kinect::trace::write(trace_path);
             }
-            handle.output_point_cloud_sequence(output_dir, binary);
         }
         else {
             throw __error__(APP_PARAMETER_FAULT);
@@ -46,5 +436,10 @@ int main(int argc, char *argv[]) {
         error_log.log_error();
         return 0;
     }
+    catch (const std::logic_error &) {
+        // std::stoul on a non-numeric option value
+        __error__(APP_PARAMETER_FAULT).log_error();
+        return 0;
+    }
     return 0;
 }
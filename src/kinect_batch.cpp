@@ -0,0 +1,348 @@
+/*
+ * Source file of kinect::record::BatchConverter
+ * Author : @ChenRP07
+ * Date : 2022-11-20
+ * */
+#include "kinect_log.h"
+#include "kinect_batch.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <map>
+
+struct kinect::record::BatchConverter::Recording {
+    // mkv file path
+    std::string path;
+    // sequence name and output sub dir
+    std::string name;
+    // converter, alive while the recording is open
+    std::unique_ptr<kinect::record::KinectMkv2VolumetricVideo> video;
+    // bytes reserved by each frame
+    uint64_t frame_bytes = 0;
+    // time the recording is opened
+    std::chrono::steady_clock::time_point start;
+
+    // guards the playback handle, demux_done and demuxed
+    std::mutex demux_mutex;
+    // no more frames
+    bool demux_done = false;
+    // frames demuxed
+    uint64_t demuxed = 0;
+
+    // guards reorder, emitted, finished and report, taken after demux_mutex
+    std::mutex emit_mutex;
+    // converted frames waiting for the previous ones
+    std::map<uint64_t, std::unique_ptr<kinect::record::FrameTask>> reorder;
+    // frames passed to video
+    uint64_t emitted = 0;
+    // finish() is called
+    bool finished = false;
+    // result
+    kinect::record::BatchReport report;
+
+    // guards contexts and free_contexts
+    std::mutex context_mutex;
+    // decoder and transformation states, created when all others are in use
+    std::vector<std::unique_ptr<kinect::record::FrameContext>> contexts;
+    std::vector<kinect::record::FrameContext *> free_contexts;
+};
+
+/*
+ * File name of __path without directory and extension.
+ * */
+static std::string file_stem(const std::string &__path) {
+    size_t begin = __path.find_last_of("/\\");
+    begin = begin == std::string::npos ? 0 : begin + 1;
+    size_t end = __path.find_last_of('.');
+    if (end == std::string::npos || end < begin) {
+        end = __path.size();
+    }
+    return __path.substr(begin, end - begin);
+}
+
+static bool is_mkv(const std::string &__path) {
+    return __path.size() > 4 && __path.substr(__path.size() - 4) == ".mkv";
+}
+
+kinect::record::BatchConverter::BatchConverter(const std::string &__output_path,
+                                               kinect::type::OutputFormat __format,
+                                               const kinect::record::ConvertConfig &__config,
+                                               const kinect::record::BatchConfig &__batch_config)
+        : output_path_{__output_path}, format_{__format}, config_{__config}, batch_config_{__batch_config} {
+    // frames are already filtered by all workers of the pool
+    this->config_.filter_workers = 0;
+    if (this->output_path_.back() != '/') {
+        this->output_path_ += '/';
+    }
+}
+
+kinect::record::BatchConverter::~BatchConverter() = default;
+
+void kinect::record::BatchConverter::add_source(const std::string &__source) {
+    try {
+        std::vector<std::string> paths;
+        DIR *dir = opendir(__source.c_str());
+        if (dir != nullptr) {
+            std::string prefix = __source;
+            if (prefix.back() != '/') {
+                prefix += '/';
+            }
+            for (dirent *entry = readdir(dir); entry != nullptr; entry = readdir(dir)) {
+                std::string name(entry->d_name);
+                if (is_mkv(name)) {
+                    paths.push_back(prefix + name);
+                }
+            }
+            closedir(dir);
+            std::sort(paths.begin(), paths.end());
+        }
+        else if (is_mkv(__source)) {
+            paths.push_back(__source);
+        }
+        else {
+            std::ifstream manifest(__source.c_str());
+            if (!manifest.is_open()) {
+                throw __error__(FILE_OPEN_FAULT);
+            }
+            std::string line;
+            while (std::getline(manifest, line)) {
+                // trailing spaces and \r of windows line endings
+                line.erase(line.find_last_not_of(" \t\r") + 1);
+                if (!line.empty() && line[0] != '#') {
+                    paths.push_back(line);
+                }
+            }
+        }
+
+        for (auto &path: paths) {
+            std::unique_ptr<Recording> recording(new Recording);
+            recording->path = path;
+            recording->name = file_stem(path);
+            // same file name in different dirs
+            size_t copies = 0;
+            for (auto &other: this->recordings_) {
+                copies += file_stem(other->path) == recording->name;
+            }
+            if (copies != 0) {
+                recording->name += "_" + std::to_string(copies + 1);
+            }
+            recording->report.name = recording->name;
+            this->recordings_.emplace_back(std::move(recording));
+        }
+    }
+    catch (const kinect::log::except &error_log) {
+        error_log.log_error();
+        exit(1);
+    }
+}
+
+void kinect::record::BatchConverter::acquire_budget(uint64_t __bytes) {
+    std::unique_lock<std::mutex> lock(this->budget_mutex_);
+    this->budget_released_.wait(lock, [this, __bytes] {
+        return this->budget_used_ == 0 || this->budget_used_ + __bytes <= this->batch_config_.memory_budget;
+    });
+    this->budget_used_ += __bytes;
+}
+
+void kinect::record::BatchConverter::release_budget(uint64_t __bytes) {
+    {
+        std::lock_guard<std::mutex> lock(this->budget_mutex_);
+        this->budget_used_ -= __bytes;
+    }
+    this->budget_released_.notify_all();
+}
+
+void kinect::record::BatchConverter::open_next() {
+    size_t limit = this->batch_config_.open_recordings == 0 ? this->pool_->size()
+                                                            : this->batch_config_.open_recordings;
+    while (this->open_recordings_ < limit && this->next_recording_ < this->recordings_.size()) {
+        Recording *recording = this->recordings_[this->next_recording_++].get();
+        this->open_recordings_++;
+        this->pool_->submit([this, recording] { this->start(recording); });
+    }
+}
+
+void kinect::record::BatchConverter::start(Recording *__recording) {
+    __recording->start = std::chrono::steady_clock::now();
+    __recording->video.reset(new kinect::record::KinectMkv2VolumetricVideo);
+    kinect::record::KinectMkv2VolumetricVideo &video = *__recording->video;
+    video.init_video(__recording->path);
+    video.set_name(__recording->name);
+    video.set_config(this->config_);
+    // a frame keeps its budget until the writer has freed it, the budget bounds the
+    // frames waiting to be written, so emit never waits for the writer
+    video.open_stream(this->output_path_ + __recording->name, this->format_, SIZE_MAX,
+                      [this, __recording] { this->release_budget(__recording->frame_bytes); });
+    // a worker holds at most one decoded image of a recording
+    video.create_color_pool(this->pool_->size());
+
+    // points before compaction, decoded color image and compressed capture
+    const k4a_calibration_t &calibration = video.scaled_calibration_;
+    const k4a_calibration_camera_t &camera = this->config_.geometry == DEPTH_GEOMETRY
+                                             ? calibration.depth_camera_calibration
+                                             : calibration.color_camera_calibration;
+    uint64_t pixels = static_cast<uint64_t>(camera.resolution_width) * camera.resolution_height;
+    uint64_t depth_pixels = static_cast<uint64_t>(calibration.depth_camera_calibration.resolution_width) *
+                            calibration.depth_camera_calibration.resolution_height;
+    uint64_t color_pixels = static_cast<uint64_t>(video.calibration_.color_camera_calibration.resolution_width) *
+                            video.calibration_.color_camera_calibration.resolution_height;
+    __recording->frame_bytes = pixels * sizeof(kinect::type::PointXYZRGB) + depth_pixels * sizeof(uint16_t) +
+                               color_pixels;
+    this->step(__recording);
+}
+
+void kinect::record::BatchConverter::step(Recording *__recording) {
+    try {
+        kinect::record::KinectMkv2VolumetricVideo &video = *__recording->video;
+        this->acquire_budget(__recording->frame_bytes);
+
+        std::unique_ptr<kinect::record::FrameTask> task(new kinect::record::FrameTask);
+        bool end = true;
+        {
+            std::lock_guard<std::mutex> lock(__recording->demux_mutex);
+            if (!__recording->demux_done) {
+                end = video.fetch_frame(video.range_, *task);
+                __recording->demux_done = end;
+                task->index = end ? 0 : __recording->demuxed++;
+            }
+        }
+        if (end) {
+            this->release_budget(__recording->frame_bytes);
+            if (this->try_finish(__recording)) {
+                this->finish(__recording);
+            }
+            return;
+        }
+
+        // the next frame of this recording can be stolen while this one is converted
+        this->pool_->submit([this, __recording] { this->step(__recording); });
+
+        kinect::record::FrameContext *context = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(__recording->context_mutex);
+            if (__recording->free_contexts.empty()) {
+                __recording->contexts.emplace_back(new kinect::record::FrameContext(video.scaled_calibration_));
+                __recording->free_contexts.push_back(__recording->contexts.back().get());
+            }
+            context = __recording->free_contexts.back();
+            __recording->free_contexts.pop_back();
+        }
+        video.process_frame(*context, *task);
+        {
+            std::lock_guard<std::mutex> lock(__recording->context_mutex);
+            __recording->free_contexts.push_back(context);
+        }
+
+        // emit in demux order
+        {
+            std::lock_guard<std::mutex> lock(__recording->emit_mutex);
+            uint64_t index = task->index;
+            __recording->reorder[index] = std::move(task);
+            for (auto it = __recording->reorder.find(__recording->emitted); it != __recording->reorder.end();
+                 it = __recording->reorder.find(__recording->emitted)) {
+                kinect::record::FrameTask &ready = *it->second;
+                __recording->report.points += ready.point_cloud.size() + ready.point_cloud_soa.size();
+                video.add_frame(ready);
+                __recording->reorder.erase(it);
+                __recording->emitted++;
+            }
+        }
+        if (this->try_finish(__recording)) {
+            this->finish(__recording);
+        }
+    }
+    catch (const kinect::log::except &error_log) {
+        error_log.log_error();
+        exit(1);
+    }
+}
+
+bool kinect::record::BatchConverter::try_finish(Recording *__recording) {
+    std::lock_guard<std::mutex> demux_lock(__recording->demux_mutex);
+    std::lock_guard<std::mutex> emit_lock(__recording->emit_mutex);
+    if (!__recording->demux_done || __recording->emitted != __recording->demuxed || __recording->finished) {
+        return false;
+    }
+    __recording->finished = true;
+    return true;
+}
+
+void kinect::record::BatchConverter::finish(Recording *__recording) {
+    kinect::record::KinectMkv2VolumetricVideo &video = *__recording->video;
+    video.output_point_cloud_sequence(this->output_path_ + __recording->name, this->format_);
+    __recording->report.frames = __recording->emitted;
+    __recording->report.seconds =
+            std::chrono::duration<double>(std::chrono::steady_clock::now() - __recording->start).count();
+    __recording->contexts.clear();
+    __recording->free_contexts.clear();
+    __recording->video.reset();
+
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->open_recordings_--;
+    this->open_next();
+}
+
+void kinect::record::BatchConverter::report(double __wall_sec) {
+    uint64_t frames = 0, points = 0;
+    double busy_sec = 0.0;
+    __log_time__;
+    printf("\033[36mBatch end, throughput of each recording listed below.\n\033[0m");
+    for (auto &recording: this->recordings_) {
+        const kinect::record::BatchReport &report = recording->report;
+        printf("                       \033[36m%-24s : %6llu frames, %10llu points, %8.3fs, %7.2ffps\n\033[0m",
+               report.name.c_str(), static_cast<unsigned long long>(report.frames),
+               static_cast<unsigned long long>(report.points), report.seconds,
+               report.seconds <= 0.0 ? 0.0 : report.frames / report.seconds);
+        frames += report.frames;
+        points += report.points;
+        busy_sec += report.seconds;
+    }
+    printf("                       \033[36m%zu recordings, %llu frames in %.3fs, %.2ffps, %.2f recordings converted"
+           " at the same time on average\n\033[0m", this->recordings_.size(),
+           static_cast<unsigned long long>(frames), __wall_sec, __wall_sec <= 0.0 ? 0.0 : frames / __wall_sec,
+           __wall_sec <= 0.0 ? 0.0 : busy_sec / __wall_sec);
+
+    std::string file_name = this->output_path_ + "batch_report.csv";
+    std::ofstream outfile(file_name.c_str(), std::ios::out | std::ios::trunc);
+    if (!outfile.is_open()) {
+        throw __error__(FILE_OPEN_FAULT);
+    }
+    outfile << "recording,frames,points,seconds,fps\n";
+    for (auto &recording: this->recordings_) {
+        const kinect::record::BatchReport &report = recording->report;
+        outfile << report.name << "," << report.frames << "," << report.points << "," << report.seconds << ","
+                << (report.seconds <= 0.0 ? 0.0 : report.frames / report.seconds) << "\n";
+    }
+    outfile << "total," << frames << "," << points << "," << __wall_sec << ","
+            << (__wall_sec <= 0.0 ? 0.0 : frames / __wall_sec) << "\n";
+}
+
+void kinect::record::BatchConverter::convert() {
+    try {
+        if (this->recordings_.empty()) {
+            throw __error__(FILE_NOT_EXIST);
+        }
+        kinect::record::KinectMkv2VolumetricVideo().create_output_dir(this->output_path_);
+
+        this->pool_.reset(new kinect::type::WorkStealingPool(this->batch_config_.threads));
+        {
+            __log_time__;
+            printf("\033[36mConverting %zu recordings with %zu workers, %.1fMB memory budget.\n\033[0m",
+                   this->recordings_.size(), this->pool_->size(),
+                   static_cast<double>(this->batch_config_.memory_budget) / 1048576.0);
+        }
+        auto time_start = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            this->open_next();
+        }
+        this->pool_->wait();
+        this->pool_.reset();
+        double wall_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - time_start).count();
+        this->report(wall_sec);
+    }
+    catch (const kinect::log::except &error_log) {
+        error_log.log_error();
+        exit(1);
+    }
+}
@@ -0,0 +1,657 @@
+/*
+ * Source file of kinect::camera
+ * Author : @ChenRP07
+ * Date : 2022-11-26
+ * */
+#include "kinect_camera.h"
+#include "kinect_kernel.h"
+#include "kinect_log.h"
+#include "kinect_stats.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+    // depth image rows unprojected by one job
+    const int band_rows = 64;
+    // Newton iterations of unproject(), same as k4a
+    const int unproject_passes = 20;
+    // color image rows rasterized by one job
+    const int tile_rows = 32;
+    // depth pixel quads of a row whose color rows are kept together
+    const int segment_columns = 64;
+    // largest depth range of a triangle per depth, larger ones cross an edge
+    const float edge_ratio = 0.05f;
+
+    void run(kinect::type::ThreadPool *__pool, size_t __count, const std::function<void(size_t)> &__body) {
+        if (__pool != nullptr && __count > 1) {
+            __pool->parallel_for(__count, __body);
+            return;
+        }
+        for (size_t i = 0; i < __count; ++i) {
+            __body(i);
+        }
+    }
+
+    // lens models k4a can project, the others are deprecated and not supported by k4a either
+    void check_model(const k4a_calibration_camera_t &__camera) {
+        k4a_calibration_model_type_t model = __camera.intrinsics.type;
+        if (model != K4A_CALIBRATION_LENS_DISTORTION_MODEL_BROWN_CONRADY &&
+            model != K4A_CALIBRATION_LENS_DISTORTION_MODEL_RATIONAL_6KT) {
+            throw __error__(LENS_MODEL_FAULT);
+        }
+    }
+
+    // std::floor() and std::ceil() are library calls without SSE4.1, |__value| must fit an int
+    inline int floor_int(float __value) {
+        int value = static_cast<int>(__value);
+        return static_cast<float>(value) > __value ? value - 1 : value;
+    }
+
+    inline int ceil_int(float __value) {
+        int value = static_cast<int>(__value);
+        return static_cast<float>(value) < __value ? value + 1 : value;
+    }
+
+    // three projected depth pixels, the vertices of a triangle
+    struct Triangle {
+        float u[3], v[3], z[3];
+        // 0 if the triangle has no area
+        float inverse_area;
+
+        Triangle(const kinect::camera::RegistrationBuffer &__buffer, size_t __a, size_t __b, size_t __c)
+                : u{__buffer.u[__a], __buffer.u[__b], __buffer.u[__c]},
+                  v{__buffer.v[__a], __buffer.v[__b], __buffer.v[__c]},
+                  z{__buffer.z[__a], __buffer.z[__b], __buffer.z[__c]}, inverse_area{0.0f} {
+            float area = (u[1] - u[0]) * (v[2] - v[0]) - (u[2] - u[0]) * (v[1] - v[0]);
+            if (std::fabs(area) >= 1e-6f) {
+                inverse_area = 1.0f / area;
+            }
+        }
+
+        // interpolated depth at a pixel center inside the triangle, barycentric
+        // weights from edge functions, a small margin closes cracks on shared edges
+        bool depth(float __x, float __y, uint16_t &__depth) const {
+            float wa = ((u[1] - __x) * (v[2] - __y) - (u[2] - __x) * (v[1] - __y)) * inverse_area;
+            float wb = ((u[2] - __x) * (v[0] - __y) - (u[0] - __x) * (v[2] - __y)) * inverse_area;
+            float wc = 1.0f - wa - wb;
+            if (inverse_area == 0.0f || wa < -1e-4f || wb < -1e-4f || wc < -1e-4f) {
+                return false;
+            }
+            __depth = static_cast<uint16_t>(wa * z[0] + wb * z[1] + wc * z[2] + 0.5f);
+            return true;
+        }
+    };
+
+    // a triangle whose depth range is larger than edge_ratio of its depth crosses an edge
+    inline bool on_surface(float __z_min, float __z_max) {
+        return __z_min > 0.0f && __z_max - __z_min <= edge_ratio * __z_max;
+    }
+
+    /*
+     * Rasterize triangles at the pixel centers of a box of color rows
+     * [__row_begin, __row_end), keeps the nearest nonzero depth of a pixel.
+     * */
+    void draw(const Triangle *__triangles, int __count, float __u_min, float __u_max, float __v_min, float __v_max,
+              int __width, int __row_begin, int __row_end, uint16_t *__rows) {
+        int x_begin = std::max(0, ceil_int(__u_min)), x_end = std::min(__width - 1, floor_int(__u_max));
+        int y_begin = std::max(__row_begin, ceil_int(__v_min)), y_end = std::min(__row_end - 1, floor_int(__v_max));
+        for (int y = y_begin; y <= y_end; ++y) {
+            auto py = static_cast<float>(y);
+            uint16_t *row = __rows + static_cast<size_t>(y - __row_begin) * __width;
+            for (int x = x_begin; x <= x_end; ++x) {
+                auto px = static_cast<float>(x);
+                for (int i = 0; i < __count; ++i) {
+                    uint16_t depth;
+                    if (__triangles[i].depth(px, py, depth) && (row[x] == 0 || depth < row[x])) {
+                        row[x] = depth;
+                    }
+                }
+            }
+        }
+    }
+
+    /*
+     * Rasterize the quad of depth pixel __a, its right, lower and lower right
+     * neighbours as triangles (a, right, lower) and (right, lower right, lower),
+     * those crossing an edge or with a pixel without projection are dropped.
+     * A quad on one surface, almost all of them, is done in one pass.
+     * */
+    void draw_quad(const kinect::camera::RegistrationBuffer &__buffer, size_t __a, size_t __depth_width,
+                   int __width, int __row_begin, int __row_end, uint16_t *__rows) {
+        size_t b = __a + 1, c = __a + __depth_width, d = c + 1;
+        const float *u = __buffer.u.data(), *v = __buffer.v.data(), *z = __buffer.z.data();
+        float z_min = std::min(std::min(z[__a], z[b]), std::min(z[c], z[d]));
+        float z_max = std::max(std::max(z[__a], z[b]), std::max(z[c], z[d]));
+        if (on_surface(z_min, z_max)) {
+            Triangle triangles[2] = {Triangle(__buffer, __a, b, c), Triangle(__buffer, b, d, c)};
+            draw(triangles, 2, std::min(std::min(u[__a], u[b]), std::min(u[c], u[d])),
+                 std::max(std::max(u[__a], u[b]), std::max(u[c], u[d])),
+                 std::min(std::min(v[__a], v[b]), std::min(v[c], v[d])),
+                 std::max(std::max(v[__a], v[b]), std::max(v[c], v[d])), __width, __row_begin, __row_end, __rows);
+            return;
+        }
+        const size_t corners[2][3] = {{__a, b, c}, {b, d, c}};
+        for (const auto &corner : corners) {
+            float za = z[corner[0]], zb = z[corner[1]], zc = z[corner[2]];
+            if (!on_surface(std::min(za, std::min(zb, zc)), std::max(za, std::max(zb, zc)))) {
+                continue;
+            }
+            Triangle triangle(__buffer, corner[0], corner[1], corner[2]);
+            draw(&triangle, 1, std::min(triangle.u[0], std::min(triangle.u[1], triangle.u[2])),
+                 std::max(triangle.u[0], std::max(triangle.u[1], triangle.u[2])),
+                 std::min(triangle.v[0], std::min(triangle.v[1], triangle.v[2])),
+                 std::max(triangle.v[0], std::max(triangle.v[1], triangle.v[2])), __width, __row_begin, __row_end,
+                 __rows);
+        }
+    }
+    // points of one tile are written from output point __first
+    size_t extract_tile(const int16_t *__xyz, const uint8_t *__bgra, size_t __pixels,
+                        const kinect::kernel::ExtractOptions &__options, kinect::type::PointXYZRGB *__output,
+                        size_t __first) {
+        return kinect::kernel::extract_points(__xyz, __bgra, __pixels, __options, __output + __first);
+    }
+
+    size_t extract_tile(const int16_t *__xyz, const uint8_t *__bgra, size_t __pixels,
+                        const kinect::kernel::ExtractOptions &__options, kinect::type::PointCloudSoA &__output,
+                        size_t __first) {
+        return kinect::kernel::extract_points(__xyz, __bgra, __pixels, __options, __output, __first);
+    }
+
+    // __to < __from, so ranges are copied forward
+    void move_points(kinect::type::PointXYZRGB *__output, size_t __from, size_t __to, size_t __count) {
+        std::copy(__output + __from, __output + __from + __count, __output + __to);
+    }
+
+    void move_points(kinect::type::PointCloudSoA &__output, size_t __from, size_t __to, size_t __count) {
+        std::copy(__output.x.begin() + __from, __output.x.begin() + __from + __count, __output.x.begin() + __to);
+        std::copy(__output.y.begin() + __from, __output.y.begin() + __from + __count, __output.y.begin() + __to);
+        std::copy(__output.z.begin() + __from, __output.z.begin() + __from + __count, __output.z.begin() + __to);
+        std::copy(__output.rgb.begin() + __from * 3, __output.rgb.begin() + (__from + __count) * 3,
+                  __output.rgb.begin() + __to * 3);
+    }
+
+    // bytes of one point
+    size_t point_bytes(const kinect::type::PointXYZRGB *) { return sizeof(kinect::type::PointXYZRGB); }
+
+    size_t point_bytes(const kinect::type::PointCloudSoA &) { return sizeof(float) * 3 + 3; }
+
+    /*
+     * Run the tiles of a fused extraction, tile i has __tile_pixels pixels from
+     * i * __tile_pixels, writes its points there and returns their number.
+     * */
+    template<class Output>
+    size_t extract_tiles(size_t __tiles, size_t __tile_pixels, Output &__output,
+                         kinect::camera::RegistrationBuffer &__buffer, kinect::type::ThreadPool *__pool,
+                         const std::function<size_t(size_t)> &__tile) {
+        __buffer.counts.resize(__tiles);
+        __buffer.tile_pixels = __tile_pixels;
+        run(__pool, __tiles, [&](size_t __index) { __buffer.counts[__index] = __tile(__index); });
+        size_t count = 0;
+        for (size_t tile_count : __buffer.counts) {
+            count += tile_count;
+        }
+        kinect::stats::count_traffic(0, count * point_bytes(__output));
+        return count;
+    }
+
+    template<class Output>
+    size_t compact_tiles(const kinect::camera::RegistrationBuffer &__buffer, Output &__points) {
+        size_t count = 0, moved = 0;
+        for (size_t i = 0; i < __buffer.counts.size(); ++i) {
+            size_t first = i * __buffer.tile_pixels;
+            if (first != count && __buffer.counts[i] != 0) {
+                move_points(__points, first, count, __buffer.counts[i]);
+                moved += __buffer.counts[i];
+            }
+            count += __buffer.counts[i];
+        }
+        kinect::stats::count_traffic(moved * point_bytes(__points), moved * point_bytes(__points));
+        return count;
+    }
+
+    // fused unprojection and extraction of a depth image, bands of rows are tiles
+    template<class Output>
+    size_t extract_depth(const kinect::camera::RayTable &__rays, const uint16_t *__depth, const uint8_t *__bgra,
+                         const kinect::kernel::ExtractOptions &__options, Output &__output,
+                         kinect::camera::RegistrationBuffer &__buffer, kinect::type::ThreadPool *__pool) {
+        const size_t width = static_cast<size_t>(__rays.width());
+        const int height = __rays.height();
+        // depth, rays and colors are read once, points are written by extract_tiles()
+        size_t pixels = width * static_cast<size_t>(height);
+        kinect::stats::count_traffic(pixels * (sizeof(uint16_t) + sizeof(float) * 2 + 4), 0);
+        size_t bands = static_cast<size_t>((height + band_rows - 1) / band_rows);
+        return extract_tiles(bands, band_rows * width, __output, __buffer, __pool, [&](size_t __band) {
+            // points of one band, reused by the bands of this thread
+            thread_local std::vector<int16_t> points;
+            size_t begin = __band * band_rows * width;
+            size_t end = std::min(static_cast<size_t>(height), (__band + 1) * band_rows) * width;
+            if (points.size() < (end - begin) * 3) {
+                points.resize((end - begin) * 3);
+            }
+            kinect::kernel::unproject_depth(__depth + begin, __rays.x() + begin, __rays.y() + begin, points.data(), 0,
+                                            end - begin);
+            return extract_tile(points.data(), __bgra + begin * 4, end - begin, __options, __output, begin);
+        });
+    }
+}
+
+bool kinect::camera::project(const k4a_calibration_camera_t &__camera, const float *__xy, float *__uv,
+                             float *__jacobian) {
+    // a metric radius of 0 is no limit
+    float radius = __camera.metric_radius;
+    if (radius > 0.0f && __xy[0] * __xy[0] + __xy[1] * __xy[1] > radius * radius) {
+        __uv[0] = 0.0f;
+        __uv[1] = 0.0f;
+        return false;
+    }
+    const auto &p = __camera.intrinsics.parameters.param;
+    bool brown_conrady = __camera.intrinsics.type == K4A_CALIBRATION_LENS_DISTORTION_MODEL_BROWN_CONRADY;
+
+    // radial distortion around the center of distortion
+    float xp = __xy[0] - p.codx, yp = __xy[1] - p.cody;
+    float xp2 = xp * xp, yp2 = yp * yp, xyp = xp * yp;
+    float rs = xp2 + yp2, rss = rs * rs, rsc = rss * rs;
+    float a = 1.0f + p.k1 * rs + p.k2 * rss + p.k3 * rsc;
+    float b = 1.0f + p.k4 * rs + p.k5 * rss + p.k6 * rsc;
+    float bi = b != 0.0f ? 1.0f / b : 1.0f;
+    float d = a * bi;
+    float xp_d = xp * d, yp_d = yp * d;
+
+    // tangential distortion, Rational 6KT has no factor 2 on the cross terms
+    float rs_2xp2 = rs + 2.0f * xp2, rs_2yp2 = rs + 2.0f * yp2;
+    float cross = brown_conrady ? 2.0f : 1.0f;
+    xp_d += rs_2xp2 * p.p2 + cross * xyp * p.p1;
+    yp_d += rs_2yp2 * p.p1 + cross * xyp * p.p2;
+
+    __uv[0] = (xp_d + p.codx) * p.fx + p.cx;
+    __uv[1] = (yp_d + p.cody) * p.fy + p.cy;
+    if (__jacobian == nullptr) {
+        return true;
+    }
+
+    // d(a / b) / d(rs)
+    float dudrs = p.k1 + 2.0f * p.k2 * rs + 3.0f * p.k3 * rss;
+    float dvdrs = p.k4 + 2.0f * p.k5 * rs + 3.0f * p.k6 * rss;
+    float dddrs_2 = (dudrs * b - a * dvdrs) * bi * bi * 2.0f;
+    float xp_dddrs_2 = xp * dddrs_2, yp_xp_dddrs_2 = yp * xp_dddrs_2;
+    __jacobian[0] = p.fx * (d + xp * xp_dddrs_2 + 6.0f * xp * p.p2 + cross * yp * p.p1);
+    __jacobian[1] = p.fx * (yp_xp_dddrs_2 + 2.0f * yp * p.p2 + cross * xp * p.p1);
+    __jacobian[2] = p.fy * (yp_xp_dddrs_2 + 2.0f * xp * p.p1 + cross * yp * p.p2);
+    __jacobian[3] = p.fy * (d + yp * yp * dddrs_2 + 6.0f * yp * p.p1 + cross * xp * p.p2);
+    return true;
+}
+
+bool kinect::camera::unproject(const k4a_calibration_camera_t &__camera, const float *__uv, float *__xy) {
+    const auto &p = __camera.intrinsics.parameters.param;
+
+    // invert the radial distortion at the distorted radius, in double as k4a
+    double xp_d = (static_cast<double>(__uv[0]) - p.cx) / p.fx - p.codx;
+    double yp_d = (static_cast<double>(__uv[1]) - p.cy) / p.fy - p.cody;
+    double rs = xp_d * xp_d + yp_d * yp_d, rss = rs * rs, rsc = rss * rs;
+    double a = 1.0 + p.k1 * rs + p.k2 * rss + p.k3 * rsc;
+    double b = 1.0 + p.k4 * rs + p.k5 * rss + p.k6 * rsc;
+    double di = (a != 0.0 ? 1.0 / a : 1.0) * b;
+    float xy[2] = {static_cast<float>(xp_d * di), static_cast<float>(yp_d * di)};
+
+    // first order correction of the tangential distortion
+    float two_xy = 2.0f * xy[0] * xy[1], xx = xy[0] * xy[0], yy = xy[1] * xy[1];
+    xy[0] -= (yy + 3.0f * xx) * p.p2 + two_xy * p.p1;
+    xy[1] -= (xx + 3.0f * yy) * p.p1 + two_xy * p.p2;
+    xy[0] += p.codx;
+    xy[1] += p.cody;
+
+    // Newton iterations on the projection, keep the best guess
+    float best[2] = {0.0f, 0.0f}, best_error = FLT_MAX;
+    for (int pass = 0; pass < unproject_passes; ++pass) {
+        float uv[2], j[4];
+        if (!kinect::camera::project(__camera, xy, uv, j)) {
+            __xy[0] = xy[0];
+            __xy[1] = xy[1];
+            return false;
+        }
+        float error_u = __uv[0] - uv[0], error_v = __uv[1] - uv[1];
+        float error = error_u * error_u + error_v * error_v;
+        if (error >= best_error) {
+            xy[0] = best[0];
+            xy[1] = best[1];
+            break;
+        }
+        best_error = error;
+        best[0] = xy[0];
+        best[1] = xy[1];
+        if (pass + 1 == unproject_passes || best_error < 1e-22f) {
+            break;
+        }
+        float inverse_determinant = 1.0f / (j[0] * j[3] - j[1] * j[2]);
+        xy[0] += inverse_determinant * (j[3] * error_u - j[1] * error_v);
+        xy[1] += inverse_determinant * (j[0] * error_v - j[2] * error_u);
+    }
+    __xy[0] = xy[0];
+    __xy[1] = xy[1];
+    return best_error <= 1e-6f;
+}
+
+kinect::camera::RayTable::RayTable() : width_{0}, height_{0} {}
+
+kinect::camera::RayTable::~RayTable() = default;
+
+void kinect::camera::RayTable::build(const k4a_calibration_camera_t &__camera, kinect::type::ThreadPool *__pool) {
+    check_model(__camera);
+    this->width_ = __camera.resolution_width;
+    this->height_ = __camera.resolution_height;
+    size_t pixels = static_cast<size_t>(this->width_) * static_cast<size_t>(this->height_);
+    this->x_.assign(pixels, 0.0f);
+    this->y_.assign(pixels, 0.0f);
+    run(__pool, static_cast<size_t>(this->height_), [&](size_t __row) {
+        size_t index = __row * static_cast<size_t>(this->width_);
+        for (int x = 0; x < this->width_; ++x, ++index) {
+            float uv[2] = {static_cast<float>(x), static_cast<float>(__row)}, xy[2];
+            bool valid = kinect::camera::unproject(__camera, uv, xy);
+            this->x_[index] = valid ? xy[0] : std::nanf("");
+            this->y_[index] = valid ? xy[1] : std::nanf("");
+        }
+    });
+}
+
+kinect::camera::Registration::Registration() : color_{}, rotation_{}, translation_{} {}
+
+kinect::camera::Registration::~Registration() = default;
+
+void kinect::camera::Registration::build(const k4a_calibration_t &__calibration, kinect::type::ThreadPool *__pool) {
+    check_model(__calibration.color_camera_calibration);
+    this->color_ = __calibration.color_camera_calibration;
+    this->depth_rays_.build(__calibration.depth_camera_calibration, __pool);
+    const k4a_calibration_extrinsics_t &extrinsics =
+            __calibration.extrinsics[K4A_CALIBRATION_TYPE_DEPTH][K4A_CALIBRATION_TYPE_COLOR];
+    std::copy(extrinsics.rotation, extrinsics.rotation + 9, this->rotation_);
+    std::copy(extrinsics.translation, extrinsics.translation + 3, this->translation_);
+}
+
+void kinect::camera::Registration::project(const uint16_t *__depth, kinect::camera::RegistrationBuffer &__buffer,
+                                           kinect::type::ThreadPool *__pool) const {
+    const int width = this->depth_rays_.width(), height = this->depth_rays_.height();
+    const size_t pixels = static_cast<size_t>(width) * static_cast<size_t>(height);
+    const int segments = (width - 1 + segment_columns - 1) / segment_columns;
+    const size_t ranges = static_cast<size_t>(segments) * static_cast<size_t>(height);
+    if (__buffer.z.size() != pixels || __buffer.lower.size() != ranges) {
+        __buffer.u.resize(pixels);
+        __buffer.v.resize(pixels);
+        __buffer.z.resize(pixels);
+        __buffer.lower.resize(ranges);
+        __buffer.upper.resize(ranges);
+    }
+    // depth and rays are read, projections and row ranges written, then projections read by splat()
+    kinect::stats::count_traffic(pixels * (sizeof(uint16_t) + sizeof(float) * 5),
+                                 pixels * sizeof(float) * 3 + ranges * sizeof(float) * 2);
+    const float *rays_x = this->depth_rays_.x(), *rays_y = this->depth_rays_.y();
+    const float *r = this->rotation_, *t = this->translation_;
+    size_t bands = static_cast<size_t>((height + band_rows - 1) / band_rows);
+    run(__pool, bands, [&](size_t __band) {
+        int row_end = std::min(height, static_cast<int>((__band + 1) * band_rows));
+        for (int y = static_cast<int>(__band * band_rows); y < row_end; ++y) {
+            float *lower = &__buffer.lower[static_cast<size_t>(y) * segments];
+            float *upper = &__buffer.upper[static_cast<size_t>(y) * segments];
+            std::fill(lower, lower + segments, FLT_MAX);
+            std::fill(upper, upper + segments, -FLT_MAX);
+            size_t index = static_cast<size_t>(y) * width;
+            for (int x = 0; x < width; ++x, ++index) {
+                __buffer.z[index] = 0.0f;
+                float depth = __depth[index], ray_x = rays_x[index];
+                if (depth == 0.0f || ray_x != ray_x) {
+                    continue;
+                }
+                float px = ray_x * depth, py = rays_y[index] * depth, pz = depth;
+                float qx = r[0] * px + r[1] * py + r[2] * pz + t[0];
+                float qy = r[3] * px + r[4] * py + r[5] * pz + t[1];
+                float qz = r[6] * px + r[7] * py + r[8] * pz + t[2];
+                if (qz <= 0.0f) {
+                    continue;
+                }
+                float xy[2] = {qx / qz, qy / qz}, uv[2];
+                if (!kinect::camera::project(this->color_, xy, uv, nullptr)) {
+                    continue;
+                }
+                __buffer.u[index] = uv[0];
+                __buffer.v[index] = uv[1];
+                __buffer.z[index] = qz;
+
+                // quads of segment s use depth columns [s * segment_columns, (s + 1) * segment_columns]
+                int segment = std::min(x / segment_columns, segments - 1);
+                lower[segment] = std::min(lower[segment], uv[1]);
+                upper[segment] = std::max(upper[segment], uv[1]);
+                if (x % segment_columns == 0 && segment > 0 && x / segment_columns == segment) {
+                    lower[segment - 1] = std::min(lower[segment - 1], uv[1]);
+                    upper[segment - 1] = std::max(upper[segment - 1], uv[1]);
+                }
+            }
+        }
+    });
+}
+
+void kinect::camera::Registration::splat(const kinect::camera::RegistrationBuffer &__buffer, int __row_begin,
+                                         int __row_end, uint16_t *__rows) const {
+    const int width = this->depth_rays_.width(), height = this->depth_rays_.height();
+    const int color_width = this->color_.resolution_width;
+    const int segments = (width - 1 + segment_columns - 1) / segment_columns;
+    std::fill(__rows, __rows + static_cast<size_t>(__row_end - __row_begin) * color_width, 0);
+    const auto row_begin = static_cast<float>(__row_begin), row_last = static_cast<float>(__row_end - 1);
+    for (int y = 0; y + 1 < height; ++y) {
+        const float *lower = &__buffer.lower[static_cast<size_t>(y) * segments];
+        const float *upper = &__buffer.upper[static_cast<size_t>(y) * segments];
+        for (int s = 0; s < segments; ++s) {
+            // color rows reached by the quads of this segment
+            float v_lower = std::min(lower[s], lower[s + segments]);
+            float v_upper = std::max(upper[s], upper[s + segments]);
+            if (v_upper < row_begin - 1.0f || v_lower > row_last + 1.0f) {
+                continue;
+            }
+            int x_end = std::min(width - 1, (s + 1) * segment_columns);
+            for (int x = s * segment_columns; x < x_end; ++x) {
+                size_t index = static_cast<size_t>(y) * width + x;
+                draw_quad(__buffer, index, static_cast<size_t>(width), color_width, __row_begin, __row_end, __rows);
+            }
+        }
+    }
+}
+
+void kinect::camera::Registration::depth_to_color(const uint16_t *__depth, uint16_t *__output,
+                                                  kinect::camera::RegistrationBuffer &__buffer,
+                                                  kinect::type::ThreadPool *__pool) const {
+    this->project(__depth, __buffer, __pool);
+    const int color_width = this->color_.resolution_width, color_height = this->color_.resolution_height;
+    kinect::stats::count_traffic(0, static_cast<size_t>(color_width) * color_height * sizeof(uint16_t));
+    size_t tiles = static_cast<size_t>((color_height + tile_rows - 1) / tile_rows);
+    run(__pool, tiles, [&](size_t __tile) {
+        int row_begin = static_cast<int>(__tile * tile_rows);
+        int row_end = std::min(color_height, row_begin + tile_rows);
+        this->splat(__buffer, row_begin, row_end, __output + static_cast<size_t>(row_begin) * color_width);
+    });
+}
+
+void kinect::camera::Registration::splat_points(const kinect::camera::RegistrationBuffer &__buffer,
+                                                const kinect::camera::RayTable &__color_rays, int __row_begin,
+                                                int __row_end, int16_t *__points) const {
+    // z-buffer of one tile, reused by the tiles of this thread
+    thread_local std::vector<uint16_t> rows;
+    size_t offset = static_cast<size_t>(__row_begin) * __color_rays.width();
+    size_t count = static_cast<size_t>(__row_end - __row_begin) * __color_rays.width();
+    if (rows.size() < count) {
+        rows.resize(count);
+    }
+    this->splat(__buffer, __row_begin, __row_end, rows.data());
+    kinect::kernel::unproject_depth(rows.data(), __color_rays.x() + offset, __color_rays.y() + offset, __points, 0,
+                                    count);
+}
+
+void kinect::camera::Registration::depth_to_color_points(const uint16_t *__depth,
+                                                         const kinect::camera::RayTable &__color_rays,
+                                                         int16_t *__points,
+                                                         kinect::camera::RegistrationBuffer &__buffer,
+                                                         kinect::type::ThreadPool *__pool) const {
+    this->project(__depth, __buffer, __pool);
+    const int color_width = this->color_.resolution_width, color_height = this->color_.resolution_height;
+    size_t pixels = static_cast<size_t>(color_width) * color_height;
+    kinect::stats::count_traffic(pixels * sizeof(float) * 2, pixels * sizeof(int16_t) * 3);
+    size_t tiles = static_cast<size_t>((color_height + tile_rows - 1) / tile_rows);
+    run(__pool, tiles, [&](size_t __tile) {
+        int row_begin = static_cast<int>(__tile * tile_rows);
+        int row_end = std::min(color_height, row_begin + tile_rows);
+        this->splat_points(__buffer, __color_rays, row_begin, row_end,
+                           __points + static_cast<size_t>(row_begin) * color_width * 3);
+    });
+}
+
+template<class Output>
+size_t kinect::camera::Registration::extract(const uint16_t *__depth, const kinect::camera::RayTable &__color_rays,
+                                             const uint8_t *__bgra, const kinect::kernel::ExtractOptions &__options,
+                                             Output &__output, kinect::camera::RegistrationBuffer &__buffer,
+                                             kinect::type::ThreadPool *__pool) const {
+    this->project(__depth, __buffer, __pool);
+    const int color_width = this->color_.resolution_width, color_height = this->color_.resolution_height;
+    // rays and colors are read once, points are written by extract_tiles()
+    size_t pixels = static_cast<size_t>(color_width) * color_height;
+    kinect::stats::count_traffic(pixels * (sizeof(float) * 2 + 4), 0);
+    size_t tiles = static_cast<size_t>((color_height + tile_rows - 1) / tile_rows);
+    size_t tile_pixels = static_cast<size_t>(tile_rows) * color_width;
+    return extract_tiles(tiles, tile_pixels, __output, __buffer, __pool, [&](size_t __tile) {
+        // points of one tile, reused by the tiles of this thread
+        thread_local std::vector<int16_t> points;
+        int row_begin = static_cast<int>(__tile * tile_rows);
+        int row_end = std::min(color_height, row_begin + tile_rows);
+        size_t first = __tile * tile_pixels, count = static_cast<size_t>(row_end - row_begin) * color_width;
+        if (points.size() < count * 3) {
+            points.resize(count * 3);
+        }
+        this->splat_points(__buffer, __color_rays, row_begin, row_end, points.data());
+        return extract_tile(points.data(), __bgra + first * 4, count, __options, __output, first);
+    });
+}
+
+size_t kinect::camera::Registration::extract_points(const uint16_t *__depth,
+                                                    const kinect::camera::RayTable &__color_rays,
+                                                    const uint8_t *__bgra,
+                                                    const kinect::kernel::ExtractOptions &__options,
+                                                    kinect::type::PointXYZRGB *__output,
+                                                    kinect::camera::RegistrationBuffer &__buffer,
+                                                    kinect::type::ThreadPool *__pool) const {
+    return this->extract(__depth, __color_rays, __bgra, __options, __output, __buffer, __pool);
+}
+
+size_t kinect::camera::Registration::extract_points(const uint16_t *__depth,
+                                                    const kinect::camera::RayTable &__color_rays,
+                                                    const uint8_t *__bgra,
+                                                    const kinect::kernel::ExtractOptions &__options,
+                                                    kinect::type::PointCloudSoA &__output,
+                                                    kinect::camera::RegistrationBuffer &__buffer,
+                                                    kinect::type::ThreadPool *__pool) const {
+    return this->extract(__depth, __color_rays, __bgra, __options, __output, __buffer, __pool);
+}
+
+size_t kinect::camera::compact_points(const kinect::camera::RegistrationBuffer &__buffer,
+                                      kinect::type::PointXYZRGB *__points) {
+    return compact_tiles(__buffer, __points);
+}
+
+size_t kinect::camera::compact_points(const kinect::camera::RegistrationBuffer &__buffer,
+                                      kinect::type::PointCloudSoA &__points) {
+    return compact_tiles(__buffer, __points);
+}
+
+void kinect::camera::gather_points(const kinect::camera::RegistrationBuffer &__buffer,
+                                   const kinect::type::PointXYZRGB *__points,
+                                   std::vector<kinect::type::PointXYZRGB> &__output) {
+    size_t count = 0;
+    for (size_t tile_count : __buffer.counts) {
+        count += tile_count;
+    }
+    __output.clear();
+    __output.reserve(count);
+    for (size_t i = 0; i < __buffer.counts.size(); ++i) {
+        const kinect::type::PointXYZRGB *tile = __points + i * __buffer.tile_pixels;
+        __output.insert(__output.end(), tile, tile + __buffer.counts[i]);
+    }
+    kinect::stats::count_traffic(count * sizeof(kinect::type::PointXYZRGB), count * sizeof(kinect::type::PointXYZRGB));
+}
+
+void kinect::camera::gather_points(const kinect::camera::RegistrationBuffer &__buffer,
+                                   const kinect::type::PointCloudSoA &__points, kinect::type::PointCloudSoA &__output) {
+    size_t count = 0;
+    for (size_t tile_count : __buffer.counts) {
+        count += tile_count;
+    }
+    std::vector<float> *coordinates[3] = {&__output.x, &__output.y, &__output.z};
+    const std::vector<float> *tiles[3] = {&__points.x, &__points.y, &__points.z};
+    for (int axis = 0; axis < 3; ++axis) {
+        coordinates[axis]->clear();
+        coordinates[axis]->reserve(count);
+        for (size_t i = 0; i < __buffer.counts.size(); ++i) {
+            auto tile = tiles[axis]->begin() + i * __buffer.tile_pixels;
+            coordinates[axis]->insert(coordinates[axis]->end(), tile, tile + __buffer.counts[i]);
+        }
+    }
+    __output.rgb.clear();
+    __output.rgb.reserve(count * 3);
+    for (size_t i = 0; i < __buffer.counts.size(); ++i) {
+        auto tile = __points.rgb.begin() + i * __buffer.tile_pixels * 3;
+        __output.rgb.insert(__output.rgb.end(), tile, tile + __buffer.counts[i] * 3);
+    }
+    kinect::stats::count_traffic(count * (sizeof(float) * 3 + 3), count * (sizeof(float) * 3 + 3));
+}
+
+double kinect::camera::registration_mismatch(const uint16_t *__depth, const uint16_t *__reference,
+                                             size_t __pixels) {
+    size_t both = 0, mismatch = 0;
+    for (size_t i = 0; i < __pixels; ++i) {
+        if (__depth[i] == 0 || __reference[i] == 0) {
+            continue;
+        }
+        ++both;
+        int difference = std::abs(static_cast<int>(__depth[i]) - __reference[i]);
+        if (difference > 2 && difference * 50 > __reference[i]) {
+            ++mismatch;
+        }
+    }
+    return both == 0 ? 0.0 : static_cast<double>(mismatch) / static_cast<double>(both);
+}
+
+void kinect::camera::unproject_depth(const kinect::camera::RayTable &__rays, const uint16_t *__depth,
+                                     int16_t *__points, kinect::type::ThreadPool *__pool) {
+    const size_t width = static_cast<size_t>(__rays.width());
+    const int height = __rays.height();
+    size_t pixels = width * static_cast<size_t>(height);
+    kinect::stats::count_traffic(pixels * (sizeof(uint16_t) + sizeof(float) * 2), pixels * sizeof(int16_t) * 3);
+    size_t bands = static_cast<size_t>((height + band_rows - 1) / band_rows);
+    run(__pool, bands, [&](size_t __band) {
+        size_t begin = __band * band_rows * width;
+        size_t end = std::min(static_cast<size_t>(height), (__band + 1) * band_rows) * width;
+        kinect::kernel::unproject_depth(__depth, __rays.x(), __rays.y(), __points, begin, end);
+    });
+}
+
+
+size_t kinect::camera::extract_points(const kinect::camera::RayTable &__rays, const uint16_t *__depth,
+                                      const uint8_t *__bgra, const kinect::kernel::ExtractOptions &__options,
+                                      kinect::type::PointXYZRGB *__output,
+                                      kinect::camera::RegistrationBuffer &__buffer,
+                                      kinect::type::ThreadPool *__pool) {
+    return extract_depth(__rays, __depth, __bgra, __options, __output, __buffer, __pool);
+}
+
+size_t kinect::camera::extract_points(const kinect::camera::RayTable &__rays, const uint16_t *__depth,
+                                      const uint8_t *__bgra, const kinect::kernel::ExtractOptions &__options,
+                                      kinect::type::PointCloudSoA &__output,
+                                      kinect::camera::RegistrationBuffer &__buffer,
+                                      kinect::type::ThreadPool *__pool) {
+    return extract_depth(__rays, __depth, __bgra, __options, __output, __buffer, __pool);
+}
+
+int kinect::camera::max_difference(const int16_t *__points, const int16_t *__reference, size_t __pixels) {
+    int difference = 0;
+    for (size_t i = 0; i < __pixels * 3; ++i) {
+        difference = std::max(difference, std::abs(static_cast<int>(__points[i]) - __reference[i]));
+    }
+    return difference;
+}
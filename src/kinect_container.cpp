@@ -0,0 +1,245 @@
+/*
+ * Source file of kinect::type::ContainerFrameSink and ContainerReader
+ * Author : @ChenRP07
+ * Date : 2022-11-16
+ * */
+#include "kinect_log.h"
+#include "kinect_container.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+kinect::type::ContainerFrameSink::ContainerFrameSink(const std::string &__output_path,
+                                                      const std::string &__sequence_name,
+                                                      const std::vector<uint8_t> &__calibration,
+                                                      k4a_calibration_type_t __camera, int __color_scale)
+        : header_{}, file_size_{0} {
+    try {
+        if (__sequence_name.empty()) {
+            throw __error__(WRONG_FILE_NAME_FORMAT);
+        }
+        std::string file_name = __output_path;
+        if (file_name.back() != '/') {
+            file_name += '/';
+        }
+        file_name += __sequence_name + ".kvv";
+        this->outfile_.open(file_name.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+        if (!this->outfile_.is_open()) {
+            throw __error__(FILE_OPEN_FAULT);
+        }
+
+        std::memcpy(this->header_.magic, kinect::type::container_magic, sizeof(this->header_.magic));
+        this->header_.version = 1;
+        this->header_.point_size = kinect::type::quantized_point_size;
+        this->header_.camera = static_cast<uint32_t>(__camera);
+        this->header_.color_scale = static_cast<uint32_t>(__color_scale);
+        // frame_count stays 0 until close(), so an unfinished file is never read as complete
+        this->append(reinterpret_cast<const char *>(&this->header_), sizeof(this->header_), 1);
+        this->header_.calibration_offset = this->append(reinterpret_cast<const char *>(__calibration.data()),
+                                                        __calibration.size(), 1);
+        this->header_.calibration_size = __calibration.size();
+    }
+    catch (const kinect::log::except &error_log) {
+        error_log.log_error();
+        exit(1);
+    }
+}
+
+uint64_t kinect::type::ContainerFrameSink::append(const char *__data, size_t __size, uint64_t __alignment) {
+    static const char padding[kinect::type::container_alignment] = {};
+    uint64_t offset = (this->file_size_ + __alignment - 1) / __alignment * __alignment;
+    this->outfile_.write(padding, static_cast<std::streamsize>(offset - this->file_size_));
+    this->outfile_.write(__data, static_cast<std::streamsize>(__size));
+    if (!this->outfile_) {
+        throw __error__(FILE_WRITE_FAULT);
+    }
+    kinect::stats::count_output(offset - this->file_size_ + __size);
+    this->file_size_ = offset + __size;
+    return offset;
+}
+
+void kinect::type::ContainerFrameSink::write(kinect::type::PointCloudFrame &__frame) {
+    try {
+        size_t size = __frame.size() * kinect::type::quantized_point_size;
+        char *buffer = kinect::type::write_buffer(size);
+        kinect::type::quantize_frame(__frame, buffer);
+
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        uint64_t offset = this->append(buffer, size, kinect::type::container_alignment);
+        this->frames_.push_back({__frame.time_stamp(), offset, __frame.size()});
+    }
+    catch (const kinect::log::except &error_log) {
+        error_log.log_error();
+        exit(1);
+    }
+}
+
+void kinect::type::ContainerFrameSink::close() {
+    try {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        // parallel writers append frames in any order
+        std::sort(this->frames_.begin(), this->frames_.end(),
+                  [](const kinect::type::ContainerFrameEntry &a, const kinect::type::ContainerFrameEntry &b) {
+                      return a.time_stamp < b.time_stamp;
+                  });
+        this->header_.frame_count = static_cast<uint32_t>(this->frames_.size());
+        this->header_.index_offset = this->append(
+                reinterpret_cast<const char *>(this->frames_.data()),
+                this->frames_.size() * sizeof(kinect::type::ContainerFrameEntry),
+                alignof(kinect::type::ContainerFrameEntry));
+
+        this->outfile_.seekp(0);
+        this->outfile_.write(reinterpret_cast<const char *>(&this->header_), sizeof(this->header_));
+        this->outfile_.close();
+        if (!this->outfile_) {
+            throw __error__(FILE_WRITE_FAULT);
+        }
+    }
+    catch (const kinect::log::except &error_log) {
+        error_log.log_error();
+        exit(1);
+    }
+}
+
+kinect::type::ContainerReader::ContainerReader()
+        : data_{nullptr}, length_{0},
+#ifdef _WIN32
+          file_{nullptr}, mapping_{nullptr},
+#endif
+          header_{nullptr}, index_{nullptr} {}
+
+kinect::type::ContainerReader::~ContainerReader() {
+    this->close();
+}
+
+void kinect::type::ContainerReader::open(const std::string &__container_path) {
+    try {
+        this->close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(__container_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            throw __error__(FILE_OPEN_FAULT);
+        }
+        this->file_ = file;
+        LARGE_INTEGER length;
+        if (!GetFileSizeEx(file, &length)) {
+            throw __error__(FILE_OPEN_FAULT);
+        }
+        this->length_ = static_cast<size_t>(length.QuadPart);
+        if (this->length_ < sizeof(kinect::type::ContainerHeader)) {
+            throw __error__(WRONG_CONTAINER_FORMAT);
+        }
+        this->mapping_ = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (this->mapping_ == nullptr) {
+            throw __error__(FILE_MAP_FAULT);
+        }
+        this->data_ = static_cast<const uint8_t *>(MapViewOfFile(this->mapping_, FILE_MAP_READ, 0, 0, 0));
+        if (this->data_ == nullptr) {
+            throw __error__(FILE_MAP_FAULT);
+        }
+#else
+        int file = ::open(__container_path.c_str(), O_RDONLY);
+        if (file == -1) {
+            throw __error__(FILE_OPEN_FAULT);
+        }
+        struct stat status;
+        if (fstat(file, &status) == -1) {
+            ::close(file);
+            throw __error__(FILE_OPEN_FAULT);
+        }
+        this->length_ = static_cast<size_t>(status.st_size);
+        if (this->length_ < sizeof(kinect::type::ContainerHeader)) {
+            ::close(file);
+            throw __error__(WRONG_CONTAINER_FORMAT);
+        }
+        void *data = mmap(nullptr, this->length_, PROT_READ, MAP_SHARED, file, 0);
+        // the mapping keeps the file alive
+        ::close(file);
+        if (data == MAP_FAILED) {
+            throw __error__(FILE_MAP_FAULT);
+        }
+        this->data_ = static_cast<const uint8_t *>(data);
+#endif
+
+        const kinect::type::ContainerHeader *header =
+                reinterpret_cast<const kinect::type::ContainerHeader *>(this->data_);
+        if (std::memcmp(header->magic, kinect::type::container_magic, sizeof(header->magic)) != 0 ||
+            header->version != 1 || header->point_size != kinect::type::quantized_point_size ||
+            header->calibration_offset + header->calibration_size > this->length_ ||
+            header->index_offset % alignof(kinect::type::ContainerFrameEntry) != 0 ||
+            header->index_offset + header->frame_count * sizeof(kinect::type::ContainerFrameEntry) > this->length_) {
+            throw __error__(WRONG_CONTAINER_FORMAT);
+        }
+        this->header_ = header;
+        this->index_ = reinterpret_cast<const kinect::type::ContainerFrameEntry *>(this->data_ + header->index_offset);
+    }
+    catch (const kinect::log::except &error_log) {
+        error_log.log_error();
+        this->~ContainerReader();
+        exit(1);
+    }
+}
+
+void kinect::type::ContainerReader::close() {
+#ifdef _WIN32
+    if (this->data_ != nullptr) {
+        UnmapViewOfFile(this->data_);
+    }
+    if (this->mapping_ != nullptr) {
+        CloseHandle(this->mapping_);
+    }
+    if (this->file_ != nullptr) {
+        CloseHandle(this->file_);
+    }
+    this->file_ = nullptr;
+    this->mapping_ = nullptr;
+#else
+    if (this->data_ != nullptr) {
+        munmap(const_cast<uint8_t *>(this->data_), this->length_);
+    }
+#endif
+    this->data_ = nullptr;
+    this->length_ = 0;
+    this->header_ = nullptr;
+    this->index_ = nullptr;
+}
+
+kinect::type::ContainerFrame kinect::type::ContainerReader::frame(size_t __index) const {
+    try {
+        if (__index >= this->size()) {
+            throw __error__(WRONG_CONTAINER_FORMAT);
+        }
+        // only the entry of this frame is checked, opening does not touch the index
+        const kinect::type::ContainerFrameEntry &entry = this->index_[__index];
+        if (entry.offset > this->length_ ||
+            entry.point_count > (this->length_ - entry.offset) / kinect::type::quantized_point_size) {
+            throw __error__(WRONG_CONTAINER_FORMAT);
+        }
+        return {entry.time_stamp, static_cast<size_t>(entry.point_count),
+                reinterpret_cast<const kinect::type::QuantizedPoint *>(this->data_ + entry.offset)};
+    }
+    catch (const kinect::log::except &error_log) {
+        error_log.log_error();
+        exit(1);
+    }
+}
+
+size_t kinect::type::ContainerReader::find(uint64_t __time_stamp) const {
+    const kinect::type::ContainerFrameEntry *end = this->index_ + this->size();
+    const kinect::type::ContainerFrameEntry *entry =
+            std::lower_bound(this->index_, end, __time_stamp,
+                             [](const kinect::type::ContainerFrameEntry &a, uint64_t b) { return a.time_stamp < b; });
+    if (entry == end || entry->time_stamp != __time_stamp) {
+        return this->size();
+    }
+    return static_cast<size_t>(entry - this->index_);
+}
@@ -0,0 +1,133 @@
+/*
+ * Source file of kinect::record::FrameContext and ImagePool
+ * Author : @ChenRP07
+ * Date : 2022-11-05
+ * */
+#include "kinect_log.h"
+#include "kinect_context.h"
+#include "kinect_stats.h"
+
+/*
+ * Wrap __buffer in a k4a image, the memory stays owned by the caller.
+ * */
+static k4a_image_t create_image_from_buffer(std::vector<uint8_t> &__buffer, k4a_image_format_t __format,
+                                            int __width, int __height, int __stride) {
+    __buffer.resize(static_cast<size_t>(__stride) * __height);
+    k4a_image_t image = nullptr;
+    if (k4a_image_create_from_buffer(__format, __width, __height, __stride, __buffer.data(), __buffer.size(),
+                                     nullptr, nullptr, &image) != K4A_RESULT_SUCCEEDED) {
+        throw __error__(CREATE_IMAGE_FAILED);
+    }
+    return image;
+}
+
+/*
+ * Allocator of the image buffers of k4a, counted as heap allocations.
+ * */
+static uint8_t *allocate_image(int __size, void **__context) {
+    *__context = nullptr;
+    kinect::stats::count_allocation(static_cast<size_t>(__size));
+    return static_cast<uint8_t *>(malloc(static_cast<size_t>(__size)));
+}
+
+static void free_image(void *__buffer, void *) {
+    free(__buffer);
+}
+
+void kinect::record::count_image_allocations() {
+    if (k4a_set_allocator(allocate_image, free_image) != K4A_RESULT_SUCCEEDED) {
+        throw __error__(SET_ALLOCATOR_FAILED);
+    }
+}
+
+kinect::record::ImagePool::ImagePool(size_t __count, k4a_image_format_t __format, int __width, int __height,
+                                     int __stride)
+        : buffers_(__count), free_{__count} {
+    for (auto &buffer: this->buffers_) {
+        k4a_image_t image = create_image_from_buffer(buffer, __format, __width, __height, __stride);
+        this->images_.emplace_back(image);
+        this->free_.push(std::move(image));
+    }
+}
+
+kinect::record::ImagePool::~ImagePool() {
+    for (auto &image: this->images_) {
+        k4a_image_release(image);
+    }
+}
+
+k4a_image_t kinect::record::ImagePool::acquire() {
+    k4a_image_t image = nullptr;
+    this->free_.pop(image);
+    return image;
+}
+
+void kinect::record::ImagePool::release(k4a_image_t __image) {
+    this->free_.push(std::move(__image));
+}
+
+kinect::record::FrameContext::FrameContext(const k4a_calibration_t &__calibration)
+        : calibration_{&__calibration}, decompressor_{nullptr}, transformation_{nullptr}, images_{} {}
+
+kinect::record::FrameContext::~FrameContext() {
+    if (this->decompressor_ != nullptr) {
+        tjDestroy(this->decompressor_);
+    }
+    if (this->transformation_ != nullptr) {
+        k4a_transformation_destroy(this->transformation_);
+    }
+    for (auto &image: this->images_) {
+        if (image != nullptr) {
+            k4a_image_release(image);
+        }
+    }
+}
+
+tjhandle kinect::record::FrameContext::decompressor() {
+    if (this->decompressor_ == nullptr) {
+        this->decompressor_ = tjInitDecompress();
+        if (this->decompressor_ == nullptr) {
+            throw __error__(JPEG_DECOMPRESSION_FAULT);
+        }
+    }
+    return this->decompressor_;
+}
+
+k4a_transformation_t kinect::record::FrameContext::transformation() {
+    if (this->transformation_ == nullptr) {
+        this->transformation_ = k4a_transformation_create(this->calibration_);
+        if (this->transformation_ == nullptr) {
+            throw __error__(CREATE_K4ATRANFORMATION_FAILED);
+        }
+    }
+    return this->transformation_;
+}
+
+k4a_image_t kinect::record::FrameContext::image(kinect::record::ContextImage __slot, k4a_image_format_t __format,
+                                                int __width, int __height, int __stride) {
+    k4a_image_t &image = this->images_[__slot];
+    if (image != nullptr) {
+        if (k4a_image_get_format(image) == __format && k4a_image_get_width_pixels(image) == __width &&
+            k4a_image_get_height_pixels(image) == __height && k4a_image_get_stride_bytes(image) == __stride) {
+            return image;
+        }
+        k4a_image_release(image);
+        image = nullptr;
+    }
+    image = create_image_from_buffer(this->buffers_[__slot], __format, __width, __height, __stride);
+    return image;
+}
+
+kinect::type::PointXYZRGB *kinect::record::FrameContext::point_buffer(size_t __size) {
+    if (this->point_buffer_.size() < __size) {
+        this->point_buffer_.resize(__size);
+    }
+    return this->point_buffer_.data();
+}
+
+kinect::type::PointCloudSoA &kinect::record::FrameContext::point_buffer_soa(size_t __size) {
+    if (this->point_buffer_soa_.size() < __size) {
+        this->point_buffer_soa_.resize(__size);
+    }
+    return this->point_buffer_soa_;
+}
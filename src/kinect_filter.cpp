@@ -0,0 +1,587 @@
+/*
+ * Source file of kinect::filter
+ * Author : @ChenRP07
+ * Date : 2022-11-24
+ * */
+#include "kinect_filter.h"
+#include "kinect_kernel.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    // partitions of a frame, fixed so the output does not depend on the number of threads
+    const int partition_bits = 6;
+    const size_t partition_count = size_t(1) << partition_bits;
+    // points summed by one job, its runs fit in L2 cache
+    const size_t chunk_size = 4096;
+    // depth image rows filtered by one job
+    const int band_rows = 64;
+    // bits of the voxel index on each axis in a key
+    const int axis_bits = 21;
+    const uint64_t axis_mask = (uint64_t(1) << axis_bits) - 1;
+    // bits of each color sum of a run, a run has at most chunk_size points
+    const int color_bits = 21;
+    const uint64_t color_mask = (uint64_t(1) << color_bits) - 1;
+    static_assert(chunk_size * 255 <= color_mask, "color sums of a run overflow");
+
+    void run(kinect::type::ThreadPool *__pool, size_t __count, const std::function<void(size_t)> &__body) {
+        if (__pool != nullptr && __count > 1) {
+            __pool->parallel_for(__count, __body);
+            return;
+        }
+        for (size_t i = 0; i < __count; ++i) {
+            __body(i);
+        }
+    }
+
+    // fibonacci hashing, the high bits select the partition, the middle bits the slot
+    inline uint64_t hash_key(uint64_t __key) {
+        return __key * 0x9E3779B97F4A7C15ull;
+    }
+
+    // floor(__value) without a library call, __value is far inside int32 range
+    inline uint64_t voxel_index(float __value) {
+        int32_t index = static_cast<int32_t>(__value);
+        index -= static_cast<int32_t>(__value < static_cast<float>(index));
+        return static_cast<uint64_t>(static_cast<int64_t>(index)) & axis_mask;
+    }
+
+    // run and voxel counts change a little from frame to frame, 1/4 headroom
+    // keeps later frames from growing the buffers again
+    template<typename T>
+    void grow(std::vector<T> &__buffer, size_t __size) {
+        if (__buffer.size() < __size) {
+            __buffer.resize(__size + __size / 4);
+        }
+    }
+
+    // input is only read, the view type is shared with the output
+    kinect::filter::PointView view_of(const kinect::type::PointXYZRGB *__points) {
+        kinect::type::PointXYZRGB *points = const_cast<kinect::type::PointXYZRGB *>(__points);
+        return kinect::filter::PointView{&points->x, &points->y, &points->z,
+                                         sizeof(kinect::type::PointXYZRGB) / sizeof(float), &points->r,
+                                         sizeof(kinect::type::PointXYZRGB)};
+    }
+
+    kinect::filter::PointView view_of(const kinect::type::PointCloudSoA &__points) {
+        kinect::type::PointCloudSoA &points = const_cast<kinect::type::PointCloudSoA &>(__points);
+        return kinect::filter::PointView{points.x.data(), points.y.data(), points.z.data(), 1, points.rgb.data(), 3};
+    }
+
+    // cell of each axis in a key, same packing as the voxel keys
+    inline uint64_t cell_key(uint64_t __x, uint64_t __y, uint64_t __z) {
+        return (__x & axis_mask) | (__y & axis_mask) << axis_bits | (__z & axis_mask) << (axis_bits * 2);
+    }
+}
+
+struct kinect::filter::VoxelGrid::Voxel {
+    uint64_t key;
+    float x, y, z;
+    uint32_t r, g, b, count;
+};
+
+struct kinect::filter::VoxelGrid::Run {
+    uint64_t key;
+    float x, y, z;
+    uint32_t count;
+    // r | g << color_bits | b << 2 * color_bits, summed in one add
+    uint64_t rgb;
+};
+
+struct kinect::filter::VoxelGrid::Chunk {
+    // sums of runs, grouped by partition
+    std::vector<Run> runs;
+    // runs of partition p are [offsets[p], offsets[p + 1])
+    uint32_t offsets[partition_count + 1];
+};
+
+struct kinect::filter::VoxelGrid::Partition {
+    // voxel index + 1 of each slot of the open addressing table, 0 is empty
+    std::vector<uint32_t> slots;
+    // voxels in the order they are found
+    std::vector<Voxel> voxels;
+    // voxels of this frame
+    size_t voxel_count = 0;
+    // first output point of this partition
+    size_t offset = 0;
+};
+
+kinect::filter::VoxelGrid::VoxelGrid() : partitions_(partition_count) {}
+
+kinect::filter::VoxelGrid::~VoxelGrid() = default;
+
+size_t kinect::filter::VoxelGrid::reduce(const kinect::filter::PointView &__points, size_t __count,
+                                         float __voxel_size, kinect::type::ThreadPool *__pool) {
+    const size_t chunks = (__count + chunk_size - 1) / chunk_size;
+    if (this->chunks_.size() < chunks) {
+        this->chunks_.resize(chunks);
+    }
+
+    // sum runs of consecutive points in the same voxel, which are neighbor pixels
+    // mostly, then group the runs of the chunk by partition, the points are read once
+    const float scale = 1.0f / __voxel_size;
+    run(__pool, chunks, [&](size_t __chunk) {
+        // runs of this chunk before grouping, small enough to stay in cache
+        thread_local std::vector<Run> scratch;
+        grow(scratch, chunk_size);
+        Chunk &chunk = this->chunks_[__chunk];
+        uint32_t counts[partition_count] = {0};
+        // locals, so stores to scratch can not alias them
+        const float *px = __points.x, *py = __points.y, *pz = __points.z, factor = scale;
+        const uint8_t *prgb = __points.rgb;
+        const size_t stride = __points.stride, rgb_stride = __points.rgb_stride;
+        Run *runs_of_chunk = scratch.data();
+        size_t runs = 0;
+        uint64_t last = UINT64_MAX;
+        size_t end = std::min(__count, (__chunk + 1) * chunk_size);
+        for (size_t i = __chunk * chunk_size; i < end; ++i) {
+            float x = px[i * stride], y = py[i * stride], z = pz[i * stride];
+            const uint8_t *color = prgb + i * rgb_stride;
+            uint64_t rgb = color[0] | uint64_t(color[1]) << color_bits | uint64_t(color[2]) << (color_bits * 2);
+            uint64_t key = voxel_index(x * factor) | voxel_index(y * factor) << axis_bits |
+                           voxel_index(z * factor) << (axis_bits * 2);
+            if (key != last) {
+                runs_of_chunk[runs++] = Run{key, x, y, z, 1, rgb};
+                counts[hash_key(key) >> (64 - partition_bits)]++;
+                last = key;
+                continue;
+            }
+            Run &sum = runs_of_chunk[runs - 1];
+            sum.x += x;
+            sum.y += y;
+            sum.z += z;
+            sum.count++;
+            sum.rgb += rgb;
+        }
+
+        uint32_t next[partition_count];
+        chunk.offsets[0] = 0;
+        for (size_t p = 0; p < partition_count; ++p) {
+            next[p] = chunk.offsets[p];
+            chunk.offsets[p + 1] = chunk.offsets[p] + counts[p];
+        }
+        grow(chunk.runs, runs);
+        for (size_t k = 0; k < runs; ++k) {
+            chunk.runs[next[hash_key(runs_of_chunk[k].key) >> (64 - partition_bits)]++] = runs_of_chunk[k];
+        }
+    });
+
+    // merge the runs of each voxel, no voxel spans two partitions
+    run(__pool, partition_count, [&](size_t __partition) {
+        Partition &partition = this->partitions_[__partition];
+        partition.voxel_count = 0;
+        size_t runs = 0;
+        for (size_t c = 0; c < chunks; ++c) {
+            runs += this->chunks_[c].offsets[__partition + 1] - this->chunks_[c].offsets[__partition];
+        }
+        if (runs == 0) {
+            return;
+        }
+        // at most half full
+        size_t table = 1;
+        while (table < runs * 2) {
+            table <<= 1;
+        }
+        const size_t mask = table - 1;
+        grow(partition.slots, table);
+        grow(partition.voxels, runs);
+        std::fill(partition.slots.begin(), partition.slots.begin() + table, 0);
+
+        // chunk order, so the order of voxels does not depend on the threads
+        for (size_t c = 0; c < chunks; ++c) {
+            const Chunk &chunk = this->chunks_[c];
+            for (size_t k = chunk.offsets[__partition]; k < chunk.offsets[__partition + 1]; ++k) {
+                const Run &sum = chunk.runs[k];
+                size_t slot = (hash_key(sum.key) >> 20) & mask;
+                Voxel *voxel;
+                while (true) {
+                    uint32_t index = partition.slots[slot];
+                    if (index == 0) {
+                        partition.slots[slot] = static_cast<uint32_t>(++partition.voxel_count);
+                        voxel = &partition.voxels[partition.voxel_count - 1];
+                        *voxel = Voxel{sum.key, 0.0f, 0.0f, 0.0f, 0, 0, 0, 0};
+                        break;
+                    }
+                    voxel = &partition.voxels[index - 1];
+                    if (voxel->key == sum.key) {
+                        break;
+                    }
+                    slot = (slot + 1) & mask;
+                }
+                voxel->x += sum.x;
+                voxel->y += sum.y;
+                voxel->z += sum.z;
+                voxel->r += static_cast<uint32_t>(sum.rgb & color_mask);
+                voxel->g += static_cast<uint32_t>(sum.rgb >> color_bits & color_mask);
+                voxel->b += static_cast<uint32_t>(sum.rgb >> (color_bits * 2));
+                voxel->count += sum.count;
+            }
+        }
+    });
+
+    size_t voxels = 0;
+    for (auto &partition: this->partitions_) {
+        partition.offset = voxels;
+        voxels += partition.voxel_count;
+    }
+    return voxels;
+}
+
+void kinect::filter::VoxelGrid::write(const kinect::filter::PointView &__output,
+                                      kinect::type::ThreadPool *__pool) {
+    run(__pool, partition_count, [&](size_t __partition) {
+        const Partition &partition = this->partitions_[__partition];
+        for (size_t v = 0; v < partition.voxel_count; ++v) {
+            const Voxel &voxel = partition.voxels[v];
+            size_t o = partition.offset + v;
+            float scale = 1.0f / static_cast<float>(voxel.count);
+            __output.x[o * __output.stride] = voxel.x * scale;
+            __output.y[o * __output.stride] = voxel.y * scale;
+            __output.z[o * __output.stride] = voxel.z * scale;
+            // rounded average
+            uint8_t *rgb = __output.rgb + o * __output.rgb_stride;
+            rgb[0] = static_cast<uint8_t>((voxel.r + voxel.count / 2) / voxel.count);
+            rgb[1] = static_cast<uint8_t>((voxel.g + voxel.count / 2) / voxel.count);
+            rgb[2] = static_cast<uint8_t>((voxel.b + voxel.count / 2) / voxel.count);
+        }
+    });
+}
+
+void kinect::filter::VoxelGrid::downsample(const kinect::type::PointXYZRGB *__points, size_t __count,
+                                           float __voxel_size, kinect::type::ThreadPool *__pool,
+                                           std::vector<kinect::type::PointXYZRGB> &__output) {
+    if (__count == 0) {
+        __output.clear();
+        return;
+    }
+    __output.resize(this->reduce(view_of(__points), __count, __voxel_size, __pool));
+    this->write(view_of(__output.data()), __pool);
+}
+
+void kinect::filter::VoxelGrid::downsample(const kinect::type::PointCloudSoA &__points, size_t __count,
+                                           float __voxel_size, kinect::type::ThreadPool *__pool,
+                                           kinect::type::PointCloudSoA &__output) {
+    if (__count == 0) {
+        __output.resize(0);
+        return;
+    }
+    __output.resize(this->reduce(view_of(__points), __count, __voxel_size, __pool));
+    this->write(view_of(__output), __pool);
+}
+
+struct kinect::filter::OutlierFilter::Entry {
+    float x, y, z;
+    // index of the point in the input
+    uint32_t index;
+};
+
+struct kinect::filter::OutlierFilter::Chunk {
+    // points, grouped by partition
+    std::vector<Entry> entries;
+    // hash grid bucket of the cell of each entry
+    std::vector<uint32_t> buckets;
+    // points of partition p are [offsets[p], offsets[p + 1])
+    uint32_t offsets[partition_count + 1];
+};
+
+kinect::filter::OutlierFilter::OutlierFilter() = default;
+
+kinect::filter::OutlierFilter::~OutlierFilter() = default;
+
+size_t kinect::filter::OutlierFilter::select(const kinect::filter::PointView &__points, size_t __count,
+                                             float __radius, size_t __neighbours,
+                                             kinect::type::ThreadPool *__pool) {
+    const size_t chunks = (__count + chunk_size - 1) / chunk_size;
+    if (this->chunks_.size() < chunks) {
+        this->chunks_.resize(chunks);
+    }
+    // surface points share cells, a quarter of a bucket per point is plenty, the
+    // high bits of a bucket are its partition
+    int bucket_bits = partition_bits;
+    while ((size_t(1) << bucket_bits) < __count / 4) {
+        bucket_bits++;
+    }
+    const size_t buckets = size_t(1) << bucket_bits;
+    const int partition_shift = bucket_bits - partition_bits;
+    grow(this->starts_, buckets + 1);
+    grow(this->cursors_, buckets);
+    grow(this->entries_, __count);
+    grow(this->keep_, __count);
+    grow(this->chunk_kept_, chunks + 1);
+
+    const float scale = 1.0f / __radius;
+    auto bucket_of = [&](uint64_t __key) {
+        return static_cast<uint32_t>(hash_key(__key) >> (64 - bucket_bits));
+    };
+
+    // hash the points of a chunk and group them by partition, the points are read once
+    run(__pool, chunks, [&](size_t __chunk) {
+        thread_local std::vector<Entry> scratch;
+        thread_local std::vector<uint32_t> scratch_buckets;
+        grow(scratch, chunk_size);
+        grow(scratch_buckets, chunk_size);
+        Chunk &chunk = this->chunks_[__chunk];
+        grow(chunk.entries, chunk_size);
+        grow(chunk.buckets, chunk_size);
+        uint32_t counts[partition_count] = {0};
+        const float *px = __points.x, *py = __points.y, *pz = __points.z;
+        const size_t stride = __points.stride;
+        Entry *entries_of_chunk = scratch.data();
+        uint32_t *buckets_of_chunk = scratch_buckets.data();
+        size_t begin = __chunk * chunk_size, end = std::min(__count, begin + chunk_size);
+        for (size_t i = begin; i < end; ++i) {
+            float x = px[i * stride], y = py[i * stride], z = pz[i * stride];
+            uint32_t bucket = bucket_of(cell_key(voxel_index(x * scale), voxel_index(y * scale),
+                                                 voxel_index(z * scale)));
+            entries_of_chunk[i - begin] = Entry{x, y, z, static_cast<uint32_t>(i)};
+            buckets_of_chunk[i - begin] = bucket;
+            counts[bucket >> partition_shift]++;
+        }
+        uint32_t offset = 0;
+        for (size_t p = 0; p < partition_count; ++p) {
+            chunk.offsets[p] = offset;
+            offset += counts[p];
+            counts[p] = chunk.offsets[p];
+        }
+        chunk.offsets[partition_count] = offset;
+        for (size_t i = 0; i < end - begin; ++i) {
+            uint32_t e = counts[buckets_of_chunk[i] >> partition_shift]++;
+            chunk.entries[e] = entries_of_chunk[i];
+            chunk.buckets[e] = buckets_of_chunk[i];
+        }
+    });
+
+    // first entry of each partition
+    uint32_t partition_starts[partition_count + 1];
+    uint32_t start = 0;
+    for (size_t p = 0; p < partition_count; ++p) {
+        partition_starts[p] = start;
+        for (size_t c = 0; c < chunks; ++c) {
+            start += this->chunks_[c].offsets[p + 1] - this->chunks_[c].offsets[p];
+        }
+    }
+    partition_starts[partition_count] = start;
+    this->starts_[buckets] = start;
+
+    // counting sort of each partition by bucket, chunks in order, so the points of
+    // a bucket stay in input order
+    run(__pool, partition_count, [&](size_t __partition) {
+        uint32_t *starts = this->starts_.data(), *cursors = this->cursors_.data();
+        Entry *entries = this->entries_.data();
+        size_t first = __partition << partition_shift, last = (__partition + 1) << partition_shift;
+        std::fill(cursors + first, cursors + last, 0);
+        for (size_t c = 0; c < chunks; ++c) {
+            const Chunk &chunk = this->chunks_[c];
+            for (uint32_t e = chunk.offsets[__partition]; e < chunk.offsets[__partition + 1]; ++e) {
+                cursors[chunk.buckets[e]]++;
+            }
+        }
+        uint32_t offset = partition_starts[__partition];
+        for (size_t b = first; b < last; ++b) {
+            starts[b] = offset;
+            offset += cursors[b];
+            cursors[b] = starts[b];
+        }
+        for (size_t c = 0; c < chunks; ++c) {
+            const Chunk &chunk = this->chunks_[c];
+            for (uint32_t e = chunk.offsets[__partition]; e < chunk.offsets[__partition + 1]; ++e) {
+                entries[cursors[chunk.buckets[e]]++] = chunk.entries[e];
+            }
+        }
+    });
+
+    // count neighbours in the own cell first, then in the 26 cells around it, a
+    // neighbour is closer than radius so it is in one of them. Points are queried
+    // in bucket order, so the points of a cell follow each other and find their
+    // own bucket and the buckets around it in cache
+    const float square_radius = __radius * __radius;
+    const size_t needed = __neighbours + 1;  // the point itself is counted too
+    run(__pool, partition_count, [&](size_t __partition) {
+        // locals, so stores to keep_ can not alias them
+        const float limit = square_radius;
+        const uint32_t *starts = this->starts_.data();
+        const Entry *entries = this->entries_.data();
+        uint8_t *keep = this->keep_.data();
+        for (uint32_t i = partition_starts[__partition]; i < partition_starts[__partition + 1]; ++i) {
+            float x = entries[i].x, y = entries[i].y, z = entries[i].z;
+            uint64_t cx = voxel_index(x * scale), cy = voxel_index(y * scale), cz = voxel_index(z * scale);
+            // cells may share a bucket, each bucket is read once, any point of it
+            // closer than radius is a neighbour whatever its cell is
+            uint32_t visited[27];
+            size_t found = 0, visited_count = 0;
+            for (int cell = 0; cell < 27 && found < needed; ++cell) {
+                // the own cell first, then the others in a fixed order
+                int offset = cell == 13 ? 0 : cell == 0 ? 13 : cell;
+                uint32_t bucket = bucket_of(cell_key(cx + offset % 3 - 1, cy + offset / 3 % 3 - 1,
+                                                     cz + offset / 9 - 1));
+                if (std::find(visited, visited + visited_count, bucket) != visited + visited_count) {
+                    continue;
+                }
+                visited[visited_count++] = bucket;
+                for (uint32_t e = starts[bucket], bucket_end = starts[bucket + 1]; e < bucket_end && found < needed;
+                     ++e) {
+                    float dx = entries[e].x - x, dy = entries[e].y - y, dz = entries[e].z - z;
+                    found += static_cast<size_t>(dx * dx + dy * dy + dz * dz <= limit);
+                }
+            }
+            keep[entries[i].index] = static_cast<uint8_t>(found >= needed);
+        }
+    });
+
+    // kept points of each chunk, the output is in input order
+    run(__pool, chunks, [&](size_t __chunk) {
+        const uint8_t *keep = this->keep_.data();
+        size_t kept = 0;
+        size_t end = std::min(__count, (__chunk + 1) * chunk_size);
+        for (size_t i = __chunk * chunk_size; i < end; ++i) {
+            kept += keep[i];
+        }
+        this->chunk_kept_[__chunk] = kept;
+    });
+
+    size_t kept = 0;
+    for (size_t c = 0; c < chunks; ++c) {
+        size_t chunk_kept = this->chunk_kept_[c];
+        this->chunk_kept_[c] = kept;
+        kept += chunk_kept;
+    }
+    return kept;
+}
+
+void kinect::filter::OutlierFilter::write(const kinect::filter::PointView &__points, size_t __count,
+                                          const kinect::filter::PointView &__output,
+                                          kinect::type::ThreadPool *__pool) {
+    const size_t chunks = (__count + chunk_size - 1) / chunk_size;
+    run(__pool, chunks, [&](size_t __chunk) {
+        size_t end = std::min(__count, (__chunk + 1) * chunk_size), o = this->chunk_kept_[__chunk];
+        for (size_t i = __chunk * chunk_size; i < end; ++i) {
+            if (!this->keep_[i]) {
+                continue;
+            }
+            __output.x[o * __output.stride] = __points.x[i * __points.stride];
+            __output.y[o * __output.stride] = __points.y[i * __points.stride];
+            __output.z[o * __output.stride] = __points.z[i * __points.stride];
+            const uint8_t *rgb = __points.rgb + i * __points.rgb_stride;
+            uint8_t *output_rgb = __output.rgb + o * __output.rgb_stride;
+            output_rgb[0] = rgb[0];
+            output_rgb[1] = rgb[1];
+            output_rgb[2] = rgb[2];
+            o++;
+        }
+    });
+}
+
+void kinect::filter::OutlierFilter::filter(const kinect::type::PointXYZRGB *__points, size_t __count,
+                                           float __radius, size_t __neighbours, kinect::type::ThreadPool *__pool,
+                                           std::vector<kinect::type::PointXYZRGB> &__output) {
+    if (__count == 0) {
+        __output.clear();
+        return;
+    }
+    __output.resize(this->select(view_of(__points), __count, __radius, __neighbours, __pool));
+    this->write(view_of(__points), __count, view_of(__output.data()), __pool);
+}
+
+void kinect::filter::OutlierFilter::filter(const kinect::type::PointCloudSoA &__points, size_t __count,
+                                           float __radius, size_t __neighbours, kinect::type::ThreadPool *__pool,
+                                           kinect::type::PointCloudSoA &__output) {
+    if (__count == 0) {
+        __output.resize(0);
+        return;
+    }
+    __output.resize(this->select(view_of(__points), __count, __radius, __neighbours, __pool));
+    this->write(view_of(__points), __count, view_of(__output), __pool);
+}
+
+void kinect::filter::remove_flying_pixels(const uint16_t *__input, uint16_t *__output, int __width, int __height,
+                                          float __ratio, kinect::type::ThreadPool *__pool) {
+    // 16-bit fraction, the kernels take the high half of depth * ratio
+    uint16_t ratio = static_cast<uint16_t>(std::min(65535L, std::lround(__ratio * 65536.0f)));
+    size_t bands = static_cast<size_t>((__height + band_rows - 1) / band_rows);
+    run(__pool, bands, [&](size_t __band) {
+        int begin = static_cast<int>(__band) * band_rows;
+        kinect::kernel::remove_flying_pixels(__input, __output, __width, __height, begin,
+                                             std::min(__height, begin + band_rows), ratio);
+    });
+}
+
+kinect::filter::TemporalFilter::TemporalFilter() = default;
+
+kinect::filter::TemporalFilter::~TemporalFilter() = default;
+
+void kinect::filter::TemporalFilter::filter(uint16_t *__depth, size_t __pixels,
+                                            const kinect::kernel::TemporalOptions &__options) {
+    if (this->average_.size() != __pixels) {
+        this->average_.assign(__pixels, 0.0f);
+        this->output_.assign(__pixels, 0);
+    }
+    kinect::kernel::temporal_filter(__depth, this->average_.data(), this->output_.data(), __pixels, __options);
+}
+
+kinect::filter::BackgroundModel::BackgroundModel(int __width, int __height)
+        : width_{__width}, height_{__height}, frames_{0}, background_pixels_{0} {
+    size_t pixels = static_cast<size_t>(__width) * static_cast<size_t>(__height);
+    this->count_.assign(pixels, 0);
+    this->sum_.assign(pixels, 0);
+    this->square_sum_.assign(pixels, 0);
+}
+
+kinect::filter::BackgroundModel::~BackgroundModel() = default;
+
+void kinect::filter::BackgroundModel::add_frame(const uint16_t *__depth) {
+    size_t pixels = this->count_.size();
+    for (size_t i = 0; i < pixels; ++i) {
+        uint64_t depth = __depth[i];
+        this->count_[i] += static_cast<uint32_t>(depth != 0);
+        this->sum_[i] += depth;
+        this->square_sum_[i] += depth * depth;
+    }
+    this->frames_++;
+}
+
+void kinect::filter::BackgroundModel::build(int __tolerance) {
+    size_t pixels = this->count_.size();
+    this->lower_.resize(pixels);
+    this->upper_.resize(pixels);
+    this->background_pixels_ = 0;
+    for (size_t i = 0; i < pixels; ++i) {
+        if (this->count_[i] == 0) {
+            this->lower_[i] = UINT16_MAX;
+            this->upper_[i] = 0;
+            continue;
+        }
+        double count = this->count_[i];
+        double mean = static_cast<double>(this->sum_[i]) / count;
+        double variance = std::max(0.0, static_cast<double>(this->square_sum_[i]) / count - mean * mean);
+        double half_width = std::max(static_cast<double>(__tolerance), 3.0 * std::sqrt(variance));
+        // 0 is no depth and is never background
+        this->lower_[i] = static_cast<uint16_t>(std::max(1.0, std::ceil(mean - half_width)));
+        this->upper_[i] = static_cast<uint16_t>(std::min(65535.0, std::floor(mean + half_width)));
+        this->background_pixels_++;
+    }
+    // samples are not needed any more
+    std::vector<uint32_t>().swap(this->count_);
+    std::vector<uint64_t>().swap(this->sum_);
+    std::vector<uint64_t>().swap(this->square_sum_);
+}
+
+void kinect::filter::BackgroundModel::subtract(uint16_t *__depth) const {
+    kinect::kernel::subtract_background(__depth, this->lower_.data(), this->upper_.data(), this->lower_.size());
+}
+
+int kinect::filter::BackgroundModel::width() const {
+    return this->width_;
+}
+
+int kinect::filter::BackgroundModel::height() const {
+    return this->height_;
+}
+
+uint64_t kinect::filter::BackgroundModel::frames() const {
+    return this->frames_;
+}
+
+double kinect::filter::BackgroundModel::coverage() const {
+    return this->lower_.empty() ? 0.0 : static_cast<double>(this->background_pixels_) / this->lower_.size();
+}
@@ -0,0 +1,409 @@
+/*
+ * Source file of kinect::record::MultiCameraFusion
+ * Author : @ChenRP07
+ * Date : 2022-11-22
+ * */
+#include "kinect_log.h"
+#include "kinect_fusion.h"
+#include "kinect_kernel.h"
+#include "kinect_trace.h"
+
+#include <sstream>
+
+struct kinect::record::MultiCameraFusion::Camera {
+    // mkv file path
+    std::string path;
+    // converter of this camera, its extrinsics transform points to world
+    std::unique_ptr<kinect::record::KinectMkv2VolumetricVideo> video;
+    // capture fetched for a later tick
+    std::unique_ptr<kinect::record::FrameTask> pending;
+    // frames paired by the sync thread
+    std::unique_ptr<kinect::type::BoundedQueue<std::unique_ptr<kinect::record::FrameTask>>> input;
+    // frames with generated points
+    std::unique_ptr<kinect::type::BoundedQueue<std::unique_ptr<kinect::record::FrameTask>>> output;
+};
+
+kinect::record::MultiCameraFusion::MultiCameraFusion() = default;
+
+kinect::record::MultiCameraFusion::~MultiCameraFusion() {
+    this->close();
+}
+
+void kinect::record::MultiCameraFusion::load_rig(const std::string &__rig_path) {
+    try {
+        std::ifstream rig(__rig_path.c_str());
+        if (!rig.is_open()) {
+            throw __error__(FILE_OPEN_FAULT);
+        }
+        std::string line;
+        while (std::getline(rig, line)) {
+            // trailing spaces and \r of windows line endings
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            std::istringstream fields(line);
+            std::unique_ptr<Camera> camera(new Camera);
+            fields >> camera->path;
+            std::vector<float> values;
+            float value;
+            while (fields >> value) {
+                values.push_back(value);
+            }
+            // stopped before the end of line at something not a number
+            if (!fields.eof() || (!values.empty() && values.size() != 12)) {
+                throw __error__(WRONG_RIG_FORMAT);
+            }
+
+            camera->video.reset(new kinect::record::KinectMkv2VolumetricVideo);
+            camera->video->init_video(camera->path);
+            if (!values.empty()) {
+                kinect::type::Extrinsics extrinsics;
+                std::copy(values.begin(), values.begin() + 9, extrinsics.rotation);
+                std::copy(values.begin() + 9, values.end(), extrinsics.translation);
+                camera->video->set_extrinsics(extrinsics);
+            }
+            this->cameras_.emplace_back(std::move(camera));
+        }
+        if (this->cameras_.empty()) {
+            throw __error__(WRONG_RIG_FORMAT);
+        }
+
+        // the master goes first, without one the first camera is the reference
+        size_t masters = 0;
+        for (size_t i = 0; i < this->cameras_.size(); ++i) {
+            if (this->cameras_[i]->video->k4a_record_config_.wired_sync_mode == K4A_WIRED_SYNC_MODE_MASTER) {
+                std::swap(this->cameras_[0], this->cameras_[i]);
+                masters++;
+            }
+        }
+        if (masters > 1) {
+            throw __error__(SYNC_MODE_FAULT);
+        }
+        // the reference camera writes the fused frames, a camera without extrinsics is
+        // the world origin, so they are in world coordinates if any camera has extrinsics
+        for (auto &camera: this->cameras_) {
+            this->cameras_[0]->video->world_output_ |= camera->video->has_extrinsics_;
+        }
+    }
+    catch (const kinect::log::except &error_log) {
+        error_log.log_error();
+        exit(1);
+    }
+}
+
+void kinect::record::MultiCameraFusion::log_config() const {
+    __log_time__;
+    std::cout << "\033[36mCamera rig listed below." << std::endl;
+    for (size_t i = 0; i < this->cameras_.size(); ++i) {
+        const k4a_record_configuration_t &config = this->cameras_[i]->video->k4a_record_config_;
+        printf("                       #%zu %s : %s, delay off master %.2fms, timestamp offset %.2fms%s\n", i,
+               this->cameras_[i]->path.c_str(), sync_mode_info[config.wired_sync_mode].c_str(),
+               config.subordinate_delay_off_master_usec / 1000.0f, config.start_timestamp_offset_usec / 1000.0f,
+               this->cameras_[i]->video->has_extrinsics_ ? "" : ", camera space");
+    }
+    std::cout << "\033[0m";
+}
+
+void kinect::record::MultiCameraFusion::set_name(const std::string &__sequence_name) {
+    try {
+        if (this->cameras_.empty()) {
+            throw __error__(WRONG_RIG_FORMAT);
+        }
+        this->cameras_[0]->video->set_name(__sequence_name);
+    }
+    catch (const kinect::log::except &error_log) {
+        error_log.log_error();
+        exit(1);
+    }
+}
+
+void kinect::record::MultiCameraFusion::set_config(const kinect::record::ConvertConfig &__config) {
+    try {
+        // checked here, cameras get no voxel_size
+        if (__config.voxel_size != 0.0f && !(__config.voxel_size >= 1.0f)) {
+            throw __error__(APP_PARAMETER_FAULT);
+        }
+        // one empty scene recording can not serve all cameras, each one learns from its own recording
+        if (!__config.background_path.empty()) {
+            throw __error__(APP_PARAMETER_FAULT);
+        }
+        this->config_ = __config;
+        this->config_.shards = 1;
+        for (size_t i = 0; i < this->cameras_.size(); ++i) {
+            kinect::record::ConvertConfig config = this->config_;
+            // voxels are computed on fused frames, each camera already has a thread of its own
+            config.voxel_size = 0.0f;
+            config.filter_workers = 0;
+            if (i != 0) {
+                // subordinates follow the master captures, every capture is a candidate
+                config.end_usec = 0;
+                config.stride = 1;
+            }
+            this->cameras_[i]->video->set_config(config);
+        }
+        this->filter_pool_.reset();
+        if (__config.voxel_size != 0.0f && __config.filter_workers != 0) {
+            this->filter_pool_.reset(new kinect::type::ThreadPool(__config.filter_workers));
+        }
+    }
+    catch (const kinect::log::except &error_log) {
+        error_log.log_error();
+        exit(1);
+    }
+}
+
+void kinect::record::MultiCameraFusion::open_stream(const std::string &__output_sequence_path,
+                                                    kinect::type::OutputFormat __format, size_t __max_in_flight) {
+    this->cameras_[0]->video->open_stream(__output_sequence_path, __format, __max_in_flight);
+}
+
+int64_t kinect::record::MultiCameraFusion::tick_time(const kinect::record::MultiCameraFusion::Camera &__camera,
+                                                     const kinect::record::FrameTask &__task) {
+    const k4a_record_configuration_t &config = __camera.video->k4a_record_config_;
+    return static_cast<int64_t>(__task.time_stamp) - static_cast<int64_t>(config.start_timestamp_offset_usec) -
+           static_cast<int64_t>(config.subordinate_delay_off_master_usec);
+}
+
+bool kinect::record::MultiCameraFusion::fetch_tick(std::vector<std::unique_ptr<kinect::record::FrameTask>> &__tasks) {
+    Camera &master = *this->cameras_[0];
+    int64_t half_period = static_cast<int64_t>(0.5e6 / fps_info[master.video->k4a_record_config_.camera_fps]);
+
+    while (true) {
+        __tasks.clear();
+        __tasks.emplace_back(new kinect::record::FrameTask);
+        if (master.video->fetch_frame(master.video->range_, *__tasks[0])) {
+            __tasks.clear();
+            return true;
+        }
+        int64_t tick = tick_time(master, *__tasks[0]);
+
+        for (size_t i = 1; i < this->cameras_.size(); ++i) {
+            Camera &camera = *this->cameras_[i];
+            int64_t delta = 0;
+            while (true) {
+                if (camera.pending == nullptr) {
+                    camera.pending.reset(new kinect::record::FrameTask);
+                    if (camera.video->fetch_frame(camera.video->range_, *camera.pending)) {
+                        // a subordinate ended, no more complete ticks
+                        camera.pending.reset();
+                        for (size_t j = 0; j < __tasks.size(); ++j) {
+                            this->cameras_[j]->video->release_frame(*__tasks[j]);
+                        }
+                        __tasks.clear();
+                        return true;
+                    }
+                }
+                delta = tick_time(camera, *camera.pending) - tick;
+                if (delta >= -half_period) {
+                    break;
+                }
+                // the master has no capture of this tick
+                camera.video->release_frame(*camera.pending);
+                camera.pending.reset();
+                this->dropped_captures_++;
+            }
+            // otherwise the capture is kept for a later tick
+            if (delta <= half_period) {
+                __tasks.emplace_back(std::move(camera.pending));
+            }
+            else {
+                break;
+            }
+        }
+
+        if (__tasks.size() == this->cameras_.size()) {
+            return false;
+        }
+        for (size_t j = 0; j < __tasks.size(); ++j) {
+            this->cameras_[j]->video->release_frame(*__tasks[j]);
+        }
+        this->dropped_ticks_++;
+    }
+}
+
+void kinect::record::MultiCameraFusion::convert() {
+    typedef std::unique_ptr<kinect::record::FrameTask> Task;
+    const size_t cameras = this->cameras_.size();
+
+    kinect::stats::StageStats sync_stats("sync", 1);
+    kinect::stats::StageStats camera_stats("camera", cameras);
+    kinect::stats::StageStats emit_stats("emit", 1);
+
+    for (auto &camera: this->cameras_) {
+        camera->input.reset(new kinect::type::BoundedQueue<Task>(this->config_.queue_depth));
+        camera->output.reset(new kinect::type::BoundedQueue<Task>(this->config_.queue_depth));
+        // a worker decodes one frame at a time and returns its image before the next
+        camera->video->create_color_pool(1);
+    }
+
+    auto time_start = std::chrono::steady_clock::now();
+    {
+        __log_time__;
+        printf("\033[36mFusing %zu cameras, queue depth %zu, %s kernels.\n\033[0m", cameras,
+               this->config_.queue_depth, kinect::kernel::instruction_set());
+    }
+
+    std::vector<std::thread> threads;
+
+    // sync, all playback handles are read by this thread only
+    threads.emplace_back([&] {
+        kinect::trace::set_thread_name("sync");
+        try {
+            std::vector<Task> tasks;
+            for (uint64_t index = 0;; ++index) {
+                auto start = std::chrono::steady_clock::now();
+                kinect::stats::StageTimer timer(sync_stats, index);
+                if (this->fetch_tick(tasks)) {
+                    timer.cancel();
+                    break;
+                }
+                timer.stop();
+                for (size_t i = 0; i < cameras; ++i) {
+                    tasks[i]->index = index;
+                    tasks[i]->start = start;
+                    this->cameras_[i]->input->push(std::move(tasks[i]));
+                }
+            }
+        }
+        catch (const kinect::log::except &error_log) {
+            error_log.log_error();
+            exit(1);
+        }
+        for (auto &camera: this->cameras_) {
+            camera->input->close();
+        }
+    });
+
+    // one worker per camera, decode, transform and generate points in world coordinates
+    for (size_t i = 0; i < cameras; ++i) {
+        threads.emplace_back([&, i] {
+            kinect::trace::set_thread_name("camera " + std::to_string(i));
+            Camera &camera = *this->cameras_[i];
+            try {
+                kinect::record::FrameContext context(camera.video->scaled_calibration_);
+                Task task;
+                while (camera.input->pop(task)) {
+                    kinect::stats::StageTimer timer(camera_stats, task->index);
+                    camera.video->process_frame(context, *task);
+                    timer.stop();
+                    camera.output->push(std::move(task));
+                }
+            }
+            catch (const kinect::log::except &error_log) {
+                error_log.log_error();
+                exit(1);
+            }
+            camera.output->close();
+        });
+    }
+
+    // emit on this thread, the points of all cameras are appended to the master frame
+    kinect::record::KinectMkv2VolumetricVideo &master = *this->cameras_[0]->video;
+    kinect::trace::set_thread_name("emit");
+    Task task;
+    while (this->cameras_[0]->output->pop(task)) {
+        kinect::stats::StageTimer timer(emit_stats, task->index);
+        std::vector<Task> parts(cameras);
+        size_t points = 0;
+        for (size_t i = 1; i < cameras; ++i) {
+            this->cameras_[i]->output->pop(parts[i]);
+            points += this->config_.layout == kinect::type::SOA_LAYOUT ? parts[i]->point_cloud_soa.size()
+                                                                       : parts[i]->point_cloud.size();
+        }
+        // grow the master frame once
+        if (this->config_.layout == kinect::type::SOA_LAYOUT) {
+            kinect::type::PointCloudSoA &cloud = task->point_cloud_soa;
+            points += cloud.size();
+            cloud.x.reserve(points);
+            cloud.y.reserve(points);
+            cloud.z.reserve(points);
+            cloud.rgb.reserve(points * 3);
+        }
+        else {
+            points += task->point_cloud.size();
+            task->point_cloud.reserve(points);
+        }
+        for (size_t i = 1; i < cameras; ++i) {
+            Task &part = parts[i];
+            if (this->config_.layout == kinect::type::SOA_LAYOUT) {
+                kinect::type::PointCloudSoA &points = task->point_cloud_soa;
+                points.x.insert(points.x.end(), part->point_cloud_soa.x.begin(), part->point_cloud_soa.x.end());
+                points.y.insert(points.y.end(), part->point_cloud_soa.y.begin(), part->point_cloud_soa.y.end());
+                points.z.insert(points.z.end(), part->point_cloud_soa.z.begin(), part->point_cloud_soa.z.end());
+                points.rgb.insert(points.rgb.end(), part->point_cloud_soa.rgb.begin(),
+                                  part->point_cloud_soa.rgb.end());
+            }
+            else {
+                task->point_cloud.insert(task->point_cloud.end(), part->point_cloud.begin(),
+                                         part->point_cloud.end());
+            }
+        }
+        if (this->config_.voxel_size != 0.0f) {
+            if (this->config_.layout == kinect::type::SOA_LAYOUT) {
+                kinect::type::PointCloudSoA cloud;
+                this->voxel_grid_.downsample(task->point_cloud_soa, task->point_cloud_soa.size(),
+                                             this->config_.voxel_size, this->filter_pool_.get(), cloud);
+                task->point_cloud_soa = std::move(cloud);
+            }
+            else {
+                std::vector<kinect::type::PointXYZRGB> cloud;
+                this->voxel_grid_.downsample(task->point_cloud.data(), task->point_cloud.size(),
+                                             this->config_.voxel_size, this->filter_pool_.get(), cloud);
+                task->point_cloud = std::move(cloud);
+            }
+            points = this->config_.layout == kinect::type::SOA_LAYOUT ? task->point_cloud_soa.size()
+                                                                      : task->point_cloud.size();
+        }
+        master.add_frame(*task);
+        timer.stop();
+        this->fused_ticks_++;
+        float time_cost = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() -
+                                                                   task->start).count();
+        __log_time__;
+        printf("\033[36mFuse point cloud of %zu cameras frame #%zu, %zu points, latency %.3fms.\n\033[0m", cameras,
+               master.video_.size(), points, time_cost);
+    }
+
+    for (auto &thread: threads) {
+        thread.join();
+    }
+
+    double wall_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - time_start).count();
+    {
+        __log_time__;
+        printf("\033[36mVideo end, %llu ticks in %.3fs, %.2ffps. Stage throughput listed below.\n\033[0m",
+               static_cast<unsigned long long>(this->fused_ticks_), wall_sec,
+               wall_sec <= 0.0 ? 0.0 : this->fused_ticks_ / wall_sec);
+    }
+    if (this->dropped_ticks_ != 0 || this->dropped_captures_ != 0) {
+        printf("                       \033[36mDropped %llu master captures missing a subordinate, %llu subordinate"
+               " captures missing the master\n\033[0m", static_cast<unsigned long long>(this->dropped_ticks_),
+               static_cast<unsigned long long>(this->dropped_captures_));
+    }
+    sync_stats.log(wall_sec);
+    camera_stats.log(wall_sec);
+    emit_stats.log(wall_sec);
+}
+
+void kinect::record::MultiCameraFusion::output_point_cloud_sequence(const std::string &__output_sequence_path,
+                                                                    kinect::type::OutputFormat __format) {
+    this->cameras_[0]->video->output_point_cloud_sequence(__output_sequence_path, __format);
+    this->close();
+}
+
+void kinect::record::MultiCameraFusion::close() {
+    for (size_t i = 1; i < this->cameras_.size(); ++i) {
+        Camera &camera = *this->cameras_[i];
+        if (camera.pending != nullptr) {
+            camera.video->release_frame(*camera.pending);
+            camera.pending.reset();
+        }
+        if (camera.video->k4a_handle_ != nullptr) {
+            k4a_playback_close(camera.video->k4a_handle_);
+            camera.video->k4a_handle_ = nullptr;
+        }
+        camera.video->context_.reset();
+        camera.video->color_pool_.reset();
+    }
+}
@@ -0,0 +1,800 @@
+/*
+ * Source file of kinect::kernel
+ * Author : @ChenRP07
+ * Date : 2022-11-10
+ * */
+#include "kinect_kernel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KINECT_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+    enum InstructionSet {
+        SCALAR,
+        SSE41,
+        AVX2
+    };
+
+    InstructionSet detect_instruction_set() {
+#ifdef KINECT_KERNEL_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            return AVX2;
+        }
+        if (__builtin_cpu_supports("sse4.1")) {
+            return SSE41;
+        }
+#endif
+        return SCALAR;
+    }
+
+    // best instruction set of this CPU
+    InstructionSet supported_instruction_set() {
+        static const InstructionSet isa = detect_instruction_set();
+        return isa;
+    }
+
+    // instruction set of the kernels, lowered by set_instruction_set()
+    std::atomic<InstructionSet> &active_instruction_set() {
+        static std::atomic<InstructionSet> isa{supported_instruction_set()};
+        return isa;
+    }
+
+    InstructionSet current_instruction_set() {
+        return active_instruction_set().load(std::memory_order_relaxed);
+    }
+
+    /*
+     * Pack the BGRA pixel at __bgra to the r/g/b bytes of PointXYZRGB, in the
+     * byte order they have in memory after x/y/z.
+     * */
+    inline uint32_t pack_rgb(const uint8_t *__bgra) {
+        return static_cast<uint32_t>(__bgra[2]) | static_cast<uint32_t>(__bgra[1]) << 8 |
+               static_cast<uint32_t>(__bgra[0]) << 16;
+    }
+
+    /*
+     * world = R * p + t of one point.
+     * */
+    inline void transform_point(const kinect::type::Extrinsics &__extrinsics, float &__x, float &__y, float &__z) {
+        const float *r = __extrinsics.rotation, *t = __extrinsics.translation;
+        float x = __x, y = __y, z = __z;
+        // same order of operations as the SIMD kernels, so all of them give the same floats
+        __x = (r[0] * x + r[1] * y) + (r[2] * z + t[0]);
+        __y = (r[3] * x + r[4] * y) + (r[5] * z + t[1]);
+        __z = (r[6] * x + r[7] * y) + (r[8] * z + t[2]);
+    }
+
+    /*
+     * 1 if a pixel is kept, raw z in the depth range and alpha != 0.
+     * */
+    inline size_t keep_pixel(int16_t __z, uint8_t __alpha, int16_t __near, int16_t __far) {
+        return static_cast<size_t>((__z >= __near) & (__z <= __far) & (__alpha != 0));
+    }
+
+    /*
+     * 1 if a point is inside the crop box.
+     * */
+    inline size_t inside_box(const kinect::type::Box &__box, float __x, float __y, float __z) {
+        return static_cast<size_t>((__x >= __box.min[0]) & (__x <= __box.max[0]) & (__y >= __box.min[1]) &
+                                   (__y <= __box.max[1]) & (__z >= __box.min[2]) & (__z <= __box.max[2]));
+    }
+
+    /*
+     * Branch free compaction, a point is always written to the next free slot
+     * and the slot is only kept if the pixel is valid. TRANSFORM and CROP are
+     * template parameters so the loop without extrinsics or box has no extra work.
+     * */
+    template<bool TRANSFORM, bool CROP>
+    size_t extract_points_scalar(const int16_t *__xyz, const uint8_t *__bgra, size_t __begin, size_t __end,
+                                 const kinect::kernel::ExtractOptions &__options,
+                                 kinect::type::PointXYZRGB *__output, size_t __count) {
+        // z == 0 is no depth, it is never kept
+        const int16_t near = std::max<int16_t>(__options.depth_min, 1), far = __options.depth_max;
+        // without a transform both spaces are the same
+        const bool camera_box = !TRANSFORM || __options.crop_camera;
+        for (size_t i = __begin; i < __end; ++i) {
+            kinect::type::PointXYZRGB &point = __output[__count];
+            float x = __xyz[i * 3 + 0], y = __xyz[i * 3 + 1], z = __xyz[i * 3 + 2];
+            size_t keep = keep_pixel(__xyz[i * 3 + 2], __bgra[i * 4 + 3], near, far);
+            if (CROP && camera_box) {
+                keep &= inside_box(*__options.crop, x, y, z);
+            }
+            if (TRANSFORM) {
+                transform_point(*__options.extrinsics, x, y, z);
+            }
+            if (CROP && !camera_box) {
+                keep &= inside_box(*__options.crop, x, y, z);
+            }
+            point.x = x;
+            point.y = y;
+            point.z = z;
+            point.r = __bgra[i * 4 + 2];
+            point.g = __bgra[i * 4 + 1];
+            point.b = __bgra[i * 4 + 0];
+            __count += keep;
+        }
+        return __count;
+    }
+
+    template<bool TRANSFORM, bool CROP>
+    size_t extract_points_soa(const int16_t *__xyz, const uint8_t *__bgra, size_t __pixels,
+                              const kinect::kernel::ExtractOptions &__options,
+                              kinect::type::PointCloudSoA &__output, size_t __first) {
+        // every array is written with unit stride, branch free like the AoS kernel
+        float *x = __output.x.data() + __first, *y = __output.y.data() + __first, *z = __output.z.data() + __first;
+        uint8_t *rgb = __output.rgb.data() + __first * 3;
+        const int16_t near = std::max<int16_t>(__options.depth_min, 1), far = __options.depth_max;
+        // without a transform both spaces are the same
+        const bool camera_box = !TRANSFORM || __options.crop_camera;
+        size_t count = 0;
+        for (size_t i = 0; i < __pixels; ++i) {
+            float px = __xyz[i * 3 + 0], py = __xyz[i * 3 + 1], pz = __xyz[i * 3 + 2];
+            size_t keep = keep_pixel(__xyz[i * 3 + 2], __bgra[i * 4 + 3], near, far);
+            if (CROP && camera_box) {
+                keep &= inside_box(*__options.crop, px, py, pz);
+            }
+            if (TRANSFORM) {
+                transform_point(*__options.extrinsics, px, py, pz);
+            }
+            if (CROP && !camera_box) {
+                keep &= inside_box(*__options.crop, px, py, pz);
+            }
+            x[count] = px;
+            y[count] = py;
+            z[count] = pz;
+            rgb[count * 3 + 0] = __bgra[i * 4 + 2];
+            rgb[count * 3 + 1] = __bgra[i * 4 + 1];
+            rgb[count * 3 + 2] = __bgra[i * 4 + 0];
+            count += keep;
+        }
+        return count;
+    }
+
+    void subtract_background_scalar(uint16_t *__depth, const uint16_t *__lower, const uint16_t *__upper,
+                                    size_t __begin, size_t __end) {
+        for (size_t i = __begin; i < __end; ++i) {
+            uint16_t depth = __depth[i];
+            __depth[i] = (depth >= __lower[i]) & (depth <= __upper[i]) ? 0 : depth;
+        }
+    }
+
+    /*
+     * 1 if __depth and __neighbour are more than __threshold apart.
+     * */
+    inline int depth_jump(uint16_t __depth, uint16_t __neighbour, uint16_t __threshold) {
+        return static_cast<int>((__depth > __neighbour ? __depth - __neighbour : __neighbour - __depth) > __threshold);
+    }
+
+    /*
+     * Pixels [__begin, __end) of one row, __up and __down are the rows above and
+     * below, or the row itself at the border of the image.
+     * */
+    void remove_flying_pixels_scalar(const uint16_t *__row, const uint16_t *__up, const uint16_t *__down,
+                                     uint16_t *__output, int __width, int __begin, int __end, uint16_t __ratio) {
+        for (int x = __begin; x < __end; ++x) {
+            uint16_t depth = __row[x];
+            uint16_t threshold = static_cast<uint16_t>((static_cast<uint32_t>(depth) * __ratio) >> 16);
+            uint16_t left = __row[x == 0 ? x : x - 1], right = __row[x == __width - 1 ? x : x + 1];
+            int flying = (depth_jump(depth, left, threshold) & depth_jump(depth, right, threshold)) |
+                         (depth_jump(depth, __up[x], threshold) & depth_jump(depth, __down[x], threshold));
+            __output[x] = flying ? 0 : depth;
+        }
+    }
+
+    void temporal_filter_scalar(uint16_t *__depth, float *__average, uint16_t *__output, size_t __begin,
+                                size_t __end, const kinect::kernel::TemporalOptions &__options) {
+        for (size_t i = __begin; i < __end; ++i) {
+            // same operations as the SIMD kernels, so all of them give the same depth
+            float depth = __depth[i], average = __average[i], output = __output[i];
+            float difference = depth - average;
+            bool restart = (average == 0.0f) | (depth == 0.0f) | (std::fabs(difference) > depth * __options.motion);
+            average = restart ? depth : average + __options.alpha * difference;
+            bool move = restart | (std::fabs(average - output) > __options.hold);
+            __average[i] = average;
+            __output[i] = move ? static_cast<uint16_t>(std::nearbyint(average)) : __output[i];
+            __depth[i] = __output[i];
+        }
+    }
+
+    void unproject_depth_scalar(const uint16_t *__depth, const float *__rays_x, const float *__rays_y,
+                                int16_t *__points, size_t __begin, size_t __end) {
+        for (size_t i = __begin; i < __end; ++i) {
+            // depth is read as int16 like k4a, NaN rays are the only ones not equal to themselves
+            int16_t depth = static_cast<int16_t>(__depth[i]);
+            float x = __rays_x[i], y = __rays_y[i], z = depth;
+            bool valid = x == x;
+            __points[i * 3 + 0] = valid ? static_cast<int16_t>(std::nearbyint(x * z)) : 0;
+            __points[i * 3 + 1] = valid ? static_cast<int16_t>(std::nearbyint(y * z)) : 0;
+            __points[i * 3 + 2] = valid ? depth : 0;
+        }
+    }
+
+#ifdef KINECT_KERNEL_X86
+    static_assert(sizeof(kinect::type::PointXYZRGB) == 16, "SIMD kernels store one point per 128-bit lane");
+
+    /*
+     * Columns of R and t as 4-lane vectors with lane 3 zero, so lane 3 of a
+     * transformed point stays zero for rgb.
+     * */
+    struct TransformColumns {
+        alignas(16) float column[3][4];
+        alignas(16) float translation[4];
+
+        explicit TransformColumns(const kinect::type::Extrinsics &__extrinsics) {
+            for (int c = 0; c < 3; ++c) {
+                for (int r = 0; r < 3; ++r) {
+                    this->column[c][r] = __extrinsics.rotation[r * 3 + c];
+                }
+                this->column[c][3] = 0.0f;
+            }
+            for (int r = 0; r < 3; ++r) {
+                this->translation[r] = __extrinsics.translation[r];
+            }
+            this->translation[3] = 0.0f;
+        }
+    };
+
+    /*
+     * Crop box as 4-lane vectors, lane 3 is unbounded so only x/y/z are tested.
+     * */
+    struct BoxBounds {
+        alignas(16) float min[4];
+        alignas(16) float max[4];
+
+        explicit BoxBounds(const kinect::type::Box &__box) {
+            for (int a = 0; a < 3; ++a) {
+                this->min[a] = __box.min[a];
+                this->max[a] = __box.max[a];
+            }
+            this->min[3] = -std::numeric_limits<float>::infinity();
+            this->max[3] = std::numeric_limits<float>::infinity();
+        }
+    };
+
+    /*
+     * One pixel per iteration, int16 xyz are widened and converted to float in one
+     * register, rgb is inserted into the padding lane and the point is stored
+     * with a single 16 byte store.
+     * */
+    template<bool TRANSFORM, bool CROP>
+    __attribute__((target("sse4.1")))
+    size_t extract_points_sse41(const int16_t *__xyz, const uint8_t *__bgra, size_t __pixels,
+                                const kinect::kernel::ExtractOptions &__options,
+                                kinect::type::PointXYZRGB *__output) {
+        __m128 c0 = _mm_setzero_ps(), c1 = _mm_setzero_ps(), c2 = _mm_setzero_ps(), t = _mm_setzero_ps();
+        if (TRANSFORM) {
+            TransformColumns columns(*__options.extrinsics);
+            c0 = _mm_load_ps(columns.column[0]);
+            c1 = _mm_load_ps(columns.column[1]);
+            c2 = _mm_load_ps(columns.column[2]);
+            t = _mm_load_ps(columns.translation);
+        }
+        __m128 lower = _mm_setzero_ps(), upper = _mm_setzero_ps();
+        if (CROP) {
+            BoxBounds bounds(*__options.crop);
+            lower = _mm_load_ps(bounds.min);
+            upper = _mm_load_ps(bounds.max);
+        }
+        const int16_t near = std::max<int16_t>(__options.depth_min, 1), far = __options.depth_max;
+        // without a transform both spaces are the same
+        const bool camera_box = !TRANSFORM || __options.crop_camera;
+
+        size_t count = 0, i = 0;
+        // a 64-bit load reads x/y/z and the next x, the last pixel is done by scalar
+        for (; i + 1 < __pixels; ++i) {
+            __m128i xyz = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(__xyz + i * 3));
+            // x y z x', lane 3 is cleared by the blend below or by the transform
+            __m128 point = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(xyz));
+            size_t keep = keep_pixel(__xyz[i * 3 + 2], __bgra[i * 4 + 3], near, far);
+            // lane 3 is finite, x' or 0, and always inside
+            if (CROP && camera_box) {
+                __m128 inside = _mm_and_ps(_mm_cmpge_ps(point, lower), _mm_cmple_ps(point, upper));
+                keep &= static_cast<size_t>(_mm_movemask_ps(inside) == 0xF);
+            }
+            if (TRANSFORM) {
+                point = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(point, point, 0x00), c0),
+                                              _mm_mul_ps(_mm_shuffle_ps(point, point, 0x55), c1)),
+                                   _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(point, point, 0xAA), c2), t));
+            }
+            if (CROP && !camera_box) {
+                __m128 inside = _mm_and_ps(_mm_cmpge_ps(point, lower), _mm_cmple_ps(point, upper));
+                keep &= static_cast<size_t>(_mm_movemask_ps(inside) == 0xF);
+            }
+            __m128i packed = _mm_insert_epi32(_mm_castps_si128(point), static_cast<int>(pack_rgb(__bgra + i * 4)), 3);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(__output + count), packed);
+            count += keep;
+        }
+        return extract_points_scalar<TRANSFORM, CROP>(__xyz, __bgra, i, __pixels, __options, __output, count);
+    }
+
+    /*
+     * Two pixels per iteration, the 6 int16 coordinates are shuffled to two
+     * 4-lane groups and converted in one 256-bit register, rgb of both pixels
+     * is shuffled into the padding lanes and blended in.
+     * */
+    template<bool TRANSFORM, bool CROP>
+    __attribute__((target("avx2")))
+    size_t extract_points_avx2(const int16_t *__xyz, const uint8_t *__bgra, size_t __pixels,
+                               const kinect::kernel::ExtractOptions &__options,
+                               kinect::type::PointXYZRGB *__output) {
+        // x0 y0 z0 x1 y1 z1 x2 y2 -> x0 y0 z0 _ x1 y1 z1 _
+        const __m128i xyz_shuffle = _mm_setr_epi8(0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10, 11, -1, -1);
+        // b0 g0 r0 a0 b1 g1 r1 a1 -> r0 g0 b0 0 and r1 g1 b1 0 in lane 3 of each half
+        const __m128i rgb_shuffle_0 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 1, 0, -1);
+        const __m128i rgb_shuffle_1 = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 6, 5, 4, -1);
+        // R columns and t repeated in both halves, one per point
+        __m256 c0 = _mm256_setzero_ps(), c1 = _mm256_setzero_ps(), c2 = _mm256_setzero_ps();
+        __m256 t = _mm256_setzero_ps();
+        if (TRANSFORM) {
+            TransformColumns columns(*__options.extrinsics);
+            c0 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(columns.column[0]));
+            c1 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(columns.column[1]));
+            c2 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(columns.column[2]));
+            t = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(columns.translation));
+        }
+        __m256 lower = _mm256_setzero_ps(), upper = _mm256_setzero_ps();
+        if (CROP) {
+            BoxBounds bounds(*__options.crop);
+            lower = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(bounds.min));
+            upper = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(bounds.max));
+        }
+        const int16_t near = std::max<int16_t>(__options.depth_min, 1), far = __options.depth_max;
+        // without a transform both spaces are the same
+        const bool camera_box = !TRANSFORM || __options.crop_camera;
+
+        size_t count = 0, i = 0;
+        // a 128-bit load reads 8 int16, the last pixels are done by scalar
+        for (; i + 3 <= __pixels; i += 2) {
+            __m128i xyz = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(__xyz + i * 3)),
+                                           xyz_shuffle);
+            __m256 coordinates = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(xyz));
+            size_t keep_0 = keep_pixel(__xyz[i * 3 + 2], __bgra[i * 4 + 3], near, far);
+            size_t keep_1 = keep_pixel(__xyz[i * 3 + 5], __bgra[i * 4 + 7], near, far);
+            // lanes 3 and 7 are 0 and always inside, 4 mask bits per point
+            if (CROP && camera_box) {
+                int inside = _mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(coordinates, lower, _CMP_GE_OQ),
+                                                              _mm256_cmp_ps(coordinates, upper, _CMP_LE_OQ)));
+                keep_0 &= static_cast<size_t>((inside & 0xF) == 0xF);
+                keep_1 &= static_cast<size_t>((inside >> 4) == 0xF);
+            }
+            if (TRANSFORM) {
+                // shuffle_ps works within each half, so x/y/z of each point are broadcast in its half
+                coordinates = _mm256_add_ps(
+                        _mm256_add_ps(_mm256_mul_ps(_mm256_shuffle_ps(coordinates, coordinates, 0x00), c0),
+                                      _mm256_mul_ps(_mm256_shuffle_ps(coordinates, coordinates, 0x55), c1)),
+                        _mm256_add_ps(_mm256_mul_ps(_mm256_shuffle_ps(coordinates, coordinates, 0xAA), c2), t));
+            }
+            if (CROP && !camera_box) {
+                int inside = _mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(coordinates, lower, _CMP_GE_OQ),
+                                                              _mm256_cmp_ps(coordinates, upper, _CMP_LE_OQ)));
+                keep_0 &= static_cast<size_t>((inside & 0xF) == 0xF);
+                keep_1 &= static_cast<size_t>((inside >> 4) == 0xF);
+            }
+            __m256i points = _mm256_castps_si256(coordinates);
+            __m128i colors = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(__bgra + i * 4));
+            __m256i rgb = _mm256_set_m128i(_mm_shuffle_epi8(colors, rgb_shuffle_1),
+                                           _mm_shuffle_epi8(colors, rgb_shuffle_0));
+            points = _mm256_blend_epi32(points, rgb, 0x88);
+
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(__output + count), _mm256_castsi256_si128(points));
+            count += keep_0;
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(__output + count), _mm256_extracti128_si256(points, 1));
+            count += keep_1;
+        }
+        return extract_points_scalar<TRANSFORM, CROP>(__xyz, __bgra, i, __pixels, __options, __output, count);
+    }
+
+    /*
+     * 8 pixels per iteration, unsigned 16-bit compares are done with min/max,
+     * lower <= d if max(d, lower) == d.
+     * */
+    __attribute__((target("sse4.1")))
+    void subtract_background_sse41(uint16_t *__depth, const uint16_t *__lower, const uint16_t *__upper,
+                                   size_t __pixels) {
+        size_t i = 0;
+        for (; i + 8 <= __pixels; i += 8) {
+            __m128i depth = _mm_loadu_si128(reinterpret_cast<const __m128i *>(__depth + i));
+            __m128i lower = _mm_loadu_si128(reinterpret_cast<const __m128i *>(__lower + i));
+            __m128i upper = _mm_loadu_si128(reinterpret_cast<const __m128i *>(__upper + i));
+            __m128i background = _mm_and_si128(_mm_cmpeq_epi16(_mm_max_epu16(depth, lower), depth),
+                                               _mm_cmpeq_epi16(_mm_min_epu16(depth, upper), depth));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(__depth + i), _mm_andnot_si128(background, depth));
+        }
+        subtract_background_scalar(__depth, __lower, __upper, i, __pixels);
+    }
+
+    /*
+     * 16 pixels per iteration, same as the SSE4.1 kernel.
+     * */
+    __attribute__((target("avx2")))
+    void subtract_background_avx2(uint16_t *__depth, const uint16_t *__lower, const uint16_t *__upper,
+                                  size_t __pixels) {
+        size_t i = 0;
+        for (; i + 16 <= __pixels; i += 16) {
+            __m256i depth = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(__depth + i));
+            __m256i lower = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(__lower + i));
+            __m256i upper = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(__upper + i));
+            __m256i background = _mm256_and_si256(_mm256_cmpeq_epi16(_mm256_max_epu16(depth, lower), depth),
+                                                  _mm256_cmpeq_epi16(_mm256_min_epu16(depth, upper), depth));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(__depth + i), _mm256_andnot_si256(background, depth));
+        }
+        subtract_background_scalar(__depth, __lower, __upper, i, __pixels);
+    }
+
+    /*
+     * 4 pixels per iteration, depth and output are widened to float, restart and
+     * move are lane masks selecting with blendv.
+     * */
+    __attribute__((target("sse4.1")))
+    void temporal_filter_sse41(uint16_t *__depth, float *__average, uint16_t *__output, size_t __pixels,
+                               const kinect::kernel::TemporalOptions &__options) {
+        const __m128 alpha = _mm_set1_ps(__options.alpha), motion = _mm_set1_ps(__options.motion);
+        const __m128 hold = _mm_set1_ps(__options.hold), zero = _mm_setzero_ps();
+        const __m128 magnitude = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+        size_t i = 0;
+        for (; i + 4 <= __pixels; i += 4) {
+            __m128 depth = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(
+                    _mm_loadl_epi64(reinterpret_cast<const __m128i *>(__depth + i))));
+            __m128i last = _mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(__output + i)));
+            __m128 average = _mm_loadu_ps(__average + i), output = _mm_cvtepi32_ps(last);
+            __m128 difference = _mm_sub_ps(depth, average);
+            __m128 restart = _mm_or_ps(_mm_or_ps(_mm_cmpeq_ps(average, zero), _mm_cmpeq_ps(depth, zero)),
+                                       _mm_cmpgt_ps(_mm_and_ps(difference, magnitude), _mm_mul_ps(depth, motion)));
+            average = _mm_blendv_ps(_mm_add_ps(average, _mm_mul_ps(alpha, difference)), depth, restart);
+            __m128 move = _mm_or_ps(restart, _mm_cmpgt_ps(_mm_and_ps(_mm_sub_ps(average, output), magnitude), hold));
+            __m128i next = _mm_blendv_epi8(last, _mm_cvtps_epi32(average), _mm_castps_si128(move));
+            next = _mm_packus_epi32(next, next);
+            _mm_storeu_ps(__average + i, average);
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(__output + i), next);
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(__depth + i), next);
+        }
+        temporal_filter_scalar(__depth, __average, __output, i, __pixels, __options);
+    }
+
+    /*
+     * 8 pixels per iteration, same as the SSE4.1 kernel.
+     * */
+    __attribute__((target("avx2")))
+    void temporal_filter_avx2(uint16_t *__depth, float *__average, uint16_t *__output, size_t __pixels,
+                              const kinect::kernel::TemporalOptions &__options) {
+        const __m256 alpha = _mm256_set1_ps(__options.alpha), motion = _mm256_set1_ps(__options.motion);
+        const __m256 hold = _mm256_set1_ps(__options.hold), zero = _mm256_setzero_ps();
+        const __m256 magnitude = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+        size_t i = 0;
+        for (; i + 8 <= __pixels; i += 8) {
+            __m256 depth = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i *>(__depth + i))));
+            __m256i last = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(__output + i)));
+            __m256 average = _mm256_loadu_ps(__average + i), output = _mm256_cvtepi32_ps(last);
+            __m256 difference = _mm256_sub_ps(depth, average);
+            __m256 restart = _mm256_or_ps(
+                    _mm256_or_ps(_mm256_cmp_ps(average, zero, _CMP_EQ_OQ), _mm256_cmp_ps(depth, zero, _CMP_EQ_OQ)),
+                    _mm256_cmp_ps(_mm256_and_ps(difference, magnitude), _mm256_mul_ps(depth, motion), _CMP_GT_OQ));
+            average = _mm256_blendv_ps(_mm256_add_ps(average, _mm256_mul_ps(alpha, difference)), depth, restart);
+            __m256 move = _mm256_or_ps(restart, _mm256_cmp_ps(_mm256_and_ps(_mm256_sub_ps(average, output), magnitude),
+                                                              hold, _CMP_GT_OQ));
+            __m256i next = _mm256_blendv_epi8(last, _mm256_cvtps_epi32(average), _mm256_castps_si256(move));
+            // packus works within 128-bit halves, the halves are packed together
+            __m128i packed = _mm_packus_epi32(_mm256_castsi256_si128(next), _mm256_extracti128_si256(next, 1));
+            _mm256_storeu_ps(__average + i, average);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(__output + i), packed);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(__depth + i), packed);
+        }
+        temporal_filter_scalar(__depth, __average, __output, i, __pixels, __options);
+    }
+
+    /*
+     * pshufb masks moving 8 x, 8 y and 8 z values to the three 128-bit vectors of
+     * 8 interleaved x, y, z points, -128 clears a byte.
+     * */
+    alignas(16) const int8_t interleave_masks[3][3][16] = {
+            {{0, 1, -128, -128, -128, -128, 2, 3, -128, -128, -128, -128, 4, 5, -128, -128},
+             {-128, -128, 0, 1, -128, -128, -128, -128, 2, 3, -128, -128, -128, -128, 4, 5},
+             {-128, -128, -128, -128, 0, 1, -128, -128, -128, -128, 2, 3, -128, -128, -128, -128}},
+            {{-128, -128, 6, 7, -128, -128, -128, -128, 8, 9, -128, -128, -128, -128, 10, 11},
+             {-128, -128, -128, -128, 6, 7, -128, -128, -128, -128, 8, 9, -128, -128, -128, -128},
+             {4, 5, -128, -128, -128, -128, 6, 7, -128, -128, -128, -128, 8, 9, -128, -128}},
+            {{-128, -128, -128, -128, 12, 13, -128, -128, -128, -128, 14, 15, -128, -128, -128, -128},
+             {10, 11, -128, -128, -128, -128, 12, 13, -128, -128, -128, -128, 14, 15, -128, -128},
+             {-128, -128, 10, 11, -128, -128, -128, -128, 12, 13, -128, -128, -128, -128, 14, 15}}};
+
+    /*
+     * Store 8 points given as 8 int16 x, y and z values, interleaved.
+     * */
+    __attribute__((target("sse4.1")))
+    inline void store_points_sse41(__m128i __x, __m128i __y, __m128i __z, int16_t *__points) {
+        for (int v = 0; v < 3; ++v) {
+            const __m128i *masks = reinterpret_cast<const __m128i *>(interleave_masks[v]);
+            __m128i points = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(__x, _mm_load_si128(masks + 0)),
+                                                       _mm_shuffle_epi8(__y, _mm_load_si128(masks + 1))),
+                                          _mm_shuffle_epi8(__z, _mm_load_si128(masks + 2)));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(__points) + v, points);
+        }
+    }
+
+    /*
+     * 8 pixels per iteration in two halves of 4, products are rounded by cvtps
+     * and saturated to int16 by packs, lanes of NaN rays are cleared by cmpord.
+     * */
+    __attribute__((target("sse4.1")))
+    void unproject_depth_sse41(const uint16_t *__depth, const float *__rays_x, const float *__rays_y,
+                               int16_t *__points, size_t __begin, size_t __end) {
+        size_t i = __begin;
+        for (; i + 8 <= __end; i += 8) {
+            __m128i depth = _mm_loadu_si128(reinterpret_cast<const __m128i *>(__depth + i));
+            __m128 z_low = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(depth));
+            __m128 z_high = _mm_cvtepi32_ps(_mm_cvtepi16_epi32(_mm_srli_si128(depth, 8)));
+            __m128 x_low = _mm_loadu_ps(__rays_x + i), x_high = _mm_loadu_ps(__rays_x + i + 4);
+            __m128 y_low = _mm_loadu_ps(__rays_y + i), y_high = _mm_loadu_ps(__rays_y + i + 4);
+            __m128i valid = _mm_packs_epi32(_mm_castps_si128(_mm_cmpord_ps(x_low, x_low)),
+                                            _mm_castps_si128(_mm_cmpord_ps(x_high, x_high)));
+            __m128i x = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(x_low, z_low)),
+                                        _mm_cvtps_epi32(_mm_mul_ps(x_high, z_high)));
+            __m128i y = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(y_low, z_low)),
+                                        _mm_cvtps_epi32(_mm_mul_ps(y_high, z_high)));
+            store_points_sse41(_mm_and_si128(x, valid), _mm_and_si128(y, valid), _mm_and_si128(depth, valid),
+                               __points + i * 3);
+        }
+        unproject_depth_scalar(__depth, __rays_x, __rays_y, __points, i, __end);
+    }
+
+    /*
+     * 8 pixels per iteration in one 256-bit vector, same as the SSE4.1 kernel.
+     * */
+    __attribute__((target("avx2")))
+    void unproject_depth_avx2(const uint16_t *__depth, const float *__rays_x, const float *__rays_y,
+                              int16_t *__points, size_t __begin, size_t __end) {
+        size_t i = __begin;
+        for (; i + 8 <= __end; i += 8) {
+            __m128i depth = _mm_loadu_si128(reinterpret_cast<const __m128i *>(__depth + i));
+            __m256 z = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(depth));
+            __m256 rays_x = _mm256_loadu_ps(__rays_x + i), rays_y = _mm256_loadu_ps(__rays_y + i);
+            __m256i valid = _mm256_castps_si256(_mm256_cmp_ps(rays_x, rays_x, _CMP_ORD_Q));
+            __m256i x = _mm256_cvtps_epi32(_mm256_mul_ps(rays_x, z));
+            __m256i y = _mm256_cvtps_epi32(_mm256_mul_ps(rays_y, z));
+            // packs works within 128-bit halves, the halves are packed together
+            __m128i valid16 = _mm_packs_epi32(_mm256_castsi256_si128(valid), _mm256_extracti128_si256(valid, 1));
+            __m128i x16 = _mm_packs_epi32(_mm256_castsi256_si128(x), _mm256_extracti128_si256(x, 1));
+            __m128i y16 = _mm_packs_epi32(_mm256_castsi256_si128(y), _mm256_extracti128_si256(y, 1));
+            store_points_sse41(_mm_and_si128(x16, valid16), _mm_and_si128(y16, valid16),
+                               _mm_and_si128(depth, valid16), __points + i * 3);
+        }
+        unproject_depth_scalar(__depth, __rays_x, __rays_y, __points, i, __end);
+    }
+
+    /*
+     * All ones in the lanes where |__depth - __neighbour| > __threshold, tested as
+     * saturated |__depth - __neighbour| - __threshold != 0.
+     * */
+    __attribute__((target("sse4.1")))
+    inline __m128i depth_jump_sse41(__m128i __depth, __m128i __neighbour, __m128i __threshold) {
+        __m128i difference = _mm_or_si128(_mm_subs_epu16(__depth, __neighbour), _mm_subs_epu16(__neighbour, __depth));
+        __m128i small = _mm_cmpeq_epi16(_mm_subs_epu16(difference, __threshold), _mm_setzero_si128());
+        return _mm_xor_si128(small, _mm_set1_epi16(-1));
+    }
+
+    __attribute__((target("avx2")))
+    inline __m256i depth_jump_avx2(__m256i __depth, __m256i __neighbour, __m256i __threshold) {
+        __m256i difference = _mm256_or_si256(_mm256_subs_epu16(__depth, __neighbour),
+                                             _mm256_subs_epu16(__neighbour, __depth));
+        __m256i small = _mm256_cmpeq_epi16(_mm256_subs_epu16(difference, __threshold), _mm256_setzero_si256());
+        return _mm256_xor_si256(small, _mm256_set1_epi16(-1));
+    }
+
+    /*
+     * 8 pixels of a row per iteration, the threshold is the high half of depth * ratio.
+     * */
+    __attribute__((target("sse4.1")))
+    void remove_flying_pixels_sse41(const uint16_t *__row, const uint16_t *__up, const uint16_t *__down,
+                                    uint16_t *__output, int __width, uint16_t __ratio) {
+        const __m128i ratio = _mm_set1_epi16(static_cast<short>(__ratio));
+        // the first and the last pixel have only one horizontal neighbour
+        int x = 1;
+        for (; x + 9 <= __width; x += 8) {
+            __m128i depth = _mm_loadu_si128(reinterpret_cast<const __m128i *>(__row + x));
+            __m128i threshold = _mm_mulhi_epu16(depth, ratio);
+            __m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i *>(__row + x - 1));
+            __m128i right = _mm_loadu_si128(reinterpret_cast<const __m128i *>(__row + x + 1));
+            __m128i up = _mm_loadu_si128(reinterpret_cast<const __m128i *>(__up + x));
+            __m128i down = _mm_loadu_si128(reinterpret_cast<const __m128i *>(__down + x));
+            __m128i flying = _mm_or_si128(
+                    _mm_and_si128(depth_jump_sse41(depth, left, threshold), depth_jump_sse41(depth, right, threshold)),
+                    _mm_and_si128(depth_jump_sse41(depth, up, threshold), depth_jump_sse41(depth, down, threshold)));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(__output + x), _mm_andnot_si128(flying, depth));
+        }
+        remove_flying_pixels_scalar(__row, __up, __down, __output, __width, 0, 1, __ratio);
+        remove_flying_pixels_scalar(__row, __up, __down, __output, __width, x, __width, __ratio);
+    }
+
+    /*
+     * 16 pixels of a row per iteration, same as the SSE4.1 kernel.
+     * */
+    __attribute__((target("avx2")))
+    void remove_flying_pixels_avx2(const uint16_t *__row, const uint16_t *__up, const uint16_t *__down,
+                                   uint16_t *__output, int __width, uint16_t __ratio) {
+        const __m256i ratio = _mm256_set1_epi16(static_cast<short>(__ratio));
+        int x = 1;
+        for (; x + 17 <= __width; x += 16) {
+            __m256i depth = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(__row + x));
+            __m256i threshold = _mm256_mulhi_epu16(depth, ratio);
+            __m256i left = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(__row + x - 1));
+            __m256i right = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(__row + x + 1));
+            __m256i up = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(__up + x));
+            __m256i down = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(__down + x));
+            __m256i flying = _mm256_or_si256(
+                    _mm256_and_si256(depth_jump_avx2(depth, left, threshold), depth_jump_avx2(depth, right, threshold)),
+                    _mm256_and_si256(depth_jump_avx2(depth, up, threshold), depth_jump_avx2(depth, down, threshold)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(__output + x), _mm256_andnot_si256(flying, depth));
+        }
+        remove_flying_pixels_scalar(__row, __up, __down, __output, __width, 0, 1, __ratio);
+        remove_flying_pixels_scalar(__row, __up, __down, __output, __width, x, __width, __ratio);
+    }
+#endif
+
+    template<bool TRANSFORM, bool CROP>
+    size_t extract_points_dispatch(const int16_t *__xyz, const uint8_t *__bgra, size_t __pixels,
+                                   const kinect::kernel::ExtractOptions &__options,
+                                   kinect::type::PointXYZRGB *__output) {
+        switch (current_instruction_set()) {
+#ifdef KINECT_KERNEL_X86
+            case AVX2:
+                return extract_points_avx2<TRANSFORM, CROP>(__xyz, __bgra, __pixels, __options, __output);
+            case SSE41:
+                return extract_points_sse41<TRANSFORM, CROP>(__xyz, __bgra, __pixels, __options, __output);
+#endif
+            default:
+                return extract_points_scalar<TRANSFORM, CROP>(__xyz, __bgra, 0, __pixels, __options, __output, 0);
+        }
+    }
+
+    template<bool TRANSFORM>
+    size_t extract_points_dispatch(const int16_t *__xyz, const uint8_t *__bgra, size_t __pixels,
+                                   const kinect::kernel::ExtractOptions &__options,
+                                   kinect::type::PointXYZRGB *__output) {
+        if (__options.crop != nullptr) {
+            return extract_points_dispatch<TRANSFORM, true>(__xyz, __bgra, __pixels, __options, __output);
+        }
+        return extract_points_dispatch<TRANSFORM, false>(__xyz, __bgra, __pixels, __options, __output);
+    }
+
+    template<bool TRANSFORM>
+    size_t extract_points_soa(const int16_t *__xyz, const uint8_t *__bgra, size_t __pixels,
+                              const kinect::kernel::ExtractOptions &__options,
+                              kinect::type::PointCloudSoA &__output, size_t __first) {
+        if (__options.crop != nullptr) {
+            return extract_points_soa<TRANSFORM, true>(__xyz, __bgra, __pixels, __options, __output, __first);
+        }
+        return extract_points_soa<TRANSFORM, false>(__xyz, __bgra, __pixels, __options, __output, __first);
+    }
+}
+
+size_t kinect::kernel::extract_points(const int16_t *__xyz, const uint8_t *__bgra, size_t __pixels,
+                                      const kinect::kernel::ExtractOptions &__options,
+                                      kinect::type::PointXYZRGB *__output) {
+    if (__options.extrinsics != nullptr) {
+        return extract_points_dispatch<true>(__xyz, __bgra, __pixels, __options, __output);
+    }
+    return extract_points_dispatch<false>(__xyz, __bgra, __pixels, __options, __output);
+}
+
+size_t kinect::kernel::extract_points(const int16_t *__xyz, const uint8_t *__bgra, size_t __pixels,
+                                      const kinect::kernel::ExtractOptions &__options,
+                                      kinect::type::PointCloudSoA &__output, size_t __first) {
+    if (__options.extrinsics != nullptr) {
+        return extract_points_soa<true>(__xyz, __bgra, __pixels, __options, __output, __first);
+    }
+    return extract_points_soa<false>(__xyz, __bgra, __pixels, __options, __output, __first);
+}
+
+void kinect::kernel::subtract_background(uint16_t *__depth, const uint16_t *__lower, const uint16_t *__upper,
+                                         size_t __pixels) {
+    switch (current_instruction_set()) {
+#ifdef KINECT_KERNEL_X86
+        case AVX2:
+            subtract_background_avx2(__depth, __lower, __upper, __pixels);
+            return;
+        case SSE41:
+            subtract_background_sse41(__depth, __lower, __upper, __pixels);
+            return;
+#endif
+        default:
+            subtract_background_scalar(__depth, __lower, __upper, 0, __pixels);
+    }
+}
+
+void kinect::kernel::remove_flying_pixels(const uint16_t *__input, uint16_t *__output, int __width, int __height,
+                                          int __row_begin, int __row_end, uint16_t __ratio) {
+    if (__width <= 0) {
+        return;
+    }
+    InstructionSet isa = current_instruction_set();
+    for (int y = __row_begin; y < __row_end; ++y) {
+        const uint16_t *row = __input + static_cast<size_t>(y) * __width;
+        const uint16_t *up = y == 0 ? row : row - __width, *down = y == __height - 1 ? row : row + __width;
+        uint16_t *output = __output + static_cast<size_t>(y) * __width;
+        switch (isa) {
+#ifdef KINECT_KERNEL_X86
+            case AVX2:
+                remove_flying_pixels_avx2(row, up, down, output, __width, __ratio);
+                break;
+            case SSE41:
+                remove_flying_pixels_sse41(row, up, down, output, __width, __ratio);
+                break;
+#endif
+            default:
+                remove_flying_pixels_scalar(row, up, down, output, __width, 0, __width, __ratio);
+        }
+    }
+}
+
+void kinect::kernel::temporal_filter(uint16_t *__depth, float *__average, uint16_t *__output, size_t __pixels,
+                                     const kinect::kernel::TemporalOptions &__options) {
+    switch (current_instruction_set()) {
+#ifdef KINECT_KERNEL_X86
+        case AVX2:
+            temporal_filter_avx2(__depth, __average, __output, __pixels, __options);
+            return;
+        case SSE41:
+            temporal_filter_sse41(__depth, __average, __output, __pixels, __options);
+            return;
+#endif
+        default:
+            temporal_filter_scalar(__depth, __average, __output, 0, __pixels, __options);
+    }
+}
+
+void kinect::kernel::unproject_depth(const uint16_t *__depth, const float *__rays_x, const float *__rays_y,
+                                     int16_t *__points, size_t __begin, size_t __end) {
+    switch (current_instruction_set()) {
+#ifdef KINECT_KERNEL_X86
+        case AVX2:
+            unproject_depth_avx2(__depth, __rays_x, __rays_y, __points, __begin, __end);
+            return;
+        case SSE41:
+            unproject_depth_sse41(__depth, __rays_x, __rays_y, __points, __begin, __end);
+            return;
+#endif
+        default:
+            unproject_depth_scalar(__depth, __rays_x, __rays_y, __points, __begin, __end);
+    }
+}
+
+bool kinect::kernel::set_instruction_set(const std::string &__name) {
+    InstructionSet isa;
+    if (__name == "avx2") {
+        isa = AVX2;
+    }
+    else if (__name == "sse4.1") {
+        isa = SSE41;
+    }
+    else if (__name == "scalar") {
+        isa = SCALAR;
+    }
+    else {
+        return false;
+    }
+    if (isa > supported_instruction_set()) {
+        return false;
+    }
+    active_instruction_set().store(isa, std::memory_order_relaxed);
+    return true;
+}
+
+const char *kinect::kernel::instruction_set() {
+    switch (current_instruction_set()) {
+        case AVX2:
+            return "avx2";
+        case SSE41:
+            return "sse4.1";
+        default:
+            return "scalar";
+    }
+}
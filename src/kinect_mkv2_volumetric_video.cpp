@@ -6,6 +6,36 @@
 
 #include "kinect_log.h"
 #include "kinect_record.h"
+#include "kinect_kernel.h"
+#include "kinect_trace.h"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+
+// stage names of the transform steps in the run report
+static const char *step_info[kinect::record::TRANSFORM_STEP_COUNT] = {"depth_filter", "registration",
+                                                                       "unprojection", "extraction", "filtering"};
+
+/*
+ * Add a stage of __workers workers for each transform step to __report.
+ * */
+static void add_step_stages(kinect::stats::RunReport &__report, size_t __workers,
+                            kinect::stats::StageStats **__stages) {
+    for (int step = 0; step < kinect::record::TRANSFORM_STEP_COUNT; ++step) {
+        __stages[step] = __report.add_stage(step_info[step], __workers).get();
+    }
+}
+
+/*
+ * Workers writing frames, a stream writer, or VolumetricVideo::output() on a pool and the caller.
+ * */
+static size_t write_workers(const kinect::type::VolumetricVideo &__video) {
+    return __video.streaming() ? 1 : std::max(1u, std::thread::hardware_concurrency()) + 1;
+}
 
 void kinect::record::KinectMkv2VolumetricVideo::init_video(
         const std::string &__video_path) {
@@ -22,6 +52,7 @@ void kinect::record::KinectMkv2VolumetricVideo::init_video(
         }
 
         // open *.mkv file
+        this->video_path_ = __video_path;
         k4a_result_t result = k4a_playback_open(__video_path.c_str(), &this->k4a_handle_);
         if (result != K4A_RESULT_SUCCEEDED) {
             k4a_playback_close(this->k4a_handle_);
@@ -37,28 +68,35 @@ void kinect::record::KinectMkv2VolumetricVideo::init_video(
             throw __error__(RECORD_CONFIGURATION_FAULT);
         }
 
-        // seek beginning timestamp
-        result = k4a_playback_seek_timestamp(this->k4a_handle_, this->k4a_record_config_.start_timestamp_offset_usec,
-                                             K4A_PLAYBACK_SEEK_BEGIN);
-        if (result != K4A_RESULT_SUCCEEDED) {
-            k4a_playback_close(this->k4a_handle_);
-            throw __error__(TIMESTAMP_FAULT);
-        }
-
         // get calibration from Azure Kinect device
-        k4a_calibration_t calibration;
+        k4a_calibration_t &calibration = this->calibration_;
         result = k4a_playback_get_calibration(this->k4a_handle_, &calibration);
         if (result != K4A_RESULT_SUCCEEDED) {
             k4a_playback_close(this->k4a_handle_);
             throw __error__(GET_K4ACALIBRATION_FAILED);
         }
 
-        // create transformation handle
-        this->k4a_point_cloud_transformation_handle_ =
-                k4a_transformation_create(&calibration);
-        if (this->k4a_point_cloud_transformation_handle_ == nullptr) {
+        // keep the calibration blob to be stored with quantized sequences
+        size_t raw_calibration_size = 0;
+        if (k4a_playback_get_raw_calibration(this->k4a_handle_, nullptr, &raw_calibration_size) ==
+            K4A_BUFFER_RESULT_TOO_SMALL) {
+            this->raw_calibration_.resize(raw_calibration_size);
+            if (k4a_playback_get_raw_calibration(this->k4a_handle_, this->raw_calibration_.data(),
+                                                 &raw_calibration_size) != K4A_BUFFER_RESULT_SUCCEEDED) {
+                k4a_playback_close(this->k4a_handle_);
+                throw __error__(GET_K4ACALIBRATION_FAILED);
+            }
+        }
+
+        // seek beginning timestamp and create transformation handle, kept by context_ for get_point_cloud()
+        try {
+            this->seek_range();
+            this->apply_color_scale();
+            this->learn_background();
+        }
+        catch (const kinect::log::except &) {
             k4a_playback_close(this->k4a_handle_);
-            throw __error__(CREATE_K4ATRANFORMATION_FAILED);
+            throw;
         }
 
         __log_time__;
@@ -150,195 +188,1048 @@ void kinect::record::KinectMkv2VolumetricVideo::log_config() const {
     std::cout << "\033[0m";
 }
 
+void kinect::record::KinectMkv2VolumetricVideo::seek_range() {
+    if (this->k4a_handle_ == nullptr) {
+        throw __error__(NO_K4A_HANDLE);
+    }
+    uint64_t length = k4a_playback_get_recording_length_usec(this->k4a_handle_);
+    if (this->config_.start_usec >= length) {
+        throw __error__(TIMESTAMP_FAULT);
+    }
+    uint64_t offset = this->k4a_record_config_.start_timestamp_offset_usec;
+    this->range_.handle = this->k4a_handle_;
+    // history of captures before the seek does not belong to the new range
+    this->range_.temporal.reset();
+    this->range_.begin = offset + this->config_.start_usec;
+    this->range_.end = this->config_.end_usec == 0 ? UINT64_MAX : offset + this->config_.end_usec;
+
+    // device time, so the start offset of the recording is not counted twice
+    if (k4a_playback_seek_timestamp(this->k4a_handle_, static_cast<int64_t>(this->range_.begin),
+                                    K4A_PLAYBACK_SEEK_DEVICE_TIME) != K4A_RESULT_SUCCEEDED) {
+        throw __error__(TIMESTAMP_FAULT);
+    }
+}
+
+void kinect::record::KinectMkv2VolumetricVideo::learn_background() {
+    this->background_.reset();
+    if (this->config_.background_frames == 0) {
+        return;
+    }
+    const std::string &path = this->config_.background_path.empty() ? this->video_path_
+                                                                     : this->config_.background_path;
+    if (access(path.c_str(), F_OK) == -1) {
+        throw __error__(FILE_NOT_EXIST);
+    }
+    k4a_playback_t handle = nullptr;
+    if (k4a_playback_open(path.c_str(), &handle) != K4A_RESULT_SUCCEEDED) {
+        throw __error__(FILE_OPEN_FAULT);
+    }
+    // the empty scene must be seen by the same depth mode
+    k4a_record_configuration_t record_config;
+    if (k4a_playback_get_record_configuration(handle, &record_config) != K4A_RESULT_SUCCEEDED) {
+        k4a_playback_close(handle);
+        throw __error__(RECORD_CONFIGURATION_FAULT);
+    }
+    if (record_config.depth_mode != this->k4a_record_config_.depth_mode) {
+        k4a_playback_close(handle);
+        throw __error__(BACKGROUND_MODEL_FAULT);
+    }
+
+    const k4a_calibration_camera_t &camera = this->calibration_.depth_camera_calibration;
+    std::unique_ptr<kinect::filter::BackgroundModel> model(
+            new kinect::filter::BackgroundModel(camera.resolution_width, camera.resolution_height));
+    // only depth images are read, nothing is decoded
+    while (model->frames() < this->config_.background_frames) {
+        k4a_capture_t capture = nullptr;
+        k4a_stream_result_t stream_result = k4a_playback_get_next_capture(handle, &capture);
+        if (stream_result == K4A_STREAM_RESULT_EOF) {
+            break;
+        }
+        else if (stream_result == K4A_STREAM_RESULT_FAILED) {
+            k4a_playback_close(handle);
+            throw __error__(GET_STREAM_FRAME_FAILED);
+        }
+        k4a_image_t depth_image = k4a_capture_get_depth_image(capture);
+        if (depth_image != nullptr) {
+            bool match = k4a_image_get_width_pixels(depth_image) == model->width() &&
+                         k4a_image_get_height_pixels(depth_image) == model->height();
+            if (match) {
+                model->add_frame(reinterpret_cast<const uint16_t *>(k4a_image_get_buffer(depth_image)));
+            }
+            k4a_image_release(depth_image);
+            if (!match) {
+                k4a_capture_release(capture);
+                k4a_playback_close(handle);
+                throw __error__(WRONG_IMAGE_SIZE);
+            }
+        }
+        k4a_capture_release(capture);
+    }
+    k4a_playback_close(handle);
+    if (model->frames() == 0) {
+        throw __error__(BACKGROUND_MODEL_FAULT);
+    }
+    model->build(this->config_.background_tolerance);
+
+    __log_time__;
+    printf("\033[36mLearned background from %llu frames of %s, %.1f%% of depth pixels have background.\n\033[0m",
+           static_cast<unsigned long long>(model->frames()), path.c_str(), model->coverage() * 100.0);
+    this->background_ = std::move(model);
+}
+
+bool kinect::record::KinectMkv2VolumetricVideo::fetch_frame(kinect::record::PlaybackRange &__range,
+                                                            kinect::record::FrameTask &__task) {
+    if (__range.handle == nullptr) {
+        throw __error__(NO_K4A_HANDLE);
+    }
+    double frame_period_usec = 1e6 / fps_info[this->k4a_record_config_.camera_fps];
+
+    while (true) {
+        // fetch next frame
+        k4a_stream_result_t stream_result = k4a_playback_get_next_capture(__range.handle, &__task.capture);
+        if (stream_result == K4A_STREAM_RESULT_EOF) {
+            return true;
+        }
+        else if (stream_result == K4A_STREAM_RESULT_FAILED) {
+            throw __error__(GET_STREAM_FRAME_FAILED);
+        }
+
+        // get depth image
+        __task.depth_image = k4a_capture_get_depth_image(__task.capture);
+        if (__task.depth_image == nullptr) {
+            throw __error__(GET_DEPTH_FRAME_FAILED);
+        }
+        __task.time_stamp = k4a_image_get_device_timestamp_usec(__task.depth_image);
+
+        if (__task.time_stamp >= __range.end) {
+            this->release_frame(__task);
+            return true;
+        }
+        // seeking may land before __range.begin, the capture then belongs to the previous range
+        if (__task.time_stamp < __range.begin) {
+            this->release_frame(__task);
+            __range.skipped++;
+            continue;
+        }
+        __task.frame_number = static_cast<uint64_t>(
+                std::llround(static_cast<double>(__task.time_stamp - this->range_.begin) / frame_period_usec));
+        if (__task.frame_number % this->config_.stride != 0) {
+            this->release_frame(__task);
+            __range.skipped++;
+            continue;
+        }
+        break;
+    }
+
+    // the capture is owned by this frame only, its depth image is changed in place
+    if (this->config_.temporal_alpha != 0.0f) {
+        if (__range.temporal == nullptr) {
+            __range.temporal.reset(new kinect::filter::TemporalFilter);
+        }
+        kinect::kernel::TemporalOptions options;
+        options.alpha = this->config_.temporal_alpha;
+        options.motion = this->config_.temporal_motion;
+        options.hold = this->config_.temporal_hold;
+        size_t pixels = static_cast<size_t>(k4a_image_get_width_pixels(__task.depth_image)) *
+                        static_cast<size_t>(k4a_image_get_height_pixels(__task.depth_image));
+        __range.temporal->filter(reinterpret_cast<uint16_t *>(k4a_image_get_buffer(__task.depth_image)), pixels,
+                                 options);
+    }
+
+    // color image
+    __task.color_image = k4a_capture_get_color_image(__task.capture);
+    if (__task.color_image == nullptr) {
+        throw __error__(GET_COLOR_FRAME_FAILED);
+    }
+
+    // check format
+    k4a_image_format_t format = k4a_image_get_format(__task.color_image);
+    if (format != K4A_IMAGE_FORMAT_COLOR_MJPG) {
+        throw __error__(WRONG_COLOR_FORMAT);
+    }
+    return false;
+}
+
+void kinect::record::KinectMkv2VolumetricVideo::apply_color_scale() {
+    this->scaled_calibration_ = this->calibration_;
+    k4a_calibration_camera_t &camera = this->scaled_calibration_.color_camera_calibration;
+    tjscalingfactor factor = {1, this->config_.color_scale};
+    // same rounding as tjDecompress2, so images and calibration always agree
+    int width = TJSCALED(camera.resolution_width, factor);
+    int height = TJSCALED(camera.resolution_height, factor);
+    float scale_x = static_cast<float>(width) / static_cast<float>(camera.resolution_width);
+    float scale_y = static_cast<float>(height) / static_cast<float>(camera.resolution_height);
+    camera.resolution_width = width;
+    camera.resolution_height = height;
+    // k4a principal point is relative to the center of the top-left pixel
+    k4a_calibration_intrinsic_parameters_t &intrinsics = camera.intrinsics.parameters;
+    intrinsics.param.cx = (intrinsics.param.cx + 0.5f) * scale_x - 0.5f;
+    intrinsics.param.cy = (intrinsics.param.cy + 0.5f) * scale_y - 0.5f;
+    intrinsics.param.fx *= scale_x;
+    intrinsics.param.fy *= scale_y;
+
+    this->context_.reset(new kinect::record::FrameContext(this->scaled_calibration_));
+    this->context_->transformation();
+    this->color_pool_.reset();
+
+    // the rays depend on the calibration of the point cloud camera only, built once per setting
+    if (this->config_.engine == kinect::record::NATIVE_ENGINE) {
+        this->rays_.build(this->config_.geometry == kinect::record::DEPTH_GEOMETRY
+                          ? this->scaled_calibration_.depth_camera_calibration
+                          : this->scaled_calibration_.color_camera_calibration, this->filter_pool_.get());
+        if (this->config_.geometry == kinect::record::COLOR_GEOMETRY) {
+            this->registration_.build(this->scaled_calibration_, this->filter_pool_.get());
+        }
+    }
+}
+
+void kinect::record::KinectMkv2VolumetricVideo::create_color_pool(size_t __count) {
+    int color_width = this->scaled_calibration_.color_camera_calibration.resolution_width;
+    int color_height = this->scaled_calibration_.color_camera_calibration.resolution_height;
+    this->color_pool_.reset(new kinect::record::ImagePool(__count, K4A_IMAGE_FORMAT_COLOR_BGRA32, color_width,
+                                                          color_height, color_width * 4 * (int) sizeof(uint8_t)));
+}
+
+k4a_image_t kinect::record::KinectMkv2VolumetricVideo::decode_color_image(kinect::record::FrameContext &__context,
+                                                                          k4a_image_t &__color_image) {
+    // get color image size after scaling
+    tjscalingfactor factor = {1, this->config_.color_scale};
+    int color_width = TJSCALED(k4a_image_get_width_pixels(__color_image), factor);
+    int color_height = TJSCALED(k4a_image_get_height_pixels(__color_image), factor);
+
+    // take an uncompressed image from pool
+    k4a_image_t uncompressed_color_image = this->color_pool_->acquire();
+    if (k4a_image_get_width_pixels(uncompressed_color_image) != color_width ||
+        k4a_image_get_height_pixels(uncompressed_color_image) != color_height) {
+        this->color_pool_->release(uncompressed_color_image);
+        throw __error__(WRONG_IMAGE_SIZE);
+    }
+
+    // JPEG decompression, TurboJPEG picks the scaling factor matching color_width x color_height
+    if (tjDecompress2(__context.decompressor(),
+                      k4a_image_get_buffer(__color_image),
+                      static_cast<unsigned long>(k4a_image_get_size(__color_image)),
+                      k4a_image_get_buffer(uncompressed_color_image),
+                      color_width,
+                      0, // pitch
+                      color_height,
+                      TJPF_BGRA,
+                      TJFLAG_FASTDCT | TJFLAG_FASTUPSAMPLE) != 0) {
+        this->color_pool_->release(uncompressed_color_image);
+        throw __error__(JPEG_DECOMPRESSION_FAULT);
+    }
+    return uncompressed_color_image;
+}
+
+k4a_image_t kinect::record::KinectMkv2VolumetricVideo::filter_depth_image(kinect::record::FrameContext &__context,
+                                                                         k4a_image_t &__depth_image) {
+    int width = k4a_image_get_width_pixels(__depth_image), height = k4a_image_get_height_pixels(__depth_image);
+    if (this->background_ != nullptr) {
+        if (width != this->background_->width() || height != this->background_->height()) {
+            throw __error__(WRONG_IMAGE_SIZE);
+        }
+        // the capture is owned by this frame only, its depth image is changed in place
+        this->background_->subtract(reinterpret_cast<uint16_t *>(k4a_image_get_buffer(__depth_image)));
+    }
+    if (this->config_.flying_pixel_ratio == 0.0f) {
+        return __depth_image;
+    }
+    // neighbours are read from the original image, so the result goes to another one
+    k4a_image_t filtered_depth_image = __context.image(kinect::record::FILTERED_DEPTH_IMAGE,
+                                                       K4A_IMAGE_FORMAT_DEPTH16, width, height,
+                                                       width * (int) sizeof(uint16_t));
+    kinect::filter::remove_flying_pixels(reinterpret_cast<const uint16_t *>(k4a_image_get_buffer(__depth_image)),
+                                         reinterpret_cast<uint16_t *>(k4a_image_get_buffer(filtered_depth_image)),
+                                         width, height, this->config_.flying_pixel_ratio, this->filter_pool_.get());
+    return filtered_depth_image;
+}
+
+void kinect::record::KinectMkv2VolumetricVideo::unproject_depth_image(
+        kinect::record::FrameContext &__context, k4a_image_t &__depth_image, k4a_calibration_type_t __camera,
+        k4a_image_t &__point_cloud_image) {
+    int width = k4a_image_get_width_pixels(__depth_image);
+    int height = k4a_image_get_height_pixels(__depth_image);
+    if (this->config_.engine == kinect::record::K4A_ENGINE) {
+        if (k4a_transformation_depth_image_to_point_cloud(__context.transformation(), __depth_image, __camera,
+                                                          __point_cloud_image) == K4A_RESULT_FAILED) {
+            throw __error__(IMAGE_TRANSFORMATION_FAULT);
+        }
+        size_t pixels = static_cast<size_t>(width) * height;
+        kinect::stats::count_traffic(pixels * sizeof(uint16_t), pixels * sizeof(int16_t) * 3);
+        return;
+    }
+
+    // rays are built for the calibration of the current geometry and color scale
+    if (width != this->rays_.width() || height != this->rays_.height()) {
+        throw __error__(WRONG_IMAGE_SIZE);
+    }
+    const uint16_t *depth = static_cast<const uint16_t *>(
+            static_cast<void *>(k4a_image_get_buffer(__depth_image)));
+    int16_t *points = static_cast<int16_t *>(static_cast<void *>(k4a_image_get_buffer(__point_cloud_image)));
+    kinect::camera::unproject_depth(this->rays_, depth, points, this->filter_pool_.get());
+    if (!this->config_.verify_engine) {
+        return;
+    }
+
+    // k4a rounds half way products either way, so 1 millimeter is allowed
+    k4a_image_t reference = __context.image(kinect::record::VERIFY_POINT_CLOUD_IMAGE, K4A_IMAGE_FORMAT_CUSTOM, width,
+                                            height, width * (int) sizeof(int16_t) * 3);
+    if (k4a_transformation_depth_image_to_point_cloud(__context.transformation(), __depth_image, __camera,
+                                                      reference) == K4A_RESULT_FAILED) {
+        throw __error__(IMAGE_TRANSFORMATION_FAULT);
+    }
+    const int16_t *reference_points = static_cast<const int16_t *>(
+            static_cast<void *>(k4a_image_get_buffer(reference)));
+    if (kinect::camera::max_difference(points, reference_points, static_cast<size_t>(width) * height) > 1) {
+        throw __error__(ENGINE_MISMATCH);
+    }
+}
+
 k4a_image_t kinect::record::KinectMkv2VolumetricVideo::get_point_cloud_image(
-        k4a_image_t &__color_image, k4a_image_t &__depth_image) {
+        kinect::record::FrameContext &__context, k4a_image_t &__color_image, k4a_image_t &__depth_image,
+        k4a_image_t &__point_color_image, kinect::record::FrameTask &__task) {
+    uint64_t time = kinect::stats::now_nsec();
+    if (this->config_.geometry == kinect::record::DEPTH_GEOMETRY) {
+        // get depth image size, width and height
+        int depth_image_width = k4a_image_get_width_pixels(__depth_image);
+        int depth_image_height = k4a_image_get_height_pixels(__depth_image);
+
+        // intermediate images are kept by context and reused for next frame
+        k4a_image_t transformed_color_image = __context.image(
+                kinect::record::TRANSFORMED_COLOR_IMAGE, K4A_IMAGE_FORMAT_COLOR_BGRA32, depth_image_width,
+                depth_image_height, depth_image_width * 4 * (int) sizeof(uint8_t));
+        k4a_image_t point_cloud_image = __context.image(
+                kinect::record::POINT_CLOUD_IMAGE, K4A_IMAGE_FORMAT_CUSTOM, depth_image_width, depth_image_height,
+                depth_image_width * (int) sizeof(int16_t) * 3);
+
+        // transform color image to depth camera
+        k4a_result_t result = k4a_transformation_color_image_to_depth_camera(
+                __context.transformation(), __depth_image, __color_image, transformed_color_image);
+        if (result == K4A_RESULT_FAILED) {
+            throw __error__(IMAGE_TRANSFORMATION_FAULT);
+        }
+        size_t pixels = static_cast<size_t>(depth_image_width) * depth_image_height;
+        kinect::stats::count_traffic(pixels * sizeof(uint16_t) + static_cast<size_t>(
+                k4a_image_get_width_pixels(__color_image)) * k4a_image_get_height_pixels(__color_image) * 4, pixels * 4);
+        time = end_step(__task, kinect::record::REGISTRATION_STEP, time);
+
+        // transform native depth image to point cloud image
+        this->unproject_depth_image(__context, __depth_image, K4A_CALIBRATION_TYPE_DEPTH, point_cloud_image);
+        end_step(__task, kinect::record::UNPROJECTION_STEP, time);
+        __point_color_image = transformed_color_image;
+        return point_cloud_image;
+    }
+
     // get color image size, width and height
     int color_image_width = k4a_image_get_width_pixels(__color_image);
     int color_image_height = k4a_image_get_height_pixels(__color_image);
 
-    // create new image
-    k4a_image_t transformed_depth_image, point_cloud_image;
-
-    k4a_result_t result = k4a_image_create(
-            K4A_IMAGE_FORMAT_DEPTH16, color_image_width, color_image_height,
-            color_image_width * sizeof(int16_t), &transformed_depth_image);
-    if (result == K4A_RESULT_FAILED) {
-        throw __error__(CREATE_IMAGE_FAILED);
+    // intermediate images are kept by context and reused for next frame
+    k4a_image_t point_cloud_image = __context.image(
+            kinect::record::POINT_CLOUD_IMAGE, K4A_IMAGE_FORMAT_CUSTOM, color_image_width, color_image_height,
+            color_image_width * (int) sizeof(int16_t) * 3);
+    const uint16_t *depth = static_cast<const uint16_t *>(static_cast<void *>(k4a_image_get_buffer(__depth_image)));
+    int depth_image_width = k4a_image_get_width_pixels(__depth_image);
+    int depth_image_height = k4a_image_get_height_pixels(__depth_image);
+    bool native = this->config_.engine == kinect::record::NATIVE_ENGINE;
+    if (native && (depth_image_width != this->scaled_calibration_.depth_camera_calibration.resolution_width ||
+                   depth_image_height != this->scaled_calibration_.depth_camera_calibration.resolution_height ||
+                   color_image_width != this->rays_.width() || color_image_height != this->rays_.height())) {
+        throw __error__(WRONG_IMAGE_SIZE);
     }
 
-    result = k4a_image_create(
-            K4A_IMAGE_FORMAT_CUSTOM, color_image_width, color_image_height,
-            color_image_width * sizeof(int16_t) * 3, &point_cloud_image);
-    if (result == K4A_RESULT_FAILED) {
-        throw __error__(CREATE_IMAGE_FAILED);
+    // native registration writes points directly, the registered depth image is never built
+    if (native && !this->config_.verify_engine) {
+        this->registration_.depth_to_color_points(
+                depth, this->rays_, static_cast<int16_t *>(static_cast<void *>(k4a_image_get_buffer(point_cloud_image))),
+                __context.registration_buffer(), this->filter_pool_.get());
+        end_step(__task, kinect::record::REGISTRATION_STEP, time);
+        __point_color_image = __color_image;
+        return point_cloud_image;
     }
 
+    k4a_image_t transformed_depth_image = __context.image(
+            kinect::record::TRANSFORMED_DEPTH_IMAGE, K4A_IMAGE_FORMAT_DEPTH16, color_image_width,
+            color_image_height, color_image_width * (int) sizeof(int16_t));
+
     // transform depth image to a color image
-    result = k4a_transformation_depth_image_to_color_camera(
-            this->k4a_point_cloud_transformation_handle_, __depth_image,
-            transformed_depth_image);
+    if (native) {
+        this->registration_.depth_to_color(
+                depth, static_cast<uint16_t *>(static_cast<void *>(k4a_image_get_buffer(transformed_depth_image))),
+                __context.registration_buffer(), this->filter_pool_.get());
 
-    if (result == K4A_RESULT_FAILED) {
-        throw __error__(IMAGE_TRANSFORMATION_FAULT);
+        // registrations differ at edges and on sub pixel positions, only a share of pixels may differ
+        k4a_image_t reference = __context.image(kinect::record::VERIFY_DEPTH_IMAGE, K4A_IMAGE_FORMAT_DEPTH16,
+                                                color_image_width, color_image_height,
+                                                color_image_width * (int) sizeof(int16_t));
+        if (k4a_transformation_depth_image_to_color_camera(__context.transformation(), __depth_image, reference) ==
+            K4A_RESULT_FAILED) {
+            throw __error__(IMAGE_TRANSFORMATION_FAULT);
+        }
+        if (kinect::camera::registration_mismatch(
+                static_cast<const uint16_t *>(static_cast<void *>(k4a_image_get_buffer(transformed_depth_image))),
+                static_cast<const uint16_t *>(static_cast<void *>(k4a_image_get_buffer(reference))),
+                static_cast<size_t>(color_image_width) * color_image_height) > 0.01) {
+            throw __error__(ENGINE_MISMATCH);
+        }
     }
-
-    // transform depth image to point cloud image
-    result = k4a_transformation_depth_image_to_point_cloud(
-            this->k4a_point_cloud_transformation_handle_, transformed_depth_image,
-            K4A_CALIBRATION_TYPE_COLOR, point_cloud_image);
-    if (result == K4A_RESULT_FAILED) {
-        throw __error__(IMAGE_TRANSFORMATION_FAULT);
+    else {
+        if (k4a_transformation_depth_image_to_color_camera(__context.transformation(), __depth_image,
+                                                           transformed_depth_image) == K4A_RESULT_FAILED) {
+            throw __error__(IMAGE_TRANSFORMATION_FAULT);
+        }
+        kinect::stats::count_traffic(static_cast<size_t>(depth_image_width) * depth_image_height * sizeof(uint16_t),
+                                     static_cast<size_t>(color_image_width) * color_image_height * sizeof(uint16_t));
     }
 
-    // free memory
-    k4a_image_release(transformed_depth_image);
+    time = end_step(__task, kinect::record::REGISTRATION_STEP, time);
+
+    // transform depth image to point cloud image
+    this->unproject_depth_image(__context, transformed_depth_image, K4A_CALIBRATION_TYPE_COLOR, point_cloud_image);
+    end_step(__task, kinect::record::UNPROJECTION_STEP, time);
+    __point_color_image = __color_image;
     return point_cloud_image;
 }
 
+kinect::kernel::ExtractOptions kinect::record::KinectMkv2VolumetricVideo::extract_options() const {
+    // drop pixels without depth, or without color in depth geometry, and pixels out of the
+    // depth range or crop box before they are stored, background pixels are already removed
+    // from the depth image by filter_depth_image()
+    kinect::kernel::ExtractOptions options;
+    options.extrinsics = this->has_extrinsics_ ? &this->extrinsics_ : nullptr;
+    options.depth_min = static_cast<int16_t>(this->config_.near_z);
+    options.depth_max = this->config_.far_z != 0 ? static_cast<int16_t>(this->config_.far_z) : INT16_MAX;
+    options.crop = this->config_.crop ? &this->config_.crop_box : nullptr;
+    options.crop_camera = this->config_.crop_camera;
+    return options;
+}
+
 void kinect::record::KinectMkv2VolumetricVideo::generate_point_cloud(
-        k4a_image_t &__point_cloud_image, k4a_image_t &__color_image) {
-    try {
-        if (__point_cloud_image == nullptr || __color_image == nullptr) {
-            throw __error__(EMPTY_IMAGE);
-        }
+        kinect::record::FrameContext &__context, k4a_image_t &__point_cloud_image, k4a_image_t &__color_image,
+        kinect::record::FrameTask &__task) {
+    if (__point_cloud_image == nullptr || __color_image == nullptr) {
+        throw __error__(EMPTY_IMAGE);
+    }
+    uint64_t time = kinect::stats::now_nsec();
 
-        // get image size
-        int width = k4a_image_get_width_pixels(__color_image);
-        int height = k4a_image_get_height_pixels(__color_image);
+    // get image size
+    int width = k4a_image_get_width_pixels(__color_image);
+    int height = k4a_image_get_height_pixels(__color_image);
+    size_t pixels = static_cast<size_t>(width) * height;
 
-        // get image data
-        int16_t *point_cloud_data = static_cast<int16_t *>(
-                static_cast<void *>(k4a_image_get_buffer(__point_cloud_image)));
+    // get image data
+    const int16_t *point_cloud_data = static_cast<const int16_t *>(
+            static_cast<void *>(k4a_image_get_buffer(__point_cloud_image)));
 
-        uint8_t *color_image_data = k4a_image_get_buffer(__color_image);
+    const uint8_t *color_image_data = k4a_image_get_buffer(__color_image);
 
-        // generate points
-        std::vector<kinect::type::PointXYZRGB> point_cloud;
-        for (int i = 0; i < width * height; ++i) {
-            kinect::type::PointXYZRGB point;
+    // points are compacted in a buffer of context, then filtered to the frame
+    kinect::kernel::ExtractOptions options = this->extract_options();
+    size_t count;
+    if (this->config_.layout == kinect::type::SOA_LAYOUT) {
+        count = kinect::kernel::extract_points(point_cloud_data, color_image_data, pixels, options,
+                                               __context.point_buffer_soa(pixels), 0);
+        kinect::stats::count_traffic(pixels * (sizeof(int16_t) * 3 + 4), count * (sizeof(float) * 3 + 3));
+    }
+    else {
+        count = kinect::kernel::extract_points(point_cloud_data, color_image_data, pixels, options,
+                                               __context.point_buffer(pixels));
+        kinect::stats::count_traffic(pixels * (sizeof(int16_t) * 3 + 4), count * sizeof(kinect::type::PointXYZRGB));
+    }
+    time = end_step(__task, kinect::record::EXTRACTION_STEP, time);
+    this->filter_points(__context, count, __task);
+    end_step(__task, kinect::record::FILTERING_STEP, time);
+}
 
-            point.x = point_cloud_data[i * 3 + 0];
-            point.y = point_cloud_data[i * 3 + 1];
-            point.z = point_cloud_data[i * 3 + 2];
+size_t kinect::record::KinectMkv2VolumetricVideo::extract_fused(kinect::record::FrameContext &__context,
+                                                                k4a_image_t &__color_image,
+                                                                k4a_image_t &__depth_image,
+                                                                kinect::record::FrameTask &__task) {
+    if (__color_image == nullptr || __depth_image == nullptr) {
+        throw __error__(EMPTY_IMAGE);
+    }
+    uint64_t time = kinect::stats::now_nsec();
+    int depth_width = k4a_image_get_width_pixels(__depth_image);
+    int depth_height = k4a_image_get_height_pixels(__depth_image);
+    int color_width = k4a_image_get_width_pixels(__color_image);
+    int color_height = k4a_image_get_height_pixels(__color_image);
+    const uint16_t *depth = static_cast<const uint16_t *>(static_cast<void *>(k4a_image_get_buffer(__depth_image)));
+    kinect::kernel::ExtractOptions options = this->extract_options();
+    kinect::camera::RegistrationBuffer &buffer = __context.registration_buffer();
+    kinect::type::ThreadPool *pool = this->filter_pool_.get();
+    bool soa = this->config_.layout == kinect::type::SOA_LAYOUT;
 
-            // TODO : Filtering background here.
-            if (point.z == 0) {
-                continue;
+    if (this->config_.geometry == kinect::record::COLOR_GEOMETRY) {
+        // registration, unprojection and extraction in one pass over tiles of color rows
+        if (depth_width != this->scaled_calibration_.depth_camera_calibration.resolution_width ||
+            depth_height != this->scaled_calibration_.depth_camera_calibration.resolution_height ||
+            color_width != this->rays_.width() || color_height != this->rays_.height()) {
+            throw __error__(WRONG_IMAGE_SIZE);
+        }
+        size_t pixels = static_cast<size_t>(color_width) * color_height;
+        const uint8_t *bgra = k4a_image_get_buffer(__color_image);
+        size_t count = soa ? this->registration_.extract_points(depth, this->rays_, bgra, options,
+                                                                __context.point_buffer_soa(pixels), buffer, pool)
+                           : this->registration_.extract_points(depth, this->rays_, bgra, options,
+                                                                __context.point_buffer(pixels), buffer, pool);
+        end_step(__task, kinect::record::EXTRACTION_STEP, time);
+        return count;
+    }
+
+    // color is still registered to the depth camera by k4a, unprojection and extraction are fused
+    if (depth_width != this->rays_.width() || depth_height != this->rays_.height()) {
+        throw __error__(WRONG_IMAGE_SIZE);
+    }
+    size_t pixels = static_cast<size_t>(depth_width) * depth_height;
+    k4a_image_t transformed_color_image = __context.image(
+            kinect::record::TRANSFORMED_COLOR_IMAGE, K4A_IMAGE_FORMAT_COLOR_BGRA32, depth_width, depth_height,
+            depth_width * 4 * (int) sizeof(uint8_t));
+    if (k4a_transformation_color_image_to_depth_camera(__context.transformation(), __depth_image, __color_image,
+                                                       transformed_color_image) == K4A_RESULT_FAILED) {
+        throw __error__(IMAGE_TRANSFORMATION_FAULT);
+    }
+    kinect::stats::count_traffic(pixels * sizeof(uint16_t) + static_cast<size_t>(color_width) * color_height * 4,
+                                 pixels * 4);
+    time = end_step(__task, kinect::record::REGISTRATION_STEP, time);
+    const uint8_t *bgra = k4a_image_get_buffer(transformed_color_image);
+    size_t count = soa ? kinect::camera::extract_points(this->rays_, depth, bgra, options,
+                                                        __context.point_buffer_soa(pixels), buffer, pool)
+                       : kinect::camera::extract_points(this->rays_, depth, bgra, options,
+                                                        __context.point_buffer(pixels), buffer, pool);
+    end_step(__task, kinect::record::EXTRACTION_STEP, time);
+    return count;
+}
+
+void kinect::record::KinectMkv2VolumetricVideo::filter_points(kinect::record::FrameContext &__context,
+                                                              size_t __count, kinect::record::FrameTask &__task) {
+    // points are copied once to an exactly sized frame, or filtered to it by the
+    // outlier filter, the voxel grid filter or both, a filter is counted as one
+    // read of its input and one write of its output
+    const float radius = this->config_.outlier_radius, voxel_size = this->config_.voxel_size;
+    const size_t neighbours = this->config_.outlier_neighbours;
+    kinect::type::ThreadPool *pool = this->filter_pool_.get();
+    if (this->config_.layout == kinect::type::SOA_LAYOUT) {
+        const size_t bytes = sizeof(float) * 3 + 3;
+        kinect::type::PointCloudSoA &buffer = __context.point_buffer_soa(__count);
+        kinect::type::PointCloudSoA &point_cloud = __task.point_cloud_soa;
+        if (radius != 0.0f && voxel_size != 0.0f) {
+            kinect::type::PointCloudSoA &filtered = __context.filtered_points_soa();
+            __context.outlier_filter().filter(buffer, __count, radius, neighbours, pool, filtered);
+            __context.voxel_grid().downsample(filtered, filtered.size(), voxel_size, pool, point_cloud);
+            kinect::stats::count_traffic((__count + filtered.size()) * bytes,
+                                         (filtered.size() + point_cloud.size()) * bytes);
+        }
+        else if (radius != 0.0f) {
+            __context.outlier_filter().filter(buffer, __count, radius, neighbours, pool, point_cloud);
+            kinect::stats::count_traffic(__count * bytes, point_cloud.size() * bytes);
+        }
+        else if (voxel_size != 0.0f) {
+            __context.voxel_grid().downsample(buffer, __count, voxel_size, pool, point_cloud);
+            kinect::stats::count_traffic(__count * bytes, point_cloud.size() * bytes);
+        }
+        else {
+            point_cloud.x.assign(buffer.x.begin(), buffer.x.begin() + __count);
+            point_cloud.y.assign(buffer.y.begin(), buffer.y.begin() + __count);
+            point_cloud.z.assign(buffer.z.begin(), buffer.z.begin() + __count);
+            point_cloud.rgb.assign(buffer.rgb.begin(), buffer.rgb.begin() + __count * 3);
+            kinect::stats::count_traffic(__count * bytes, __count * bytes);
+        }
+    }
+    else {
+        const size_t bytes = sizeof(kinect::type::PointXYZRGB);
+        kinect::type::PointXYZRGB *buffer = __context.point_buffer(__count);
+        std::vector<kinect::type::PointXYZRGB> &point_cloud = __task.point_cloud;
+        if (radius != 0.0f && voxel_size != 0.0f) {
+            std::vector<kinect::type::PointXYZRGB> &filtered = __context.filtered_points();
+            __context.outlier_filter().filter(buffer, __count, radius, neighbours, pool, filtered);
+            __context.voxel_grid().downsample(filtered.data(), filtered.size(), voxel_size, pool, point_cloud);
+            kinect::stats::count_traffic((__count + filtered.size()) * bytes,
+                                         (filtered.size() + point_cloud.size()) * bytes);
+        }
+        else if (radius != 0.0f) {
+            __context.outlier_filter().filter(buffer, __count, radius, neighbours, pool, point_cloud);
+            kinect::stats::count_traffic(__count * bytes, point_cloud.size() * bytes);
+        }
+        else if (voxel_size != 0.0f) {
+            __context.voxel_grid().downsample(buffer, __count, voxel_size, pool, point_cloud);
+            kinect::stats::count_traffic(__count * bytes, point_cloud.size() * bytes);
+        }
+        else {
+            point_cloud.assign(buffer, buffer + __count);
+            kinect::stats::count_traffic(__count * bytes, __count * bytes);
+        }
+    }
+}
+
+void kinect::record::KinectMkv2VolumetricVideo::transform_frame(kinect::record::FrameContext &__context,
+                                                                k4a_image_t &__color_image,
+                                                                k4a_image_t &__depth_image,
+                                                                kinect::record::FrameTask &__task) {
+    // points go to the storage of a written frame in streaming mode
+    if (this->config_.layout == kinect::type::SOA_LAYOUT) {
+        this->video_.reuse_points(__task.point_cloud_soa);
+    }
+    else {
+        this->video_.reuse_points(__task.point_cloud);
+    }
+    if (this->config_.fuse_points) {
+        size_t count = this->extract_fused(__context, __color_image, __depth_image, __task);
+        uint64_t time = kinect::stats::now_nsec();
+        const kinect::camera::RegistrationBuffer &buffer = __context.registration_buffer();
+        bool soa = this->config_.layout == kinect::type::SOA_LAYOUT;
+        // without filters tiles are copied to the frame at once, filters need them together first
+        if (this->config_.outlier_radius == 0.0f && this->config_.voxel_size == 0.0f) {
+            if (soa) {
+                kinect::camera::gather_points(buffer, __context.point_buffer_soa(count), __task.point_cloud_soa);
+            }
+            else {
+                kinect::camera::gather_points(buffer, __context.point_buffer(count), __task.point_cloud);
             }
+            end_step(__task, kinect::record::FILTERING_STEP, time);
+            return;
+        }
+        if (soa) {
+            kinect::camera::compact_points(buffer, __context.point_buffer_soa(count));
+        }
+        else {
+            kinect::camera::compact_points(buffer, __context.point_buffer(count));
+        }
+        this->filter_points(__context, count, __task);
+        end_step(__task, kinect::record::FILTERING_STEP, time);
+        return;
+    }
+    k4a_image_t point_color_image;
+    k4a_image_t point_cloud_image = this->get_point_cloud_image(__context, __color_image, __depth_image,
+                                                                point_color_image, __task);
+    this->generate_point_cloud(__context, point_cloud_image, point_color_image, __task);
+}
 
-            point.b = color_image_data[i * 4 + 0];
-            point.g = color_image_data[i * 4 + 1];
-            point.r = color_image_data[i * 4 + 2];
+uint64_t kinect::record::KinectMkv2VolumetricVideo::end_step(kinect::record::FrameTask &__task,
+                                                             kinect::record::TransformStep __step, uint64_t __begin) {
+    uint64_t end = kinect::stats::now_nsec();
+    __task.step_nsec[__step] += end - __begin;
+    __task.steps |= 1u << __step;
+    kinect::trace::record(step_info[__step], __task.index, __begin, end);
+    return end;
+}
 
-            point_cloud.emplace_back(point);
+void kinect::record::KinectMkv2VolumetricVideo::add_steps(kinect::stats::StageStats *const *__stages,
+                                                          const kinect::record::FrameTask &__task) {
+    for (int step = 0; step < kinect::record::TRANSFORM_STEP_COUNT; ++step) {
+        if (__task.steps & (1u << step)) {
+            __stages[step]->add(__task.step_nsec[step]);
         }
+    }
+}
 
-        this->video_.add_point_cloud(
-                point_cloud,
-                this->k4a_record_config_.start_timestamp_offset_usec,
-                this->k4a_record_config_.camera_fps);
+void kinect::record::KinectMkv2VolumetricVideo::add_frame(kinect::record::FrameTask &__task) {
+    if (this->config_.layout == kinect::type::SOA_LAYOUT) {
+        this->video_.add_point_cloud(std::move(__task.point_cloud_soa), __task.time_stamp);
     }
-    catch (const kinect::log::except &error_log) {
-        error_log.log_error();
-        this->~KinectMkv2VolumetricVideo();
-        exit(1);
+    else {
+        this->video_.add_point_cloud(std::move(__task.point_cloud), __task.time_stamp);
+    }
+}
+
+void kinect::record::KinectMkv2VolumetricVideo::process_frame(kinect::record::FrameContext &__context,
+                                                              kinect::record::FrameTask &__task) {
+    {
+        // decode is a stage of convert() only, other drivers see it in the timeline
+        kinect::trace::Span span("decode", __task.index);
+        __task.uncompressed_color_image = this->decode_color_image(__context, __task.color_image);
+    }
+    uint64_t time = kinect::stats::now_nsec();
+    k4a_image_t depth_image = this->filter_depth_image(__context, __task.depth_image);
+    end_step(__task, kinect::record::DEPTH_FILTER_STEP, time);
+    this->transform_frame(__context, __task.uncompressed_color_image, depth_image, __task);
+    this->release_frame(__task);
+}
+
+void kinect::record::KinectMkv2VolumetricVideo::release_frame(kinect::record::FrameTask &__task) {
+    if (__task.depth_image != nullptr) {
+        k4a_image_release(__task.depth_image);
+        __task.depth_image = nullptr;
+    }
+    if (__task.color_image != nullptr) {
+        k4a_image_release(__task.color_image);
+        __task.color_image = nullptr;
+    }
+    if (__task.uncompressed_color_image != nullptr) {
+        this->color_pool_->release(__task.uncompressed_color_image);
+        __task.uncompressed_color_image = nullptr;
+    }
+    // the capture still holds its images, release it too
+    if (__task.capture != nullptr) {
+        k4a_capture_release(__task.capture);
+        __task.capture = nullptr;
     }
 }
 
 bool kinect::record::KinectMkv2VolumetricVideo::get_point_cloud() {
     try {
-        timeval time_start, time_end;
-        mingw_gettimeofday(&time_start, nullptr);
-        if (this->k4a_handle_ == nullptr) {
-            throw __error__(NO_K4A_HANDLE);
-        }
+        auto time_start = std::chrono::steady_clock::now();
 
-        k4a_image_t depth_image, color_image, point_cloud_image, uncompressed_color_image;
-
-        // fetch next frame
-        k4a_stream_result_t stream_result = k4a_playback_get_next_capture(
-                this->k4a_handle_, &this->k4a_capture_);
-        if (stream_result == K4A_STREAM_RESULT_EOF) {
+        kinect::record::FrameTask task;
+        if (this->fetch_frame(this->range_, task)) {
             __log_time__;
             std::cout << "\033[36mVideo end.\033[0m" << std::endl;
             return true;
         }
-        else if (stream_result == K4A_STREAM_RESULT_FAILED) {
-            throw __error__(GET_STREAM_FRAME_FAILED);
-        }
 
-        // get depth image
-        depth_image = k4a_capture_get_depth_image(this->k4a_capture_);
-        if (depth_image == nullptr) {
-            throw __error__(GET_DEPTH_FRAME_FAILED);
+        // JPEG decompression
+        if (this->color_pool_ == nullptr) {
+            this->create_color_pool(1);
         }
+        task.uncompressed_color_image = this->decode_color_image(*this->context_, task.color_image);
 
-        // color image
-        color_image = k4a_capture_get_color_image(this->k4a_capture_);
-        if (color_image == nullptr) {
-            throw __error__(GET_COLOR_FRAME_FAILED);
-        }
+        // drop background and flying pixels, then align depth image to color image
+        k4a_image_t depth_image = this->filter_depth_image(*this->context_, task.depth_image);
+
+        // generate point cloud
+        this->transform_frame(*this->context_, task.uncompressed_color_image, depth_image, task);
+        this->add_frame(task);
+
+        float time_cost = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() -
+                                                                   time_start).count();
+        __log_time__;
+        printf("\033[36mGenerate point cloud from mkv video frame #%zu, cost %.3fms.\n\033[0m", this->video_.size(),
+               time_cost);
+
+        this->release_frame(task);
+        return false;
+
+    }
+    catch (const kinect::log::except &error_log) {
+        error_log.log_error();
+        this->~KinectMkv2VolumetricVideo();
+        exit(1);
+    }
+}
 
-        // check format
-        k4a_image_format_t format = k4a_image_get_format(color_image);
-        if (format != K4A_IMAGE_FORMAT_COLOR_MJPG) {
-            throw __error__(WRONG_COLOR_FORMAT);
+void kinect::record::KinectMkv2VolumetricVideo::set_config(const kinect::record::ConvertConfig &__config) {
+    try {
+        if (__config.decode_workers == 0 || __config.transform_workers == 0 || __config.queue_depth == 0 ||
+            __config.max_in_flight == 0) {
+            throw __error__(APP_PARAMETER_FAULT);
+        }
+        if (__config.color_scale != 1 && __config.color_scale != 2 && __config.color_scale != 4 &&
+            __config.color_scale != 8) {
+            throw __error__(APP_PARAMETER_FAULT);
+        }
+        if (__config.stride == 0 || __config.shards == 0 || (__config.end_usec != 0 && __config.end_usec <= __config.start_usec)) {
+            throw __error__(APP_PARAMETER_FAULT);
+        }
+        // coordinates are whole millimeters, smaller voxels keep every point
+        if (__config.voxel_size != 0.0f && !(__config.voxel_size >= 1.0f)) {
+            throw __error__(APP_PARAMETER_FAULT);
+        }
+        if (__config.verify_engine && __config.engine != kinect::record::NATIVE_ENGINE) {
+            throw __error__(APP_PARAMETER_FAULT);
+        }
+        // fused extraction writes no image to compare with k4a
+        if (__config.fuse_points && (__config.engine != kinect::record::NATIVE_ENGINE || __config.verify_engine)) {
+            throw __error__(APP_PARAMETER_FAULT);
         }
+        if (__config.outlier_radius != 0.0f && (!(__config.outlier_radius >= 1.0f) || __config.outlier_neighbours == 0)) {
+            throw __error__(APP_PARAMETER_FAULT);
+        }
+        // depth is int16 millimeters
+        if (__config.near_z < 0 || __config.far_z < 0 || __config.near_z > INT16_MAX || __config.far_z > INT16_MAX ||
+            (__config.far_z != 0 && __config.far_z < __config.near_z)) {
+            throw __error__(APP_PARAMETER_FAULT);
+        }
+        if (!(__config.flying_pixel_ratio >= 0.0f && __config.flying_pixel_ratio < 1.0f)) {
+            throw __error__(APP_PARAMETER_FAULT);
+        }
+        if (!(__config.temporal_alpha >= 0.0f && __config.temporal_alpha <= 1.0f) ||
+            !(__config.temporal_motion >= 0.0f) || !(__config.temporal_hold >= 0.0f)) {
+            throw __error__(APP_PARAMETER_FAULT);
+        }
+        if (__config.background_tolerance < 0 ||
+            (__config.background_frames == 0 && !__config.background_path.empty())) {
+            throw __error__(APP_PARAMETER_FAULT);
+        }
+        if (__config.crop && (__config.crop_box.min[0] > __config.crop_box.max[0] ||
+                              __config.crop_box.min[1] > __config.crop_box.max[1] ||
+                              __config.crop_box.min[2] > __config.crop_box.max[2])) {
+            throw __error__(APP_PARAMETER_FAULT);
+        }
+        this->config_ = __config;
+        this->filter_pool_.reset();
+        if ((__config.voxel_size != 0.0f || __config.outlier_radius != 0.0f || __config.flying_pixel_ratio != 0.0f ||
+             __config.engine == kinect::record::NATIVE_ENGINE) && __config.filter_workers != 0) {
+            this->filter_pool_.reset(new kinect::type::ThreadPool(__config.filter_workers));
+        }
+        // calibration is read by init_video()
+        if (this->k4a_handle_ != nullptr) {
+            this->seek_range();
+            this->apply_color_scale();
+            this->learn_background();
+        }
+    }
+    catch (const kinect::log::except &error_log) {
+        error_log.log_error();
+        this->~KinectMkv2VolumetricVideo();
+        exit(1);
+    }
+}
+
+void kinect::record::KinectMkv2VolumetricVideo::set_extrinsics(const kinect::type::Extrinsics &__extrinsics) {
+    this->extrinsics_ = __extrinsics;
+    this->has_extrinsics_ = true;
+    this->world_output_ = true;
+}
+
+void kinect::record::KinectMkv2VolumetricVideo::convert() {
+    typedef std::unique_ptr<kinect::record::FrameTask> Task;
+    const kinect::record::ConvertConfig &config = this->config_;
+    if (config.shards > 1) {
+        this->convert_sharded();
+        return;
+    }
 
-        // get color image size
-        int color_width = k4a_image_get_width_pixels(color_image);
-        int color_height = k4a_image_get_height_pixels(color_image);
+    kinect::type::BoundedQueue<Task> decode_queue(config.queue_depth);
+    kinect::type::BoundedQueue<Task> transform_queue(config.queue_depth);
+    kinect::type::BoundedQueue<Task> emit_queue(config.max_in_flight);
+    // one ticket per frame between demux and emit, bounds the reorder buffer
+    kinect::type::BoundedQueue<uint64_t> in_flight(config.max_in_flight);
 
-        // create uncompressed image
-        if (K4A_RESULT_SUCCEEDED != k4a_image_create(K4A_IMAGE_FORMAT_COLOR_BGRA32,
-                                                     color_width,
-                                                     color_height,
-                                                     color_width * 4 * (int) sizeof(uint8_t),
-                                                     &uncompressed_color_image)) {
-            throw __error__(CREATE_IMAGE_FAILED);
+    this->report_.reset(new kinect::stats::RunReport(this->video_.name()));
+    kinect::stats::RunReport &report = *this->report_;
+    kinect::stats::StageStats &demux_stats = *report.add_stage("demux", 1);
+    kinect::stats::StageStats &decode_stats = *report.add_stage("decode", config.decode_workers);
+    kinect::stats::StageStats &transform_stats = *report.add_stage("transform", config.transform_workers);
+    kinect::stats::StageStats *step_stats[kinect::record::TRANSFORM_STEP_COUNT];
+    add_step_stages(report, config.transform_workers, step_stats);
+    kinect::stats::StageStats &emit_stats = *report.add_stage("emit", 1);
+    this->video_.set_write_stats(report.add_stage("write", write_workers(this->video_)));
+
+    // the last worker leaving a stage closes the queue of the next stage
+    std::atomic<size_t> decode_running{config.decode_workers};
+    std::atomic<size_t> transform_running{config.transform_workers};
+
+    auto time_start = std::chrono::steady_clock::now();
+    {
+        __log_time__;
+        printf("\033[36mConverting with %zu decode and %zu transform workers, queue depth %zu, %zu frames in flight,"
+               " %s kernels.\n\033[0m", config.decode_workers, config.transform_workers, config.queue_depth,
+               config.max_in_flight, kinect::kernel::instruction_set());
+    }
+
+    uint64_t warm_up_allocations = 0, warm_up_bytes = 0;
+    uint64_t start_allocations = kinect::stats::allocation_count();
+    uint64_t start_bytes = kinect::stats::allocation_bytes();
+    uint64_t start_read = kinect::stats::traffic_read(), start_written = kinect::stats::traffic_written();
+    // BGRA images between decode and transform, more could only wait in a queue
+    this->create_color_pool(std::min(config.max_in_flight,
+                                     config.decode_workers + config.queue_depth + config.transform_workers));
+
+    std::vector<std::thread> threads;
+
+    // demux, k4a playback is read by this thread only
+    threads.emplace_back([&] {
+        kinect::trace::set_thread_name("demux");
+        try {
+            for (uint64_t index = 0;; ++index) {
+                in_flight.push(uint64_t(index));
+                Task task(new kinect::record::FrameTask);
+                task->index = index;
+                task->start = std::chrono::steady_clock::now();
+                kinect::stats::StageTimer timer(demux_stats, index);
+                if (this->fetch_frame(this->range_, *task)) {
+                    timer.cancel();
+                    break;
+                }
+                timer.stop();
+                decode_queue.push(std::move(task));
+            }
+            decode_queue.close();
         }
+        catch (const kinect::log::except &error_log) {
+            error_log.log_error();
+            exit(1);
+        }
+    });
 
-        // JPEG decompression
-        tjhandle tjHandle;
-        tjHandle = tjInitDecompress();
-        if (tjDecompress2(tjHandle,
-                          k4a_image_get_buffer(color_image),
-                          static_cast<unsigned long>(k4a_image_get_size(color_image)),
-                          k4a_image_get_buffer(uncompressed_color_image),
-                          color_width,
-                          0, // pitch
-                          color_height,
-                          TJPF_BGRA,
-                          TJFLAG_FASTDCT | TJFLAG_FASTUPSAMPLE) != 0) {
-            tjDestroy(tjHandle);
-            throw __error__(JPEG_DECOMPRESSION_FAULT);
-        }
-        tjDestroy(tjHandle);
-
-        // align depth image to color image
-        point_cloud_image =
-                this->get_point_cloud_image(uncompressed_color_image, depth_image);
-
-        if (point_cloud_image == nullptr) {
-            throw __error__(IMAGE_TRANSFORMATION_FAULT);
+    // decode, one TurboJPEG decompressor per worker
+    for (size_t i = 0; i < config.decode_workers; ++i) {
+        threads.emplace_back([&, i] {
+            kinect::trace::set_thread_name("decode " + std::to_string(i));
+            try {
+                kinect::record::FrameContext context(this->scaled_calibration_);
+                Task task;
+                while (decode_queue.pop(task)) {
+                    kinect::stats::StageTimer timer(decode_stats, task->index);
+                    task->uncompressed_color_image = this->decode_color_image(context, task->color_image);
+                    // compressed data is not needed any more
+                    k4a_image_release(task->color_image);
+                    task->color_image = nullptr;
+                    timer.stop();
+                    transform_queue.push(std::move(task));
+                }
+            }
+            catch (const kinect::log::except &error_log) {
+                error_log.log_error();
+                exit(1);
+            }
+            if (--decode_running == 0) {
+                transform_queue.close();
+            }
+        });
+    }
+
+    // transform, one k4a transformation handle and intermediate images per worker
+    for (size_t i = 0; i < config.transform_workers; ++i) {
+        threads.emplace_back([&, i] {
+            kinect::trace::set_thread_name("transform " + std::to_string(i));
+            try {
+                kinect::record::FrameContext context(this->scaled_calibration_);
+                Task task;
+                while (transform_queue.pop(task)) {
+                    kinect::stats::StageTimer timer(transform_stats, task->index);
+                    uint64_t time = kinect::stats::now_nsec();
+                    k4a_image_t depth_image = this->filter_depth_image(context, task->depth_image);
+                    end_step(*task, kinect::record::DEPTH_FILTER_STEP, time);
+                    this->transform_frame(context, task->uncompressed_color_image, depth_image, *task);
+                    this->release_frame(*task);
+                    timer.stop();
+                    add_steps(step_stats, *task);
+                    emit_queue.push(std::move(task));
+                }
+            }
+            catch (const kinect::log::except &error_log) {
+                error_log.log_error();
+                exit(1);
+            }
+            if (--transform_running == 0) {
+                emit_queue.close();
+            }
+        });
+    }
+
+    // emit on this thread, restore frame order
+    kinect::trace::set_thread_name("emit");
+    std::map<uint64_t, Task> reorder;
+    uint64_t next_index = 0;
+    Task task;
+    while (emit_queue.pop(task)) {
+        uint64_t index = task->index;
+        reorder[index] = std::move(task);
+        for (auto it = reorder.find(next_index); it != reorder.end(); it = reorder.find(next_index)) {
+            kinect::stats::StageTimer timer(emit_stats, next_index);
+            Task ready = std::move(it->second);
+            reorder.erase(it);
+            report.add_frame(config.layout == kinect::type::SOA_LAYOUT ? ready->point_cloud_soa.size()
+                                                                       : ready->point_cloud.size());
+            this->add_frame(*ready);
+            timer.stop();
+            float time_cost = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() -
+                                                                       ready->start).count();
+            __log_time__;
+            printf("\033[36mGenerate point cloud from mkv video frame #%zu, latency %.3fms.\n\033[0m",
+                   this->video_.size(), time_cost);
+            if (next_index == 0) {
+                warm_up_allocations = kinect::stats::allocation_count() - start_allocations;
+                warm_up_bytes = kinect::stats::allocation_bytes() - start_bytes;
+            }
+            ++next_index;
+            uint64_t ticket;
+            in_flight.pop(ticket);
         }
+    }
 
-        // generate point cloud
-        this->generate_point_cloud(point_cloud_image, uncompressed_color_image);
+    for (auto &thread: threads) {
+        thread.join();
+    }
 
-        mingw_gettimeofday(&time_end, nullptr);
-        float time_cost = static_cast<float>(time_end.tv_sec - time_start.tv_sec) * 1000.0f + static_cast<float>
-                (time_end.tv_usec - time_start.tv_usec) / 1000.0f;
+    double wall_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - time_start).count();
+    {
         __log_time__;
-        printf("\033[36mGenerate point cloud from mkv video frame #%u, cost %.3fms.\n\033[0m", this->video_.size(),
-               time_cost);
+        printf("\033[36mVideo end, %zu frames in %.3fs, %.2ffps. Stage throughput listed below.\n\033[0m",
+               this->video_.size(), wall_sec, wall_sec <= 0.0 ? 0.0 : this->video_.size() / wall_sec);
+    }
+    this->skipped_captures_ += this->range_.skipped;
+    this->range_.skipped = 0;
+    if (this->skipped_captures_ != 0) {
+        printf("                       \033[36mSkipped %llu captures out of range or between strides\n\033[0m",
+               static_cast<unsigned long long>(this->skipped_captures_));
+    }
+    demux_stats.log(wall_sec);
+    decode_stats.log(wall_sec);
+    transform_stats.log(wall_sec);
+    for (auto stats: step_stats) {
+        stats->log(wall_sec);
+    }
+    emit_stats.log(wall_sec);
+    // heap allocations of all threads, k4a images included, buffers of the
+    // contexts are allocated while the first frame goes through
+    uint64_t steady_allocations = kinect::stats::allocation_count() - start_allocations - warm_up_allocations;
+    uint64_t steady_bytes = kinect::stats::allocation_bytes() - start_bytes - warm_up_bytes;
+    printf("                       \033[36mHeap allocations : %llu (%.1fMB) until first frame, %llu (%.1fMB) for"
+           " the other %zu frames\n\033[0m", static_cast<unsigned long long>(warm_up_allocations),
+           warm_up_bytes / 1048576.0, static_cast<unsigned long long>(steady_allocations),
+           steady_bytes / 1048576.0, next_index == 0 ? 0 : static_cast<size_t>(next_index - 1));
+    // bytes of images, tables and points moved by point generation, from buffer sizes
+    double frames = next_index == 0 ? 1.0 : static_cast<double>(next_index);
+    printf("                       \033[36mPoint generation traffic : %.1fMB read, %.1fMB written per frame (%s)\n\033[0m",
+           (kinect::stats::traffic_read() - start_read) / 1048576.0 / frames,
+           (kinect::stats::traffic_written() - start_written) / 1048576.0 / frames,
+           this->config_.fuse_points ? "fused" : this->config_.engine == kinect::record::NATIVE_ENGINE ? "native" : "k4a");
+}
 
-        k4a_image_release(depth_image);
-        k4a_image_release(color_image);
-        k4a_image_release(uncompressed_color_image);
-        k4a_image_release(point_cloud_image);
-        return false;
+void kinect::record::KinectMkv2VolumetricVideo::create_output_dir(
+        const std::string &__output_sequence_path) {
+    // dir do not exist
+    DIR *dir = opendir(__output_sequence_path.c_str());
+    if (dir == nullptr) {
+        // create this dir, mode 0775
+        if (mkdir(__output_sequence_path.c_str()) == -1) {
+            throw __error__(CREATE_OUTPUT_DIR_FAILED);
+        }
+    }
+    else {
+        closedir(dir);
+    }
+}
+
+std::shared_ptr<kinect::type::FrameSink> kinect::record::KinectMkv2VolumetricVideo::create_sink(
+        const std::string &__output_sequence_path, kinect::type::OutputFormat __format) {
+    // points in world coordinates are in no camera of the calibration
+    k4a_calibration_type_t camera = this->config_.geometry == DEPTH_GEOMETRY ? K4A_CALIBRATION_TYPE_DEPTH
+                                                                             : K4A_CALIBRATION_TYPE_COLOR;
+    if (this->world_output_) {
+        camera = K4A_CALIBRATION_TYPE_UNKNOWN;
+    }
+    if (__format == kinect::type::CONTAINER_FORMAT) {
+        return std::make_shared<kinect::type::ContainerFrameSink>(__output_sequence_path, this->video_.name(),
+                                                                   this->raw_calibration_, camera,
+                                                                   this->config_.color_scale);
+    }
+    if (__format == kinect::type::QUANTIZED_FORMAT) {
+        return std::make_shared<kinect::type::QuantizedFrameSink>(__output_sequence_path, this->video_.name(),
+                                                                   this->raw_calibration_, camera,
+                                                                   this->config_.color_scale);
+    }
+    return std::make_shared<kinect::type::PlyFrameSink>(__output_sequence_path, this->video_.name(),
+                                                         __format == kinect::type::BINARY_PLY_FORMAT);
+}
 
+void kinect::record::KinectMkv2VolumetricVideo::open_stream(
+        const std::string &__output_sequence_path, kinect::type::OutputFormat __format, size_t __max_in_flight,
+        std::function<void()> __frame_written) {
+    try {
+        this->create_output_dir(__output_sequence_path);
+        this->video_.open_stream(this->create_sink(__output_sequence_path, __format), __max_in_flight,
+                                 std::move(__frame_written));
+        __log_time__;
+        if (__max_in_flight == SIZE_MAX) {
+            // bounded by the caller, e.g. the memory budget of a batch
+            printf("\033[36mStreaming volumetric video to %s format file.\n\033[0m", format_info[__format].c_str());
+        }
+        else {
+            printf("\033[36mStreaming volumetric video to %s format file, at most %zu frames in flight.\n\033[0m",
+                   format_info[__format].c_str(), __max_in_flight);
+        }
     }
     catch (const kinect::log::except &error_log) {
         error_log.log_error();
@@ -348,33 +1239,32 @@ bool kinect::record::KinectMkv2VolumetricVideo::get_point_cloud() {
 }
 
 void kinect::record::KinectMkv2VolumetricVideo::output_point_cloud_sequence(
-        const std::string &__output_sequence_path, bool __binary) {
+        const std::string &__output_sequence_path, kinect::type::OutputFormat __format) {
     try {
-        timeval time_start, time_end;
-        mingw_gettimeofday(&time_start, nullptr);
-        std::string format;
-        if (__binary) {
-            format = "binary";
+        auto time_start = std::chrono::steady_clock::now();
+
+        __log_time__;
+        if (this->video_.streaming()) {
+            // frames are already written by the stream, wait for the last ones
+            printf("\033[36mWaiting for streamed frames to be written ......\n\033[0m");
+            this->video_.close_stream();
         }
         else {
-            format = "ascii";
+            printf("\033[36mWriting volumetric video to %s format file ......\n\033[0m",
+                   format_info[__format].c_str());
+            this->create_output_dir(__output_sequence_path);
+            this->video_.output(*this->create_sink(__output_sequence_path, __format));
         }
+        double time_cost = std::chrono::duration<double>(std::chrono::steady_clock::now() - time_start).count();
 
-        __log_time__;
-        printf("\033[36mWriting volumetric video to %s .ply format file ......\n\033[0m", format.c_str());
-
-        // dir do not exist
-        if (opendir(__output_sequence_path.c_str()) == nullptr) {
-            // create this dir, mode 0775
-            if (mkdir(__output_sequence_path.c_str()) == -1) {
-                throw __error__(CREATE_OUTPUT_DIR_FAILED);
-            }
+        printf("                      \033[36mWriting %zu frames done, cost %.3fs.\n\033[0m", this->video_.size(),
+               time_cost);
+        if (this->report_ != nullptr) {
+            // written frames of the last convert(), streamed or written above
+            this->video_.set_write_stats(nullptr);
+            this->report_->stage("write")->log(this->report_->wall_sec());
+            this->report_->log();
         }
-        this->video_.output(__output_sequence_path, __binary);
-        mingw_gettimeofday(&time_end, nullptr);
-
-        printf("                      \033[36mWriting file done, cost %ds.\n\033[0m", this->video_.size(),
-               time_end.tv_sec - time_start.tv_sec);
 
         // release memory
         if (this->k4a_handle_ != nullptr) {
@@ -383,9 +1273,25 @@ void kinect::record::KinectMkv2VolumetricVideo::output_point_cloud_sequence(
         if (this->k4a_capture_ != nullptr) {
             k4a_capture_release(this->k4a_capture_);
         }
-        if (this->k4a_point_cloud_transformation_handle_ != nullptr) {
-            k4a_transformation_destroy(this->k4a_point_cloud_transformation_handle_);
+        this->context_.reset();
+        this->color_pool_.reset();
+    }
+    catch (const kinect::log::except &error_log) {
+        error_log.log_error();
+        this->~KinectMkv2VolumetricVideo();
+        exit(1);
+    }
+}
+
+void kinect::record::KinectMkv2VolumetricVideo::write_report(const std::string &__report_path) {
+    try {
+        if (this->report_ == nullptr) {
+            // nothing is converted by convert()
+            throw __error__(APP_PARAMETER_FAULT);
         }
+        this->report_->write(__report_path);
+        __log_time__;
+        printf("\033[36mRun report written to %s.\n\033[0m", __report_path.c_str());
     }
     catch (const kinect::log::except &error_log) {
         error_log.log_error();
@@ -393,3 +1299,165 @@ void kinect::record::KinectMkv2VolumetricVideo::output_point_cloud_sequence(
         exit(1);
     }
 }
+
+void kinect::record::KinectMkv2VolumetricVideo::convert_sharded() {
+    typedef std::unique_ptr<kinect::record::FrameTask> Task;
+    const kinect::record::ConvertConfig &config = this->config_;
+    const size_t shards = config.shards;
+
+    // split [range_.begin, end of recording or range_.end) to equal segments,
+    // a capture belongs to the segment its device timestamp falls in
+    uint64_t recording_end = this->k4a_record_config_.start_timestamp_offset_usec +
+                             k4a_playback_get_recording_length_usec(this->k4a_handle_);
+    uint64_t span = std::min(this->range_.end, recording_end) - this->range_.begin;
+    uint64_t segment = (span + shards - 1) / shards;
+    std::vector<kinect::record::PlaybackRange> ranges(shards);
+    for (size_t i = 0; i < shards; ++i) {
+        ranges[i].begin = this->range_.begin + std::min(span, segment * i);
+        // the last capture may be stamped at the very end of the recording
+        ranges[i].end = i + 1 == shards ? this->range_.end : this->range_.begin + std::min(span, segment * (i + 1));
+    }
+
+    // frames between fetch and emit of all shards, in streaming mode at most
+    // max_in_flight of them, otherwise all frames are kept in memory anyway.
+    // The last ticket is kept for the segment being emitted, whose next frame
+    // is the only one emit can take, so later segments never starve it.
+    const size_t capacity = this->video_.streaming() ? config.max_in_flight : SIZE_MAX;
+    std::mutex mutex;
+    std::condition_variable changed;
+    size_t in_flight = 0;
+    // segment being emitted, segments before it are emitted completely
+    size_t head = 0;
+    std::vector<bool> done(shards, false);
+    // converted frames waiting for their turn, by segment, a segment is fetched
+    // and converted by one thread, so its frames are queued in time order
+    std::vector<std::deque<Task>> reorder(shards);
+
+    this->report_.reset(new kinect::stats::RunReport(this->video_.name()));
+    kinect::stats::RunReport &report = *this->report_;
+    kinect::stats::StageStats &shard_stats = *report.add_stage("shard", shards);
+    kinect::stats::StageStats *step_stats[kinect::record::TRANSFORM_STEP_COUNT];
+    add_step_stages(report, shards, step_stats);
+    kinect::stats::StageStats &emit_stats = *report.add_stage("emit", 1);
+    this->video_.set_write_stats(report.add_stage("write", write_workers(this->video_)));
+
+    auto time_start = std::chrono::steady_clock::now();
+    {
+        __log_time__;
+        printf("\033[36mConverting with %zu shards of %.3fs, %s kernels.\n\033[0m", shards,
+               static_cast<double>(segment) / 1e6, kinect::kernel::instruction_set());
+    }
+
+    // one BGRA image per shard, it is returned before the frame is queued
+    this->create_color_pool(shards);
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < shards; ++i) {
+        threads.emplace_back([&, i] {
+            kinect::trace::set_thread_name("shard " + std::to_string(i));
+            kinect::record::PlaybackRange &range = ranges[i];
+            try {
+                if (range.begin < range.end && range.begin < recording_end) {
+                    if (k4a_playback_open(this->video_path_.c_str(), &range.handle) != K4A_RESULT_SUCCEEDED) {
+                        throw __error__(FILE_OPEN_FAULT);
+                    }
+                    if (k4a_playback_seek_timestamp(range.handle, static_cast<int64_t>(range.begin),
+                                                    K4A_PLAYBACK_SEEK_DEVICE_TIME) != K4A_RESULT_SUCCEEDED) {
+                        throw __error__(TIMESTAMP_FAULT);
+                    }
+                    kinect::record::FrameContext context(this->scaled_calibration_);
+                    for (;;) {
+                        {
+                            std::unique_lock<std::mutex> lock(mutex);
+                            changed.wait(lock, [&] {
+                                return in_flight < (i == head || capacity == SIZE_MAX ? capacity : capacity - 1);
+                            });
+                            ++in_flight;
+                        }
+                        Task task(new kinect::record::FrameTask);
+                        task->start = std::chrono::steady_clock::now();
+                        uint64_t begin = kinect::stats::now_nsec();
+                        if (this->fetch_frame(range, *task)) {
+                            std::lock_guard<std::mutex> lock(mutex);
+                            --in_flight;
+                            break;
+                        }
+                        // frame numbers are in time order across segments, unlike a count per segment
+                        task->index = task->frame_number;
+                        this->process_frame(context, *task);
+                        shard_stats.add(task->index, begin, kinect::stats::now_nsec());
+                        add_steps(step_stats, *task);
+                        std::lock_guard<std::mutex> lock(mutex);
+                        reorder[i].push_back(std::move(task));
+                        changed.notify_all();
+                    }
+                    k4a_playback_close(range.handle);
+                    range.handle = nullptr;
+                }
+            }
+            catch (const kinect::log::except &error_log) {
+                error_log.log_error();
+                exit(1);
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            done[i] = true;
+            changed.notify_all();
+        });
+    }
+
+    // emit on this thread, segments in time order, each frame as soon as all frames before it are emitted
+    kinect::trace::set_thread_name("emit");
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (head < shards) {
+            if (!reorder[head].empty()) {
+                Task task = std::move(reorder[head].front());
+                reorder[head].pop_front();
+                lock.unlock();
+                kinect::stats::StageTimer timer(emit_stats, task->index);
+                report.add_frame(config.layout == kinect::type::SOA_LAYOUT ? task->point_cloud_soa.size()
+                                                                           : task->point_cloud.size());
+                this->add_frame(*task);
+                timer.stop();
+                float time_cost = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() -
+                                                                           task->start).count();
+                __log_time__;
+                printf("\033[36mGenerate point cloud from mkv video frame #%zu, shard %zu, latency %.3fms.\n\033[0m",
+                       this->video_.size(), head, time_cost);
+                lock.lock();
+                --in_flight;
+                changed.notify_all();
+            }
+            else if (done[head]) {
+                ++head;
+                changed.notify_all();
+            }
+            else {
+                changed.wait(lock);
+            }
+        }
+    }
+
+    for (auto &thread: threads) {
+        thread.join();
+    }
+    for (auto &range: ranges) {
+        this->skipped_captures_ += range.skipped;
+    }
+
+    double wall_sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - time_start).count();
+    {
+        __log_time__;
+        printf("\033[36mVideo end, %zu frames in %.3fs, %.2ffps. Stage throughput listed below.\n\033[0m",
+               this->video_.size(), wall_sec, wall_sec <= 0.0 ? 0.0 : this->video_.size() / wall_sec);
+    }
+    if (this->skipped_captures_ != 0) {
+        printf("                       \033[36mSkipped %llu captures out of range or between strides\n\033[0m",
+               static_cast<unsigned long long>(this->skipped_captures_));
+    }
+    shard_stats.log(wall_sec);
+    for (auto stats: step_stats) {
+        stats->log(wall_sec);
+    }
+    emit_stats.log(wall_sec);
+}
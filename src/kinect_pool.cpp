@@ -0,0 +1,176 @@
+/*
+ * Source file of kinect::type::ThreadPool
+ * Author : @ChenRP07
+ * Date : 2022-11-12
+ * */
+#include "kinect_pool.h"
+
+#include <algorithm>
+#include <atomic>
+
+kinect::type::ThreadPool::ThreadPool(size_t __threads) : stopped_{false} {
+    if (__threads == 0) {
+        __threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < __threads; ++i) {
+        this->workers_.emplace_back([this] { this->work(); });
+    }
+}
+
+kinect::type::ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->stopped_ = true;
+    }
+    this->job_ready_.notify_all();
+    for (auto &worker: this->workers_) {
+        worker.join();
+    }
+}
+
+void kinect::type::ThreadPool::work() {
+    while (true) {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex_);
+            this->job_ready_.wait(lock, [this] { return this->stopped_ || !this->jobs_.empty(); });
+            if (this->jobs_.empty()) {
+                return;
+            }
+            job = std::move(this->jobs_.front());
+            this->jobs_.pop_front();
+        }
+        job();
+    }
+}
+
+void kinect::type::ThreadPool::submit(std::function<void()> __job) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->jobs_.emplace_back(std::move(__job));
+    }
+    this->job_ready_.notify_one();
+}
+
+void kinect::type::ThreadPool::parallel_for(size_t __count, const std::function<void(size_t)> &__body) {
+    std::atomic<size_t> next{0};
+    // run by the helpers and the caller, stops when all indices are taken
+    auto run = [&next, &__count, &__body] {
+        for (size_t i = next.fetch_add(1); i < __count; i = next.fetch_add(1)) {
+            __body(i);
+        }
+    };
+
+    size_t helpers = std::min(this->workers_.size(), __count > 0 ? __count - 1 : 0);
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    size_t running = helpers;
+    for (size_t i = 0; i < helpers; ++i) {
+        this->submit([&] {
+            run();
+            std::lock_guard<std::mutex> lock(done_mutex);
+            if (--running == 0) {
+                done_cv.notify_one();
+            }
+        });
+    }
+    run();
+
+    // helpers reference this frame, wait for all of them even if the caller finished the range
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done_cv.wait(lock, [&running] { return running == 0; });
+}
+
+namespace {
+    // pool and deque index of the calling thread, if it is a worker
+    thread_local const kinect::type::WorkStealingPool *current_pool = nullptr;
+    thread_local size_t current_queue = 0;
+}
+
+kinect::type::WorkStealingPool::WorkStealingPool(size_t __threads)
+        : queued_{0}, pending_{0}, next_queue_{0}, stopped_{false} {
+    if (__threads == 0) {
+        __threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < __threads; ++i) {
+        this->queues_.emplace_back(new JobQueue);
+    }
+    for (size_t i = 0; i < __threads; ++i) {
+        this->workers_.emplace_back([this, i] { this->work(i); });
+    }
+}
+
+kinect::type::WorkStealingPool::~WorkStealingPool() {
+    this->wait();
+    {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->stopped_ = true;
+    }
+    this->changed_.notify_all();
+    for (auto &worker: this->workers_) {
+        worker.join();
+    }
+}
+
+bool kinect::type::WorkStealingPool::take(size_t __index, bool __own, std::function<void()> &__job) {
+    JobQueue &queue = *this->queues_[__index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.jobs.empty()) {
+        return false;
+    }
+    if (__own) {
+        __job = std::move(queue.jobs.back());
+        queue.jobs.pop_back();
+    }
+    else {
+        __job = std::move(queue.jobs.front());
+        queue.jobs.pop_front();
+    }
+    this->queued_.fetch_sub(1);
+    return true;
+}
+
+void kinect::type::WorkStealingPool::work(size_t __index) {
+    current_pool = this;
+    current_queue = __index;
+    const size_t count = this->queues_.size();
+    while (true) {
+        std::function<void()> job;
+        bool found = this->take(__index, true, job);
+        for (size_t i = 1; !found && i < count; ++i) {
+            found = this->take((__index + i) % count, false, job);
+        }
+        if (found) {
+            job();
+            if (this->pending_.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(this->mutex_);
+                this->changed_.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(this->mutex_);
+        this->changed_.wait(lock, [this] { return this->stopped_ || this->queued_.load() != 0; });
+        if (this->stopped_ && this->queued_.load() == 0) {
+            return;
+        }
+    }
+}
+
+void kinect::type::WorkStealingPool::submit(std::function<void()> __job) {
+    size_t index = current_pool == this ? current_queue : this->next_queue_.fetch_add(1) % this->queues_.size();
+    this->pending_.fetch_add(1);
+    {
+        JobQueue &queue = *this->queues_[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.emplace_back(std::move(__job));
+        this->queued_.fetch_add(1);
+    }
+    // taking mutex_ orders this with the predicate check of a worker going to sleep
+    std::lock_guard<std::mutex> lock(this->mutex_);
+    this->changed_.notify_all();
+}
+
+void kinect::type::WorkStealingPool::wait() {
+    std::unique_lock<std::mutex> lock(this->mutex_);
+    this->changed_.wait(lock, [this] { return this->pending_.load() == 0; });
+}
@@ -0,0 +1,129 @@
+/*
+ * Source file of kinect::type::QuantizedFrameSink
+ * Author : @ChenRP07
+ * Date : 2022-11-14
+ * */
+#include "kinect_log.h"
+#include "kinect_quantized.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+/*
+ * Coordinates of k4a point cloud images are whole millimeters and rounding
+ * only removes float noise, points moved to world coordinates or averaged by
+ * the voxel grid are rounded to the nearest millimeter, the clamp guards
+ * values made by later filters.
+ * */
+static int16_t quantize(float __value) {
+    float value = std::round(__value);
+    value = std::min(std::max(value, -32768.0f), 32767.0f);
+    return static_cast<int16_t>(value);
+}
+
+static char *quantize_point(char *__out, float __x, float __y, float __z, const uint8_t *__rgb) {
+    int16_t coordinates[3] = {quantize(__x), quantize(__y), quantize(__z)};
+    std::memcpy(__out, coordinates, sizeof(coordinates));
+    std::memcpy(__out + sizeof(coordinates), __rgb, sizeof(uint8_t) * 3);
+    return __out + kinect::type::quantized_point_size;
+}
+
+void kinect::type::quantize_frame(const kinect::type::PointCloudFrame &__frame, char *__output) {
+    if (__frame.layout() == kinect::type::SOA_LAYOUT) {
+        const kinect::type::PointCloudSoA &soa = __frame.points_soa();
+        for (size_t i = 0; i < soa.size(); i++) {
+            __output = quantize_point(__output, soa.x[i], soa.y[i], soa.z[i], &soa.rgb[i * 3]);
+        }
+    }
+    else {
+        for (auto &i: __frame.points()) {
+            __output = quantize_point(__output, i.x, i.y, i.z, &i.r);
+        }
+    }
+}
+
+kinect::type::QuantizedFrameSink::QuantizedFrameSink(const std::string &__output_path,
+                                                      const std::string &__sequence_name,
+                                                      const std::vector<uint8_t> &__calibration,
+                                                      k4a_calibration_type_t __camera, int __color_scale)
+        : header_{}, calibration_{__calibration} {
+    try {
+        if (__sequence_name.empty()) {
+            throw __error__(WRONG_FILE_NAME_FORMAT);
+        }
+        this->file_name_prev_ = __output_path;
+        if (this->file_name_prev_.back() != '/') {
+            this->file_name_prev_ += '/';
+        }
+        this->file_name_prev_ += __sequence_name;
+
+        std::memcpy(this->header_.magic, kinect::type::quantized_magic, sizeof(this->header_.magic));
+        this->header_.version = 1;
+        this->header_.point_size = kinect::type::quantized_point_size;
+        this->header_.camera = static_cast<uint32_t>(__camera);
+        this->header_.color_scale = static_cast<uint32_t>(__color_scale);
+        this->header_.calibration_size = this->calibration_.size();
+    }
+    catch (const kinect::log::except &error_log) {
+        error_log.log_error();
+        exit(1);
+    }
+}
+
+void kinect::type::QuantizedFrameSink::write(kinect::type::PointCloudFrame &__frame) {
+    try {
+        size_t size = __frame.size() * kinect::type::quantized_point_size;
+        char *buffer = kinect::type::write_buffer(size);
+        kinect::type::quantize_frame(__frame, buffer);
+
+        std::string file_name = this->file_name_prev_ + "_" + std::to_string(__frame.time_stamp()) + ".kpq";
+        std::ofstream outfile(file_name.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+        if (!outfile.is_open()) {
+            throw __error__(FILE_OPEN_FAULT);
+        }
+        outfile.write(buffer, static_cast<std::streamsize>(size));
+        if (!outfile) {
+            throw __error__(FILE_WRITE_FAULT);
+        }
+        kinect::stats::count_output(size);
+
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->frames_[__frame.time_stamp()] = __frame.size();
+    }
+    catch (const kinect::log::except &error_log) {
+        error_log.log_error();
+        exit(1);
+    }
+}
+
+void kinect::type::QuantizedFrameSink::close() {
+    try {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->header_.frame_count = static_cast<uint32_t>(this->frames_.size());
+        std::vector<kinect::type::QuantizedFrameEntry> entries;
+        for (auto &i: this->frames_) {
+            entries.push_back({i.first, i.second});
+        }
+
+        std::string file_name = this->file_name_prev_ + ".kpc";
+        std::ofstream outfile(file_name.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+        if (!outfile.is_open()) {
+            throw __error__(FILE_OPEN_FAULT);
+        }
+        outfile.write(reinterpret_cast<const char *>(&this->header_), sizeof(this->header_));
+        outfile.write(reinterpret_cast<const char *>(this->calibration_.data()),
+                      static_cast<std::streamsize>(this->calibration_.size()));
+        outfile.write(reinterpret_cast<const char *>(entries.data()),
+                      static_cast<std::streamsize>(entries.size() * sizeof(kinect::type::QuantizedFrameEntry)));
+        if (!outfile) {
+            throw __error__(FILE_WRITE_FAULT);
+        }
+        kinect::stats::count_output(sizeof(this->header_) + this->calibration_.size() +
+                                    entries.size() * sizeof(kinect::type::QuantizedFrameEntry));
+    }
+    catch (const kinect::log::except &error_log) {
+        error_log.log_error();
+        exit(1);
+    }
+}
@@ -0,0 +1,340 @@
+/*
+ * Source file of kinect::stats
+ * Author : @ChenRP07
+ * Date : 2022-11-02
+ * */
+#include "kinect_stats.h"
+#include "kinect_log.h"
+#include "kinect_trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#ifdef _WIN32
+// keep std::min and std::max
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+    // slots of a Counter, threads are spread over them
+    const size_t counter_slots = 64;
+
+    // slot of the calling thread in every Counter
+    std::atomic<size_t> next_slot{0};
+
+    size_t thread_slot() {
+        static thread_local size_t slot = next_slot.fetch_add(1, std::memory_order_relaxed) % counter_slots;
+        return slot;
+    }
+
+    /*
+     * Sum updated by many threads, each one adds to a slot on a cache line of
+     * its own, so counting in hot paths does not bounce one line between cores.
+     * */
+    class Counter {
+    private:
+        struct alignas(64) Slot {
+            std::atomic<uint64_t> value{0};
+        };
+
+        Slot slots_[counter_slots];
+
+    public:
+        void add(uint64_t __value) {
+            this->slots_[thread_slot()].value.fetch_add(__value, std::memory_order_relaxed);
+        }
+
+        uint64_t load() const {
+            uint64_t sum = 0;
+            for (const Slot &slot: this->slots_) {
+                sum += slot.value.load(std::memory_order_relaxed);
+            }
+            return sum;
+        }
+    };
+}
+
+// heap allocations recorded by count_allocation()
+static Counter allocation_count_;
+static Counter allocation_bytes_;
+// memory traffic recorded by count_traffic()
+static Counter traffic_read_;
+static Counter traffic_written_;
+// output file bytes recorded by count_output()
+static Counter output_bytes_;
+
+/*
+ * Nanoseconds to milliseconds.
+ * */
+static double to_ms(uint64_t __nsec) {
+    return static_cast<double>(__nsec) / 1e6;
+}
+
+std::string kinect::stats::json_string(const std::string &__text) {
+    std::string quoted = "\"";
+    for (char c: __text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+            quoted += escaped;
+        }
+        else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+void kinect::stats::count_allocation(size_t __bytes) {
+    allocation_count_.add(1);
+    allocation_bytes_.add(__bytes);
+}
+
+uint64_t kinect::stats::allocation_count() {
+    return allocation_count_.load();
+}
+
+uint64_t kinect::stats::allocation_bytes() {
+    return allocation_bytes_.load();
+}
+
+void kinect::stats::count_traffic(size_t __read, size_t __written) {
+    traffic_read_.add(__read);
+    traffic_written_.add(__written);
+}
+
+uint64_t kinect::stats::traffic_read() {
+    return traffic_read_.load();
+}
+
+uint64_t kinect::stats::traffic_written() {
+    return traffic_written_.load();
+}
+
+void kinect::stats::count_output(size_t __bytes) {
+    output_bytes_.add(__bytes);
+}
+
+uint64_t kinect::stats::output_bytes() {
+    return output_bytes_.load();
+}
+
+uint64_t kinect::stats::peak_memory() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return 0;
+    }
+    return static_cast<uint64_t>(counters.PeakWorkingSetSize);
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+    // kilobytes on Linux
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+kinect::stats::Histogram::Histogram() : count_{0}, sum_{0}, max_{0} {
+    for (auto &bucket: this->buckets_) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+size_t kinect::stats::Histogram::bucket(uint64_t __value) {
+    if (__value < (uint64_t(1) << sub_bits)) {
+        return static_cast<size_t>(__value);
+    }
+    int exponent = 63;
+    while ((__value >> exponent) == 0) {
+        --exponent;
+    }
+    // the sub_bits bits below the highest one select the bucket of this power of 2
+    int shift = exponent - sub_bits;
+    return (static_cast<size_t>(shift + 1) << sub_bits) +
+           static_cast<size_t>((__value >> shift) & ((uint64_t(1) << sub_bits) - 1));
+}
+
+uint64_t kinect::stats::Histogram::upper_bound(size_t __bucket) {
+    if (__bucket < (size_t(1) << sub_bits)) {
+        return __bucket;
+    }
+    int shift = static_cast<int>(__bucket >> sub_bits) - 1;
+    uint64_t lower = static_cast<uint64_t>((size_t(1) << sub_bits) + (__bucket & ((size_t(1) << sub_bits) - 1)))
+            << shift;
+    return lower + ((uint64_t(1) << shift) - 1);
+}
+
+void kinect::stats::Histogram::add(uint64_t __value) {
+    this->buckets_[bucket(__value)].fetch_add(1, std::memory_order_relaxed);
+    this->count_.fetch_add(1, std::memory_order_relaxed);
+    this->sum_.fetch_add(__value, std::memory_order_relaxed);
+    uint64_t max = this->max_.load(std::memory_order_relaxed);
+    while (__value > max && !this->max_.compare_exchange_weak(max, __value, std::memory_order_relaxed)) {}
+}
+
+uint64_t kinect::stats::Histogram::count() const {
+    return this->count_.load();
+}
+
+uint64_t kinect::stats::Histogram::sum() const {
+    return this->sum_.load();
+}
+
+uint64_t kinect::stats::Histogram::maximum() const {
+    return this->max_.load();
+}
+
+uint64_t kinect::stats::Histogram::percentile(double __share) const {
+    // count of the buckets read here, values may still be added
+    uint64_t count = 0;
+    for (const auto &bucket: this->buckets_) {
+        count += bucket.load(std::memory_order_relaxed);
+    }
+    if (count == 0) {
+        return 0;
+    }
+    // rank of the value, 1 based
+    uint64_t rank = static_cast<uint64_t>(__share * static_cast<double>(count) + 0.999999);
+    rank = std::max<uint64_t>(1, std::min(rank, count));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bucket_count; ++i) {
+        seen += this->buckets_[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::min(upper_bound(i), this->maximum());
+        }
+    }
+    return this->maximum();
+}
+
+kinect::stats::StageStats::StageStats(const std::string &__name, size_t __workers)
+        : name_{__name}, trace_name_{kinect::trace::intern(__name)}, workers_{__workers}, frames_{0}, busy_nsec_{0} {}
+
+void kinect::stats::StageStats::add(uint64_t __busy_nsec) {
+    this->frames_.fetch_add(1, std::memory_order_relaxed);
+    this->busy_nsec_.fetch_add(__busy_nsec, std::memory_order_relaxed);
+    this->latency_.add(__busy_nsec);
+}
+
+void kinect::stats::StageStats::add(uint64_t __frame, uint64_t __begin_nsec, uint64_t __end_nsec) {
+    this->add(__end_nsec - __begin_nsec);
+    kinect::trace::record(this->trace_name_, __frame, __begin_nsec, __end_nsec);
+}
+
+void kinect::stats::StageStats::log(double __wall_sec) const {
+    uint64_t frames = this->frames_.load();
+    double busy_ms = static_cast<double>(this->busy_nsec_.load()) / 1e6;
+    double per_frame_ms = frames == 0 ? 0.0 : busy_ms / static_cast<double>(frames);
+    double fps = __wall_sec <= 0.0 ? 0.0 : static_cast<double>(frames) / __wall_sec;
+    // busy time of all workers divided by the time they were available
+    double utilization = __wall_sec <= 0.0 ? 0.0 : busy_ms / 1e3 / (__wall_sec * static_cast<double>(this->workers_));
+    printf("                       \033[36m%-12s x%-2zu : %6llu frames, %8.3fms/frame, %7.2ffps, %5.1f%% busy,"
+           " p50 %.3fms p90 %.3fms p99 %.3fms max %.3fms\n\033[0m", this->name_.c_str(), this->workers_,
+           static_cast<unsigned long long>(frames), per_frame_ms, fps, utilization * 100.0,
+           to_ms(this->latency_.percentile(0.5)), to_ms(this->latency_.percentile(0.9)),
+           to_ms(this->latency_.percentile(0.99)), to_ms(this->latency_.maximum()));
+}
+
+std::string kinect::stats::StageStats::json(double __wall_sec) const {
+    uint64_t frames = this->frames_.load();
+    double busy_ms = to_ms(this->busy_nsec_.load());
+    double utilization = __wall_sec <= 0.0 ? 0.0 : busy_ms / 1e3 / (__wall_sec * static_cast<double>(this->workers_));
+    char text[512];
+    snprintf(text, sizeof(text), "{\"name\": %s, \"workers\": %zu, \"frames\": %llu, \"busy_ms\": %.3f, "
+             "\"mean_ms\": %.3f, \"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f, "
+             "\"utilization\": %.4f}", json_string(this->name_).c_str(), this->workers_,
+             static_cast<unsigned long long>(frames), busy_ms, frames == 0 ? 0.0 : busy_ms / static_cast<double>(frames),
+             to_ms(this->latency_.percentile(0.5)), to_ms(this->latency_.percentile(0.9)),
+             to_ms(this->latency_.percentile(0.99)), to_ms(this->latency_.maximum()), utilization);
+    return text;
+}
+
+kinect::stats::RunReport::RunReport(const std::string &__name)
+        : name_{__name}, start_{std::chrono::steady_clock::now()}, start_output_bytes_{output_bytes()},
+          start_traffic_read_{traffic_read()}, start_traffic_written_{traffic_written()} {}
+
+std::shared_ptr<kinect::stats::StageStats> kinect::stats::RunReport::add_stage(const std::string &__name,
+                                                                               size_t __workers) {
+    this->stages_.push_back(std::make_shared<kinect::stats::StageStats>(__name, __workers));
+    return this->stages_.back();
+}
+
+std::shared_ptr<kinect::stats::StageStats> kinect::stats::RunReport::stage(const std::string &__name) const {
+    for (auto &stage: this->stages_) {
+        if (stage->name() == __name) {
+            return stage;
+        }
+    }
+    return nullptr;
+}
+
+void kinect::stats::RunReport::add_frame(uint64_t __points) {
+    this->points_.add(__points);
+}
+
+double kinect::stats::RunReport::wall_sec() const {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - this->start_).count();
+}
+
+void kinect::stats::RunReport::log() const {
+    uint64_t frames = this->points_.count();
+    printf("                       \033[36mPoints per frame : mean %llu, p50 %llu, p90 %llu, p99 %llu, max %llu."
+           " Output %.1fMB, peak memory %.1fMB\n\033[0m",
+           static_cast<unsigned long long>(frames == 0 ? 0 : this->points_.sum() / frames),
+           static_cast<unsigned long long>(this->points_.percentile(0.5)),
+           static_cast<unsigned long long>(this->points_.percentile(0.9)),
+           static_cast<unsigned long long>(this->points_.percentile(0.99)),
+           static_cast<unsigned long long>(this->points_.maximum()),
+           (output_bytes() - this->start_output_bytes_) / 1048576.0, peak_memory() / 1048576.0);
+}
+
+void kinect::stats::RunReport::write(const std::string &__path) const {
+    double wall_sec = this->wall_sec();
+    uint64_t frames = this->points_.count();
+    char text[1024];
+    std::string report = "{\n  \"name\": " + json_string(this->name_) + ",\n";
+    snprintf(text, sizeof(text), "  \"wall_sec\": %.3f,\n  \"frames\": %llu,\n  \"fps\": %.3f,\n"
+             "  \"points_per_frame\": {\"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu},\n"
+             "  \"output_bytes\": %llu,\n  \"traffic_read_bytes\": %llu,\n  \"traffic_written_bytes\": %llu,\n"
+             "  \"peak_memory_bytes\": %llu,\n", wall_sec, static_cast<unsigned long long>(frames),
+             wall_sec <= 0.0 ? 0.0 : static_cast<double>(frames) / wall_sec,
+             frames == 0 ? 0.0 : static_cast<double>(this->points_.sum()) / static_cast<double>(frames),
+             static_cast<unsigned long long>(this->points_.percentile(0.5)),
+             static_cast<unsigned long long>(this->points_.percentile(0.9)),
+             static_cast<unsigned long long>(this->points_.percentile(0.99)),
+             static_cast<unsigned long long>(this->points_.maximum()),
+             static_cast<unsigned long long>(output_bytes() - this->start_output_bytes_),
+             static_cast<unsigned long long>(traffic_read() - this->start_traffic_read_),
+             static_cast<unsigned long long>(traffic_written() - this->start_traffic_written_),
+             static_cast<unsigned long long>(peak_memory()));
+    report += text;
+    report += "  \"stages\": [";
+    for (size_t i = 0; i < this->stages_.size(); ++i) {
+        report += i == 0 ? "\n    " : ",\n    ";
+        report += this->stages_[i]->json(wall_sec);
+    }
+    report += "\n  ]\n}\n";
+
+    std::ofstream outfile(__path.c_str(), std::ios::out | std::ios::trunc);
+    if (!outfile.is_open()) {
+        throw __error__(FILE_OPEN_FAULT);
+    }
+    outfile << report;
+    if (!outfile) {
+        throw __error__(FILE_WRITE_FAULT);
+    }
+}
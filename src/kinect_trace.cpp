@@ -0,0 +1,146 @@
+/*
+ * Source file of kinect::trace
+ * Author : @ChenRP07
+ * Date : 2022-11-28
+ * */
+#include "kinect_trace.h"
+#include "kinect_log.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+std::atomic<bool> kinect::trace::enabled_{false};
+
+namespace {
+    // spans of a chunk, chunks are never moved once written
+    const size_t chunk_events = 4096;
+
+    struct Event {
+        const char *name;
+        uint64_t frame;
+        uint64_t begin, end;
+    };
+
+    /*
+     * Spans of one thread, appended by this thread only.
+     * */
+    struct ThreadBuffer {
+        // tid in the timeline
+        uint32_t id;
+        // thread name, empty if not set
+        std::string name;
+        std::vector<std::unique_ptr<Event[]>> chunks;
+        // written spans, published for write()
+        std::atomic<size_t> count{0};
+    };
+
+    /*
+     * Buffers of all threads which recorded a span and interned names, kept
+     * until the process exits, so spans of finished threads are written too.
+     * */
+    struct Registry {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+        std::set<std::string> names;
+        // now_nsec() of enable(), origin of the timeline
+        uint64_t origin = 0;
+    };
+
+    Registry &registry() {
+        // never destroyed, threads may still record while static objects are destroyed at exit
+        static Registry *registry = new Registry;
+        return *registry;
+    }
+
+    // buffer of the calling thread, created by its first span
+    thread_local ThreadBuffer *thread_buffer = nullptr;
+
+    ThreadBuffer &local_buffer() {
+        if (thread_buffer == nullptr) {
+            Registry &shared = registry();
+            std::lock_guard<std::mutex> lock(shared.mutex);
+            shared.buffers.emplace_back(new ThreadBuffer);
+            thread_buffer = shared.buffers.back().get();
+            thread_buffer->id = static_cast<uint32_t>(shared.buffers.size());
+        }
+        return *thread_buffer;
+    }
+}
+
+void kinect::trace::enable() {
+    registry().origin = kinect::stats::now_nsec();
+    enabled_.store(true);
+}
+
+const char *kinect::trace::intern(const std::string &__name) {
+    Registry &shared = registry();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    return shared.names.insert(__name).first->c_str();
+}
+
+void kinect::trace::set_thread_name(const std::string &__name) {
+    if (!enabled()) {
+        return;
+    }
+    ThreadBuffer &buffer = local_buffer();
+    // read by write() after this thread stops recording
+    buffer.name = __name;
+}
+
+void kinect::trace::record(const char *__name, uint64_t __frame, uint64_t __begin_nsec, uint64_t __end_nsec) {
+    if (!enabled()) {
+        return;
+    }
+    ThreadBuffer &buffer = local_buffer();
+    size_t count = buffer.count.load(std::memory_order_relaxed);
+    if (count == buffer.chunks.size() * chunk_events) {
+        buffer.chunks.emplace_back(new Event[chunk_events]);
+    }
+    buffer.chunks[count / chunk_events][count % chunk_events] = {__name, __frame, __begin_nsec, __end_nsec};
+    buffer.count.store(count + 1, std::memory_order_release);
+}
+
+void kinect::trace::write(const std::string &__path) {
+    Registry &shared = registry();
+    std::lock_guard<std::mutex> lock(shared.mutex);
+    std::ofstream outfile(__path.c_str(), std::ios::out | std::ios::trunc);
+    if (!outfile.is_open()) {
+        throw __error__(FILE_OPEN_FAULT);
+    }
+
+    // complete events of one process, times in usec from enable()
+    outfile << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    outfile << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"kinect\"}}";
+    char text[256];
+    for (auto &buffer: shared.buffers) {
+        if (!buffer->name.empty()) {
+            outfile << ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->id
+                    << ", \"args\": {\"name\": " << kinect::stats::json_string(buffer->name) << "}}";
+        }
+        size_t count = buffer->count.load(std::memory_order_acquire);
+        for (size_t i = 0; i < count; ++i) {
+            const Event &event = buffer->chunks[i / chunk_events][i % chunk_events];
+            // spans begun before enable() start at 0
+            uint64_t begin = std::max(event.begin, shared.origin);
+            uint64_t end = std::max(event.end, begin);
+            int length = snprintf(text, sizeof(text), ",\n{\"name\": %s, \"ph\": \"X\", \"pid\": 1, \"tid\": %u, "
+                                  "\"ts\": %.3f, \"dur\": %.3f", kinect::stats::json_string(event.name).c_str(), buffer->id,
+                                  static_cast<double>(begin - shared.origin) / 1e3,
+                                  static_cast<double>(end - begin) / 1e3);
+            outfile.write(text, std::min<int>(length, sizeof(text) - 1));
+            if (event.frame != no_frame) {
+                outfile << ", \"args\": {\"frame\": " << event.frame << "}";
+            }
+            outfile << "}";
+        }
+    }
+    outfile << "\n]}\n";
+    if (!outfile) {
+        throw __error__(FILE_WRITE_FAULT);
+    }
+}
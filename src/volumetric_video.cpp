@@ -5,42 +5,143 @@
  * */
 #include "kinect_log.h"
 #include "kinect_type.h"
+#include "kinect_pool.h"
+#include "kinect_trace.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <ostream>
 
 kinect::type::PointCloudFrame::PointCloudFrame(
-        std::vector<kinect::type::PointXYZRGB> &__point_cloud, uint64_t __time) {
-    this->cloud_.resize(__point_cloud.size());
-    for (size_t i = 0; i < this->cloud_.size(); i++) {
-        this->cloud_[i] = __point_cloud.at(i);
+        std::vector<kinect::type::PointXYZRGB> &&__point_cloud, uint64_t __time)
+        : cloud_{std::move(__point_cloud)}, layout_{kinect::type::AOS_LAYOUT}, time_stamp_{__time} {}
+
+kinect::type::PointCloudFrame::PointCloudFrame(kinect::type::PointCloudSoA &&__point_cloud, uint64_t __time)
+        : cloud_soa_{std::move(__point_cloud)}, layout_{kinect::type::SOA_LAYOUT}, time_stamp_{__time} {}
+
+void kinect::type::PointCloudFrame::release_points(std::vector<kinect::type::PointXYZRGB> &__points,
+                                                   kinect::type::PointCloudSoA &__points_soa) {
+    __points = std::move(this->cloud_);
+    __points_soa = std::move(this->cloud_soa_);
+    this->cloud_.clear();
+    this->cloud_soa_.resize(0);
+}
+
+char *kinect::type::write_buffer(size_t __bytes) {
+    static thread_local std::vector<char> buffer;
+    if (buffer.size() < __bytes) {
+        // frames differ a little in size, 1/4 headroom keeps later ones from growing it again
+        buffer.resize(__bytes + __bytes / 4);
+    }
+    return buffer.data();
+}
+
+/*
+ * Header of a .ply file with __size xyzrgb vertices.
+ * */
+static std::string ply_header(size_t __size, bool __binary) {
+    std::string header = "ply\n";
+    header += __binary ? "format binary_little_endian 1.0\n" : "format ascii 1.0\n";
+    header += "comment made by @ChenRP07\n";
+    header += "element vertex " + std::to_string(__size) + "\n";
+    header += "property float x\n";
+    header += "property float y\n";
+    header += "property float z\n";
+    header += "property uchar red\n";
+    header += "property uchar green\n";
+    header += "property uchar blue\n";
+    header += "end_header\n";
+    return header;
+}
+
+/*
+ * Write __size bytes of __buffer to __output_path with one write.
+ * */
+static void write_file(const std::string &__output_path, const char *__buffer, size_t __size) {
+    std::ofstream outfile(__output_path.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!outfile.is_open()) {
+        throw __error__(FILE_OPEN_FAULT);
     }
-    this->time_stamp_ = __time;
+    outfile.write(__buffer, static_cast<std::streamsize>(__size));
+    if (!outfile) {
+        throw __error__(FILE_WRITE_FAULT);
+    }
+    kinect::stats::count_output(__size);
 }
 
+/*
+ * Print __value in decimal at __out, return the end of the text.
+ * */
+static char *format_uint(char *__out, uint32_t __value) {
+    char digits[10];
+    int length = 0;
+    do {
+        digits[length++] = static_cast<char>('0' + __value % 10);
+        __value /= 10;
+    } while (__value != 0);
+    while (length > 0) {
+        *__out++ = digits[--length];
+    }
+    return __out;
+}
+
+/*
+ * Print __value at __out as operator<< with default precision does, return
+ * the end of the text. k4a coordinates are whole millimeters, they are
+ * printed by integer conversion, the other values fall back to "%g".
+ * */
+static char *format_float(char *__out, float __value) {
+    if (std::fabs(__value) < 1e6f && __value == std::trunc(__value) && !std::signbit(__value)) {
+        return format_uint(__out, static_cast<uint32_t>(__value));
+    }
+    if (std::fabs(__value) < 1e6f && __value == std::trunc(__value) && __value != 0.0f) {
+        *__out++ = '-';
+        return format_uint(__out, static_cast<uint32_t>(-__value));
+    }
+    // 12 chars at most, e.g. -1.23457e+06
+    return __out + snprintf(__out, 16, "%g", __value);
+}
+
+/*
+ * Print one vertex line of an ascii .ply file, return the end of the text.
+ * */
+static char *format_point(char *__out, float __x, float __y, float __z, uint8_t __r, uint8_t __g, uint8_t __b) {
+    __out = format_float(__out, __x);
+    *__out++ = ' ';
+    __out = format_float(__out, __y);
+    *__out++ = ' ';
+    __out = format_float(__out, __z);
+    *__out++ = ' ';
+    __out = format_uint(__out, __r);
+    *__out++ = ' ';
+    __out = format_uint(__out, __g);
+    *__out++ = ' ';
+    __out = format_uint(__out, __b);
+    *__out++ = '\n';
+    return __out;
+}
+
+// max length of a line printed by format_point, 3 floats, 3 uchars and separators
+static const size_t ascii_point_size = 3 * 16 + 3 * 3 + 6;
+
 void kinect::type::PointCloudFrame::output_ascii(
         const std::string &__output_path) {
     try {
-        std::ofstream outfile;
-        outfile.open(__output_path.c_str(), std::ios::out | std::ios::trunc);
-        if (!outfile.is_open()) {
-            throw __error__(FILE_OPEN_FAULT);
-        }
-        outfile << "ply" << std::endl;
-        outfile << "format ascii 1.0" << std::endl;
-        outfile << "comment made by @ChenRP07" << std::endl;
-        outfile << "element vertex " << this->cloud_.size() << std::endl;
-        outfile << "property float x" << std::endl;
-        outfile << "property float y" << std::endl;
-        outfile << "property float z" << std::endl;
-        outfile << "property uchar red" << std::endl;
-        outfile << "property uchar green" << std::endl;
-        outfile << "property uchar blue" << std::endl;
-        outfile << "end_header" << std::endl;
+        std::string header = ply_header(this->size(), false);
+        char *buffer = kinect::type::write_buffer(header.size() + this->size() * ascii_point_size);
+        char *out = std::copy(header.begin(), header.end(), buffer);
         for (auto &i: this->cloud_) {
-            outfile << i.x << " " << i.y << " " << i.z << " " << i.r << " "
-                    << i.g << " " << i.b << std::endl;
+            out = format_point(out, i.x, i.y, i.z, i.r, i.g, i.b);
+        }
+        const kinect::type::PointCloudSoA &soa = this->cloud_soa_;
+        for (size_t i = 0; i < soa.size(); i++) {
+            out = format_point(out, soa.x[i], soa.y[i], soa.z[i], soa.rgb[i * 3 + 0], soa.rgb[i * 3 + 1],
+                               soa.rgb[i * 3 + 2]);
         }
-        outfile.close();
+        write_file(__output_path, buffer, static_cast<size_t>(out - buffer));
     }
     catch (const kinect::log::except &error_log) {
         error_log.log_error();
@@ -49,41 +150,37 @@ void kinect::type::PointCloudFrame::output_ascii(
     }
 }
 
+// bytes of one vertex in a binary .ply file
+static const size_t binary_point_size = sizeof(float) * 3 + sizeof(uint8_t) * 3;
+
+static_assert(offsetof(kinect::type::PointXYZRGB, r) == sizeof(float) * 3 &&
+              offsetof(kinect::type::PointXYZRGB, b) == binary_point_size - 1,
+              "PointXYZRGB starts with the bytes of a binary .ply vertex");
+
 void kinect::type::PointCloudFrame::output_binary(const std::string &__output_path) {
     try {
-        std::ofstream outfile;
-        outfile.open(__output_path.c_str(), std::ios::out | std::ios::trunc);
-        if (!outfile.is_open()) {
-            throw __error__(FILE_OPEN_FAULT);
-        }
-        outfile << "ply" << std::endl;
-        outfile << "format binary_little_endian 1.0" << std::endl;
-        outfile << "comment made by @ChenRP07" << std::endl;
-        outfile << "element vertex " << this->cloud_.size() << std::endl;
-        outfile << "property float x" << std::endl;
-        outfile << "property float y" << std::endl;
-        outfile << "property float z" << std::endl;
-        outfile << "property uchar red" << std::endl;
-        outfile << "property uchar green" << std::endl;
-        outfile << "property uchar blue" << std::endl;
-        outfile << "end_header" << std::endl;
-        outfile.close();
-
-        outfile.open(__output_path.c_str(), std::ios::out | std::ios::app | std::ios::binary);
+        std::string header = ply_header(this->size(), true);
+        size_t size = header.size() + this->size() * binary_point_size;
+        char *buffer = kinect::type::write_buffer(size);
+        char *out = std::copy(header.begin(), header.end(), buffer);
         for (auto &i: this->cloud_) {
-            float coordinates[3] = {i.x, i.y, i.z};
-            uint8_t colors[3] = {i.r, i.g, i.b};
-            outfile.write((char *) coordinates, sizeof(float) * 3);
-            outfile.write((char *) colors, sizeof(uint8_t) * 3);
+            std::memcpy(out, &i, binary_point_size);
+            out += binary_point_size;
+        }
+        const kinect::type::PointCloudSoA &soa = this->cloud_soa_;
+        for (size_t i = 0; i < soa.size(); i++) {
+            float coordinates[3] = {soa.x[i], soa.y[i], soa.z[i]};
+            std::memcpy(out, coordinates, sizeof(coordinates));
+            std::memcpy(out + sizeof(coordinates), &soa.rgb[i * 3], sizeof(uint8_t) * 3);
+            out += binary_point_size;
         }
-        outfile.close();
+        write_file(__output_path, buffer, size);
     }
     catch (const kinect::log::except &error_log) {
         error_log.log_error();
         this->~PointCloudFrame();
         exit(1);
     }
-
 }
 
 void kinect::type::PointCloudFrame::output(const std::string &__output_path,
@@ -98,6 +195,33 @@ void kinect::type::PointCloudFrame::output(const std::string &__output_path,
     }
 }
 
+kinect::type::PlyFrameSink::PlyFrameSink(const std::string &__output_path,
+                                          const std::string &__sequence_name, bool __binary) {
+    try {
+        if (__sequence_name.empty()) {
+            throw __error__(WRONG_FILE_NAME_FORMAT);
+        }
+        this->file_name_prev_ = __output_path;
+        if (this->file_name_prev_.back() != '/') {
+            this->file_name_prev_ += '/';
+        }
+        this->file_name_prev_ += __sequence_name;
+        this->binary_ = __binary;
+    }
+    catch (const kinect::log::except &error_log) {
+        error_log.log_error();
+        exit(1);
+    }
+}
+
+void kinect::type::PlyFrameSink::write(kinect::type::PointCloudFrame &__frame) {
+    __frame.output(this->file_name_prev_, this->binary_);
+}
+
+kinect::type::VolumetricVideo::~VolumetricVideo() {
+    this->close_stream();
+}
+
 void kinect::type::VolumetricVideo::set_name(
         const std::string &__sequence_name) {
     try {
@@ -113,32 +237,159 @@ void kinect::type::VolumetricVideo::set_name(
     }
 }
 
-void kinect::type::VolumetricVideo::add_point_cloud(
-        std::vector<kinect::type::PointXYZRGB> &__point_cloud,
-        uint64_t __time_offset, int __fps) {
+uint64_t kinect::type::VolumetricVideo::next_time_stamp(uint64_t __time_offset, int __fps) const {
     // time interval using usec
     uint64_t time_interval = 1e6 / __fps;
-    uint64_t time_stamp = __time_offset + this->frames_.size() * time_interval;
-    this->frames_.emplace_back(__point_cloud, time_stamp);
+    return __time_offset + this->frame_count_ * time_interval;
 }
 
-void kinect::type::VolumetricVideo::output(const std::string &__output_path,
-                                           bool __binary) {
-    try {
-        if (this->volumetric_video_name_.empty()) {
-            throw __error__(WRONG_FILE_NAME_FORMAT);
+void kinect::type::VolumetricVideo::add_frame(kinect::type::PointCloudFrame &&__frame) {
+    this->frame_count_++;
+    if (this->sink_ != nullptr) {
+        // blocks while max_in_flight frames are waiting for the writer
+        this->stream_queue_->push(std::move(__frame));
+    }
+    else {
+        this->frames_.emplace_back(std::move(__frame));
+    }
+}
+
+void kinect::type::VolumetricVideo::add_point_cloud(
+        std::vector<kinect::type::PointXYZRGB> &&__point_cloud,
+        uint64_t __time_offset, int __fps) {
+    uint64_t time_stamp = this->next_time_stamp(__time_offset, __fps);
+    this->add_frame(kinect::type::PointCloudFrame(std::move(__point_cloud), time_stamp));
+}
+
+void kinect::type::VolumetricVideo::add_point_cloud(kinect::type::PointCloudSoA &&__point_cloud,
+                                                    uint64_t __time_offset, int __fps) {
+    uint64_t time_stamp = this->next_time_stamp(__time_offset, __fps);
+    this->add_frame(kinect::type::PointCloudFrame(std::move(__point_cloud), time_stamp));
+}
+
+void kinect::type::VolumetricVideo::add_point_cloud(std::vector<kinect::type::PointXYZRGB> &&__point_cloud,
+                                                    uint64_t __time_stamp) {
+    this->add_frame(kinect::type::PointCloudFrame(std::move(__point_cloud), __time_stamp));
+}
+
+void kinect::type::VolumetricVideo::add_point_cloud(kinect::type::PointCloudSoA &&__point_cloud,
+                                                    uint64_t __time_stamp) {
+    this->add_frame(kinect::type::PointCloudFrame(std::move(__point_cloud), __time_stamp));
+}
+
+void kinect::type::VolumetricVideo::count_write(uint64_t __frame, uint64_t __begin) {
+    if (this->write_stats_ != nullptr) {
+        this->write_stats_->add(__frame, __begin, kinect::stats::now_nsec());
+    }
+    else {
+        kinect::trace::record("write", __frame, __begin, kinect::stats::now_nsec());
+    }
+}
+
+void kinect::type::VolumetricVideo::set_write_stats(std::shared_ptr<kinect::stats::StageStats> __stats) {
+    this->write_stats_ = __stats;
+}
+
+void kinect::type::VolumetricVideo::open_stream(std::shared_ptr<kinect::type::FrameSink> __sink,
+                                                size_t __max_in_flight, std::function<void()> __frame_written) {
+    this->close_stream();
+    this->sink_ = __sink;
+    this->frame_written_ = std::move(__frame_written);
+    this->spare_limit_ = std::min<size_t>(__max_in_flight, 64);
+    this->stream_queue_.reset(new kinect::type::BoundedQueue<kinect::type::PointCloudFrame>(__max_in_flight));
+    // index in this video of the first streamed frame
+    uint64_t first_frame = this->frame_count_;
+    this->stream_writer_ = std::thread([this, first_frame] {
+        kinect::trace::set_thread_name("writer");
+        kinect::type::PointCloudFrame frame;
+        for (uint64_t index = first_frame; this->stream_queue_->pop(frame); ++index) {
+            uint64_t begin = kinect::stats::now_nsec();
+            this->sink_->write(frame);
+            this->count_write(index, begin);
+            // keep the storage of the points for a later frame, free the rest before waiting for the next frame
+            std::vector<kinect::type::PointXYZRGB> points;
+            kinect::type::PointCloudSoA points_soa;
+            frame.release_points(points, points_soa);
+            {
+                std::lock_guard<std::mutex> lock(this->spare_mutex_);
+                this->largest_frame_ = std::max(this->largest_frame_, std::max(points.size(), points_soa.size()));
+                if (points.capacity() != 0 && this->spare_points_.size() < this->spare_limit_) {
+                    this->spare_points_.emplace_back(std::move(points));
+                }
+                if (points_soa.x.capacity() != 0 && this->spare_points_soa_.size() < this->spare_limit_) {
+                    this->spare_points_soa_.emplace_back(std::move(points_soa));
+                }
+            }
+            frame = kinect::type::PointCloudFrame();
+            if (this->frame_written_) {
+                this->frame_written_();
+            }
         }
+    });
+}
 
-        std::string file_name_prev = __output_path;
-        if (file_name_prev.back() != '/') {
-            file_name_prev += '/';
+void kinect::type::VolumetricVideo::close_stream() {
+    if (this->sink_ == nullptr) {
+        return;
+    }
+    this->stream_queue_->close();
+    if (this->stream_writer_.joinable()) {
+        this->stream_writer_.join();
+    }
+    this->sink_->close();
+    this->sink_.reset();
+    this->stream_queue_.reset();
+    this->frame_written_ = nullptr;
+    this->spare_points_.clear();
+    this->spare_points_soa_.clear();
+}
+
+void kinect::type::VolumetricVideo::reuse_points(std::vector<kinect::type::PointXYZRGB> &__points) {
+    size_t room;
+    {
+        std::lock_guard<std::mutex> lock(this->spare_mutex_);
+        if (this->spare_points_.empty()) {
+            return;
         }
+        __points.swap(this->spare_points_.back());
+        this->spare_points_.pop_back();
+        room = this->largest_frame_ + this->largest_frame_ / 4;
+    }
+    __points.clear();
+    // frames differ a little in size, so a reused storage grows once and then fits
+    if (__points.capacity() < room) {
+        __points.reserve(room);
+    }
+}
 
-        file_name_prev += this->volumetric_video_name_;
+void kinect::type::VolumetricVideo::reuse_points(kinect::type::PointCloudSoA &__points) {
+    size_t room;
+    {
+        std::lock_guard<std::mutex> lock(this->spare_mutex_);
+        if (this->spare_points_soa_.empty()) {
+            return;
+        }
+        std::swap(__points, this->spare_points_soa_.back());
+        this->spare_points_soa_.pop_back();
+        room = this->largest_frame_ + this->largest_frame_ / 4;
+    }
+    __points.resize(0);
+    if (__points.x.capacity() < room) {
+        __points.x.reserve(room);
+        __points.y.reserve(room);
+        __points.z.reserve(room);
+        __points.rgb.reserve(room * 3);
+    }
+}
 
-        for (auto &i: this->frames_) {
-            i.output(file_name_prev, __binary);
+void kinect::type::VolumetricVideo::output(const std::string &__output_path,
+                                           bool __binary) {
+    try {
+        if (this->volumetric_video_name_.empty()) {
+            throw __error__(WRONG_FILE_NAME_FORMAT);
         }
+        kinect::type::PlyFrameSink sink(__output_path, this->volumetric_video_name_, __binary);
+        this->output(sink);
     }
     catch (const kinect::log::except &error_log) {
         error_log.log_error();
@@ -146,3 +397,14 @@ void kinect::type::VolumetricVideo::output(const std::string &__output_path,
         exit(1);
     }
 }
+
+void kinect::type::VolumetricVideo::output(kinect::type::FrameSink &__sink) {
+    // frames are independent files, each worker formats a whole frame and writes it at once
+    kinect::type::ThreadPool pool;
+    pool.parallel_for(this->frames_.size(), [&](size_t i) {
+        uint64_t begin = kinect::stats::now_nsec();
+        __sink.write(this->frames_[i]);
+        this->count_write(i, begin);
+    });
+    __sink.close();
+}
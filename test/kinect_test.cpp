@@ -0,0 +1,1092 @@
+/*
+ * Tests of the native camera geometry and kernels of kinect-core against
+ * fixed reference data, run by ctest.
+ * Author : @ChenRP07
+ * Date : 2022-11-29
+ * */
+#include "kinect_camera.h"
+#include "kinect_filter.h"
+#include "kinect_kernel.h"
+#include "kinect_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+    int failures = 0;
+
+#define __check__(condition, ...)                                 \
+    do {                                                          \
+        if (!(condition)) {                                       \
+            ++failures;                                           \
+            printf("FAILED %s:%d : ", __FILE__, __LINE__);        \
+            printf(__VA_ARGS__);                                  \
+            printf("\n");                                         \
+        }                                                         \
+    } while (0)
+
+    /*
+     * A pixel and its ray at z = 1.
+     * */
+    struct Ray {
+        int u, v;
+        float x, y;
+    };
+
+    /*
+     * Calibration of an Azure Kinect depth camera, NFOV unbinned, Rational 6KT.
+     * */
+    k4a_calibration_camera_t rational_camera() {
+        k4a_calibration_camera_t camera{};
+        camera.intrinsics.type = K4A_CALIBRATION_LENS_DISTORTION_MODEL_RATIONAL_6KT;
+        camera.intrinsics.parameter_count = 14;
+        auto &p = camera.intrinsics.parameters.param;
+        p.cx = 323.5466614f;
+        p.cy = 331.5437927f;
+        p.fx = 504.0703125f;
+        p.fy = 504.1362305f;
+        p.k1 = 0.5247318745f;
+        p.k2 = -0.0286131538f;
+        p.k3 = -0.0035466012f;
+        p.k4 = 0.8574312925f;
+        p.k5 = 0.0802934170f;
+        p.k6 = -0.0178561173f;
+        p.p1 = -0.0000459838f;
+        p.p2 = 0.0000179346f;
+        p.metric_radius = 1.7f;
+        camera.resolution_width = 640;
+        camera.resolution_height = 576;
+        camera.metric_radius = 1.7f;
+        return camera;
+    }
+
+    /*
+     * Calibration of a 720p color camera, Brown Conrady.
+     * */
+    k4a_calibration_camera_t brown_conrady_camera() {
+        k4a_calibration_camera_t camera{};
+        camera.intrinsics.type = K4A_CALIBRATION_LENS_DISTORTION_MODEL_BROWN_CONRADY;
+        camera.intrinsics.parameter_count = 14;
+        auto &p = camera.intrinsics.parameters.param;
+        p.cx = 638.1627197f;
+        p.cy = 366.5047913f;
+        p.fx = 605.3215942f;
+        p.fy = 605.1567383f;
+        p.k1 = 0.0812412053f;
+        p.k2 = -0.0613562055f;
+        p.k3 = 0.0108345077f;
+        p.p1 = 0.0005413263f;
+        p.p2 = -0.0003261184f;
+        p.metric_radius = 1.7f;
+        camera.resolution_width = 1280;
+        camera.resolution_height = 720;
+        camera.metric_radius = 1.7f;
+        return camera;
+    }
+
+    /*
+     * Calibration of a camera without lens distortion.
+     * */
+    k4a_calibration_camera_t pinhole_camera(int __width, int __height, float __focal, float __cx, float __cy) {
+        k4a_calibration_camera_t camera{};
+        camera.intrinsics.type = K4A_CALIBRATION_LENS_DISTORTION_MODEL_BROWN_CONRADY;
+        camera.intrinsics.parameter_count = 14;
+        auto &p = camera.intrinsics.parameters.param;
+        p.cx = __cx;
+        p.cy = __cy;
+        p.fx = __focal;
+        p.fy = __focal;
+        camera.resolution_width = __width;
+        camera.resolution_height = __height;
+        return camera;
+    }
+
+    /*
+     * A depth camera and a color camera of twice its resolution and focal
+     * length, so color pixel 2 * u looks along the ray of depth pixel u, the
+     * color camera sits at __translation in the depth camera.
+     * */
+    k4a_calibration_t pinhole_rig(int __width, int __height, const float *__translation) {
+        k4a_calibration_t calibration{};
+        float cx = static_cast<float>(__width / 2), cy = static_cast<float>(__height / 2);
+        calibration.depth_camera_calibration = pinhole_camera(__width, __height, 250.0f, cx, cy);
+        calibration.color_camera_calibration = pinhole_camera(__width * 2, __height * 2, 500.0f, cx * 2, cy * 2);
+        k4a_calibration_extrinsics_t &extrinsics =
+                calibration.extrinsics[K4A_CALIBRATION_TYPE_DEPTH][K4A_CALIBRATION_TYPE_COLOR];
+        const float identity[9] = {1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+        std::copy(identity, identity + 9, extrinsics.rotation);
+        std::copy(__translation, __translation + 3, extrinsics.translation);
+        return calibration;
+    }
+
+    /*
+     * Depth of a slanted surface with a step, noise and holes, colors with
+     * some alpha 0 pixels.
+     * */
+    void synthetic_scene(int __width, int __height, std::mt19937 &__random, std::vector<uint16_t> &__depth,
+                         std::vector<uint8_t> &__bgra, int __bgra_width, int __bgra_height) {
+        __depth.resize(static_cast<size_t>(__width) * __height);
+        for (int v = 0; v < __height; ++v) {
+            for (int u = 0; u < __width; ++u) {
+                uint32_t z = 1000 + 3 * u + 2 * v + (u > __width * 3 / 5 ? 700 : 0) + __random() % 7;
+                __depth[static_cast<size_t>(v) * __width + u] = __random() % 32 == 0 ? 0 : static_cast<uint16_t>(z);
+            }
+        }
+        __bgra.resize(static_cast<size_t>(__bgra_width) * __bgra_height * 4);
+        for (size_t i = 0; i < __bgra.size(); i += 4) {
+            uint32_t color = __random();
+            __bgra[i] = static_cast<uint8_t>(color);
+            __bgra[i + 1] = static_cast<uint8_t>(color >> 8);
+            __bgra[i + 2] = static_cast<uint8_t>(color >> 16);
+            __bgra[i + 3] = __random() % 16 == 0 ? 0 : 255;
+        }
+    }
+
+    /*
+     * Points with the same bits, padding of PointXYZRGB is not compared.
+     * */
+    bool same_points(const kinect::type::PointXYZRGB *__points, const kinect::type::PointXYZRGB *__reference,
+                     size_t __size) {
+        for (size_t i = 0; i < __size; ++i) {
+            const kinect::type::PointXYZRGB &p = __points[i], &q = __reference[i];
+            if (std::memcmp(&p.x, &q.x, sizeof(float) * 3) != 0 || p.r != q.r || p.g != q.g || p.b != q.b) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool same_points(const kinect::type::PointCloudSoA &__points, const kinect::type::PointCloudSoA &__reference,
+                     size_t __size) {
+        return std::memcmp(__points.x.data(), __reference.x.data(), __size * sizeof(float)) == 0 &&
+               std::memcmp(__points.y.data(), __reference.y.data(), __size * sizeof(float)) == 0 &&
+               std::memcmp(__points.z.data(), __reference.z.data(), __size * sizeof(float)) == 0 &&
+               std::memcmp(__points.rgb.data(), __reference.rgb.data(), __size * 3) == 0;
+    }
+
+    // rays of the k4a lens model at some pixels, the projection equations of k4a solved in double
+    const Ray rational_rays[] = {{0, 0, -0.957022738f, -0.980278269f},
+                                 {320, 288, -0.007053796f, -0.086588600f},
+                                 {639, 575, 0.813909520f, 0.628183453f},
+                                 {100, 500, -0.496888802f, 0.374404989f},
+                                 {600, 40, 0.717201776f, -0.756191861f},
+                                 {323, 331, -0.001084495f, -0.001078663f}};
+
+    const Ray brown_conrady_rays[] = {{0, 0, -1.030207711f, -0.592828695f},
+                                      {640, 360, 0.003035265f, -0.010749041f},
+                                      {1279, 719, 1.035012469f, 0.568485839f},
+                                      {200, 650, -0.701560560f, 0.453816087f},
+                                      {1100, 90, 0.740978971f, -0.444000152f},
+                                      {638, 366, -0.000268815f, -0.000834151f}};
+
+    // largest difference of a ray from the reference, the Newton iterations of k4a stop at 1e-3 pixels
+    const float ray_tolerance = 1e-5f;
+
+    /*
+     * Pixel -> ray -> pixel on a grid of the image and ray -> pixel -> ray on a
+     * grid of the z = 1 plane.
+     * */
+    void test_round_trip(const char *__name, const k4a_calibration_camera_t &__camera) {
+        float largest_uv = 0.0f, largest_xy = 0.0f;
+        for (int v = 0; v < __camera.resolution_height; v += 16) {
+            for (int u = 0; u < __camera.resolution_width; u += 16) {
+                float uv[2] = {static_cast<float>(u), static_cast<float>(v)}, xy[2], back[2];
+                __check__(kinect::camera::unproject(__camera, uv, xy), "%s: no ray at (%d, %d)", __name, u, v);
+                __check__(kinect::camera::project(__camera, xy, back, nullptr), "%s: no pixel at (%d, %d)", __name,
+                          u, v);
+                largest_uv = std::max(largest_uv, std::max(std::fabs(back[0] - uv[0]), std::fabs(back[1] - uv[1])));
+            }
+        }
+        for (float y = -0.6f; y <= 0.6f; y += 0.05f) {
+            for (float x = -0.8f; x <= 0.8f; x += 0.05f) {
+                float xy[2] = {x, y}, uv[2], back[2];
+                __check__(kinect::camera::project(__camera, xy, uv, nullptr), "%s: no pixel at (%f, %f)", __name, x,
+                          y);
+                __check__(kinect::camera::unproject(__camera, uv, back), "%s: no ray at (%f, %f)", __name, x, y);
+                largest_xy = std::max(largest_xy, std::max(std::fabs(back[0] - x), std::fabs(back[1] - y)));
+            }
+        }
+        __check__(largest_uv < 1e-3f, "%s: pixel round trip is off by %g", __name, largest_uv);
+        __check__(largest_xy < ray_tolerance, "%s: ray round trip is off by %g", __name, largest_xy);
+        printf("%s round trip : pixel %g, ray %g\n", __name, largest_uv, largest_xy);
+    }
+
+    /*
+     * RayTable at some pixels against the reference rays.
+     * */
+    template<size_t N>
+    void test_ray_table(const char *__name, const k4a_calibration_camera_t &__camera, const Ray (&__rays)[N],
+                        kinect::type::ThreadPool *__pool) {
+        kinect::camera::RayTable table;
+        table.build(__camera, __pool);
+        __check__(table.width() == __camera.resolution_width && table.height() == __camera.resolution_height,
+                  "%s: table is %dx%d", __name, table.width(), table.height());
+        float largest = 0.0f;
+        for (const Ray &ray: __rays) {
+            size_t index = static_cast<size_t>(ray.v) * table.width() + ray.u;
+            float x = table.x()[index], y = table.y()[index];
+            float difference = std::max(std::fabs(x - ray.x), std::fabs(y - ray.y));
+            __check__(difference < ray_tolerance, "%s: ray of (%d, %d) is (%.9f, %.9f), expected (%.9f, %.9f)",
+                      __name, ray.u, ray.v, x, y, ray.x, ray.y);
+            largest = std::max(largest, difference);
+        }
+        printf("%s ray table : %g\n", __name, largest);
+    }
+
+    /*
+     * unproject_depth of every instruction set of this CPU gives the same bytes
+     * as the scalar version, on random depth and rays with NaN and odd ends.
+     * */
+    void test_unproject_depth(const k4a_calibration_camera_t &__camera, kinect::type::ThreadPool *__pool) {
+        kinect::camera::RayTable table;
+        table.build(__camera, __pool);
+        size_t pixels = static_cast<size_t>(table.width()) * table.height();
+        std::vector<float> rays_x(table.x(), table.x() + pixels), rays_y(table.y(), table.y() + pixels);
+        std::mt19937 random(2022);
+        std::vector<uint16_t> depth(pixels);
+        for (size_t i = 0; i < pixels; ++i) {
+            // no depth, near, far and the largest depth, where z no longer fits int16
+            uint32_t kind = random() % 16;
+            depth[i] = kind == 0 ? 0 : kind == 1 ? 65535 : static_cast<uint16_t>(random() % 12000);
+            if (random() % 64 == 0) {
+                rays_x[i] = rays_y[i] = std::nanf("");
+            }
+        }
+
+        // odd begin and end, so the scalar tails of the SIMD versions run too
+        const size_t begin = 3, end = pixels - 5;
+        std::vector<int16_t> reference(pixels * 3, 0x5a5a), points(pixels * 3);
+        __check__(kinect::camera::max_difference(reference.data(), reference.data(), pixels) == 0,
+                  "max_difference of an image and itself");
+        __check__(kinect::kernel::set_instruction_set("scalar"), "scalar is not supported");
+        kinect::kernel::unproject_depth(depth.data(), rays_x.data(), rays_y.data(), reference.data(), begin, end);
+        for (const char *isa: {"sse4.1", "avx2"}) {
+            if (!kinect::kernel::set_instruction_set(isa)) {
+                printf("unproject_depth %s : not supported, skipped\n", isa);
+                continue;
+            }
+            std::fill(points.begin(), points.end(), 0x5a5a);
+            kinect::kernel::unproject_depth(depth.data(), rays_x.data(), rays_y.data(), points.data(), begin, end);
+            bool same = std::memcmp(points.data(), reference.data(), points.size() * sizeof(int16_t)) == 0;
+            __check__(same, "unproject_depth %s differs from scalar by %d", isa,
+                      kinect::camera::max_difference(points.data(), reference.data(), pixels));
+            printf("unproject_depth %s : %s\n", isa, same ? "bit identical" : "different");
+        }
+    }
+
+    /*
+     * extract_points of every instruction set of this CPU gives the same points
+     * as the scalar version, with and without transform and crop, on pixels
+     * with holes, depth out of the limits and alpha 0, and on 1 to 3 pixels,
+     * which only the scalar tails see.
+     * */
+    void test_extract_points() {
+        const size_t pixels = 1003;
+        std::mt19937 random(2024);
+        std::vector<int16_t> xyz(pixels * 3);
+        std::vector<uint8_t> bgra(pixels * 4);
+        for (size_t i = 0; i < pixels; ++i) {
+            uint32_t kind = random() % 16;
+            xyz[i * 3] = static_cast<int16_t>(static_cast<int>(random() % 2001) - 1000);
+            xyz[i * 3 + 1] = static_cast<int16_t>(static_cast<int>(random() % 2001) - 1000);
+            // holes, depth under depth_min and over depth_max, the others in the limits
+            xyz[i * 3 + 2] = static_cast<int16_t>(kind == 0 ? 0 : kind == 1 ? 300 : kind == 2 ? 4000
+                                                                                              : 500 + random() % 3000);
+            for (int c = 0; c < 3; ++c) {
+                bgra[i * 4 + c] = static_cast<uint8_t>(random());
+            }
+            bgra[i * 4 + 3] = kind == 3 ? 0 : 255;
+        }
+
+        kinect::type::Extrinsics extrinsics;
+        const float c = std::cos(0.3f), s = std::sin(0.3f);
+        const float rotation[9] = {c, 0.0f, s, 0.0f, 1.0f, 0.0f, -s, 0.0f, c};
+        std::copy(rotation, rotation + 9, extrinsics.rotation);
+        extrinsics.translation[0] = -40.0f;
+        extrinsics.translation[1] = 15.5f;
+        extrinsics.translation[2] = 250.0f;
+        kinect::type::Box crop;
+        crop.min[0] = -600.0f, crop.min[1] = -500.0f, crop.min[2] = 900.0f;
+        crop.max[0] = 700.0f, crop.max[1] = 650.0f, crop.max[2] = 3000.0f;
+
+        // SoA points are written from point first on
+        const size_t first = 5;
+        int compared = 0;
+        for (int combination = 0; combination < 6; ++combination) {
+            kinect::kernel::ExtractOptions options;
+            options.depth_min = 500;
+            options.depth_max = 3500;
+            options.extrinsics = (combination & 1) ? &extrinsics : nullptr;
+            options.crop = combination >= 2 ? &crop : nullptr;
+            options.crop_camera = combination >= 4;
+            for (size_t size: {size_t(1), size_t(2), size_t(3), pixels}) {
+                std::vector<kinect::type::PointXYZRGB> reference(size), points(size);
+                kinect::type::PointCloudSoA reference_soa, points_soa;
+                reference_soa.resize(first + size);
+                points_soa.resize(first + size);
+                kinect::kernel::set_instruction_set("scalar");
+                size_t count = kinect::kernel::extract_points(xyz.data(), bgra.data(), size, options,
+                                                              reference.data());
+                size_t count_soa = kinect::kernel::extract_points(xyz.data(), bgra.data(), size, options,
+                                                                  reference_soa, first);
+                __check__(count == count_soa, "extract_points: %zu AoS and %zu SoA points", count, count_soa);
+                if (size == pixels) {
+                    __check__(count != 0 && count < size, "extract_points keeps %zu of %zu points", count, size);
+                }
+                for (const char *isa: {"sse4.1", "avx2"}) {
+                    if (!kinect::kernel::set_instruction_set(isa)) {
+                        continue;
+                    }
+                    size_t isa_count = kinect::kernel::extract_points(xyz.data(), bgra.data(), size, options,
+                                                                      points.data());
+                    size_t isa_count_soa = kinect::kernel::extract_points(xyz.data(), bgra.data(), size, options,
+                                                                          points_soa, first);
+                    __check__(isa_count == count && same_points(points.data(), reference.data(), count),
+                              "extract_points %s AoS differs, combination %d, %zu pixels", isa, combination, size);
+                    __check__(isa_count_soa == count &&
+                              same_points(points_soa, reference_soa, first + count),
+                              "extract_points %s SoA differs, combination %d, %zu pixels", isa, combination, size);
+                    ++compared;
+                }
+            }
+        }
+        printf("extract_points : %d cases against scalar\n", compared);
+    }
+
+    /*
+     * remove_flying_pixels of every instruction set of this CPU against the
+     * scalar version on widths with SIMD tails, bands of rows and the image
+     * borders, and the 16-bit ratio against the depth jumps it allows.
+     * */
+    void test_remove_flying_pixels(kinect::type::ThreadPool *__pool) {
+        std::mt19937 random(2025);
+        int compared = 0;
+        for (int width: {5, 17, 75}) {
+            const int height = 37;
+            const size_t pixels = static_cast<size_t>(width) * height;
+            // a step from 1000mm to 1600mm, pixels between the surfaces, holes and noise
+            std::vector<uint16_t> input(pixels);
+            for (int y = 0; y < height; ++y) {
+                for (int x = 0; x < width; ++x) {
+                    uint32_t kind = random() % 16;
+                    uint16_t depth = static_cast<uint16_t>((x + y > width / 2 ? 1600 : 1000) + random() % 40);
+                    input[static_cast<size_t>(y) * width + x] = kind == 0 ? 0 : kind == 1 ? 1300 : depth;
+                }
+            }
+            // whole image, first and last rows alone and a band inside
+            const int bands[][2] = {{0, height}, {0, 1}, {height - 1, height}, {5, 23}};
+            for (uint16_t ratio: {uint16_t(3277), uint16_t(65535)}) {
+                for (const auto &band: bands) {
+                    std::vector<uint16_t> reference(pixels, 0xabcd), output(pixels);
+                    kinect::kernel::set_instruction_set("scalar");
+                    kinect::kernel::remove_flying_pixels(input.data(), reference.data(), width, height, band[0],
+                                                         band[1], ratio);
+                    size_t begin = static_cast<size_t>(band[0]) * width, end = static_cast<size_t>(band[1]) * width;
+                    size_t written = 0;
+                    for (size_t i = 0; i < pixels; ++i) {
+                        written += (i < begin || i >= end) && reference[i] != 0xabcd;
+                    }
+                    __check__(written == 0, "remove_flying_pixels writes outside rows %d to %d", band[0], band[1]);
+                    for (const char *isa: {"sse4.1", "avx2"}) {
+                        if (!kinect::kernel::set_instruction_set(isa)) {
+                            continue;
+                        }
+                        std::fill(output.begin(), output.end(), 0xabcd);
+                        kinect::kernel::remove_flying_pixels(input.data(), output.data(), width, height, band[0],
+                                                             band[1], ratio);
+                        __check__(output == reference, "remove_flying_pixels %s differs, width %d, rows %d to %d",
+                                  isa, width, band[0], band[1]);
+                        ++compared;
+                    }
+                }
+            }
+        }
+        printf("remove_flying_pixels : %d cases against scalar\n", compared);
+
+        // 0.05 is 3277 / 65536, at 1000mm a jump of 50mm is allowed and 51mm is not
+        const int width = 3, height = 3;
+        for (const char *isa: {"scalar", "sse4.1", "avx2"}) {
+            if (!kinect::kernel::set_instruction_set(isa)) {
+                continue;
+            }
+            for (uint16_t neighbour: {uint16_t(1050), uint16_t(1051), uint16_t(949), uint16_t(950)}) {
+                const uint16_t input[9] = {neighbour, neighbour, neighbour, 1000, 1000, 1000,
+                                           neighbour, neighbour, neighbour};
+                uint16_t output[9];
+                kinect::filter::remove_flying_pixels(input, output, width, height, 0.05f, __pool);
+                bool flying = neighbour == 1051 || neighbour == 949;
+                __check__(output[4] == (flying ? 0 : 1000), "remove_flying_pixels %s: 1000mm between %dmm is %d",
+                          isa, neighbour, output[4]);
+            }
+        }
+        // ratios of 1 and more are clamped to the largest fraction
+        const uint16_t wide[9] = {3000, 3000, 3000, 1000, 1000, 1000, 3000, 3000, 3000};
+        uint16_t clamped[9], largest[9];
+        kinect::filter::remove_flying_pixels(wide, clamped, width, height, 4.0f, __pool);
+        kinect::kernel::remove_flying_pixels(wide, largest, width, height, 0, height, 65535);
+        __check__(std::memcmp(clamped, largest, sizeof(clamped)) == 0 && clamped[4] == 0,
+                  "remove_flying_pixels: ratio 4 is not clamped");
+    }
+
+    /*
+     * temporal_filter over many frames: every instruction set of this CPU keeps
+     * the same state as the scalar version, a steady depth converges and holds,
+     * and motion or no depth restarts a pixel at once.
+     * */
+    void test_temporal_filter() {
+        const kinect::kernel::TemporalOptions options;
+        const size_t pixels = 1003;
+        std::mt19937 random(2026);
+        std::vector<uint16_t> base(pixels);
+        for (uint16_t &depth: base) {
+            depth = static_cast<uint16_t>(500 + random() % 4000);
+        }
+        int compared = 0;
+        for (const char *isa: {"sse4.1", "avx2"}) {
+            if (!kinect::kernel::set_instruction_set(isa)) {
+                continue;
+            }
+            std::vector<float> reference_average(pixels, 0.0f), average(pixels, 0.0f);
+            std::vector<uint16_t> reference_output(pixels, 0), output(pixels, 0);
+            std::mt19937 frames(2027);
+            bool same = true;
+            for (int frame = 0; frame < 40 && same; ++frame) {
+                // noise, holes and surfaces moving beyond the motion threshold
+                std::vector<uint16_t> depth(pixels), reference;
+                for (size_t i = 0; i < pixels; ++i) {
+                    uint32_t kind = frames() % 32;
+                    int noise = static_cast<int>(frames() % 21) - 10;
+                    depth[i] = kind == 0 ? 0 : static_cast<uint16_t>(base[i] + noise + (kind == 1 ? 300 : 0));
+                }
+                reference = depth;
+                kinect::kernel::set_instruction_set("scalar");
+                kinect::kernel::temporal_filter(reference.data(), reference_average.data(), reference_output.data(),
+                                                pixels, options);
+                kinect::kernel::set_instruction_set(isa);
+                kinect::kernel::temporal_filter(depth.data(), average.data(), output.data(), pixels, options);
+                same = depth == reference && output == reference_output &&
+                       std::memcmp(average.data(), reference_average.data(), pixels * sizeof(float)) == 0;
+                __check__(same, "temporal_filter %s differs from scalar at frame %d", isa, frame);
+            }
+            ++compared;
+        }
+        printf("temporal_filter : %d instruction sets against scalar over 40 frames\n", compared);
+
+        // 19 pixels, so SIMD kernels and their tails see the same sequence
+        const size_t size = 19;
+        for (const char *isa: {"scalar", "sse4.1", "avx2"}) {
+            if (!kinect::kernel::set_instruction_set(isa)) {
+                continue;
+            }
+            std::vector<float> average(size, 0.0f);
+            std::vector<uint16_t> output(size, 0);
+            auto run = [&](uint16_t __depth) {
+                std::vector<uint16_t> depth(size, __depth);
+                kinect::kernel::temporal_filter(depth.data(), average.data(), output.data(), size, options);
+                return depth;
+            };
+            // no history starts at the sample, a step to 1010mm within the motion threshold is
+            // followed until the average is within hold of the output, which then stays
+            std::vector<uint16_t> depth = run(1000);
+            __check__(depth[0] == 1000, "temporal_filter %s: first frame is %d", isa, depth[0]);
+            for (int frame = 0; frame < 20; ++frame) {
+                depth = run(1010);
+            }
+            const std::vector<uint16_t> steady = depth;
+            __check__(steady[0] > 1000 && std::abs(steady[0] - 1010) <= options.hold &&
+                      std::fabs(average[0] - 1010.0f) < 0.05f,
+                      "temporal_filter %s: steady depth gives %d, average %f", isa, steady[0], average[0]);
+            bool held = true;
+            for (int frame = 0; frame < 20; ++frame) {
+                held = held && run(1010) == steady;
+            }
+            // noise under hold keeps the output too
+            for (int frame = 0; frame < 20; ++frame) {
+                held = held && run(frame % 2 == 0 ? 1009 : 1011) == steady;
+            }
+            __check__(held, "temporal_filter %s: output does not hold", isa);
+            // 90mm at 1100mm is more than 2%, the output jumps
+            depth = run(1100);
+            __check__(depth[size - 1] == 1100 && average[size - 1] == 1100.0f,
+                      "temporal_filter %s: motion gives %d, average %f", isa, depth[size - 1], average[size - 1]);
+            // no depth restarts the pixel, so the next sample is taken as it is
+            depth = run(0);
+            __check__(depth[0] == 0 && average[0] == 0.0f, "temporal_filter %s: no depth gives %d", isa, depth[0]);
+            depth = run(1090);
+            __check__(depth[size - 1] == 1090 && average[size - 1] == 1090.0f,
+                      "temporal_filter %s: depth after a hole is %d", isa, depth[size - 1]);
+        }
+    }
+
+    /*
+     * BackgroundModel bands of known samples, subtract() at the band edges and
+     * subtract_background of every instruction set of this CPU against scalar.
+     * */
+    void test_background() {
+        // pixels of a steady wall at 2000mm, a noisy wall, a near wall, a wall seen in
+        // every other frame and pixels never seen, 161 pixels so SIMD tails run
+        const int width = 23, height = 7, tolerance = 10;
+        const size_t pixels = static_cast<size_t>(width) * height;
+        kinect::filter::BackgroundModel model(width, height);
+        for (int frame = 0; frame < 10; ++frame) {
+            std::vector<uint16_t> depth(pixels);
+            for (size_t i = 0; i < pixels; ++i) {
+                switch (i % 5) {
+                    case 0:
+                        depth[i] = 2000;
+                        break;
+                    case 1:
+                        // mean 2000, standard deviation 100
+                        depth[i] = frame % 2 == 0 ? 1900 : 2100;
+                        break;
+                    case 2:
+                        depth[i] = 3;
+                        break;
+                    case 3:
+                        // holes are not samples, the band is the one of 1000mm
+                        depth[i] = frame % 2 == 0 ? 1000 : 0;
+                        break;
+                    default:
+                        depth[i] = 0;
+                }
+            }
+            model.add_frame(depth.data());
+        }
+        model.build(tolerance);
+        __check__(model.frames() == 10 && std::fabs(model.coverage() - 129.0 / 161.0) < 1e-9,
+                  "background: %llu frames, coverage %f", static_cast<unsigned long long>(model.frames()),
+                  model.coverage());
+
+        // band of each kind: [1990, 2010], [1700, 2300], [1, 13], [990, 1010], none
+        const uint16_t lower[5] = {1990, 1700, 1, 990, 0}, upper[5] = {2010, 2300, 13, 1010, 0};
+        for (const char *isa: {"scalar", "sse4.1", "avx2"}) {
+            if (!kinect::kernel::set_instruction_set(isa)) {
+                continue;
+            }
+            size_t wrong = 0;
+            for (int probe = 0; probe < 5; ++probe) {
+                std::vector<uint16_t> depth(pixels), expected(pixels);
+                for (size_t i = 0; i < pixels; ++i) {
+                    size_t kind = i % 5;
+                    // band edges, just outside them and no depth
+                    const int values[5] = {lower[kind], upper[kind], lower[kind] - 1, upper[kind] + 1, 0};
+                    depth[i] = kind == 4 ? static_cast<uint16_t>(2000 + probe)
+                                         : static_cast<uint16_t>(std::max(0, values[probe]));
+                    bool background = kind != 4 && depth[i] != 0 && depth[i] >= lower[kind] &&
+                                      depth[i] <= upper[kind];
+                    expected[i] = background ? 0 : depth[i];
+                }
+                model.subtract(depth.data());
+                for (size_t i = 0; i < pixels; ++i) {
+                    wrong += depth[i] != expected[i];
+                }
+            }
+            __check__(wrong == 0, "background %s: %zu pixels wrong", isa, wrong);
+        }
+
+        // random depth and bands
+        const size_t size = 1003;
+        std::mt19937 random(2028);
+        std::vector<uint16_t> depth(size), band_lower(size), band_upper(size);
+        for (size_t i = 0; i < size; ++i) {
+            depth[i] = random() % 16 == 0 ? 0 : static_cast<uint16_t>(random() % 4000);
+            band_lower[i] = static_cast<uint16_t>(1 + random() % 4000);
+            // an eighth of the bands are empty
+            int upper = band_lower[i] + static_cast<int>(random() % 400) - (random() % 8 == 0 ? 500 : 0);
+            band_upper[i] = static_cast<uint16_t>(std::max(0, upper));
+        }
+        std::vector<uint16_t> reference = depth;
+        kinect::kernel::set_instruction_set("scalar");
+        kinect::kernel::subtract_background(reference.data(), band_lower.data(), band_upper.data(), size);
+        int compared = 0;
+        for (const char *isa: {"sse4.1", "avx2"}) {
+            if (!kinect::kernel::set_instruction_set(isa)) {
+                continue;
+            }
+            std::vector<uint16_t> output = depth;
+            kinect::kernel::subtract_background(output.data(), band_lower.data(), band_upper.data(), size);
+            __check__(output == reference, "subtract_background %s differs from scalar", isa);
+            ++compared;
+        }
+        printf("background : %d instruction sets against scalar\n", compared);
+    }
+
+    /*
+     * VoxelGrid on shuffled points of known voxels on both sides of 0: one
+     * point per voxel at the centroid with the rounded average color, the same
+     * points in both layouts and with and without helpers.
+     * */
+    void test_voxel_grid(kinect::type::ThreadPool *__pool) {
+        // voxels -3..2 x -2..1 x -1..0 of 10mm, points at half millimeters, so all sums are exact
+        const float voxel_size = 10.0f;
+        struct Expected {
+            int index[3];
+            double x = 0.0, y = 0.0, z = 0.0;
+            uint32_t r = 0, g = 0, b = 0, count = 0;
+        };
+        std::vector<Expected> expected;
+        std::vector<kinect::type::PointXYZRGB> points;
+        for (int ix = -3; ix <= 2; ++ix) {
+            for (int iy = -2; iy <= 1; ++iy) {
+                for (int iz = -1; iz <= 0; ++iz) {
+                    Expected voxel;
+                    voxel.index[0] = ix, voxel.index[1] = iy, voxel.index[2] = iz;
+                    uint32_t count = 50 + static_cast<uint32_t>(expected.size()) * 7;
+                    for (uint32_t j = 0; j < count; ++j) {
+                        // 0 and 9.5mm into the voxel, on its lower faces too
+                        kinect::type::PointXYZRGB point{};
+                        point.x = static_cast<float>(ix) * voxel_size + static_cast<float>(j % 20) * 0.5f;
+                        point.y = static_cast<float>(iy) * voxel_size + static_cast<float>(j % 7) * 1.5f;
+                        point.z = static_cast<float>(iz) * voxel_size + static_cast<float>(j % 3) * 4.5f;
+                        point.r = static_cast<uint8_t>(expected.size() * 3 + j);
+                        point.g = static_cast<uint8_t>(j * 7);
+                        point.b = static_cast<uint8_t>(255 - j % 5);
+                        voxel.x += point.x, voxel.y += point.y, voxel.z += point.z;
+                        voxel.r += point.r, voxel.g += point.g, voxel.b += point.b, voxel.count++;
+                        points.push_back(point);
+                    }
+                    expected.push_back(voxel);
+                }
+            }
+        }
+        // more than one chunk, and points of a voxel are not consecutive
+        std::shuffle(points.begin(), points.end(), std::mt19937(2029));
+        kinect::type::PointCloudSoA points_soa;
+        points_soa.resize(points.size());
+        for (size_t i = 0; i < points.size(); ++i) {
+            points_soa.x[i] = points[i].x, points_soa.y[i] = points[i].y, points_soa.z[i] = points[i].z;
+            points_soa.rgb[i * 3] = points[i].r, points_soa.rgb[i * 3 + 1] = points[i].g;
+            points_soa.rgb[i * 3 + 2] = points[i].b;
+        }
+
+        kinect::filter::VoxelGrid grid;
+        std::vector<kinect::type::PointXYZRGB> output, threaded;
+        kinect::type::PointCloudSoA output_soa, threaded_soa;
+        grid.downsample(points.data(), points.size(), voxel_size, nullptr, output);
+        grid.downsample(points.data(), points.size(), voxel_size, __pool, threaded);
+        grid.downsample(points_soa, points_soa.size(), voxel_size, nullptr, output_soa);
+        grid.downsample(points_soa, points_soa.size(), voxel_size, __pool, threaded_soa);
+
+        size_t wrong = 0;
+        std::vector<bool> found(expected.size(), false);
+        for (const kinect::type::PointXYZRGB &point: output) {
+            int index[3] = {static_cast<int>(std::floor(point.x / voxel_size)),
+                            static_cast<int>(std::floor(point.y / voxel_size)),
+                            static_cast<int>(std::floor(point.z / voxel_size))};
+            size_t v = static_cast<size_t>(((index[0] + 3) * 4 + index[1] + 2) * 2 + index[2] + 1);
+            if (v >= expected.size() || found[v]) {
+                ++wrong;
+                continue;
+            }
+            found[v] = true;
+            const Expected &voxel = expected[v];
+            float scale = 1.0f / static_cast<float>(voxel.count);
+            bool centroid = point.x == static_cast<float>(voxel.x) * scale &&
+                            point.y == static_cast<float>(voxel.y) * scale &&
+                            point.z == static_cast<float>(voxel.z) * scale;
+            bool color = point.r == (voxel.r + voxel.count / 2) / voxel.count &&
+                         point.g == (voxel.g + voxel.count / 2) / voxel.count &&
+                         point.b == (voxel.b + voxel.count / 2) / voxel.count;
+            wrong += !centroid || !color;
+        }
+        __check__(output.size() == expected.size() && wrong == 0, "voxel grid: %zu voxels of %zu, %zu wrong",
+                  output.size(), expected.size(), wrong);
+
+        bool same = threaded.size() == output.size() && same_points(threaded.data(), output.data(), output.size());
+        bool same_soa = output_soa.size() == output.size() && threaded_soa.size() == output.size() &&
+                        same_points(threaded_soa, output_soa, output.size());
+        for (size_t i = 0; same_soa && i < output.size(); ++i) {
+            same_soa = output_soa.x[i] == output[i].x && output_soa.y[i] == output[i].y &&
+                       output_soa.z[i] == output[i].z && output_soa.rgb[i * 3] == output[i].r &&
+                       output_soa.rgb[i * 3 + 1] == output[i].g && output_soa.rgb[i * 3 + 2] == output[i].b;
+        }
+        __check__(same, "voxel grid with helpers differs");
+        __check__(same_soa, "voxel grid of SoA differs");
+        printf("voxel grid : %zu points to %zu voxels, %zu wrong, %s\n", points.size(), output.size(), wrong,
+               same && same_soa ? "same with helpers and SoA" : "different with helpers or SoA");
+    }
+
+    /*
+     * Input points with at least __neighbours others within __radius, by testing all pairs.
+     * */
+    std::vector<kinect::type::PointXYZRGB> brute_force_outliers(const std::vector<kinect::type::PointXYZRGB> &__points,
+                                                                float __radius, size_t __neighbours) {
+        std::vector<kinect::type::PointXYZRGB> kept;
+        for (size_t i = 0; i < __points.size(); ++i) {
+            size_t neighbours = 0;
+            for (size_t j = 0; j < __points.size(); ++j) {
+                float dx = __points[i].x - __points[j].x, dy = __points[i].y - __points[j].y,
+                        dz = __points[i].z - __points[j].z;
+                neighbours += j != i && dx * dx + dy * dy + dz * dz <= __radius * __radius;
+            }
+            if (neighbours >= __neighbours) {
+                kept.push_back(__points[i]);
+            }
+        }
+        return kept;
+    }
+
+    /*
+     * OutlierFilter against all pairs: isolated points go, dense points stay in
+     * input order, in both layouts and with any number of helpers, and the time
+     * of a frame of 1M points.
+     * */
+    void test_outlier_filter(kinect::type::ThreadPool *__pool) {
+        const float radius = 5.0f;
+        const size_t neighbours = 4;
+        std::mt19937 random(2030);
+        // a 12 x 12 x 3 lattice of 2mm, no two points exactly 5mm apart, isolated points and
+        // pairs between its points, and random points in a 60mm cube
+        std::vector<kinect::type::PointXYZRGB> points;
+        for (int i = 0; i < 12 * 12 * 3; ++i) {
+            kinect::type::PointXYZRGB point{};
+            point.x = static_cast<float>(i % 12) * 2.0f;
+            point.y = static_cast<float>(i / 12 % 12) * 2.0f;
+            point.z = 1000.0f + static_cast<float>(i / 144) * 2.0f;
+            point.r = static_cast<uint8_t>(i);
+            points.push_back(point);
+            if (i % 50 == 0) {
+                kinect::type::PointXYZRGB isolated{};
+                isolated.x = -500.0f - static_cast<float>(i) * 20.0f;
+                isolated.z = 1000.0f;
+                isolated.g = 255;
+                points.push_back(isolated);
+                isolated.x += 1.0f;
+                points.push_back(isolated);
+            }
+        }
+        std::uniform_real_distribution<float> cube(300.0f, 360.0f);
+        for (int i = 0; i < 3000; ++i) {
+            kinect::type::PointXYZRGB point{};
+            point.x = cube(random), point.y = cube(random), point.z = cube(random);
+            point.b = static_cast<uint8_t>(i);
+            points.push_back(point);
+        }
+        std::vector<kinect::type::PointXYZRGB> expected = brute_force_outliers(points, radius, neighbours);
+        size_t dropped = points.size() - expected.size();
+        __check__(expected.size() > 12 * 12 * 3 && dropped > 200, "outlier filter: %zu of %zu points are kept",
+                  expected.size(), points.size());
+
+        kinect::filter::OutlierFilter filter;
+        kinect::type::ThreadPool two(2);
+        std::vector<kinect::type::PointXYZRGB> output;
+        kinect::type::PointCloudSoA points_soa, output_soa;
+        points_soa.resize(points.size());
+        for (size_t i = 0; i < points.size(); ++i) {
+            points_soa.x[i] = points[i].x, points_soa.y[i] = points[i].y, points_soa.z[i] = points[i].z;
+            points_soa.rgb[i * 3] = points[i].r, points_soa.rgb[i * 3 + 1] = points[i].g;
+            points_soa.rgb[i * 3 + 2] = points[i].b;
+        }
+        for (kinect::type::ThreadPool *pool: {static_cast<kinect::type::ThreadPool *>(nullptr), &two, __pool}) {
+            filter.filter(points.data(), points.size(), radius, neighbours, pool, output);
+            __check__(output.size() == expected.size() && same_points(output.data(), expected.data(), output.size()),
+                      "outlier filter with %zu helpers keeps %zu points, expected %zu",
+                      pool == nullptr ? 0 : pool->size(), output.size(), expected.size());
+            filter.filter(points_soa, points_soa.size(), radius, neighbours, pool, output_soa);
+            bool same_soa = output_soa.size() == expected.size();
+            for (size_t i = 0; same_soa && i < expected.size(); ++i) {
+                same_soa = output_soa.x[i] == expected[i].x && output_soa.y[i] == expected[i].y &&
+                           output_soa.z[i] == expected[i].z && output_soa.rgb[i * 3] == expected[i].r &&
+                           output_soa.rgb[i * 3 + 1] == expected[i].g && output_soa.rgb[i * 3 + 2] == expected[i].b;
+            }
+            __check__(same_soa, "outlier filter of SoA with %zu helpers differs", pool == nullptr ? 0 : pool->size());
+        }
+        printf("outlier filter : %zu of %zu points dropped\n", dropped, points.size());
+
+        // a frame: 1M points of a wavy surface at about 1.5mm spacing and 1% noise points,
+        // the output does not depend on the helpers
+        const int side = 1000;
+        std::vector<kinect::type::PointXYZRGB> frame(static_cast<size_t>(side) * side);
+        std::uniform_real_distribution<float> noise(-1000.0f, 1000.0f);
+        for (int v = 0; v < side; ++v) {
+            for (int u = 0; u < side; ++u) {
+                kinect::type::PointXYZRGB &point = frame[static_cast<size_t>(v) * side + u];
+                point.x = static_cast<float>(u - side / 2) * 1.5f;
+                point.y = static_cast<float>(v - side / 2) * 1.5f;
+                point.z = 1500.0f + 50.0f * std::sin(static_cast<float>(u) * 0.01f) *
+                                            std::cos(static_cast<float>(v) * 0.01f);
+                if (random() % 100 == 0) {
+                    point.x += noise(random), point.y += noise(random), point.z += noise(random);
+                }
+            }
+        }
+        std::vector<kinect::type::PointXYZRGB> single;
+        filter.filter(frame.data(), frame.size(), radius, neighbours, nullptr, single);
+        double single_msec = 0.0, threaded_msec = 0.0;
+        for (int run = 0; run < 3; ++run) {
+            uint64_t start = kinect::stats::now_nsec();
+            filter.filter(frame.data(), frame.size(), radius, neighbours, nullptr, single);
+            uint64_t middle = kinect::stats::now_nsec();
+            filter.filter(frame.data(), frame.size(), radius, neighbours, __pool, output);
+            uint64_t end = kinect::stats::now_nsec();
+            single_msec = run == 0 ? (middle - start) / 1e6 : std::min(single_msec, (middle - start) / 1e6);
+            threaded_msec = run == 0 ? (end - middle) / 1e6 : std::min(threaded_msec, (end - middle) / 1e6);
+        }
+        __check__(output.size() == single.size() && same_points(output.data(), single.data(), single.size()),
+                  "outlier filter of a frame with helpers differs");
+        __check__(single.size() > frame.size() * 98 / 100 && single.size() < frame.size(),
+                  "outlier filter keeps %zu of %zu frame points", single.size(), frame.size());
+        printf("outlier filter of 1M points : %zu dropped, %.1f ms on 1 thread, %.1f ms with %zu helpers\n",
+               frame.size() - single.size(), single_msec, threaded_msec, __pool->size());
+    }
+
+    /*
+     * Registration::depth_to_color of synthetic scenes against their analytic
+     * depth, and the same image with and without helpers.
+     * */
+    void test_registration(kinect::type::ThreadPool *__pool) {
+        // odd sizes, so neither bands nor tiles divide the images
+        const int width = 161, height = 139;
+        const size_t pixels = static_cast<size_t>(width) * height;
+        kinect::camera::RegistrationBuffer buffer;
+
+        // fronto-parallel plane at 1000mm, the color camera is 5mm behind and moved sideways,
+        // so the plane is at 1005mm in the color camera at every pixel it covers
+        {
+            const float translation[3] = {20.0f, -10.0f, 5.0f};
+            k4a_calibration_t calibration = pinhole_rig(width, height, translation);
+            kinect::camera::Registration registration;
+            registration.build(calibration, nullptr);
+            const int color_width = width * 2, color_height = height * 2;
+            std::vector<uint16_t> depth(pixels, 1000), color(static_cast<size_t>(color_width) * color_height);
+            registration.depth_to_color(depth.data(), color.data(), buffer, nullptr);
+            size_t wrong = 0, holes = 0;
+            for (int v = 0; v < color_height; ++v) {
+                for (int u = 0; u < color_width; ++u) {
+                    uint16_t z = color[static_cast<size_t>(v) * color_width + u];
+                    wrong += z != 0 && z != 1005;
+                    // 20mm at 1005mm is 10 color pixels, inside that margin the plane covers every pixel
+                    holes += z == 0 && u >= 16 && u < color_width - 16 && v >= 16 && v < color_height - 16;
+                }
+            }
+            __check__(wrong == 0, "registered plane: %zu pixels are not at 1005mm", wrong);
+            __check__(holes == 0, "registered plane: %zu holes inside the plane", holes);
+            printf("registration plane : %zu wrong, %zu holes\n", wrong, holes);
+        }
+
+        // plane z = 1000 + x / 2 seen from the same place, depth is interpolated across triangles
+        {
+            const float translation[3] = {0.0f, 0.0f, 0.0f};
+            k4a_calibration_t calibration = pinhole_rig(width, height, translation);
+            kinect::camera::Registration registration;
+            registration.build(calibration, nullptr);
+            const auto &depth_camera = calibration.depth_camera_calibration.intrinsics.parameters.param;
+            const auto &color_camera = calibration.color_camera_calibration.intrinsics.parameters.param;
+            std::vector<uint16_t> depth(pixels);
+            for (int v = 0; v < height; ++v) {
+                for (int u = 0; u < width; ++u) {
+                    float x = (static_cast<float>(u) - depth_camera.cx) / depth_camera.fx;
+                    depth[static_cast<size_t>(v) * width + u] =
+                            static_cast<uint16_t>(std::lround(1000.0f / (1.0f - 0.5f * x)));
+                }
+            }
+            const int color_width = width * 2, color_height = height * 2;
+            std::vector<uint16_t> color(static_cast<size_t>(color_width) * color_height);
+            registration.depth_to_color(depth.data(), color.data(), buffer, nullptr);
+            int largest = 0;
+            size_t holes = 0;
+            for (int v = 2; v < color_height - 2; ++v) {
+                for (int u = 2; u < color_width - 2; ++u) {
+                    uint16_t z = color[static_cast<size_t>(v) * color_width + u];
+                    float x = (static_cast<float>(u) - color_camera.cx) / color_camera.fx;
+                    int expected = static_cast<int>(std::lround(1000.0f / (1.0f - 0.5f * x)));
+                    holes += z == 0;
+                    if (z != 0) {
+                        largest = std::max(largest, std::abs(z - expected));
+                    }
+                }
+            }
+            __check__(holes == 0, "registered slope: %zu holes", holes);
+            __check__(largest <= 2, "registered slope is off by %dmm", largest);
+            printf("registration slope : %zu holes, off by %dmm\n", holes, largest);
+        }
+
+        // step from 1000mm to 2000mm between depth columns 79 and 80, color pixels
+        // between them belong to no surface and stay empty
+        {
+            const float translation[3] = {0.0f, 0.0f, 0.0f};
+            k4a_calibration_t calibration = pinhole_rig(width, height, translation);
+            kinect::camera::Registration registration;
+            registration.build(calibration, nullptr);
+            std::vector<uint16_t> depth(pixels);
+            for (int v = 0; v < height; ++v) {
+                for (int u = 0; u < width; ++u) {
+                    depth[static_cast<size_t>(v) * width + u] = u < 80 ? 1000 : 2000;
+                }
+            }
+            const int color_width = width * 2, color_height = height * 2;
+            const size_t color_pixels = static_cast<size_t>(color_width) * color_height;
+            std::vector<uint16_t> color(color_pixels), threaded(color_pixels);
+            registration.depth_to_color(depth.data(), color.data(), buffer, nullptr);
+            size_t joined = 0, filled = 0, wrong = 0;
+            for (int v = 2; v < color_height - 2; ++v) {
+                for (int u = 2; u < color_width - 2; ++u) {
+                    uint16_t z = color[static_cast<size_t>(v) * color_width + u];
+                    joined += z > 1000 && z < 2000;
+                    // color column 159 lies between depth columns 79 and 80
+                    filled += u == 159 && z != 0;
+                    wrong += (u < 158 && z != 1000) || (u > 160 && z != 2000);
+                }
+            }
+            __check__(joined == 0, "registered step: %zu pixels join the surfaces", joined);
+            __check__(filled == 0, "registered step: %zu pixels fill the edge", filled);
+            __check__(wrong == 0, "registered step: %zu pixels off their surface", wrong);
+            printf("registration step : %zu joined, %zu filled, %zu wrong\n", joined, filled, wrong);
+
+            // tiles own their rows, so helpers give the same image
+            kinect::camera::RegistrationBuffer threaded_buffer;
+            registration.depth_to_color(depth.data(), threaded.data(), threaded_buffer, __pool);
+            bool same = std::memcmp(color.data(), threaded.data(), color_pixels * sizeof(uint16_t)) == 0;
+            __check__(same, "registration with helpers differs");
+            printf("registration with helpers : %s\n", same ? "bit identical" : "different");
+        }
+    }
+
+    /*
+     * Fused extraction of both geometries, put together by compact_points() and
+     * gather_points(), against the passes it replaces, in both layouts, with a
+     * transform, a crop and depth limits. __extract runs the fused extraction
+     * of __image to the AoS or the SoA points it is given.
+     * */
+    template<class Extract>
+    void check_fused(const char *__name, const int16_t *__image, const uint8_t *__bgra, size_t __pixels,
+                     const kinect::kernel::ExtractOptions &__options, Extract __extract) {
+        std::vector<kinect::type::PointXYZRGB> reference(__pixels), fused(__pixels), gathered;
+        kinect::type::PointCloudSoA reference_soa, fused_soa, gathered_soa;
+        reference_soa.resize(__pixels);
+        fused_soa.resize(__pixels);
+        kinect::camera::RegistrationBuffer buffer;
+
+        size_t count = kinect::kernel::extract_points(__image, __bgra, __pixels, __options, reference.data());
+        __check__(count != 0 && count < __pixels, "%s: passes keep %zu of %zu points", __name, count, __pixels);
+        __extract(__options, fused.data(), nullptr, buffer);
+        size_t compacted = kinect::camera::compact_points(buffer, fused.data());
+        bool same = compacted == count && same_points(fused.data(), reference.data(), count);
+        __extract(__options, fused.data(), nullptr, buffer);
+        kinect::camera::gather_points(buffer, fused.data(), gathered);
+        same = same && gathered.size() == count && same_points(gathered.data(), reference.data(), count);
+        __check__(same, "%s: fused AoS gives %zu and %zu points, passes give %zu", __name, compacted,
+                  gathered.size(), count);
+
+        size_t count_soa = kinect::kernel::extract_points(__image, __bgra, __pixels, __options, reference_soa, 0);
+        __extract(__options, nullptr, &fused_soa, buffer);
+        size_t compacted_soa = kinect::camera::compact_points(buffer, fused_soa);
+        bool same_soa = count_soa == count && compacted_soa == count && same_points(fused_soa, reference_soa, count);
+        __extract(__options, nullptr, &fused_soa, buffer);
+        kinect::camera::gather_points(buffer, fused_soa, gathered_soa);
+        same_soa = same_soa && gathered_soa.size() == count && same_points(gathered_soa, reference_soa, count);
+        __check__(same_soa, "%s: fused SoA gives %zu and %zu points, passes give %zu", __name, compacted_soa,
+                  gathered_soa.size(), count_soa);
+        printf("%s fused extraction : %zu points, %s\n", __name, count,
+               same && same_soa ? "same as passes" : "different");
+    }
+
+    /*
+     * Registration::extract_points and camera::extract_points against
+     * depth_to_color_points or unproject_depth and kernel::extract_points.
+     * */
+    void test_fused_extraction(kinect::type::ThreadPool *__pool) {
+        // 139 and 278 rows are multiples of neither tile_rows nor band_rows
+        const int width = 161, height = 139, color_width = width * 2, color_height = height * 2;
+        const size_t pixels = static_cast<size_t>(width) * height;
+        const size_t color_pixels = static_cast<size_t>(color_width) * color_height;
+        const float translation[3] = {20.0f, -10.0f, 5.0f};
+        k4a_calibration_t calibration = pinhole_rig(width, height, translation);
+        kinect::camera::Registration registration;
+        registration.build(calibration, nullptr);
+        kinect::camera::RayTable color_rays, depth_rays;
+        color_rays.build(calibration.color_camera_calibration, nullptr);
+        depth_rays.build(calibration.depth_camera_calibration, nullptr);
+
+        std::mt19937 random(2023);
+        std::vector<uint16_t> depth;
+        std::vector<uint8_t> bgra, depth_bgra;
+        synthetic_scene(width, height, random, depth, bgra, color_width, color_height);
+        depth_bgra.assign(bgra.begin(), bgra.begin() + pixels * 4);
+
+        // 10 degrees about z and a shift, the box cuts the surface on every axis
+        kinect::type::Extrinsics extrinsics;
+        const float c = std::cos(0.1745f), s = std::sin(0.1745f);
+        const float rotation[9] = {c, -s, 0.0f, s, c, 0.0f, 0.0f, 0.0f, 1.0f};
+        std::copy(rotation, rotation + 9, extrinsics.rotation);
+        extrinsics.translation[0] = 100.0f;
+        extrinsics.translation[1] = -50.0f;
+        extrinsics.translation[2] = 30.0f;
+        kinect::type::Box crop;
+        crop.min[0] = -200.0f, crop.min[1] = -150.0f, crop.min[2] = 1100.0f;
+        crop.max[0] = 250.0f, crop.max[1] = 200.0f, crop.max[2] = 2300.0f;
+
+        std::vector<int16_t> color_points(color_pixels * 3), depth_points(pixels * 3);
+        kinect::camera::RegistrationBuffer buffer;
+        registration.depth_to_color_points(depth.data(), color_rays, color_points.data(), buffer, nullptr);
+        kinect::camera::unproject_depth(depth_rays, depth.data(), depth_points.data(), nullptr);
+
+        for (bool crop_camera: {false, true}) {
+            kinect::kernel::ExtractOptions options;
+            options.extrinsics = &extrinsics;
+            options.depth_min = 1050;
+            options.depth_max = 2400;
+            options.crop = &crop;
+            options.crop_camera = crop_camera;
+            check_fused(crop_camera ? "color, camera crop" : "color, world crop", color_points.data(),
+                        bgra.data(), color_pixels, options,
+                        [&](const kinect::kernel::ExtractOptions &__options, kinect::type::PointXYZRGB *__points,
+                            kinect::type::PointCloudSoA *__points_soa, kinect::camera::RegistrationBuffer &__buffer) {
+                            if (__points != nullptr) {
+                                registration.extract_points(depth.data(), color_rays, bgra.data(), __options,
+                                                            __points, __buffer, __pool);
+                            }
+                            else {
+                                registration.extract_points(depth.data(), color_rays, bgra.data(), __options,
+                                                            *__points_soa, __buffer, __pool);
+                            }
+                        });
+            check_fused(crop_camera ? "depth, camera crop" : "depth, world crop", depth_points.data(),
+                        depth_bgra.data(), pixels, options,
+                        [&](const kinect::kernel::ExtractOptions &__options, kinect::type::PointXYZRGB *__points,
+                            kinect::type::PointCloudSoA *__points_soa, kinect::camera::RegistrationBuffer &__buffer) {
+                            if (__points != nullptr) {
+                                kinect::camera::extract_points(depth_rays, depth.data(), depth_bgra.data(),
+                                                               __options, __points, __buffer, __pool);
+                            }
+                            else {
+                                kinect::camera::extract_points(depth_rays, depth.data(), depth_bgra.data(),
+                                                               __options, *__points_soa, __buffer, __pool);
+                            }
+                        });
+        }
+    }
+}
+
+int main() {
+    const std::string best = kinect::kernel::instruction_set();
+    kinect::type::ThreadPool pool(4);
+    k4a_calibration_camera_t rational = rational_camera(), brown_conrady = brown_conrady_camera();
+
+    test_round_trip("rational 6kt", rational);
+    test_round_trip("brown conrady", brown_conrady);
+    test_ray_table("rational 6kt", rational, rational_rays, &pool);
+    test_ray_table("brown conrady", brown_conrady, brown_conrady_rays, nullptr);
+    test_unproject_depth(rational, &pool);
+    test_extract_points();
+    test_remove_flying_pixels(&pool);
+    test_temporal_filter();
+    test_background();
+    test_voxel_grid(&pool);
+    test_outlier_filter(&pool);
+    test_registration(&pool);
+    test_fused_extraction(&pool);
+    kinect::kernel::set_instruction_set(best);
+
+    if (failures != 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}